@@ -52,6 +52,9 @@ BOOL g_bUseDarkMode = FALSE;
 HANDLE g_hDibDefault = NULL;
 HANDLE g_hDibThumb = NULL;
 HBITMAP g_hBitmapThumb = NULL;
+HANDLE g_hDibDecoded = NULL;
+BOOL g_bPrepareThumb = FALSE;
+BOOL g_bDecodeThumb = FALSE;
 HDRAWDIB g_hDrawDib = NULL;
 
 int g_nIcmMode = ICM_OFF;
@@ -73,8 +76,6 @@ LRESULT CALLBACK OutputWndProc(HWND, UINT, WPARAM, LPARAM);
 
 // Opens and parses the passed file and outputs the result
 BOOL ParseFile(HWND hDlg, LPCTSTR lpszFileName);
-// Decompresses a JPEG image and displays some of its metadata
-BOOL ParseJpeg(HWND hDlg, HANDLE hFile, DWORD dwFileSize);
 // Displays a hex dump of the first 1024 bytes of a file
 BOOL HexDump(HWND hwndEdit, HANDLE hFile, SIZE_T cbLen);
 
@@ -154,8 +155,11 @@ int APIENTRY _tWinMain(__in HINSTANCE hInstance, __in_opt HINSTANCE hPrevInstanc
 		DrawDibClose(g_hDrawDib);
 
 	g_hBitmapThumb = FreeBitmap(g_hBitmapThumb);
+	g_hDibDecoded = FreeDib(g_hDibDecoded);
 	g_hDibThumb = FreeDib(g_hDibThumb);
 	g_hDibDefault = FreeDib(g_hDibDefault);
+	FlushDibPool();
+	FlushJpegPool();
 
 	return (int)nResult;
 }
@@ -666,7 +670,7 @@ INT_PTR CALLBACK HeaderViewerDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPA
 						else
 						{
 							DWORD dwError = GetLastError();
-							GlobalFree(hNewDib);
+							FreeDib(hNewDib);
 							if (dwError != ERROR_SUCCESS)
 								OutputErrorMessage(hwndEdit, dwError);
 						}
@@ -789,15 +793,21 @@ INT_PTR CALLBACK HeaderViewerDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPA
 					if (hDib == NULL)
 						return FALSE;
 
+					// Embedded images are copied decoded
+					HANDLE hDibDecoded = DecodeThumbnail();
+					if (hDibDecoded != NULL)
+						hDib = hDibDecoded;
+
 					// Create a DIBv3 or DIBv5 depending on the source DIB
 					UINT uFormat = CF_DIB; // Use CF_DIBV5 to force the generation of a DIBv5
 					HANDLE hNewDib = CreateClipboardDib(hDib, &uFormat);
+					FreeDib(hDibDecoded);
 					if (hNewDib == NULL)
 						return FALSE;
 
 					if (!OpenClipboard(hDlg))
 					{
-						GlobalFree(hNewDib);
+						FreeDib(hNewDib);
 						return FALSE;
 					}
 
@@ -806,12 +816,12 @@ INT_PTR CALLBACK HeaderViewerDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPA
 					{
 						CloseClipboard();
 						SetCursor(hOldCursor);
-						GlobalFree(hNewDib);
+						FreeDib(hNewDib);
 						return FALSE;
 					}
 
 					if (SetClipboardData(uFormat, hNewDib) == NULL)
-						GlobalFree(hNewDib);
+						FreeDib(hNewDib);
 
 					CloseClipboard();
 					SetCursor(hOldCursor);
@@ -820,7 +830,7 @@ INT_PTR CALLBACK HeaderViewerDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPA
 
 				case IDC_THUMB_SAVE:
 				{ // Save the current thumbnail
-					DWORD dwFilterIndex = 1;
+					DWORD dwFilterIndex = SAVE_FILTER_BMP;
 					TCHAR szFileName[MY_OFN_MAX_PATH];
 					MyStrNCpy(szFileName, s_szFileName, _countof(szFileName));
 
@@ -830,7 +840,7 @@ INT_PTR CALLBACK HeaderViewerDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPA
 						if (lpbiv5 != NULL)
 						{
 							if (DibHasEmbeddedProfile((LPCSTR)lpbiv5))
-								dwFilterIndex = 2;	// Add the option to save the ICC profile
+								dwFilterIndex = SAVE_FILTER_ICC;	// Add the option to save the ICC profile
 							GlobalUnlock(g_hDibThumb);
 						}
 					}
@@ -839,11 +849,36 @@ INT_PTR CALLBACK HeaderViewerDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPA
 					{
 						BOOL bSuccess = FALSE;
 
+						HANDLE hDib = g_hDibThumb ? g_hDibThumb : g_hDibDefault;
+						HANDLE hDibDecoded = NULL;
+
 						HCURSOR hOldCursor = SetCursor(LoadCursor(NULL, IDC_WAIT));
-						if (dwFilterIndex == 2)
+
+						// Embedded images are saved decoded with their full size
+						if (dwFilterIndex != SAVE_FILTER_ICC)
+						{
+							hDibDecoded = DecodeThumbnail();
+							if (hDibDecoded != NULL)
+								hDib = hDibDecoded;
+						}
+
+						if (dwFilterIndex == SAVE_FILTER_ICC)
 							bSuccess = SaveProfile(szFileName, g_hDibThumb);
+						else if (dwFilterIndex == SAVE_FILTER_RLE)
+						{
+							HANDLE hDibRle = DibToRle(hDib);
+							if (hDibRle != NULL)
+							{
+								bSuccess = SaveBitmap(szFileName, hDibRle);
+								FreeDib(hDibRle);
+							}
+						}
+						else if (dwFilterIndex == SAVE_FILTER_JPEG)
+							bSuccess = DibToJpeg(szFileName, hDib);
 						else
-							bSuccess = SaveBitmap(szFileName, g_hDibThumb ? g_hDibThumb : g_hDibDefault);
+							bSuccess = SaveBitmap(szFileName, hDib);
+
+						FreeDib(hDibDecoded);
 						SetCursor(hOldCursor);
 
 						if (!bSuccess)
@@ -851,7 +886,7 @@ INT_PTR CALLBACK HeaderViewerDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPA
 							TaskDialog(hDlg, g_hInstance, g_szTitle, MAKEINTRESOURCE(IDP_WRITEFILE),
 								szFileName, TDCBF_OK_BUTTON, TD_WARNING_ICON, NULL);
 						}
-						else if (dwFilterIndex != 2)
+						else if (dwFilterIndex != SAVE_FILTER_ICC)
 						{
 							TCHAR szText[512];
 							int nLen = LoadString(g_hInstance, IDS_UNNAMED, szText, _countof(szText));
@@ -1306,8 +1341,9 @@ BOOL ParseFile(HWND hDlg, LPCTSTR lpszFileName)
 	}
 
 	// Read file signature
-	BYTE achMagic[2] = { 0 };
-	if (!MyReadFile(hFile, (LPVOID)&achMagic, sizeof(achMagic)))
+	BYTE abMagic[CODEC_MAX_MAGIC] = { 0 };
+	DWORD cbMagic = wfad.nFileSizeHigh > 0 ? sizeof(abMagic) : min(wfad.nFileSizeLow, sizeof(abMagic));
+	if (cbMagic < 2 || !MyReadFile(hFile, (LPVOID)abMagic, cbMagic))
 	{
 		OutputTextFromID(hwndEdit, IDS_MAGIC);
 		OutputText(hwndEdit, g_szSepThick);
@@ -1317,22 +1353,11 @@ BOOL ParseFile(HWND hDlg, LPCTSTR lpszFileName)
 	}
 
 	BOOL bSuccess = FALSE;
-	if (memcmp(achMagic, "BM", 2) == 0 || memcmp(achMagic, "BA", 2) == 0)
-	{ // Bitmap or Bitmap Array
-		SetLastError(ERROR_SUCCESS);
-		bSuccess = ParseBitmap(hDlg, hFile, wfad.nFileSizeLow);
-		if (!bSuccess)
-		{
-			DWORD dwError = GetLastError();
-			if (dwError != ERROR_SUCCESS)
-				OutputErrorMessage(hwndEdit, dwError);
-		}
-		EnableButton(hDlg, IDC_THUMB_COPY, IDC_OPEN, bSuccess);
-	}
-	else if (achMagic[0] == 0xFF && achMagic[1] == 0xD8)
-	{ // JPEG
+	LPCCODEC_INFO lpCodec = FindCodecByMagic(abMagic, cbMagic);
+	if (lpCodec != NULL && lpCodec->lpfnParse != NULL)
+	{ // Bitmap, Bitmap Array, JPEG or any other registered file format
 		SetLastError(ERROR_SUCCESS);
-		bSuccess = ParseJpeg(hDlg, hFile, wfad.nFileSizeLow);
+		bSuccess = lpCodec->lpfnParse(hDlg, hFile, wfad.nFileSizeLow);
 		if (!bSuccess)
 		{
 			DWORD dwError = GetLastError();
@@ -1356,86 +1381,6 @@ BOOL ParseFile(HWND hDlg, LPCTSTR lpszFileName)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-BOOL ParseJpeg(HWND hDlg, HANDLE hFile, DWORD dwFileSize)
-{
-	if (hDlg == NULL || hFile == NULL || dwFileSize == 0)
-	{
-		SetLastError(ERROR_INVALID_PARAMETER);
-		return FALSE;
-	}
-
-	HWND hwndEdit = GetDlgItem(hDlg, IDC_OUTPUT);
-	if (hwndEdit == NULL)
-		return FALSE;
-
-	HWND hwndThumb = GetDlgItem(hDlg, IDC_THUMB);
-	if (hwndThumb == NULL)
-		return FALSE;
-
-	// Jump to the beginning of the file
-	if (!FileSeekBegin(hFile, 0))
-		return FALSE;
-
-	LPVOID lpData = MyGlobalAllocPtr(GHND, dwFileSize);
-	if (lpData == NULL)
-		return FALSE;
-
-	// Read the file
-	if (!MyReadFile(hFile, lpData, dwFileSize))
-	{
-		MyGlobalFreePtr(lpData);
-		return FALSE;
-	}
-
-	OutputText(hwndEdit, g_szSepThin);
-
-	HANDLE hDib = NULL;
-	HCURSOR hOldCursor = SetCursor(LoadCursor(NULL, IDC_WAIT));
-
-	// Decode the JPEG image
-	__try { hDib = JpegToDib(lpData, dwFileSize, 1); }
-	__except (EXCEPTION_EXECUTE_HANDLER) { hDib = NULL; }
-
-	SetCursor(hOldCursor);
-
-	if (hDib == NULL)
-	{
-		MyGlobalFreePtr(lpData);
-		SetThumbnailText(hwndThumb, IDS_UNSUPPORTED);
-		return FALSE;
-	}
-
-	MyGlobalFreePtr(lpData);
-
-	// Parse the returned DIB
-	OutputText(hwndEdit, g_szSepThin);
-
-	TCHAR szOutput[OUTPUT_LEN];
-	SIZE_T cbSize = GlobalSize(hDib);
-
-	OutputText(hwndEdit, TEXT("DIB Size:\t"));
-	if (cbSize > 0xFFFFFFFF)
-		OutputText(hwndEdit, TEXT("> 4 GB"));
-	else if (FormatByteSize((DWORD)cbSize, szOutput, _countof(szOutput)))
-		OutputText(hwndEdit, szOutput);
-	OutputText(hwndEdit, TEXT("\r\n"));
-
-	if (!ParseDIBitmap(hDlg, hDib))
-	{
-		DWORD dwError = GetLastError();
-		GlobalFree(hDib);
-		if (dwError != ERROR_SUCCESS)
-			SetLastError(dwError);
-		return FALSE;
-	}
-
-	ReplaceThumbnail(hwndThumb, hDib);
-
-	return TRUE;
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////
-
 BOOL HexDump(HWND hwndEdit, HANDLE hFile, SIZE_T cbLen)
 {
 	const int COLUMNS = 16;
@@ -1620,6 +1565,11 @@ BOOL OnDrawItem(const LPDRAWITEMSTRUCT lpDrawItem)
 	{
 		bDrawText = FALSE;
 		hDib = g_hDibThumb;
+
+		// Decode the thumbnail or create the pre-multiplied bitmap, if not yet done
+		PrepareThumbnail(rc.right - rc.left, rc.bottom - rc.top);
+		if (g_hDibDecoded != NULL)
+			hDib = g_hDibDecoded;
 	}
 
 	if (hDib == NULL)
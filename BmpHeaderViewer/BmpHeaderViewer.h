@@ -32,6 +32,11 @@
 #define RGB_DARKMODE_BKCOLOR    RGB(56, 56, 56)
 #define RGB_THUMBNAIL_TEXTCOLOR RGB(255, 64, 64)
 
+#ifndef _LPCBYTE_DEFINED
+#define _LPCBYTE_DEFINED
+typedef const BYTE FAR* LPCBYTE;
+#endif
+
 #ifndef USER_DEFAULT_SCREEN_DPI
 #define USER_DEFAULT_SCREEN_DPI 96
 #endif
@@ -56,6 +61,9 @@ extern const TCHAR g_szTitle[];
 extern HINSTANCE g_hInstance;
 extern HBITMAP g_hBitmapThumb;
 extern HANDLE g_hDibThumb;
+extern HANDLE g_hDibDecoded;
+extern BOOL g_bPrepareThumb;
+extern BOOL g_bDecodeThumb;
 extern int g_nIcmMode;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
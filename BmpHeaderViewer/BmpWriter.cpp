@@ -0,0 +1,278 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// BmpWriter.cpp - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "stdafx.h"
+
+// Buffered output file of WriteBitmap
+typedef struct _BMP_STREAM
+{
+    HANDLE         hFile;                     // Handle of the output file
+    LPBYTE         lpBuffer;                  // Page-aligned write buffer
+    DWORD          cbBuffer;                  // Size of the write buffer
+    DWORD          cbUsed;                    // Number of bytes in the write buffer
+} BMP_STREAM, FAR* LPBMP_STREAM;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Forward declarations of functions included in this code module
+
+// Writes the content of the write buffer to the file
+static BOOL StreamFlush(LPBMP_STREAM lpStream);
+// Appends data to the stream. Large blocks are written without copying them.
+static BOOL StreamWrite(LPBMP_STREAM lpStream, LPCVOID lpData, SIZE_T cbData);
+// Returns a pointer to cbData free bytes in the write buffer, or NULL on error
+static LPBYTE StreamReserve(LPBMP_STREAM lpStream, DWORD cbData);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL WriteBitmap(LPCTSTR lpszFileName, LPCSTR lpbi, LPCVOID lpBits, LPCVOID lpProfile,
+	BMPROWPROC lpfnRow, LPVOID lpParam)
+{
+	if (lpszFileName == NULL || lpbi == NULL || (lpBits == NULL && lpfnRow == NULL))
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	// Scan lines can only be supplied for uncompressed DIBs
+	if (lpBits == NULL && DibIsCompressed(lpbi))
+	{
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return FALSE;
+	}
+
+	DWORD dwHeaderSize = *(LPDWORD)lpbi;
+	DWORD dwMasksSize = ColorMasksSize(lpbi);
+	DWORD dwPaletteSize = PaletteSize(lpbi);
+	DWORD dwImageSize = DibImageSize(lpbi);
+	DWORD dwProfileSize = 0;
+
+	BOOL bHasProfile = DibHasColorProfile(lpbi);
+	if (bHasProfile)
+	{
+		if (lpProfile == NULL)
+		{
+			SetLastError(ERROR_INVALID_PARAMETER);
+			return FALSE;
+		}
+		dwProfileSize = ((LPBITMAPV5HEADER)lpbi)->bV5ProfileSize;
+	}
+
+	DWORD cbOffBits = dwHeaderSize + dwMasksSize + dwPaletteSize;
+	UINT64 ullFileSize = (UINT64)sizeof(BITMAPFILEHEADER) + cbOffBits + dwImageSize + dwProfileSize;
+	if (dwHeaderSize < sizeof(BITMAPCOREHEADER) || ullFileSize > MAXDWORD ||
+		cbOffBits + sizeof(BITMAPFILEHEADER) > BMPWRITER_BUFFER_SIZE)
+	{
+		SetLastError(ERROR_INVALID_DATA);
+		return FALSE;
+	}
+
+	// The image size must be a multiple of the number of scan lines, otherwise
+	// the callback would receive rows of the wrong size or no rows at all
+	LONG lWidth = 0, lHeight = 0;
+	UINT cbRow = 0;
+	if (lpBits == NULL)
+	{
+		GetDibDimensions(lpbi, &lWidth, &lHeight, TRUE);
+		if (dwImageSize == 0 || lHeight <= 0 || dwImageSize % lHeight != 0)
+		{
+			SetLastError(ERROR_ARITHMETIC_OVERFLOW);
+			return FALSE;
+		}
+		cbRow = dwImageSize / lHeight;
+	}
+
+	BMP_STREAM bs = { 0 };
+	bs.cbBuffer = BMPWRITER_BUFFER_SIZE;
+	bs.lpBuffer = (LPBYTE)VirtualAlloc(NULL, bs.cbBuffer, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (bs.lpBuffer == NULL)
+		return FALSE;
+
+	bs.hFile = CreateFile(lpszFileName, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (bs.hFile == INVALID_HANDLE_VALUE)
+	{
+		VirtualFree(bs.lpBuffer, 0, MEM_RELEASE);
+		return FALSE;
+	}
+
+	// The headers are assembled in the write buffer and adjusted there
+	LPBITMAPFILEHEADER lpbfh = (LPBITMAPFILEHEADER)bs.lpBuffer;
+	lpbfh->bfType = BFT_BITMAP;
+	lpbfh->bfSize = (DWORD)ullFileSize;
+	lpbfh->bfReserved1 = 0;
+	lpbfh->bfReserved2 = 0;
+	lpbfh->bfOffBits = cbOffBits + sizeof(BITMAPFILEHEADER);
+
+	LPBYTE lpHeader = bs.lpBuffer + sizeof(BITMAPFILEHEADER);
+	CopyMemory(lpHeader, lpbi, dwHeaderSize);
+	CopyMemory(lpHeader + dwHeaderSize, lpbi + dwHeaderSize, dwMasksSize);
+	CopyMemory(lpHeader + dwHeaderSize + dwMasksSize, FindDibPalette(lpbi), dwPaletteSize);
+	bs.cbUsed = sizeof(BITMAPFILEHEADER) + cbOffBits;
+
+	LPBITMAPV5HEADER lpbiv5 = (LPBITMAPV5HEADER)lpHeader;
+	if (dwHeaderSize >= FIELD_OFFSET(BITMAPINFOHEADER, biSizeImage) + sizeof(DWORD) && lpbiv5->bV5SizeImage)
+		lpbiv5->bV5SizeImage = dwImageSize;
+	if (bHasProfile)
+		lpbiv5->bV5ProfileData = cbOffBits + dwImageSize;
+
+	BOOL bSuccess = TRUE;
+
+	if (lpBits != NULL)
+		bSuccess = StreamWrite(&bs, lpBits, dwImageSize);
+	else
+	{
+		// Scan lines that don't fit into the write buffer use their own memory block
+		LPBYTE lpLargeRow = NULL;
+		if (cbRow > bs.cbBuffer)
+		{
+			lpLargeRow = (LPBYTE)MyGlobalAllocPtr(GMEM_MOVEABLE, cbRow);
+			bSuccess = (lpLargeRow != NULL);
+		}
+
+		for (LONG h = 0; bSuccess && h < lHeight; h++)
+		{
+			LPBYTE lpRow = lpLargeRow != NULL ? lpLargeRow : StreamReserve(&bs, cbRow);
+			if (lpRow == NULL)
+			{
+				bSuccess = FALSE;
+				break;
+			}
+
+			// Don't write uninitialized padding bytes
+			if (cbRow >= sizeof(DWORD))
+				*(LPDWORD)(lpRow + cbRow - sizeof(DWORD)) = 0;
+
+			// The error code of a callback that cancels without setting one
+			SetLastError(ERROR_CANCELLED);
+
+			__try { bSuccess = lpfnRow((UINT)h, lpRow, cbRow, lpParam); }
+			__except (EXCEPTION_EXECUTE_HANDLER) { bSuccess = FALSE; SetLastError(ERROR_NOACCESS); }
+
+			if (bSuccess && lpLargeRow != NULL)
+				bSuccess = StreamWrite(&bs, lpLargeRow, cbRow);
+		}
+
+		if (lpLargeRow != NULL)
+			MyGlobalFreePtr(lpLargeRow);
+	}
+
+	if (bSuccess && bHasProfile)
+		bSuccess = StreamWrite(&bs, lpProfile, dwProfileSize);
+
+	if (bSuccess)
+		bSuccess = StreamFlush(&bs);
+
+	DWORD dwError = bSuccess ? ERROR_SUCCESS : GetLastError();
+
+	CloseHandle(bs.hFile);
+	VirtualFree(bs.lpBuffer, 0, MEM_RELEASE);
+
+	if (!bSuccess)
+	{
+		DeleteFile(lpszFileName);
+		SetLastError(dwError);
+	}
+
+	return bSuccess;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL StreamFlush(LPBMP_STREAM lpStream)
+{
+	DWORD dwWrite = 0;
+	if (lpStream->cbUsed != 0)
+	{
+		if (!WriteFile(lpStream->hFile, lpStream->lpBuffer, lpStream->cbUsed, &dwWrite, NULL))
+			return FALSE;
+
+		if (dwWrite != lpStream->cbUsed)
+		{
+			SetLastError(ERROR_WRITE_FAULT);
+			return FALSE;
+		}
+	}
+
+	lpStream->cbUsed = 0;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL StreamWrite(LPBMP_STREAM lpStream, LPCVOID lpData, SIZE_T cbData)
+{
+	LPCBYTE lpSrc = (LPCBYTE)lpData;
+
+	// Fill up the write buffer first
+	DWORD cbCopy = (DWORD)min(cbData, (SIZE_T)(lpStream->cbBuffer - lpStream->cbUsed));
+	__try { CopyMemory(lpStream->lpBuffer + lpStream->cbUsed, lpSrc, cbCopy); }
+	__except (EXCEPTION_EXECUTE_HANDLER) { SetLastError(ERROR_NOACCESS); return FALSE; }
+	lpStream->cbUsed += cbCopy;
+	lpSrc += cbCopy;
+	cbData -= cbCopy;
+
+	if (cbData == 0)
+		return TRUE;
+
+	if (!StreamFlush(lpStream))
+		return FALSE;
+
+	// Write the remaining full buffer sizes directly from the source
+	while (cbData >= lpStream->cbBuffer)
+	{
+		DWORD cbWrite = (DWORD)min(cbData, (SIZE_T)lpStream->cbBuffer * 64);
+		DWORD dwWrite = 0;
+		if (!WriteFile(lpStream->hFile, lpSrc, cbWrite, &dwWrite, NULL))
+			return FALSE;
+
+		if (dwWrite != cbWrite)
+		{
+			SetLastError(ERROR_WRITE_FAULT);
+			return FALSE;
+		}
+
+		lpSrc += cbWrite;
+		cbData -= cbWrite;
+	}
+
+	__try { CopyMemory(lpStream->lpBuffer, lpSrc, cbData); }
+	__except (EXCEPTION_EXECUTE_HANDLER) { SetLastError(ERROR_NOACCESS); return FALSE; }
+	lpStream->cbUsed = (DWORD)cbData;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static LPBYTE StreamReserve(LPBMP_STREAM lpStream, DWORD cbData)
+{
+	if (cbData > lpStream->cbBuffer)
+		return NULL;
+
+	if (cbData > lpStream->cbBuffer - lpStream->cbUsed && !StreamFlush(lpStream))
+		return NULL;
+
+	LPBYTE lpData = lpStream->lpBuffer + lpStream->cbUsed;
+	lpStream->cbUsed += cbData;
+
+	return lpData;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,36 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// BmpWriter.h - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+// Size of the write buffer of WriteBitmap
+#define BMPWRITER_BUFFER_SIZE   (1024 * 1024)
+
+// Supplies an uncompressed scan line for WriteBitmap. uRow is the index of the scan line
+// in the file (the bottom row first for bottom-up DIBs). lpRow points to cbRow bytes in
+// the write buffer, including the padding to a DWORD boundary. Returns FALSE to cancel,
+// WriteBitmap then fails with the last error code set by the callback or ERROR_CANCELLED.
+typedef BOOL (CALLBACK* BMPROWPROC)(UINT uRow, LPBYTE lpRow, UINT cbRow, LPVOID lpParam);
+
+// Writes a Windows Bitmap file through a large write buffer. lpbi points to the bitmap
+// header, followed by the color masks and the color table. Either lpBits points to the
+// complete (possibly compressed) bitmap bits, or lpfnRow supplies the uncompressed scan
+// lines one by one, so the bitmap bits never have to be in memory at once. lpProfile
+// points to the profile data if the header references a color profile. If the image size
+// is not a multiple of the height, lpfnRow cannot be used (ERROR_ARITHMETIC_OVERFLOW).
+BOOL WriteBitmap(LPCTSTR lpszFileName, LPCSTR lpbi, LPCVOID lpBits, LPCVOID lpProfile,
+	BMPROWPROC lpfnRow = NULL, LPVOID lpParam = NULL);
@@ -0,0 +1,172 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Codecs.cpp - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Forward declarations of functions included in this code module
+
+// Adapters of the image decoders to DIBDECODEPROC
+HANDLE DecodeJpegDib(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData, UINT uMinWidth, UINT uMinHeight);
+HANDLE DecodePngDib(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData, UINT uMinWidth, UINT uMinHeight);
+HANDLE DecodeCinepakDib(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData, UINT uMinWidth, UINT uMinHeight);
+HANDLE DecodeVideo1Dib(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData, UINT uMinWidth, UINT uMinHeight);
+
+// Converts the characters of a FourCC code to uppercase
+DWORD FourCCToUpper(DWORD dwFourCC);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Supported file formats and DIB compressions. New formats are added here only.
+
+static const CODEC_INFO g_aCodecs[] =
+{
+	// File formats
+	{ { 'B', 'M' }, 2, 0, 0,
+		CODEC_PARSE, ParseBitmap, NULL },
+	{ { 'B', 'A' }, 2, 0, 0,
+		CODEC_PARSE, ParseBitmap, NULL },
+	{ { 0xFF, 0xD8 }, 2, 0, 0,
+		CODEC_PARSE, ParseJpeg, NULL },
+
+	// Passthrough DIBs
+	{ { 0 }, 0, BI_JPEG, 0,
+		CODEC_DECODE | CODEC_PASSTHROUGH | CODEC_SCALABLE, NULL, DecodeJpegDib },
+	{ { 0 }, 0, BI_PNG, 33,
+		CODEC_DECODE | CODEC_PASSTHROUGH, NULL, DecodePngDib },
+
+	// Video compressed DIBs
+	{ { 0 }, 0, mmioFOURCC('C','V','I','D'), 10,
+		CODEC_DECODE, NULL, DecodeCinepakDib },
+	{ { 0 }, 0, FOURCC_CRAM, 0,
+		CODEC_DECODE, NULL, DecodeVideo1Dib },
+	{ { 0 }, 0, FOURCC_MSVC, 0,
+		CODEC_DECODE, NULL, DecodeVideo1Dib },
+	{ { 0 }, 0, FOURCC_WHAM, 0,
+		CODEC_DECODE, NULL, DecodeVideo1Dib }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+LPCCODEC_INFO FindCodecByMagic(LPCVOID lpMagic, SIZE_T cbMagic)
+{
+	if (lpMagic == NULL)
+		return NULL;
+
+	for (UINT u = 0; u < _countof(g_aCodecs); u++)
+	{
+		UINT cb = g_aCodecs[u].cbMagic;
+		if (cb > 0 && cb <= cbMagic && memcmp(lpMagic, g_aCodecs[u].abMagic, cb) == 0)
+			return &g_aCodecs[u];
+	}
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+LPCCODEC_INFO FindCodecByDib(LPCSTR lpbi)
+{
+	if (lpbi == NULL)
+		return NULL;
+
+	// BI_JPEG and BI_PNG have a different meaning in OS/2 2.0 DIBs,
+	// and FourCC codes are only valid in a BITMAPINFOHEADER
+	if (*(LPDWORD)lpbi < sizeof(BITMAPINFOHEADER) || IS_OS2V2_DIB(lpbi))
+		return NULL;
+
+	// Other compressions than FourCC codes can only be passthrough formats
+	DWORD dwFlags = CODEC_PASSTHROUGH;
+	DWORD dwCompression = ((LPBITMAPINFOHEADER)lpbi)->biCompression;
+	if (DibIsCustomFormat(lpbi))
+	{
+		dwFlags = 0;
+		dwCompression = FourCCToUpper(dwCompression);
+	}
+
+	for (UINT u = 0; u < _countof(g_aCodecs); u++)
+	{
+		if (g_aCodecs[u].cbMagic == 0 && g_aCodecs[u].dwCompression == dwCompression &&
+			(g_aCodecs[u].dwFlags & CODEC_PASSTHROUGH) == dwFlags)
+			return &g_aCodecs[u];
+	}
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+DWORD QueryCodecCaps(LPCSTR lpbi)
+{
+	LPCCODEC_INFO lpCodec = FindCodecByDib(lpbi);
+
+	return lpCodec != NULL ? lpCodec->dwFlags : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE DecodeJpegDib(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData, UINT uMinWidth, UINT uMinHeight)
+{
+	UNREFERENCED_PARAMETER(lpbi);
+
+	return JpegToDib(lpData, dwLenData, 0, uMinWidth, uMinHeight);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE DecodePngDib(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData, UINT uMinWidth, UINT uMinHeight)
+{
+	UNREFERENCED_PARAMETER(lpbi);
+	UNREFERENCED_PARAMETER(uMinWidth);
+	UNREFERENCED_PARAMETER(uMinHeight);
+
+	return PngToDib(lpData, dwLenData);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE DecodeCinepakDib(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData, UINT uMinWidth, UINT uMinHeight)
+{
+	UNREFERENCED_PARAMETER(uMinWidth);
+	UNREFERENCED_PARAMETER(uMinHeight);
+
+	return CinepakToDib(lpbi, lpData, dwLenData);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE DecodeVideo1Dib(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData, UINT uMinWidth, UINT uMinHeight)
+{
+	UNREFERENCED_PARAMETER(uMinWidth);
+	UNREFERENCED_PARAMETER(uMinHeight);
+
+	return Video1ToDib(lpbi, lpData, dwLenData);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+DWORD FourCCToUpper(DWORD dwFourCC)
+{
+	DWORD dwResult = 0;
+
+	for (int nShift = 0; nShift < 32; nShift += 8)
+		dwResult |= (DWORD)toupper((dwFourCC >> nShift) & 0xFF) << nShift;
+
+	return dwResult;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
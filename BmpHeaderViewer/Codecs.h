@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Codecs.h - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Maximum length of a file signature
+#define CODEC_MAX_MAGIC     4
+
+// Codec capabilities
+#define CODEC_PARSE         0x0001  // Parses files starting with the signature
+#define CODEC_DECODE        0x0002  // Decodes bitmap bits with the compression into a DIB
+#define CODEC_PASSTHROUGH   0x0004  // The bitmap bits contain a complete JPEG or PNG image
+#define CODEC_SCALABLE      0x0008  // The decoder can reduce the image size while decoding
+
+// Parses a file and displays its content. The parser sets the file pointer itself.
+typedef BOOL (*CODECPARSEPROC)(HWND hDlg, HANDLE hFile, DWORD dwFileSize);
+
+// Decodes the bitmap bits of a compressed DIB into a new DIB. lpbi points to the header
+// of the compressed DIB. uMinWidth and uMinHeight allow decoding with a reduced size.
+typedef HANDLE (*DIBDECODEPROC)(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData, UINT uMinWidth, UINT uMinHeight);
+
+// Registry entry for a file format or a DIB compression
+typedef struct _CODEC_INFO
+{
+    BYTE           abMagic[CODEC_MAX_MAGIC];  // File signature
+    UINT           cbMagic;                   // Length of the signature, 0 for a DIB compression
+    DWORD          dwCompression;             // biCompression value (uppercase for FourCC codes)
+    DWORD          cbProbe;                   // Minimum size of the bitmap bits for the header check, 0 if variable
+    DWORD          dwFlags;                   // Capabilities
+    CODECPARSEPROC lpfnParse;                 // File parser
+    DIBDECODEPROC  lpfnDecode;                // Pixel decoder
+} CODEC_INFO, FAR* LPCODEC_INFO;
+
+typedef const CODEC_INFO FAR* LPCCODEC_INFO;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Finds the codec for a file signature
+LPCCODEC_INFO FindCodecByMagic(LPCVOID lpMagic, SIZE_T cbMagic);
+
+// Finds the built-in decoder for the compression of a passthrough or FourCC DIB
+LPCCODEC_INFO FindCodecByDib(LPCSTR lpbi);
+
+// Gets the capabilities of the built-in decoder for a DIB, or 0
+DWORD QueryCodecCaps(LPCSTR lpbi);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
@@ -18,14 +18,6 @@
 
 #include "stdafx.h"
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-// Forward declarations of functions included in this code module
-
-// Determines the value of a color component using a color mask
-BYTE GetColorValue(DWORD dwPixel, DWORD dwMask);
-// Transforms a 16-bit sRGB64 color value in s2.13 format to 8-bit sRGB
-BYTE SRGB64ToSRGB(WORD wColor, BOOL bUseGammaEncoding = TRUE);
-
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 BOOL SaveBitmap(LPCTSTR lpszFileName, HANDLE hDib)
@@ -41,120 +33,28 @@ BOOL SaveBitmap(LPCTSTR lpszFileName, HANDLE hDib)
 	if (lpbi == NULL)
 		return FALSE;
 
-	DWORD dwHeaderSize = *(LPDWORD)lpbi;
-	DWORD dwMasksSize = ColorMasksSize(lpbi);
-	DWORD dwPaletteSize = PaletteSize(lpbi);
 	DWORD dwImageSize = DibImageSize(lpbi);
 	DWORD dwProfileSize = 0;
-
-	SIZE_T cbOffBits = (SIZE_T)dwHeaderSize + dwMasksSize + dwPaletteSize;
-
-	// Copy the header so that we can adjust biSizeImage and bV5ProfileData.
-	// For this purpose, we can use a v5 structure for all bitmap variants.
-	BITMAPV5HEADER bmhv5;
-	ZeroMemory(&bmhv5, sizeof(bmhv5));
-	CopyMemory(&bmhv5, lpbi, min(dwHeaderSize, sizeof(bmhv5)));
-
-	if (bmhv5.bV5SizeImage)
-		bmhv5.bV5SizeImage = dwImageSize;
-
 	BOOL bHasProfile = DibHasColorProfile(lpbi);
 	if (bHasProfile)
-	{
-		dwProfileSize = bmhv5.bV5ProfileSize;
-		bmhv5.bV5ProfileData = (DWORD)(cbOffBits + dwImageSize);
-	}
-
-	SIZE_T cbDibSize = cbOffBits + dwImageSize + dwProfileSize;
-	if (cbDibSize == 0 || cbDibSize > cbSize)
-	{
-		GlobalUnlock(hDib);
-		return FALSE;
-	}
-
-	BITMAPFILEHEADER bfh = { 0 };
-	bfh.bfType = BFT_BITMAP;
-	bfh.bfSize = (DWORD)(cbDibSize + sizeof(BITMAPFILEHEADER));
-	bfh.bfOffBits = (DWORD)(cbOffBits + sizeof(BITMAPFILEHEADER));
-
-	HANDLE hFile = CreateFile(lpszFileName, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
-		FILE_ATTRIBUTE_NORMAL, NULL);
-	if (hFile == INVALID_HANDLE_VALUE)
-	{
-		GlobalUnlock(hDib);
-		return FALSE;
-	}
+		dwProfileSize = ((LPBITMAPV5HEADER)lpbi)->bV5ProfileSize;
 
-	DWORD dwWrite = 0;
-	// Write file header
-	if (!WriteFile(hFile, &bfh, sizeof(BITMAPFILEHEADER), &dwWrite, NULL) || dwWrite != sizeof(BITMAPFILEHEADER))
+	// The DIB must contain all the data referenced by the header
+	SIZE_T cbOffBits = (SIZE_T)*(LPDWORD)lpbi + ColorMasksSize(lpbi) + PaletteSize(lpbi);
+	SIZE_T cbDibSize = cbOffBits + dwImageSize;
+	if (cbDibSize > cbSize || (bHasProfile && (((LPBITMAPV5HEADER)lpbi)->bV5ProfileData > cbSize ||
+		dwProfileSize > cbSize - ((LPBITMAPV5HEADER)lpbi)->bV5ProfileData)))
 	{
 		GlobalUnlock(hDib);
-		CloseHandle(hFile);
-		DeleteFile(lpszFileName);
 		return FALSE;
 	}
 
-	if (dwHeaderSize)
-	{ // Write bitmap header
-		if (!WriteFile(hFile, &bmhv5, dwHeaderSize, &dwWrite, NULL) || dwWrite != dwHeaderSize)
-		{
-			GlobalUnlock(hDib);
-			CloseHandle(hFile);
-			DeleteFile(lpszFileName);
-			return FALSE;
-		}
-	}
-
-	if (dwMasksSize)
-	{ // Write color masks
-		if (!WriteFile(hFile, lpbi + dwHeaderSize, dwMasksSize, &dwWrite, NULL) || dwWrite != dwMasksSize)
-		{
-			GlobalUnlock(hDib);
-			CloseHandle(hFile);
-			DeleteFile(lpszFileName);
-			return FALSE;
-		}
-	}
-
-	if (dwPaletteSize)
-	{ // Write color table
-		if (!WriteFile(hFile, FindDibPalette(lpbi), dwPaletteSize, &dwWrite, NULL) || dwWrite != dwPaletteSize)
-		{
-			GlobalUnlock(hDib);
-			CloseHandle(hFile);
-			DeleteFile(lpszFileName);
-			return FALSE;
-		}
-	}
-
-	if (dwImageSize)
-	{ // Write bitmap bits
-		if (!WriteFile(hFile, FindDibBits(lpbi), dwImageSize, &dwWrite, NULL) || dwWrite != dwImageSize)
-		{
-			GlobalUnlock(hDib);
-			CloseHandle(hFile);
-			DeleteFile(lpszFileName);
-			return FALSE;
-		}
-	}
-
-	if (bHasProfile)
-	{ // Write color profile
-		if (!WriteFile(hFile, lpbi + ((LPBITMAPV5HEADER)lpbi)->bV5ProfileData, dwProfileSize, &dwWrite, NULL) ||
-			dwWrite != dwProfileSize)
-		{
-			GlobalUnlock(hDib);
-			CloseHandle(hFile);
-			DeleteFile(lpszFileName);
-			return FALSE;
-		}
-	}
+	BOOL bSuccess = WriteBitmap(lpszFileName, lpbi, FindDibBits(lpbi),
+		bHasProfile ? lpbi + ((LPBITMAPV5HEADER)lpbi)->bV5ProfileData : NULL);
 
 	GlobalUnlock(hDib);
-	CloseHandle(hFile);
 
-	return TRUE;
+	return bSuccess;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -215,28 +115,39 @@ HBITMAP CreatePremultipliedBitmap(HANDLE hDib)
 		return NULL;
 	}
 
-	LONG lWidth  = 0;
-	LONG lHeight = 0;
+	// The lookup tables make the structure too large for the stack
+	LPDIB_FORMAT lpFormat = (LPDIB_FORMAT)MyGlobalAllocPtr(GMEM_MOVEABLE, sizeof(DIB_FORMAT));
+	if (lpFormat == NULL)
+	{
+		GlobalUnlock(hDib);
+		return NULL;
+	}
 
-	GetDibDimensions((LPCSTR)lpbi, &lWidth, &lHeight);
+	if (!GetDibFormat((LPCSTR)lpbi, lpFormat))
+	{
+		MyGlobalFreePtr(lpFormat);
+		GlobalUnlock(hDib);
+		return NULL;
+	}
 
 	BITMAPINFO bmi = { {0} };
 	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-	bmi.bmiHeader.biWidth = lWidth;
-	bmi.bmiHeader.biHeight = lHeight;
+	bmi.bmiHeader.biWidth = lpFormat->lWidth;
+	bmi.bmiHeader.biHeight = lpFormat->lHeight;
 	bmi.bmiHeader.biPlanes = 1;
 	bmi.bmiHeader.biBitCount = 32;
 	bmi.bmiHeader.biCompression = BI_RGB;
 
-	lWidth = abs(lWidth);
-	lHeight = abs(lHeight);
+	LONG lWidth = abs(lpFormat->lWidth);
+	LONG lHeight = abs(lpFormat->lHeight);
 
 	LPBYTE lpBGRA = NULL;
-	LPBYTE lpDIB = FindDibBits((LPCSTR)lpbi);
+	LPCBYTE lpDIB = FindDibBits((LPCSTR)lpbi);
 
 	HBITMAP hbmpDib = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, (PVOID*)&lpBGRA, NULL, 0);
 	if (hbmpDib == NULL || lpBGRA == NULL)
 	{
+		MyGlobalFreePtr(lpFormat);
 		GlobalUnlock(hDib);
 		return NULL;
 	}
@@ -244,86 +155,35 @@ HBITMAP CreatePremultipliedBitmap(HANDLE hDib)
 	BOOL bHasVisiblePixels = FALSE;
 	BOOL bHasTransparentPixels = FALSE;
 
-	BOOL bIsCore = IS_OS2PM_DIB(lpbi);
-	WORD wBitCount = bIsCore ? ((LPBITMAPCOREHEADER)lpbi)->bcBitCount : lpbi->biBitCount;
-	ULONG ulIncrement = WIDTHBYTES(lWidth * wBitCount);
-	DWORD dwRedMask, dwGreenMask, dwBlueMask, dwAlphaMask;
+	ULONG ulIncrement = lpFormat->ulIncrement;
 
 	__try
 	{
-		if (!bIsCore && (lpbi->biCompression == BI_BITFIELDS || lpbi->biCompression == BI_ALPHABITFIELDS))
+		for (LONG h = 0; h < lHeight; h++)
 		{
-			LPDWORD lpdwColorMasks = (LPDWORD)&(((LPBITMAPINFO)lpbi)->bmiColors[0]);
-			dwRedMask   = lpdwColorMasks[0];
-			dwGreenMask = lpdwColorMasks[1];
-			dwBlueMask  = lpdwColorMasks[2];
-			dwAlphaMask = 0x00000000;
-			if (lpbi->biSize >= sizeof(BITMAPV3INFOHEADER) || lpbi->biCompression == BI_ALPHABITFIELDS)
-				dwAlphaMask = lpdwColorMasks[3];
-		}
-		else if (wBitCount == 16)
-		{
-			dwRedMask   = 0x00007C00;
-			dwGreenMask = 0x000003E0;
-			dwBlueMask  = 0x0000001F;
-			dwAlphaMask = 0x00008000;
-		}
-		else
-		{
-			dwRedMask   = 0x00FF0000;
-			dwGreenMask = 0x0000FF00;
-			dwBlueMask  = 0x000000FF;
-			dwAlphaMask = 0xFF000000;
-		}
+			LPBYTE lpDest = lpBGRA + (ULONG_PTR)h * lWidth * 4;
 
-		if (dwAlphaMask || wBitCount == 64)
-		{
-			for (LONG h = 0; h < lHeight; h++)
+			// Convert the scan line to BGRA and pre-multiply the color values in place
+			ConvertDibRow(lpFormat, lpDIB + (ULONG_PTR)h * ulIncrement, (LPDWORD)lpDest);
+
+			for (LONG w = 0; w < lWidth; w++, lpDest += 4)
 			{
-				LPBYTE lpSrc = lpDIB + (ULONG_PTR)h * ulIncrement;
-				LPBYTE lpDest = lpBGRA + (ULONG_PTR)h * lWidth * 4;
+				BYTE cAlpha = lpDest[3];
 
-				for (LONG w = 0; w < lWidth; w++)
-				{
-					if (wBitCount == 64)
-					{
-						LPWORD lpwSrc = (LPWORD)lpSrc;
-						BYTE cAlpha = SRGB64ToSRGB(lpwSrc[3], FALSE);
-
-						if (cAlpha != 0x00)
-							bHasVisiblePixels = TRUE;
-						if (cAlpha != 0xFF)
-							bHasTransparentPixels = TRUE;
-
-						*lpDest++ = Mul8Bit(SRGB64ToSRGB(lpwSrc[0]), cAlpha);
-						*lpDest++ = Mul8Bit(SRGB64ToSRGB(lpwSrc[1]), cAlpha);
-						*lpDest++ = Mul8Bit(SRGB64ToSRGB(lpwSrc[2]), cAlpha);
-						*lpDest++ = cAlpha;
-					}
-					else
-					{
-						DWORD dwColor = MAKELONG(MAKEWORD(lpSrc[0], lpSrc[1]),
-							wBitCount == 16 ? 0 : MAKEWORD(lpSrc[2], lpSrc[3]));
-						BYTE cAlpha = GetColorValue(dwColor, dwAlphaMask);
-
-						if (cAlpha != 0x00)
-							bHasVisiblePixels = TRUE;
-						if (cAlpha != 0xFF)
-							bHasTransparentPixels = TRUE;
-
-						*lpDest++ = Mul8Bit(GetColorValue(dwColor, dwBlueMask), cAlpha);
-						*lpDest++ = Mul8Bit(GetColorValue(dwColor, dwGreenMask), cAlpha);
-						*lpDest++ = Mul8Bit(GetColorValue(dwColor, dwRedMask), cAlpha);
-						*lpDest++ = cAlpha;
-					}
-
-					lpSrc += wBitCount >> 3;
-				}
+				if (cAlpha != 0x00)
+					bHasVisiblePixels = TRUE;
+				if (cAlpha != 0xFF)
+					bHasTransparentPixels = TRUE;
+
+				lpDest[0] = Mul8Bit(lpDest[0], cAlpha);
+				lpDest[1] = Mul8Bit(lpDest[1], cAlpha);
+				lpDest[2] = Mul8Bit(lpDest[2], cAlpha);
 			}
 		}
 	}
 	__except (EXCEPTION_EXECUTE_HANDLER) { ; }
 
+	MyGlobalFreePtr(lpFormat);
 	GlobalUnlock(hDib);
 
 	if (!bHasVisiblePixels || !bHasTransparentPixels)
@@ -350,12 +210,155 @@ HBITMAP FreeBitmap(HBITMAP hbmpDib)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Freed DIBs are not returned to the heap immediately, but are kept in a few slots of a small
+// pool. When parsing many files in a row, AllocDib can then reuse a block of a similar size
+// instead of requesting (and zeroing) a new block each time. Since the size of a DIB is often
+// determined with GlobalSize, a pooled block is shrunk to the exact size before it is reused.
+
+#define DIBPOOL_SLOTS       8                                   // Number of pool slots
+#define DIBPOOL_MIN_BLOCK   ((SIZE_T)64 * 1024)                 // Smaller blocks are not pooled
+#define DIBPOOL_MAX_BLOCK   ((SIZE_T)256 * 1024 * 1024)         // Larger blocks are not pooled
+#define DIBPOOL_MAX_TOTAL   ((SIZE_T)512 * 1024 * 1024)         // Max. size of all pooled blocks
+
+static HANDLE g_ahDibPool[DIBPOOL_SLOTS] = { NULL };
+static SIZE_T g_acbDibPool[DIBPOOL_SLOTS] = { 0 };
+static SIZE_T g_cbDibPoolTotal = 0;
+static SRWLOCK g_srwDibPool = SRWLOCK_INIT;
+
+HANDLE AllocDib(SIZE_T cbSize, BOOL bZeroInit)
+{
+	if (cbSize == 0)
+		return NULL;
+
+	HANDLE hDib = NULL;
+
+	if (cbSize >= DIBPOOL_MIN_BLOCK / 2)
+	{
+		// Take the smallest pooled block that is large enough,
+		// but not more than twice as large as the requested size
+		AcquireSRWLockExclusive(&g_srwDibPool);
+
+		int nSlot = -1;
+		for (int i = 0; i < DIBPOOL_SLOTS; i++)
+		{
+			if (g_ahDibPool[i] != NULL && g_acbDibPool[i] >= cbSize && g_acbDibPool[i] / 2 <= cbSize &&
+				(nSlot < 0 || g_acbDibPool[i] < g_acbDibPool[nSlot]))
+				nSlot = i;
+		}
+
+		if (nSlot >= 0)
+		{
+			hDib = g_ahDibPool[nSlot];
+			g_cbDibPoolTotal -= g_acbDibPool[nSlot];
+			g_ahDibPool[nSlot] = NULL;
+			g_acbDibPool[nSlot] = 0;
+		}
+
+		ReleaseSRWLockExclusive(&g_srwDibPool);
+	}
+
+	if (hDib != NULL)
+	{
+		// Shrinking a block usually doesn't move it
+		if (GlobalSize(hDib) != cbSize)
+		{
+			HANDLE hTemp = GlobalReAlloc(hDib, cbSize, GMEM_MOVEABLE);
+			if (hTemp == NULL)
+			{
+				GlobalFree(hDib);
+				return GlobalAlloc(bZeroInit ? GHND : GMEM_MOVEABLE, cbSize);
+			}
+			hDib = hTemp;
+		}
+
+		if (bZeroInit)
+		{
+			LPVOID lpDib = GlobalLock(hDib);
+			if (lpDib == NULL)
+			{
+				GlobalFree(hDib);
+				return NULL;
+			}
+
+			ZeroMemory(lpDib, cbSize);
+			GlobalUnlock(hDib);
+		}
+
+		return hDib;
+	}
+
+	return GlobalAlloc(bZeroInit ? GHND : GMEM_MOVEABLE, cbSize);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 HANDLE FreeDib(HANDLE hDib)
 {
 	if (hDib == NULL)
 		return NULL;
 
-	return GlobalFree(hDib);
+	// Only unlocked blocks of a reasonable size are pooled
+	SIZE_T cbSize = GlobalSize(hDib);
+	if (cbSize < DIBPOOL_MIN_BLOCK || cbSize > DIBPOOL_MAX_BLOCK ||
+		(GlobalFlags(hDib) & GMEM_LOCKCOUNT) != 0)
+		return GlobalFree(hDib);
+
+	AcquireSRWLockExclusive(&g_srwDibPool);
+
+	// Use a free slot or replace the smallest pooled block
+	int nSlot = 0;
+	for (int i = 0; i < DIBPOOL_SLOTS; i++)
+	{
+		if (g_ahDibPool[i] == NULL)
+		{
+			nSlot = i;
+			break;
+		}
+
+		if (g_acbDibPool[i] < g_acbDibPool[nSlot])
+			nSlot = i;
+	}
+
+	HANDLE hFree = NULL;
+	if (g_ahDibPool[nSlot] != NULL && g_acbDibPool[nSlot] >= cbSize)
+		hFree = hDib;
+	else if (g_cbDibPoolTotal - g_acbDibPool[nSlot] + cbSize > DIBPOOL_MAX_TOTAL)
+		hFree = hDib;
+	else
+	{
+		hFree = g_ahDibPool[nSlot];
+		g_cbDibPoolTotal -= g_acbDibPool[nSlot];
+		g_ahDibPool[nSlot] = hDib;
+		g_acbDibPool[nSlot] = cbSize;
+		g_cbDibPoolTotal += cbSize;
+	}
+
+	ReleaseSRWLockExclusive(&g_srwDibPool);
+
+	if (hFree != NULL)
+		GlobalFree(hFree);
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FlushDibPool()
+{
+	AcquireSRWLockExclusive(&g_srwDibPool);
+
+	for (int i = 0; i < DIBPOOL_SLOTS; i++)
+	{
+		if (g_ahDibPool[i] != NULL)
+			GlobalFree(g_ahDibPool[i]);
+
+		g_ahDibPool[i] = NULL;
+		g_acbDibPool[i] = 0;
+	}
+
+	g_cbDibPoolTotal = 0;
+
+	ReleaseSRWLockExclusive(&g_srwDibPool);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -373,7 +376,8 @@ HANDLE CopyDib(HANDLE hDib)
 	if (lpSrc == NULL)
 		return NULL;
 
-	HANDLE hNewDib = GlobalAlloc(GHND, cbSize);
+	// The new block is completely overwritten
+	HANDLE hNewDib = AllocDib(cbSize, FALSE);
 	if (hNewDib == NULL)
 	{
 		GlobalUnlock(hDib);
@@ -383,7 +387,7 @@ HANDLE CopyDib(HANDLE hDib)
 	LPBYTE lpDest = (LPBYTE)GlobalLock(hNewDib);
 	if (lpDest == NULL)
 	{
-		GlobalFree(hNewDib);
+		FreeDib(hNewDib);
 		GlobalUnlock(hDib);
 		return NULL;
 	}
@@ -399,26 +403,50 @@ HANDLE CopyDib(HANDLE hDib)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-HANDLE DecompressDib(HANDLE hDib)
+HANDLE DecompressDib(HANDLE hDib, UINT uMinWidth, UINT uMinHeight)
 {
 	if (hDib == NULL)
 		return NULL;
 
-	HANDLE hDibNew = NULL;
-
-#ifdef ICVERSION
+	SIZE_T cbSize = GlobalSize(hDib);
+	if (cbSize == 0)
+		return NULL;
 
 	LPBITMAPINFO lpbmi = (LPBITMAPINFO)GlobalLock(hDib);
 	if (lpbmi == NULL)
 		return NULL;
 
-	if (DibIsCustomFormat((LPCSTR)lpbmi))
-		hDibNew = ICImageDecompress(NULL, 0, lpbmi, FindDibBits((LPCSTR)lpbmi), NULL);
+	HANDLE hDibNew = NULL;
 
-	GlobalUnlock(hDib);
+	LPCCODEC_INFO lpCodec = FindCodecByDib((LPCSTR)lpbmi);
+	if (lpCodec != NULL && lpCodec->lpfnDecode != NULL)
+	{
+		// Decode the image directly from the bitmap bits, without copying it
+		DWORD dwOffBits = DibBitsOffset((LPCSTR)lpbmi);
+		if (dwOffBits < cbSize)
+		{
+			DWORD dwSizeImage = lpbmi->bmiHeader.biSizeImage;
+			if (dwSizeImage == 0 || dwSizeImage > cbSize - dwOffBits)
+				dwSizeImage = (DWORD)(cbSize - dwOffBits);
 
+			// Bitmap bits that are too small for the image header are not passed to the decoder.
+			// Only in-page errors are handled, so that bugs in the decoders are not hidden.
+			if (dwSizeImage >= lpCodec->cbProbe)
+			{
+				__try { hDibNew = lpCodec->lpfnDecode((LPCSTR)lpbmi, FindDibBits((LPCSTR)lpbmi), dwSizeImage, uMinWidth, uMinHeight); }
+				__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ?
+					EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) { hDibNew = NULL; }
+			}
+		}
+	}
+#ifdef ICVERSION
+	// Fall back to an installed codec
+	if (hDibNew == NULL && DibIsCustomFormat((LPCSTR)lpbmi))
+		hDibNew = ICImageDecompress(NULL, 0, lpbmi, FindDibBits((LPCSTR)lpbmi), NULL);
 #endif // ICVERSION
 
+	GlobalUnlock(hDib);
+
 	return hDibNew;
 }
 
@@ -434,6 +462,18 @@ HANDLE ChangeDibBitDepth(HANDLE hDib, WORD wBitCount)
 	if (wBitCount == 0)
 		wBitCount = (WORD)GetDeviceCaps(hdc, BITSPIXEL);
 
+	// Uncompressed DIBs are converted in software. The detour via a
+	// compatible bitmap is only needed for RLE-compressed DIBs and ICM.
+	if (g_nIcmMode != ICM_ON)
+	{
+		HANDLE hNewDib = ConvertDibBitDepth(hDib, wBitCount);
+		if (hNewDib != NULL)
+		{
+			ReleaseDC(NULL, hdc);
+			return hNewDib;
+		}
+	}
+
 	HPALETTE hpalOld = NULL;
 	HPALETTE hpal = CreateDibPalette(hDib);
 	if (hpal != NULL)
@@ -496,14 +536,14 @@ HANDLE ConvertBitmapToDib(HBITMAP hBitmap, HDC hdc, WORD wBitCount)
 
 	// Request memory for the target DIB. The memory block must
 	// be large enough to hold the data supplied by GetDIBits.
-	HANDLE hDib = GlobalAlloc(GHND, (SIZE_T)DibBitsOffset((LPCSTR)&bi) + DibImageSize((LPCSTR)&bi));
+	HANDLE hDib = AllocDib((SIZE_T)DibBitsOffset((LPCSTR)&bi) + DibImageSize((LPCSTR)&bi));
 	if (hDib == NULL)
 		return NULL;
 
 	LPBITMAPINFO lpbmi = (LPBITMAPINFO)GlobalLock(hDib);
 	if (lpbmi == NULL)
 	{
-		GlobalFree(hDib);
+		FreeDib(hDib);
 		return NULL;
 	}
 
@@ -528,10 +568,7 @@ HANDLE ConvertBitmapToDib(HBITMAP hBitmap, HDC hdc, WORD wBitCount)
 	GlobalUnlock(hDib);
 
 	if (!nRet)
-	{
-		GlobalFree(hDib);
-		hDib = NULL;
-	}
+		hDib = FreeDib(hDib);
 
 	return hDib;
 }
@@ -571,7 +608,7 @@ HANDLE CreateClipboardDib(HANDLE hDib, UINT *puFormat)
 		UINT uColors = DibNumColors((LPCSTR)lpbmci);
 		UINT uImageSize = DibImageSize((LPCSTR)lpbmci);
 
-		hNewDib = GlobalAlloc(GMEM_MOVEABLE | GMEM_ZEROINIT | GMEM_DDESHARE,
+		hNewDib = AllocDib(
 			dwDestHeaderSize + uColors * sizeof(RGBQUAD) + uImageSize);
 		if (hNewDib == NULL)
 		{
@@ -582,7 +619,7 @@ HANDLE CreateClipboardDib(HANDLE hDib, UINT *puFormat)
 		LPBITMAPV5HEADER lpDest = (LPBITMAPV5HEADER)GlobalLock(hNewDib);
 		if (lpDest == NULL)
 		{
-			GlobalFree(hNewDib);
+			FreeDib(hNewDib);
 			GlobalUnlock(hDib);
 			return NULL;
 		}
@@ -624,7 +661,7 @@ HANDLE CreateClipboardDib(HANDLE hDib, UINT *puFormat)
 	else if (dwSrcHeaderSize == sizeof(BITMAPINFOHEADER2))
 	{
 		// Create a new DIBv3 (or DIBv5) from an OS/2 2.0 DIB
-		hNewDib = GlobalAlloc(GMEM_MOVEABLE | GMEM_DDESHARE, cbSize + dwDestHeaderSize - dwSrcHeaderSize);
+		hNewDib = AllocDib(cbSize + dwDestHeaderSize - dwSrcHeaderSize, FALSE);
 		if (hNewDib == NULL)
 		{
 			GlobalUnlock(hDib);
@@ -634,7 +671,7 @@ HANDLE CreateClipboardDib(HANDLE hDib, UINT *puFormat)
 		LPBYTE lpDest = (LPBYTE)GlobalLock(hNewDib);
 		if (lpDest == NULL)
 		{
-			GlobalFree(hNewDib);
+			FreeDib(hNewDib);
 			GlobalUnlock(hDib);
 			return NULL;
 		}
@@ -663,7 +700,7 @@ HANDLE CreateClipboardDib(HANDLE hDib, UINT *puFormat)
 		// Create a new DIBv5 from an extended DIBv3, a DIBv4 or, if requested, from a DIBv3
 		SIZE_T cbDibSize = sizeof(BITMAPV5HEADER) + PaletteSize((LPCSTR)lpSrc) + DibImageSize((LPCSTR)lpSrc);
 
-		hNewDib = GlobalAlloc(GMEM_MOVEABLE | GMEM_ZEROINIT | GMEM_DDESHARE, cbDibSize);
+		hNewDib = AllocDib(cbDibSize);
 		if (hNewDib == NULL)
 		{
 			GlobalUnlock(hDib);
@@ -673,7 +710,7 @@ HANDLE CreateClipboardDib(HANDLE hDib, UINT *puFormat)
 		LPBYTE lpDest = (LPBYTE)GlobalLock(hNewDib);
 		if (lpDest == NULL)
 		{
-			GlobalFree(hNewDib);
+			FreeDib(hNewDib);
 			GlobalUnlock(hDib);
 			return NULL;
 		}
@@ -709,7 +746,7 @@ HANDLE CreateClipboardDib(HANDLE hDib, UINT *puFormat)
 			return NULL;
 		}
 
-		hNewDib = GlobalAlloc(GMEM_MOVEABLE | GMEM_ZEROINIT | GMEM_DDESHARE, cbDibSize);
+		hNewDib = AllocDib(cbDibSize);
 		if (hNewDib == NULL)
 		{
 			GlobalUnlock(hDib);
@@ -719,7 +756,7 @@ HANDLE CreateClipboardDib(HANDLE hDib, UINT *puFormat)
 		LPBYTE lpDest = (LPBYTE)GlobalLock(hNewDib);
 		if (lpDest == NULL)
 		{
-			GlobalFree(hNewDib);
+			FreeDib(hNewDib);
 			GlobalUnlock(hDib);
 			return NULL;
 		}
@@ -740,7 +777,7 @@ HANDLE CreateClipboardDib(HANDLE hDib, UINT *puFormat)
 	else
 	{
 		// Copy the packed DIB
-		hNewDib = GlobalAlloc(GMEM_MOVEABLE | GMEM_DDESHARE, cbSize);
+		hNewDib = AllocDib(cbSize, FALSE);
 		if (hNewDib == NULL)
 		{
 			GlobalUnlock(hDib);
@@ -750,7 +787,7 @@ HANDLE CreateClipboardDib(HANDLE hDib, UINT *puFormat)
 		LPBYTE lpDest = (LPBYTE)GlobalLock(hNewDib);
 		if (lpDest == NULL)
 		{
-			GlobalFree(hNewDib);
+			FreeDib(hNewDib);
 			GlobalUnlock(hDib);
 			return NULL;
 		}
@@ -1095,6 +1132,20 @@ BOOL DibIsCustomFormat(LPCSTR lpbi)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+BOOL DibIsPassthrough(LPCSTR lpbi)
+{
+	return (QueryCodecCaps(lpbi) & CODEC_PASSTHROUGH) != 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL DibHasBuiltinDecoder(LPCSTR lpbi)
+{
+	return (QueryCodecCaps(lpbi) & CODEC_DECODE) != 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 BOOL DibIsCMYK(LPCSTR lpbi)
 {
 	if (lpbi == NULL)
@@ -1146,43 +1197,3 @@ DWORD QueryDibSupport(LPCSTR lpbi)
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
-
-static BYTE GetColorValue(DWORD dwPixel, DWORD dwMask)
-{
-	if (dwMask == 0)
-		return 0;
-
-	DWORD dwColor = dwPixel & dwMask;
-
-	// Shift the mask and color value left until the highest bit of the mask is set
-	while ((dwMask & 0x80000000) == 0)
-	{
-		dwColor = dwColor << 1;
-		dwMask  = dwMask  << 1;
-	}
-
-	// Return the high-order byte of the color value
-	return HIBYTE(HIWORD(dwColor));
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////
-// Transformation from 16-bit sRGB64 values to 8-bit sRGB, as described in ANNEX A.1 of the
-// IEC 61966-2-2 working draft (http://www.colour.org/tc8-05/Docs/colorspace/61966-2-2NPa.pdf)
-
-static BYTE SRGB64ToSRGB(WORD wColor, BOOL bUseGammaEncoding)
-{
-	wColor = min(max((SHORT)wColor, 0), 8192);
-
-	if (!bUseGammaEncoding)
-		return (BYTE)(255 * wColor / 8192);
-
-	double fColor = (double)wColor / 8192;
-	if (fColor < 0.0031308)
-		fColor *= 12.92;
-	else
-		fColor = pow(fColor, 1.0 / 2.4) * 1.055 - 0.055;
-
-	return (BYTE)(fColor * 255.0 + 0.5);
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////
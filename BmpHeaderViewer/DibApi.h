@@ -172,16 +172,26 @@ HBITMAP CreatePremultipliedBitmap(HANDLE hDib);
 // Frees the memory allocated for a DIB section using DeleteObject
 HBITMAP FreeBitmap(HBITMAP hbmpDib);
 
-// Frees the memory allocated for a DIB using GlobalFree
+// Allocates a movable memory block for a DIB. Blocks released with FreeDib are reused
+// if possible. Set bZeroInit to FALSE if the caller overwrites the entire block anyway.
+HANDLE AllocDib(SIZE_T cbSize, BOOL bZeroInit = TRUE);
+
+// Frees the memory allocated for a DIB or keeps it in the DIB pool for reuse
 HANDLE FreeDib(HANDLE hDib);
 
+// Releases all memory blocks held in the DIB pool
+void FlushDibPool();
+
 // Creates a copy of a DIB
 HANDLE CopyDib(HANDLE hDib);
 
-// Decompresses a video compressed DIB using Video Compression Manager
-HANDLE DecompressDib(HANDLE hDib);
+// Decodes a passthrough or video compressed DIB using a built-in decoder. Other video
+// compressed DIBs are decompressed using Video Compression Manager. uMinWidth and
+// uMinHeight are passed to the decoder.
+HANDLE DecompressDib(HANDLE hDib, UINT uMinWidth = 0, UINT uMinHeight = 0);
 
-// Converts any DIB to a compatible bitmap and then back to a DIB with the desired bit depth
+// Converts any DIB to a DIB with the desired bit depth (0 for the screen depth). Uncompressed
+// DIBs are converted by ConvertDibBitDepth, all others by way of a compatible bitmap.
 HANDLE ChangeDibBitDepth(HANDLE hDib, WORD wBitCount = 0);
 
 // Converts a compatible bitmap to a device-independent bitmap with the desired bit depth.
@@ -242,6 +252,12 @@ BOOL DibIsCompressed(LPCSTR lpbi);
 // Checks if the biCompression member of a DIBv3 struct contains a FourCC code
 BOOL DibIsCustomFormat(LPCSTR lpbi);
 
+// Checks if the bitmap bits of the DIB contain a JPEG or PNG image
+BOOL DibIsPassthrough(LPCSTR lpbi);
+
+// Checks if the bitmap bits of the DIB can be decoded by a built-in decoder
+BOOL DibHasBuiltinDecoder(LPCSTR lpbi);
+
 // Checks whether the DIB uses the CMYK color model
 BOOL DibIsCMYK(LPCSTR lpbi);
 
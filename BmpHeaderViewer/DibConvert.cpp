@@ -0,0 +1,846 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// DibConvert.cpp - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+// Number of scan lines converted by a thread at a time
+#define BAND_HEIGHT         64
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Parameters of the bit depth conversion shared by all threads
+typedef struct _BITDEPTH_JOB
+{
+    DIB_FORMAT     df;                        // Format of the source DIB
+    LPCBYTE        lpSrcBits;                 // Bitmap bits of the source DIB
+    LONG           lSrcRows;                  // Number of complete scan lines in the source DIB
+    LPBYTE         lpDestBits;                // Bitmap bits of the target DIB
+    ULONG          ulDestIncrement;           // Bytes per scan line of the target DIB
+    WORD           wBitCount;                 // Bits per pixel of the target DIB
+    UINT           uDither;                   // Dithering method
+    BOOL           bCopyIndexes;              // The color indexes of the source DIB are retained
+    UINT           uColors;                   // Number of colors in the color table
+    RGBQUAD        aColors[PALETTE_LUT_SIZE]; // Color table of the target DIB
+    LPINVERSE_CMAP lpInverseMap;              // Nearest color table index for each color
+} BITDEPTH_JOB, FAR* LPBITDEPTH_JOB;
+
+typedef const BITDEPTH_JOB FAR* LPCBITDEPTH_JOB;
+
+// 8x8 Bayer matrix for ordered dithering
+static const BYTE g_abBayer[8][8] =
+{
+	{  0, 32,  8, 40,  2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44,  4, 36, 14, 46,  6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{  3, 35, 11, 43,  1, 33,  9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47,  7, 39, 13, 45,  5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Forward declarations of functions included in this code module
+
+// Row converters for the supported pixel formats
+static void ConvertRowPalette(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth);
+static void ConvertRowBgr24(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth);
+static void ConvertRowBgra32(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth);
+static void ConvertRowBgrx32(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth);
+static void ConvertRowMasks16(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth);
+static void ConvertRowMasks32(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth);
+static void ConvertRowCmyk32(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth);
+static void ConvertRowRgba64(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth);
+
+// Converts a pixel value with the given color masks to BGRA
+static DWORD MaskedPixelToBgra(LPCDIB_FORMAT lpFormat, DWORD dwPixel);
+// Converts a CMYK color value with black in the low-order byte to BGRA
+static DWORD CmykToBgra(DWORD dwCmyk);
+// Transforms a 16-bit sRGB64 color value in s2.13 format to 8-bit sRGB
+static BYTE SRGB64ToSRGB(WORD wColor, BOOL bUseGammaEncoding = TRUE);
+
+// Converts a band of scan lines of a bit depth conversion
+static void CALLBACK ConvertBand(UINT uIndex, LPVOID lpParam);
+// Reads a color index from a scan line with 1, 2, 4 or 8 bpp
+static UINT LoadIndex(LPCBYTE lpRow, UINT x, UINT uBitCount);
+// Writes a color index into a zero-initialized scan line with 1, 4 or 8 bpp
+static void StoreIndex(LPBYTE lpRow, UINT x, UINT uBitCount, UINT uIndex);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL GetDibFormat(LPCSTR lpbi, LPDIB_FORMAT lpFormat)
+{
+	if (lpbi == NULL || lpFormat == NULL)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	ZeroMemory(lpFormat, sizeof(DIB_FORMAT));
+
+	BOOL bIsCore = IS_OS2PM_DIB(lpbi);
+	LPBITMAPINFOHEADER lpbih = (LPBITMAPINFOHEADER)lpbi;
+	WORD wBitCount = bIsCore ? ((LPBITMAPCOREHEADER)lpbi)->bcBitCount : lpbih->biBitCount;
+	WORD wPlanes = bIsCore ? ((LPBITMAPCOREHEADER)lpbi)->bcPlanes : lpbih->biPlanes;
+
+	if (wPlanes != 1 || DibIsCompressed(lpbi))
+		return FALSE;
+
+	GetDibDimensions(lpbi, &lpFormat->lWidth, &lpFormat->lHeight);
+	UINT64 ullIncrement = WIDTHBYTES((UINT64)abs(lpFormat->lWidth) * wBitCount);
+	if (lpFormat->lWidth == 0 || lpFormat->lHeight == 0 || ullIncrement > 0x80000000)
+		return FALSE;
+
+	lpFormat->wBitCount = wBitCount;
+	lpFormat->ulIncrement = (ULONG)ullIncrement;
+	lpFormat->bHasAlpha = DibHasAlphaChannel(lpbi);
+	lpFormat->bIsCMYK = DibIsCMYK(lpbi);
+
+	// Color masks for 16 and 32 bpp
+	BOOL bHasMasks = !bIsCore && !IS_OS2V2_DIB(lpbi) &&
+		(lpbih->biCompression == BI_BITFIELDS || lpbih->biCompression == BI_ALPHABITFIELDS);
+	if (bHasMasks)
+	{
+		LPDWORD lpdwColorMasks = (LPDWORD)&(((LPBITMAPINFO)lpbi)->bmiColors[0]);
+		lpFormat->adwMasks[0] = lpdwColorMasks[0];
+		lpFormat->adwMasks[1] = lpdwColorMasks[1];
+		lpFormat->adwMasks[2] = lpdwColorMasks[2];
+		if (lpbih->biSize >= sizeof(BITMAPV3INFOHEADER) || lpbih->biCompression == BI_ALPHABITFIELDS)
+			lpFormat->adwMasks[3] = lpdwColorMasks[3];
+	}
+	else if (wBitCount == 16)
+	{
+		lpFormat->adwMasks[0] = 0x00007C00;
+		lpFormat->adwMasks[1] = 0x000003E0;
+		lpFormat->adwMasks[2] = 0x0000001F;
+		lpFormat->adwMasks[3] = 0x00008000;
+	}
+	else
+	{
+		lpFormat->adwMasks[0] = 0x00FF0000;
+		lpFormat->adwMasks[1] = 0x0000FF00;
+		lpFormat->adwMasks[2] = 0x000000FF;
+		lpFormat->adwMasks[3] = 0xFF000000;
+	}
+
+	// Without an alpha channel, the unused bits are ignored
+	if (!lpFormat->bHasAlpha)
+		lpFormat->adwMasks[3] = 0;
+
+	for (int i = 0; i < 4; i++)
+	{
+		DWORD dwMask = lpFormat->adwMasks[i];
+		if (dwMask != 0)
+			while ((dwMask & 0x80000000) == 0)
+			{
+				dwMask <<= 1;
+				lpFormat->abShifts[i]++;
+			}
+	}
+
+	switch (wBitCount)
+	{
+		case 1:
+		case 2:
+		case 4:
+		case 8:
+			CreatePaletteLut(lpbi, lpFormat->adwLut);
+			lpFormat->lpfnConvert = ConvertRowPalette;
+			break;
+
+		case 16:
+			if (lpFormat->bIsCMYK)
+				return FALSE;
+			lpFormat->lpfnConvert = ConvertRowMasks16;
+			break;
+
+		case 24:
+			if (bHasMasks || lpFormat->bIsCMYK)
+				return FALSE;
+			lpFormat->lpfnConvert = ConvertRowBgr24;
+			break;
+
+		case 32:
+			if (lpFormat->bIsCMYK)
+				lpFormat->lpfnConvert = ConvertRowCmyk32;
+			else if (lpFormat->adwMasks[0] == 0x00FF0000 &&
+				lpFormat->adwMasks[1] == 0x0000FF00 &&
+				lpFormat->adwMasks[2] == 0x000000FF)
+			{ // Standard layout, only the alpha channel needs attention
+				if (lpFormat->adwMasks[3] == 0xFF000000)
+					lpFormat->lpfnConvert = ConvertRowBgra32;
+				else if (lpFormat->adwMasks[3] == 0)
+					lpFormat->lpfnConvert = ConvertRowBgrx32;
+				else
+					lpFormat->lpfnConvert = ConvertRowMasks32;
+			}
+			else
+				lpFormat->lpfnConvert = ConvertRowMasks32;
+			break;
+
+		case 64:
+			if (bHasMasks)
+				return FALSE;
+			for (UINT u = 0; u < SRGB64_LUT_SIZE; u++)
+				lpFormat->abSrgb64Lut[u] = SRGB64ToSRGB((WORD)u);
+			lpFormat->lpfnConvert = ConvertRowRgba64;
+			break;
+
+		default:
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL DibNeedsConversion(LPCSTR lpbi)
+{
+	if (lpbi == NULL)
+		return FALSE;
+
+	BOOL bIsCore = IS_OS2PM_DIB(lpbi);
+	LPBITMAPINFOHEADER lpbih = (LPBITMAPINFOHEADER)lpbi;
+	WORD wBitCount = bIsCore ? ((LPBITMAPCOREHEADER)lpbi)->bcBitCount : lpbih->biBitCount;
+	WORD wPlanes = bIsCore ? ((LPBITMAPCOREHEADER)lpbi)->bcPlanes : lpbih->biPlanes;
+
+	if (wPlanes != 1 || DibIsCompressed(lpbi))
+		return FALSE;
+
+	switch (wBitCount)
+	{
+		case 1:
+		case 2:
+		case 4:
+		case 8:
+		case 64:
+			return TRUE;
+
+		case 32:
+			if (DibIsCMYK(lpbi))
+				return TRUE;
+			// Fall through
+
+		case 16:
+			// The display driver only supports some combinations of color masks
+			if (!bIsCore && !IS_OS2V2_DIB(lpbi) && lpbih->biCompression != BI_RGB)
+				return !IsDibSupported(lpbi);
+			break;
+	}
+
+	return FALSE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE ConvertDibToBgra(HANDLE hDib)
+{
+	if (hDib == NULL)
+		return NULL;
+
+	SIZE_T cbDibSize = GlobalSize(hDib);
+	LPCSTR lpbi = (LPCSTR)GlobalLock(hDib);
+	if (lpbi == NULL)
+		return NULL;
+
+	// The lookup tables make the structure too large for the stack
+	LPDIB_FORMAT lpFormat = (LPDIB_FORMAT)MyGlobalAllocPtr(GMEM_MOVEABLE, sizeof(DIB_FORMAT));
+	if (lpFormat == NULL)
+	{
+		GlobalUnlock(hDib);
+		return NULL;
+	}
+
+	if (!GetDibFormat(lpbi, lpFormat))
+	{
+		MyGlobalFreePtr(lpFormat);
+		GlobalUnlock(hDib);
+		return NULL;
+	}
+
+	LONG lWidth = abs(lpFormat->lWidth);
+	LONG lHeight = abs(lpFormat->lHeight);
+
+	// Use the same limit for the bitmap bits as ParseDIBitmap
+	UINT64 ullBitsSize = (UINT64)lWidth * lHeight * 4;
+	if (ullBitsSize > 0x80000000)
+	{
+		MyGlobalFreePtr(lpFormat);
+		GlobalUnlock(hDib);
+		return NULL;
+	}
+
+	BOOL bHasAlpha = lpFormat->adwMasks[3] != 0 || lpFormat->wBitCount == 64;
+	SIZE_T cbHeader = sizeof(BITMAPINFOHEADER) + (bHasAlpha ? 0 : 3 * sizeof(DWORD));
+
+	HANDLE hDibNew = AllocDib(cbHeader + (SIZE_T)ullBitsSize);
+	if (hDibNew == NULL)
+	{
+		MyGlobalFreePtr(lpFormat);
+		GlobalUnlock(hDib);
+		return NULL;
+	}
+
+	LPBITMAPINFOHEADER lpbiNew = (LPBITMAPINFOHEADER)GlobalLock(hDibNew);
+	if (lpbiNew == NULL)
+	{
+		FreeDib(hDibNew);
+		MyGlobalFreePtr(lpFormat);
+		GlobalUnlock(hDib);
+		return NULL;
+	}
+
+	// The orientation of the DIB is retained. GDI ignores the alpha values
+	// of a BI_RGB DIB, but CreatePremultipliedBitmap takes them into account.
+	lpbiNew->biSize = sizeof(BITMAPINFOHEADER);
+	lpbiNew->biWidth = lWidth;
+	lpbiNew->biHeight = lpFormat->lHeight;
+	lpbiNew->biPlanes = 1;
+	lpbiNew->biBitCount = 32;
+	lpbiNew->biCompression = bHasAlpha ? BI_RGB : BI_BITFIELDS;
+	lpbiNew->biSizeImage = (DWORD)ullBitsSize;
+
+	if (!bHasAlpha)
+	{
+		LPDWORD lpdwMasks = (LPDWORD)(lpbiNew + 1);
+		lpdwMasks[0] = 0x00FF0000;
+		lpdwMasks[1] = 0x0000FF00;
+		lpdwMasks[2] = 0x000000FF;
+	}
+
+	// Rows that are missing in a truncated DIB remain black
+	LPCBYTE lpSrc = FindDibBits(lpbi);
+	LPDWORD lpDest = (LPDWORD)((LPBYTE)lpbiNew + cbHeader);
+	ULONG ulIncrement = lpFormat->ulIncrement;
+	SIZE_T cbOffBits = (SIZE_T)(lpSrc - (LPCBYTE)lpbi);
+	LONG lRows = cbDibSize > cbOffBits ? (LONG)min((cbDibSize - cbOffBits) / ulIncrement, (SIZE_T)lHeight) : 0;
+
+	__try
+	{
+		for (LONG h = 0; h < lRows; h++)
+			ConvertDibRow(lpFormat, lpSrc + (ULONG_PTR)h * ulIncrement, lpDest + (ULONG_PTR)h * lWidth);
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER) { ; }
+
+	GlobalUnlock(hDibNew);
+	MyGlobalFreePtr(lpFormat);
+	GlobalUnlock(hDib);
+
+	return hDibNew;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE ConvertDibBitDepth(HANDLE hDib, WORD wBitCount, UINT uDither)
+{
+	if (hDib == NULL)
+		return NULL;
+
+	if (wBitCount != 1 && wBitCount != 4 && wBitCount != 8 &&
+		wBitCount != 16 && wBitCount != 24 && wBitCount != 32)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+
+	SIZE_T cbDibSize = GlobalSize(hDib);
+	LPCSTR lpbi = (LPCSTR)GlobalLock(hDib);
+	if (lpbi == NULL)
+		return NULL;
+
+	LPBITDEPTH_JOB lpJob = (LPBITDEPTH_JOB)MyGlobalAllocPtr(GHND, sizeof(BITDEPTH_JOB));
+	if (lpJob == NULL)
+	{
+		GlobalUnlock(hDib);
+		return NULL;
+	}
+
+	HANDLE hDibNew = NULL;
+	LPBITMAPINFOHEADER lpbiNew = NULL;
+	LPCDIB_FORMAT lpFormat = &lpJob->df;
+	LONG lWidth, lHeight;
+	UINT64 ullIncrement, ullBitsSize;
+	SIZE_T cbOffBits, cbHeader;
+
+	if (!GetDibFormat(lpbi, &lpJob->df))
+		goto Cleanup;
+
+	lWidth = abs(lpFormat->lWidth);
+	lHeight = abs(lpFormat->lHeight);
+
+	ullIncrement = WIDTHBYTES((UINT64)lWidth * wBitCount);
+	ullBitsSize = ullIncrement * lHeight;
+	if (ullBitsSize > 0x80000000)
+		goto Cleanup;
+
+	lpJob->lpSrcBits = FindDibBits(lpbi);
+	cbOffBits = (SIZE_T)(lpJob->lpSrcBits - (LPCBYTE)lpbi);
+	lpJob->lSrcRows = cbDibSize > cbOffBits ?
+		(LONG)min((cbDibSize - cbOffBits) / lpFormat->ulIncrement, (SIZE_T)lHeight) : 0;
+	lpJob->ulDestIncrement = (ULONG)ullIncrement;
+	lpJob->wBitCount = wBitCount;
+	lpJob->uDither = uDither;
+
+	if (wBitCount <= 8)
+	{
+		if (lpFormat->wBitCount <= wBitCount)
+		{ // The color table of the source DIB fits into the target DIB
+			lpJob->bCopyIndexes = TRUE;
+			lpJob->uColors = 1U << lpFormat->wBitCount;
+			CopyMemory(lpJob->aColors, lpFormat->adwLut, lpJob->uColors * sizeof(RGBQUAD));
+			for (UINT u = 0; u < lpJob->uColors; u++)
+				lpJob->aColors[u].rgbReserved = 0;
+		}
+		else
+		{
+			lpJob->uColors = CreateOptimizedPalette(lpFormat, lpJob->lpSrcBits,
+				lpJob->lSrcRows, lpJob->aColors, 1U << wBitCount);
+			if (lpJob->uColors == 0)
+				goto Cleanup;
+
+			lpJob->lpInverseMap = CreateInverseColorMap(lpJob->aColors, lpJob->uColors);
+			if (lpJob->lpInverseMap == NULL)
+				goto Cleanup;
+		}
+	}
+
+	cbHeader = sizeof(BITMAPINFOHEADER) + lpJob->uColors * sizeof(RGBQUAD);
+	hDibNew = AllocDib(cbHeader + (SIZE_T)ullBitsSize);
+	if (hDibNew == NULL)
+		goto Cleanup;
+
+	lpbiNew = (LPBITMAPINFOHEADER)GlobalLock(hDibNew);
+	if (lpbiNew == NULL)
+	{
+		hDibNew = FreeDib(hDibNew);
+		goto Cleanup;
+	}
+
+	// The orientation and the resolution of the DIB are retained
+	lpbiNew->biSize = sizeof(BITMAPINFOHEADER);
+	lpbiNew->biWidth = lWidth;
+	lpbiNew->biHeight = lpFormat->lHeight;
+	lpbiNew->biPlanes = 1;
+	lpbiNew->biBitCount = wBitCount;
+	lpbiNew->biCompression = BI_RGB;
+	lpbiNew->biSizeImage = (DWORD)ullBitsSize;
+	lpbiNew->biClrUsed = lpJob->uColors;
+	if (*(LPDWORD)lpbi >= FIELD_OFFSET(BITMAPINFOHEADER, biClrUsed))
+	{
+		lpbiNew->biXPelsPerMeter = ((LPBITMAPINFOHEADER)lpbi)->biXPelsPerMeter;
+		lpbiNew->biYPelsPerMeter = ((LPBITMAPINFOHEADER)lpbi)->biYPelsPerMeter;
+	}
+
+	CopyMemory(lpbiNew + 1, lpJob->aColors, lpJob->uColors * sizeof(RGBQUAD));
+
+	// Rows that are missing in a truncated DIB remain black (or color index 0)
+	lpJob->lpDestBits = (LPBYTE)lpbiNew + cbHeader;
+	ParallelFor((UINT)((lpJob->lSrcRows + BAND_HEIGHT - 1) / BAND_HEIGHT), ConvertBand, lpJob);
+
+	GlobalUnlock(hDibNew);
+
+Cleanup:
+	if (lpJob->lpInverseMap != NULL)
+		FreeInverseColorMap(lpJob->lpInverseMap);
+	MyGlobalFreePtr(lpJob);
+	GlobalUnlock(hDib);
+
+	return hDibNew;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CreatePaletteLut(LPCSTR lpbi, DWORD adwLut[PALETTE_LUT_SIZE])
+{
+	if (lpbi == NULL || adwLut == NULL)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	BOOL bIsCore = IS_OS2PM_DIB(lpbi);
+	BOOL bIsCMYK = DibIsCMYK(lpbi);
+	UINT uNumColors = min(DibNumColors(lpbi), PALETTE_LUT_SIZE);
+	LPBYTE lpEntry = FindDibPalette(lpbi);
+	UINT cbEntrySize = bIsCore ? sizeof(RGBTRIPLE) : sizeof(RGBQUAD);
+
+	// The reserved byte of a RGBQUAD is not used as alpha value
+	UINT u = 0;
+	for (; u < uNumColors; u++, lpEntry += cbEntrySize)
+	{
+		if (bIsCMYK)
+			adwLut[u] = CmykToBgra(*(LPDWORD)lpEntry);
+		else
+			adwLut[u] = 0xFF000000 | ((DWORD)lpEntry[2] << 16) | ((DWORD)lpEntry[1] << 8) | lpEntry[0];
+	}
+
+	// Invalid indexes (see pal8badindex.bmp)
+	for (; u < PALETTE_LUT_SIZE; u++)
+		adwLut[u] = 0xFF000000;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ExpandPaletteRow(LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth, UINT uBitCount, const DWORD adwLut[PALETTE_LUT_SIZE])
+{
+	if (lpSrc == NULL || lpDest == NULL || adwLut == NULL ||
+		(uBitCount != 1 && uBitCount != 2 && uBitCount != 4 && uBitCount != 8))
+		return;
+
+	// Each source byte is unpacked completely before the next one is read
+	UINT uBytes = uWidth / (8 / uBitCount);
+	UINT uRest = uWidth % (8 / uBitCount);
+	BYTE b;
+
+	switch (uBitCount)
+	{
+		case 1:
+			for (UINT u = 0; u < uBytes; u++, lpDest += 8)
+			{
+				b = lpSrc[u];
+				lpDest[0] = adwLut[(b >> 7)    ];
+				lpDest[1] = adwLut[(b >> 6) & 1];
+				lpDest[2] = adwLut[(b >> 5) & 1];
+				lpDest[3] = adwLut[(b >> 4) & 1];
+				lpDest[4] = adwLut[(b >> 3) & 1];
+				lpDest[5] = adwLut[(b >> 2) & 1];
+				lpDest[6] = adwLut[(b >> 1) & 1];
+				lpDest[7] = adwLut[ b       & 1];
+			}
+			for (UINT u = 0; u < uRest; u++)
+				lpDest[u] = adwLut[(lpSrc[uBytes] >> (7 - u)) & 1];
+			break;
+
+		case 2:
+			for (UINT u = 0; u < uBytes; u++, lpDest += 4)
+			{
+				b = lpSrc[u];
+				lpDest[0] = adwLut[(b >> 6)    ];
+				lpDest[1] = adwLut[(b >> 4) & 3];
+				lpDest[2] = adwLut[(b >> 2) & 3];
+				lpDest[3] = adwLut[ b       & 3];
+			}
+			for (UINT u = 0; u < uRest; u++)
+				lpDest[u] = adwLut[(lpSrc[uBytes] >> (6 - 2 * u)) & 3];
+			break;
+
+		case 4:
+			for (UINT u = 0; u < uBytes; u++, lpDest += 2)
+			{
+				b = lpSrc[u];
+				lpDest[0] = adwLut[b >> 4  ];
+				lpDest[1] = adwLut[b & 0x0F];
+			}
+			if (uRest)
+				lpDest[0] = adwLut[lpSrc[uBytes] >> 4];
+			break;
+
+		case 8:
+			for (UINT u = 0; u < uWidth; u++)
+				lpDest[u] = adwLut[lpSrc[u]];
+			break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ConvertRowPalette(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth)
+{
+	ExpandPaletteRow(lpSrc, lpDest, uWidth, lpFormat->wBitCount, lpFormat->adwLut);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ConvertRowBgr24(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth)
+{
+	UNREFERENCED_PARAMETER(lpFormat);
+
+	for (UINT u = 0; u < uWidth; u++, lpSrc += 3)
+		lpDest[u] = 0xFF000000 | ((DWORD)lpSrc[2] << 16) | ((DWORD)lpSrc[1] << 8) | lpSrc[0];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ConvertRowBgra32(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth)
+{
+	UNREFERENCED_PARAMETER(lpFormat);
+
+	CopyMemory(lpDest, lpSrc, (SIZE_T)uWidth * 4);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ConvertRowBgrx32(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth)
+{
+	UNREFERENCED_PARAMETER(lpFormat);
+
+	for (UINT u = 0; u < uWidth; u++, lpSrc += 4)
+		lpDest[u] = 0xFF000000 | ((DWORD)lpSrc[2] << 16) | ((DWORD)lpSrc[1] << 8) | lpSrc[0];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ConvertRowMasks16(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth)
+{
+	for (UINT u = 0; u < uWidth; u++, lpSrc += 2)
+		lpDest[u] = MaskedPixelToBgra(lpFormat, MAKEWORD(lpSrc[0], lpSrc[1]));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ConvertRowMasks32(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth)
+{
+	for (UINT u = 0; u < uWidth; u++, lpSrc += 4)
+		lpDest[u] = MaskedPixelToBgra(lpFormat,
+			MAKELONG(MAKEWORD(lpSrc[0], lpSrc[1]), MAKEWORD(lpSrc[2], lpSrc[3])));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ConvertRowCmyk32(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth)
+{
+	UNREFERENCED_PARAMETER(lpFormat);
+
+	for (UINT u = 0; u < uWidth; u++, lpSrc += 4)
+		lpDest[u] = CmykToBgra(MAKELONG(MAKEWORD(lpSrc[0], lpSrc[1]), MAKEWORD(lpSrc[2], lpSrc[3])));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ConvertRowRgba64(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth)
+{
+	const BYTE* lpLut = lpFormat->abSrgb64Lut;
+
+	// The color values are clamped to the range 0.0 to 1.0, the alpha values aren't gamma encoded
+	for (UINT u = 0; u < uWidth; u++, lpSrc += 8)
+	{
+		LPWORD lpwSrc = (LPWORD)lpSrc;
+		lpDest[u] = ((DWORD)SRGB64ToSRGB(lpwSrc[3], FALSE) << 24) |
+			((DWORD)lpLut[min(max((SHORT)lpwSrc[2], 0), 8192)] << 16) |
+			((DWORD)lpLut[min(max((SHORT)lpwSrc[1], 0), 8192)] << 8) |
+			lpLut[min(max((SHORT)lpwSrc[0], 0), 8192)];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static DWORD MaskedPixelToBgra(LPCDIB_FORMAT lpFormat, DWORD dwPixel)
+{
+	// Like GetColorValue, return the high-order byte of each aligned color value
+	const DWORD* lpdwMasks = lpFormat->adwMasks;
+	const BYTE* lpShifts = lpFormat->abShifts;
+
+	DWORD dwRed   = ((dwPixel & lpdwMasks[0]) << lpShifts[0]) >> 24;
+	DWORD dwGreen = ((dwPixel & lpdwMasks[1]) << lpShifts[1]) >> 24;
+	DWORD dwBlue  = ((dwPixel & lpdwMasks[2]) << lpShifts[2]) >> 24;
+	DWORD dwAlpha = lpdwMasks[3] != 0 ? ((dwPixel & lpdwMasks[3]) << lpShifts[3]) >> 24 : 0xFF;
+
+	return (dwAlpha << 24) | (dwRed << 16) | (dwGreen << 8) | dwBlue;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static DWORD CmykToBgra(DWORD dwCmyk)
+{
+	// Memory layout like the GDI CMYK macro: black, yellow, magenta, cyan
+	BYTE cWhite = 255 - (BYTE)dwCmyk;
+	BYTE cBlue  = (BYTE)Mul8Bit(255 - (BYTE)(dwCmyk >> 8), cWhite);
+	BYTE cGreen = (BYTE)Mul8Bit(255 - (BYTE)(dwCmyk >> 16), cWhite);
+	BYTE cRed   = (BYTE)Mul8Bit(255 - (BYTE)(dwCmyk >> 24), cWhite);
+
+	return 0xFF000000 | ((DWORD)cRed << 16) | ((DWORD)cGreen << 8) | cBlue;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Transformation from 16-bit sRGB64 values to 8-bit sRGB, as described in ANNEX A.1 of the
+// IEC 61966-2-2 working draft (http://www.colour.org/tc8-05/Docs/colorspace/61966-2-2NPa.pdf)
+
+static BYTE SRGB64ToSRGB(WORD wColor, BOOL bUseGammaEncoding)
+{
+	wColor = min(max((SHORT)wColor, 0), 8192);
+
+	if (!bUseGammaEncoding)
+		return (BYTE)(255 * wColor / 8192);
+
+	double fColor = (double)wColor / 8192;
+	if (fColor < 0.0031308)
+		fColor *= 12.92;
+	else
+		fColor = pow(fColor, 1.0 / 2.4) * 1.055 - 0.055;
+
+	return (BYTE)(fColor * 255.0 + 0.5);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void CALLBACK ConvertBand(UINT uIndex, LPVOID lpParam)
+{
+	LPCBITDEPTH_JOB lpJob = (LPCBITDEPTH_JOB)lpParam;
+	LPCDIB_FORMAT lpFormat = &lpJob->df;
+
+	LONG lWidth = abs(lpFormat->lWidth);
+	LONG lFirst = (LONG)uIndex * BAND_HEIGHT;
+	LONG lLast = min(lFirst + BAND_HEIGHT, lpJob->lSrcRows);
+	UINT uBitCount = lpJob->wBitCount;
+	UINT uDither = lpJob->uDither;
+
+	LPDWORD lpRow = (LPDWORD)MyGlobalAllocPtr(GMEM_MOVEABLE, (SIZE_T)lWidth * sizeof(DWORD));
+	if (lpRow == NULL)
+		return;
+
+	// Two rows of accumulated errors in 1/16 units, with one extra pixel at each end.
+	// The error diffusion starts anew in each band, so that the bands are independent.
+	LPINT lpErrors = NULL;
+	if (uBitCount <= 8 && !lpJob->bCopyIndexes && uDither == DIB_DITHER_FLOYD)
+	{
+		lpErrors = (LPINT)MyGlobalAllocPtr(GHND, (SIZE_T)(lWidth + 2) * 6 * sizeof(int));
+		if (lpErrors == NULL)
+		{
+			MyGlobalFreePtr(lpRow);
+			return;
+		}
+	}
+
+	// Amplitude of the ordered dither, depending on the distance between the palette colors
+	int nAmplitude = lpJob->uColors <= 2 ? 128 : (lpJob->uColors <= 16 ? 48 : 16);
+
+	__try
+	{
+		for (LONG h = lFirst; h < lLast; h++)
+		{
+			LPCBYTE lpSrc = lpJob->lpSrcBits + (ULONG_PTR)h * lpFormat->ulIncrement;
+			LPBYTE lpDest = lpJob->lpDestBits + (ULONG_PTR)h * lpJob->ulDestIncrement;
+
+			if (lpJob->bCopyIndexes)
+			{
+				for (LONG w = 0; w < lWidth; w++)
+					StoreIndex(lpDest, w, uBitCount, LoadIndex(lpSrc, w, lpFormat->wBitCount));
+				continue;
+			}
+
+			ConvertDibRow(lpFormat, lpSrc, lpRow);
+
+			switch (uBitCount)
+			{
+				case 32:
+					CopyMemory(lpDest, lpRow, (SIZE_T)lWidth * sizeof(DWORD));
+					break;
+
+				case 24:
+					for (LONG w = 0; w < lWidth; w++, lpDest += 3)
+					{
+						lpDest[0] = (BYTE)lpRow[w];
+						lpDest[1] = (BYTE)(lpRow[w] >> 8);
+						lpDest[2] = (BYTE)(lpRow[w] >> 16);
+					}
+					break;
+
+				case 16:
+					for (LONG w = 0; w < lWidth; w++, lpDest += 2)
+					{
+						DWORD dwColor = lpRow[w];
+						WORD wColor = (WORD)((((dwColor >> 16 & 0xFF) * 31 + 127) / 255) << 10 |
+							(((dwColor >> 8 & 0xFF) * 31 + 127) / 255) << 5 | ((dwColor & 0xFF) * 31 + 127) / 255);
+						lpDest[0] = LOBYTE(wColor);
+						lpDest[1] = HIBYTE(wColor);
+					}
+					break;
+
+				default:
+					if (lpErrors != NULL)
+					{ // Floyd-Steinberg with serpentine scanning
+						int nDir = ((h - lFirst) & 1) ? -1 : 1;
+						LPINT lpCur = lpErrors + ((h - lFirst) & 1) * (lWidth + 2) * 3;
+						LPINT lpNext = lpErrors + (((h - lFirst) & 1) ^ 1) * (lWidth + 2) * 3;
+						ZeroMemory(lpNext, (SIZE_T)(lWidth + 2) * 3 * sizeof(int));
+
+						for (LONG n = 0; n < lWidth; n++)
+						{
+							LONG w = nDir > 0 ? n : lWidth - 1 - n;
+							LPINT lpErr = lpCur + (w + 1) * 3;
+							int nRed   = min(max((int)(lpRow[w] >> 16 & 0xFF) + lpErr[0] / 16, 0), 255);
+							int nGreen = min(max((int)(lpRow[w] >> 8 & 0xFF) + lpErr[1] / 16, 0), 255);
+							int nBlue  = min(max((int)(lpRow[w] & 0xFF) + lpErr[2] / 16, 0), 255);
+
+							BYTE cIndex = MapToColorIndex(lpJob->lpInverseMap, nRed, nGreen, nBlue);
+							StoreIndex(lpDest, w, uBitCount, cIndex);
+
+							int anError[3] = {
+								nRed - lpJob->aColors[cIndex].rgbRed,
+								nGreen - lpJob->aColors[cIndex].rgbGreen,
+								nBlue - lpJob->aColors[cIndex].rgbBlue };
+
+							for (int i = 0; i < 3; i++)
+							{
+								lpErr[nDir * 3 + i] += anError[i] * 7;
+								lpNext[(w + 1 - nDir) * 3 + i] += anError[i] * 3;
+								lpNext[(w + 1) * 3 + i] += anError[i] * 5;
+								lpNext[(w + 1 + nDir) * 3 + i] += anError[i];
+							}
+						}
+					}
+					else
+					{
+						for (LONG w = 0; w < lWidth; w++)
+						{
+							int nRed   = (int)(lpRow[w] >> 16 & 0xFF);
+							int nGreen = (int)(lpRow[w] >> 8 & 0xFF);
+							int nBlue  = (int)(lpRow[w] & 0xFF);
+
+							if (uDither == DIB_DITHER_ORDERED)
+							{
+								int nOffset = ((int)g_abBayer[h & 7][w & 7] * 2 - 63) * nAmplitude / 64;
+								nRed   = min(max(nRed + nOffset, 0), 255);
+								nGreen = min(max(nGreen + nOffset, 0), 255);
+								nBlue  = min(max(nBlue + nOffset, 0), 255);
+							}
+
+							StoreIndex(lpDest, w, uBitCount, MapToColorIndex(lpJob->lpInverseMap, nRed, nGreen, nBlue));
+						}
+					}
+					break;
+			}
+		}
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER) { ; }
+
+	if (lpErrors != NULL)
+		MyGlobalFreePtr(lpErrors);
+	MyGlobalFreePtr(lpRow);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static UINT LoadIndex(LPCBYTE lpRow, UINT x, UINT uBitCount)
+{
+	UINT uBit = x * uBitCount;
+	return (lpRow[uBit >> 3] >> (8 - uBitCount - (uBit & 7))) & ((1U << uBitCount) - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void StoreIndex(LPBYTE lpRow, UINT x, UINT uBitCount, UINT uIndex)
+{
+	UINT uBit = x * uBitCount;
+	lpRow[uBit >> 3] |= (BYTE)(uIndex << (8 - uBitCount - (uBit & 7)));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
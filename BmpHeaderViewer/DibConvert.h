@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// DibConvert.h - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Number of entries of a palette lookup table (enough for any 8-bpp index)
+#define PALETTE_LUT_SIZE    256
+
+// Number of entries of the lookup table for 16-bit sRGB64 values in s2.13 format (0.0 to 1.0)
+#define SRGB64_LUT_SIZE     8193
+
+typedef struct _DIB_FORMAT DIB_FORMAT, FAR* LPDIB_FORMAT;
+typedef const DIB_FORMAT FAR* LPCDIB_FORMAT;
+
+// Converts a scan line of a DIB into BGRA pixels (0xAARRGGBB)
+typedef void (*ROWCONVERTPROC)(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth);
+
+// Pixel format of an uncompressed DIB and the row converter selected for it
+struct _DIB_FORMAT
+{
+    LONG           lWidth;                      // Width in pixels
+    LONG           lHeight;                     // Height in pixels (negative for top-down DIBs)
+    WORD           wBitCount;                   // Bits per pixel
+    ULONG          ulIncrement;                 // Bytes per scan line
+    BOOL           bHasAlpha;                   // The DIB may contain alpha values
+    BOOL           bIsCMYK;                     // The DIB uses the CMYK color model
+    DWORD          adwMasks[4];                 // Red, green, blue and alpha masks (16 and 32 bpp)
+    BYTE           abShifts[4];                 // Left shifts that align the masks with the top bit
+    DWORD          adwLut[PALETTE_LUT_SIZE];    // BGRA colors of the color table (up to 8 bpp)
+    BYTE           abSrgb64Lut[SRGB64_LUT_SIZE];// Gamma-encoded sRGB values (64 bpp)
+    ROWCONVERTPROC lpfnConvert;                 // Row converter
+};
+
+// Determines the pixel format of an uncompressed DIB with 1, 2, 4, 8, 16, 24, 32 or 64 bpp
+// (core, OS/2 2.0, DIBv3 to DIBv5, bit fields, CMYK) and selects the matching row converter.
+// lpbi must point to a DIB including its color masks and color table.
+BOOL GetDibFormat(LPCSTR lpbi, LPDIB_FORMAT lpFormat);
+
+// Converts a scan line of a DIB into BGRA pixels using the row converter of the format
+__inline void ConvertDibRow(LPCDIB_FORMAT lpFormat, LPCBYTE lpSrc, LPDWORD lpDest)
+{ lpFormat->lpfnConvert(lpFormat, lpSrc, lpDest, (UINT)abs(lpFormat->lWidth)); }
+
+// Checks whether a DIB must be converted by ConvertDibToBgra to be displayed with GDI,
+// either because GDI cannot draw it or only with a palette lookup for each pixel
+BOOL DibNeedsConversion(LPCSTR lpbi);
+
+// Creates a 32-bpp DIB from any DIB supported by GetDibFormat. Alpha values are stored in
+// a BI_RGB DIB. Opaque images are stored as BI_BITFIELDS DIB without an alpha channel.
+HANDLE ConvertDibToBgra(HANDLE hDib);
+
+// Dithering methods of ConvertDibBitDepth for targets with a color table
+#define DIB_DITHER_NONE     0   // Nearest color
+#define DIB_DITHER_ORDERED  1   // 8x8 Bayer matrix
+#define DIB_DITHER_FLOYD    2   // Floyd-Steinberg error diffusion
+
+// Converts any DIB supported by GetDibFormat to an uncompressed DIB with 1, 4, 8, 16 (5-5-5),
+// 24 or 32 bpp without using GDI. For targets with a color table, an optimized palette is
+// created, unless the color table of the source DIB can be reused. The scan lines are
+// converted in parallel. Returns NULL without setting an error for unsupported source DIBs.
+HANDLE ConvertDibBitDepth(HANDLE hDib, WORD wBitCount, UINT uDither = DIB_DITHER_FLOYD);
+
+// Fills a lookup table with the opaque BGRA colors of the color table of a DIB with up
+// to 8 bpp. Indexes beyond the end of the color table are mapped to black, as by GDI.
+BOOL CreatePaletteLut(LPCSTR lpbi, DWORD adwLut[PALETTE_LUT_SIZE]);
+
+// Expands a scan line of 1, 2, 4 or 8-bpp color indexes to BGRA pixels
+void ExpandPaletteRow(LPCBYTE lpSrc, LPDWORD lpDest, UINT uWidth, UINT uBitCount, const DWORD adwLut[PALETTE_LUT_SIZE]);
@@ -0,0 +1,406 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// DibToRle.cpp - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+// Number of scan lines encoded by a thread at a time
+#define RLE_BAND_HEIGHT     64
+
+// Maximum number of pixels of an encoded or absolute run
+#define RLE_MAX_RUN         255
+
+// Marks an absolute run in the run lengths selected for a scan line
+#define RLE_ABSOLUTE        0x8000
+
+// Encoded scan lines of a band
+typedef struct _RLE_BAND
+{
+    LPBYTE         lpData;                    // RLE data, NULL if the band could not be encoded
+    DWORD          cbData;                    // Size of the RLE data
+} RLE_BAND, FAR* LPRLE_BAND;
+
+// Parameters of the RLE encoding shared by all threads
+typedef struct _RLE_JOB
+{
+    LPCBYTE        lpSrcBits;                 // Bitmap bits of the source DIB
+    ULONG          ulIncrement;               // Bytes per scan line of the source DIB
+    UINT           uWidth;                    // Width in pixels
+    LONG           lHeight;                   // Height in pixels
+    BOOL           bTopDown;                  // The source DIB is a top-down DIB
+    UINT           uBitCount;                 // Bits per pixel (4 or 8)
+    LPRLE_BAND     lpBands;                   // Encoded bands, bottom-up
+} RLE_JOB, FAR* LPRLE_JOB;
+
+typedef const RLE_JOB FAR* LPCRLE_JOB;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Forward declarations of functions included in this code module
+
+// Creates an RLE compressed DIB from an uncompressed DIB with 4 or 8 bpp
+static HANDLE EncodeDib(LPCSTR lpbi, SIZE_T cbDibSize);
+// Encodes a band of scan lines
+static void CALLBACK EncodeBand(UINT uIndex, LPVOID lpParam);
+// Encodes a scan line with one color index per byte and returns the number of bytes written
+static UINT EncodeRow(LPCBYTE lpPixels, UINT uWidth, UINT uBitCount, LPDWORD lpCost, LPWORD lpRun, LPBYTE lpDest);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE DibToRle(HANDLE hDib)
+{
+	if (hDib == NULL)
+		return NULL;
+
+	SIZE_T cbDibSize = GlobalSize(hDib);
+	if (cbDibSize < sizeof(BITMAPCOREHEADER))
+		return NULL;
+
+	LPCSTR lpbi = (LPCSTR)GlobalLock(hDib);
+	if (lpbi == NULL)
+		return NULL;
+
+	HANDLE hDibNew = NULL;
+	LPBITMAPINFOHEADER lpbih = (LPBITMAPINFOHEADER)lpbi;
+	BOOL bIsInfoHeader = !IS_OS2PM_DIB(lpbi) && lpbih->biSize >= sizeof(BITMAPINFOHEADER) &&
+		cbDibSize >= sizeof(BITMAPINFOHEADER);
+
+	if (bIsInfoHeader && (lpbih->biCompression == BI_RLE8 || lpbih->biCompression == BI_RLE4))
+	{ // Nothing to do
+		hDibNew = AllocDib(cbDibSize, FALSE);
+		if (hDibNew != NULL)
+		{
+			LPVOID lpNew = GlobalLock(hDibNew);
+			if (lpNew != NULL)
+			{
+				CopyMemory(lpNew, lpbi, cbDibSize);
+				GlobalUnlock(hDibNew);
+			}
+			else
+				hDibNew = FreeDib(hDibNew);
+		}
+	}
+	else if (bIsInfoHeader && lpbih->biCompression == BI_RGB && lpbih->biPlanes == 1 &&
+		(lpbih->biBitCount == 4 || lpbih->biBitCount == 8) && !DibIsCMYK(lpbi))
+	{ // The color indexes can be encoded directly
+		hDibNew = EncodeDib(lpbi, cbDibSize);
+	}
+
+	WORD wBitCount = IS_OS2PM_DIB(lpbi) ? ((LPBITMAPCOREHEADER)lpbi)->bcBitCount : lpbih->biBitCount;
+	GlobalUnlock(hDib);
+
+	if (hDibNew != NULL)
+		return hDibNew;
+
+	// All other formats (and truncated DIBs) are converted to a 4 or 8-bpp DIB first
+	HANDLE hDibIndexed = ConvertDibBitDepth(hDib, wBitCount <= 4 ? 4 : 8);
+	if (hDibIndexed == NULL)
+		return NULL;
+
+	cbDibSize = GlobalSize(hDibIndexed);
+	lpbi = (LPCSTR)GlobalLock(hDibIndexed);
+	if (lpbi != NULL)
+	{
+		hDibNew = EncodeDib(lpbi, cbDibSize);
+		GlobalUnlock(hDibIndexed);
+	}
+
+	FreeDib(hDibIndexed);
+
+	return hDibNew;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static HANDLE EncodeDib(LPCSTR lpbi, SIZE_T cbDibSize)
+{
+	LPBITMAPINFOHEADER lpbih = (LPBITMAPINFOHEADER)lpbi;
+	LONG lWidth = lpbih->biWidth;
+	LONG lHeight = lpbih->biHeight;
+	if (lWidth <= 0 || lWidth > 0x7FFFFF || lHeight == 0)
+		return NULL;
+
+	// The DIB must contain all the data referenced by the header
+	DWORD dwImageSize = DibImageSize(lpbi);
+	SIZE_T cbOffBits = DibBitsOffset(lpbi);
+	if (cbOffBits > cbDibSize || dwImageSize > cbDibSize - cbOffBits)
+		return NULL;
+
+	// A color profile may be placed between the color table and the bits. Only the header
+	// and the color table are copied, the profile follows the encoded bits in the new DIB.
+	SIZE_T cbHeader = lpbih->biSize + ColorMasksSize(lpbi) + PaletteSize(lpbi);
+
+	DWORD dwProfileSize = 0;
+	LPCBYTE lpProfile = NULL;
+	if (DibHasColorProfile(lpbi))
+	{
+		LPBITMAPV5HEADER lpbiv5 = (LPBITMAPV5HEADER)lpbi;
+		if (lpbiv5->bV5ProfileData > cbDibSize || lpbiv5->bV5ProfileSize > cbDibSize - lpbiv5->bV5ProfileData)
+			return NULL;
+		dwProfileSize = lpbiv5->bV5ProfileSize;
+		lpProfile = (LPCBYTE)lpbi + lpbiv5->bV5ProfileData;
+	}
+
+	RLE_JOB job = { 0 };
+	job.lpSrcBits = FindDibBits(lpbi);
+	job.ulIncrement = WIDTHBYTES((ULONG)lWidth * lpbih->biBitCount);
+	job.uWidth = (UINT)lWidth;
+	job.lHeight = abs(lHeight);
+	job.bTopDown = lHeight < 0;
+	job.uBitCount = lpbih->biBitCount;
+
+	UINT uBands = (UINT)((job.lHeight + RLE_BAND_HEIGHT - 1) / RLE_BAND_HEIGHT);
+	job.lpBands = (LPRLE_BAND)MyGlobalAllocPtr(GHND, uBands * sizeof(RLE_BAND));
+	if (job.lpBands == NULL)
+		return NULL;
+
+	ParallelFor(uBands, EncodeBand, &job);
+
+	HANDLE hDibNew = NULL;
+	UINT64 ullBitsSize = 0;
+	UINT u = 0;
+	for (; u < uBands && job.lpBands[u].lpData != NULL; u++)
+		ullBitsSize += job.lpBands[u].cbData;
+
+	if (u == uBands && ullBitsSize + cbHeader + dwProfileSize <= 0x80000000)
+		hDibNew = AllocDib(cbHeader + (SIZE_T)ullBitsSize + dwProfileSize, FALSE);
+
+	LPBYTE lpNew = hDibNew != NULL ? (LPBYTE)GlobalLock(hDibNew) : NULL;
+	if (lpNew != NULL)
+	{
+		// The header and the color table are retained, RLE DIBs are always bottom-up
+		CopyMemory(lpNew, lpbi, cbHeader);
+		LPBITMAPINFOHEADER lpbihNew = (LPBITMAPINFOHEADER)lpNew;
+		lpbihNew->biHeight = job.lHeight;
+		lpbihNew->biCompression = job.uBitCount == 8 ? BI_RLE8 : BI_RLE4;
+		lpbihNew->biSizeImage = (DWORD)ullBitsSize;
+
+		LPBYTE lpDest = lpNew + cbHeader;
+		for (u = 0; u < uBands; u++)
+		{
+			CopyMemory(lpDest, job.lpBands[u].lpData, job.lpBands[u].cbData);
+			lpDest += job.lpBands[u].cbData;
+		}
+
+		if (lpProfile != NULL)
+		{
+			((LPBITMAPV5HEADER)lpNew)->bV5ProfileData = (DWORD)(lpDest - lpNew);
+			CopyMemory(lpDest, lpProfile, dwProfileSize);
+		}
+
+		GlobalUnlock(hDibNew);
+	}
+	else if (hDibNew != NULL)
+		hDibNew = FreeDib(hDibNew);
+
+	for (u = 0; u < uBands; u++)
+	{
+		if (job.lpBands[u].lpData != NULL)
+			MyGlobalFreePtr(job.lpBands[u].lpData);
+	}
+	MyGlobalFreePtr(job.lpBands);
+
+	return hDibNew;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void CALLBACK EncodeBand(UINT uIndex, LPVOID lpParam)
+{
+	LPCRLE_JOB lpJob = (LPCRLE_JOB)lpParam;
+
+	UINT uWidth = lpJob->uWidth;
+	LONG lFirst = (LONG)uIndex * RLE_BAND_HEIGHT;
+	LONG lLast = min(lFirst + RLE_BAND_HEIGHT, lpJob->lHeight);
+
+	// At most one encoded run per pixel plus the end-of-line or end-of-bitmap marker
+	SIZE_T cbMaxRow = (SIZE_T)uWidth * 2 + 2;
+	LPBYTE lpData = (LPBYTE)MyGlobalAllocPtr(GMEM_MOVEABLE, cbMaxRow * (lLast - lFirst));
+	if (lpData == NULL)
+		return;
+
+	// Costs and run lengths of the encoder, followed by the unpacked color indexes of a row
+	LPDWORD lpCost = (LPDWORD)MyGlobalAllocPtr(GMEM_MOVEABLE,
+		(SIZE_T)(uWidth + 1) * sizeof(DWORD) + (SIZE_T)uWidth * sizeof(WORD) + uWidth);
+	if (lpCost == NULL)
+	{
+		MyGlobalFreePtr(lpData);
+		return;
+	}
+	LPWORD lpRun = (LPWORD)(lpCost + uWidth + 1);
+	LPBYTE lpPixels = (LPBYTE)(lpRun + uWidth);
+
+	LPBYTE lpDest = lpData;
+
+	__try
+	{
+		for (LONG h = lFirst; h < lLast; h++)
+		{
+			LONG lRow = lpJob->bTopDown ? lpJob->lHeight - 1 - h : h;
+			LPCBYTE lpSrc = lpJob->lpSrcBits + (ULONG_PTR)lRow * lpJob->ulIncrement;
+
+			if (lpJob->uBitCount == 8)
+				CopyMemory(lpPixels, lpSrc, uWidth);
+			else
+			{
+				for (UINT x = 0; x < uWidth; x += 2)
+				{
+					lpPixels[x] = lpSrc[x / 2] >> 4;
+					if (x + 1 < uWidth)
+						lpPixels[x + 1] = lpSrc[x / 2] & 0x0F;
+				}
+			}
+
+			lpDest += EncodeRow(lpPixels, uWidth, lpJob->uBitCount, lpCost, lpRun, lpDest);
+
+			// End of line, or end of bitmap after the top scan line
+			*lpDest++ = 0;
+			*lpDest++ = h == lpJob->lHeight - 1 ? 1 : 0;
+		}
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		MyGlobalFreePtr(lpCost);
+		MyGlobalFreePtr(lpData);
+		return;
+	}
+
+	MyGlobalFreePtr(lpCost);
+
+	lpJob->lpBands[uIndex].lpData = lpData;
+	lpJob->lpBands[uIndex].cbData = (DWORD)(lpDest - lpData);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static UINT EncodeRow(LPCBYTE lpPixels, UINT uWidth, UINT uBitCount, LPDWORD lpCost, LPWORD lpRun, LPBYTE lpDest)
+{
+	// An encoded run repeats one color index (RLE8) or alternates two (RLE4) and always
+	// takes 2 bytes. An absolute run takes 2 bytes plus 2 bytes for each started group
+	// of 2 (RLE8) or 4 (RLE4) pixels, because it is padded to a word boundary.
+	UINT uPeriod = uBitCount == 8 ? 1 : 2;
+	UINT uGroup = uBitCount == 8 ? 2 : 4;
+
+	// The row is optimized from right to left. lpCost[x] receives the minimum number of
+	// bytes for the pixels from x to the end of the row, lpRun[x] the length of the first
+	// run. The cost of the cheapest absolute run starting at x only depends on its length
+	// modulo the group size, so one candidate per remainder is sufficient. Only where an
+	// absolute run reaches 255 pixels, the result can be a few bytes above the optimum.
+	DWORD adwAbsCost[4], adwNewCost[4];
+	UINT auAbsLength[4], auNewLength[4];
+	for (UINT k = 0; k < uGroup; k++)
+		adwAbsCost[k] = MAXDWORD;
+
+	lpCost[uWidth] = 0;
+	UINT uRepeat = 0;
+
+	for (UINT x = uWidth; x-- > 0; )
+	{
+		// Length of the pattern of one or two color indexes starting at x
+		if (x + uPeriod < uWidth && lpPixels[x + uPeriod] == lpPixels[x])
+			uRepeat++;
+		else
+			uRepeat = min(uPeriod, uWidth - x);
+
+		// Extend the absolute runs starting at x + 1 by one pixel, or start a new one
+		for (UINT k = 0; k < uGroup; k++)
+			adwNewCost[k] = MAXDWORD;
+		for (UINT k = 0; k < uGroup; k++)
+		{
+			if (adwAbsCost[k] != MAXDWORD && auAbsLength[k] < RLE_MAX_RUN)
+			{
+				UINT uNext = (k + 1) % uGroup;
+				adwNewCost[uNext] = adwAbsCost[k] + (k == 0 ? 2 : 0);
+				auNewLength[uNext] = auAbsLength[k] + 1;
+			}
+		}
+		if (lpCost[x + 1] + 4 <= adwNewCost[1])
+		{
+			adwNewCost[1] = lpCost[x + 1] + 4;
+			auNewLength[1] = 1;
+		}
+		CopyMemory(adwAbsCost, adwNewCost, sizeof(adwAbsCost));
+		CopyMemory(auAbsLength, auNewLength, sizeof(auAbsLength));
+
+		// Longer encoded runs are preferred at the same cost. Shorter runs than the full
+		// pattern are only needed to end the pattern before an absolute run.
+		UINT uLength = min(uRepeat, RLE_MAX_RUN);
+		lpCost[x] = lpCost[x + uLength] + 2;
+		lpRun[x] = (WORD)uLength;
+
+		for (uLength = 1; uLength <= uPeriod && uLength < uRepeat; uLength++)
+		{
+			if (lpCost[x + uLength] + 2 < lpCost[x])
+			{
+				lpCost[x] = lpCost[x + uLength] + 2;
+				lpRun[x] = (WORD)uLength;
+			}
+		}
+
+		for (UINT k = 0; k < uGroup; k++)
+		{
+			if (adwAbsCost[k] < lpCost[x])
+			{
+				lpCost[x] = adwAbsCost[k];
+				lpRun[x] = (WORD)(auAbsLength[k] | RLE_ABSOLUTE);
+			}
+		}
+	}
+
+	LPBYTE lpOut = lpDest;
+
+	for (UINT x = 0; x < uWidth; )
+	{
+		UINT uLength = lpRun[x] & ~RLE_ABSOLUTE;
+
+		// Absolute runs with less than 3 pixels would be escape codes, but they are never
+		// selected, because encoded runs of 1 or 2 pixels are cheaper
+		if (lpRun[x] & RLE_ABSOLUTE)
+		{
+			*lpOut++ = 0;
+			*lpOut++ = (BYTE)uLength;
+
+			if (uBitCount == 8)
+			{
+				CopyMemory(lpOut, lpPixels + x, uLength);
+				lpOut += uLength;
+			}
+			else
+			{
+				for (UINT u = 0; u < uLength; u += 2)
+					*lpOut++ = (BYTE)(lpPixels[x + u] << 4 | (u + 1 < uLength ? lpPixels[x + u + 1] : 0));
+			}
+
+			if ((lpOut - lpDest) & 1)
+				*lpOut++ = 0;
+
+			x += uLength;
+			continue;
+		}
+
+		*lpOut++ = (BYTE)uLength;
+		if (uBitCount == 8)
+			*lpOut++ = lpPixels[x];
+		else
+			*lpOut++ = (BYTE)(lpPixels[x] << 4 | (uLength > 1 ? lpPixels[x + 1] : 0));
+
+		x += uLength;
+	}
+
+	return (UINT)(lpOut - lpDest);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
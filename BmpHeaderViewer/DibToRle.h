@@ -0,0 +1,24 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// DibToRle.h - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Creates an RLE8 or RLE4 compressed DIB from a DIB supported by GetDibFormat. 4 and 8-bpp
+// DIBs keep their header, color table and color profile. 1 and 2-bpp DIBs are stored with
+// 4 bpp, DIBs with more than 8 bpp are reduced to 256 colors by ConvertDibBitDepth. Each
+// scan line is encoded with a minimal number of bytes, the bands of scan lines are encoded
+// in parallel. DIBs that are already RLE8 or RLE4 compressed are copied.
+HANDLE DibToRle(HANDLE hDib);
@@ -23,6 +23,8 @@
 #include "stdafx.h"
 
 #include "..\libjpeg\jpeglib.h"
+#include "..\libjpeg\jerror.h"
+#include "..\libjpeg\transupp.h"
 #include "..\libjpeg\iccprofile.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -54,28 +56,115 @@ static const char* const my_message_table[] =
 // Data Types
 
 typedef struct jpeg_decompress_struct j_decompress;
+typedef struct jpeg_compress_struct   j_compress;
 typedef struct jpeg_error_mgr         j_error_mgr;
+typedef struct jpeg_destination_mgr   j_destination_mgr;
+
+// Error manager (overloads jpeg_error_mgr). Each JPEG object has its own jump buffer,
+// so that JpegToDib and DibToJpeg can be used by several threads at the same time.
+typedef struct _JPEG_ERROR_MGR
+{
+	j_error_mgr     jError;         // Standard error manager
+	jmp_buf         JmpBuffer;      // Processor status for error handling
+	LPBOOL          lpbNeedDestroy; // Reset by my_error_exit after destroying the JPEG object
+	DWORD           dwError;        // System error code of a fatal libjpeg error
+	LPJPEG_DECODE_STATS lpStats;    // Receives the memory statistics before the object is destroyed
+	BOOL            bShowMessages;  // Messages are displayed (GUI threads only)
+} JPEG_ERROR_MGR, *LPJPEG_ERROR_MGR;
 
 // JPEG decompression structure (overloads jpeg_decompress_struct)
 typedef struct _JPEG_DECOMPRESS
 {
 	j_decompress    jInfo;          // Decompression structure
-	j_error_mgr     jError;         // Error manager
-	INT             nTraceLevel;    // Max. message level that will be displayed
+	JPEG_ERROR_MGR  jError;         // Error manager
 	BOOL            bNeedDestroy;   // jInfo must be destroyed
 	LPBYTE          lpProfileData;  // Pointer to ICC profile data
+	UINT            uUses;          // Number of images decoded with the pooled object
 } JPEG_DECOMPRESS, *LPJPEG_DECOMPRESS;
 
-// Buffer for processor status
-static jmp_buf JmpBuffer;
+// JPEG compression structure (overloads jpeg_compress_struct)
+typedef struct _JPEG_COMPRESS
+{
+	j_compress        jInfo;        // Compression structure
+	JPEG_ERROR_MGR    jError;       // Error manager
+	j_destination_mgr jDest;        // Destination manager
+	BOOL              bNeedDestroy; // jInfo must be destroyed
+	HANDLE            hFile;        // Output file
+	HANDLE            hDib;         // Locked source DIB
+	HANDLE            hDibTemp;     // Locked uncompressed copy of a compressed DIB
+	LPDIB_FORMAT      lpFormat;     // Pixel format of the DIB
+	LPBYTE            lpRow;        // Buffer for a converted scanline
+	JOCTET*           lpBuffer;     // Output buffer of the destination manager
+} JPEG_COMPRESS, *LPJPEG_COMPRESS;
+
+// Lossless transformation (source and destination object share the error manager)
+typedef struct _JPEG_TRANSFORM
+{
+	j_compress        jDstInfo;     // Compression structure (first member for the destination manager)
+	j_decompress      jSrcInfo;     // Decompression structure
+	JPEG_ERROR_MGR    jError;       // Error manager of both structures
+	j_destination_mgr jDest;        // Destination manager
+	LPBYTE            lpOutput;     // Growing output buffer
+	SIZE_T            cbOutput;     // Size of the output buffer
+	SIZE_T            cbJpeg;       // Length of the new JPEG file
+} JPEG_TRANSFORM, *LPJPEG_TRANSFORM;
+
+// Search for the end of the DC scans of a progressive image
+typedef struct _DC_SCAN_INFO
+{
+	UINT  uComponents;      // Number of components in the frame
+	UINT  uDcComponents;    // Number of components in the DC scans found so far
+	DWORD dwAcScan;         // Offset of the first AC scan, 0 if the DC scans are incomplete
+} DC_SCAN_INFO, *LPDC_SCAN_INFO;
+
+// Size of the output buffer of the destination manager
+#define OUTPUT_BUF_SIZE 65536
+
+// Decompression objects are not destroyed after each image, but are reset with
+// jpeg_abort_decompress and kept in a small pool. The next call of JpegToDib then
+// reuses the object including its marker processor, the source manager and
+// the permanent memory pool instead of creating everything from scratch.
+// The quantization and Huffman tables of the previous image are discarded. Their
+// memory stays in the permanent pool until the object is destroyed, so an object
+// is only reused for a limited number of images.
+
+#define JPEGPOOL_SLOTS      8   // Number of pooled decompression objects
+#define JPEGPOOL_MAX_USES   64  // Number of images before a pooled object is destroyed
+
+static LPJPEG_DECOMPRESS g_alpJpegPool[JPEGPOOL_SLOTS] = { NULL };
+static SRWLOCK g_srwJpegPool = SRWLOCK_INIT;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // Helper functions
 
 // Performs housekeeping
 void cleanup_jpeg_to_dib(LPJPEG_DECOMPRESS lpJpegDecompress, HANDLE hDib);
+// Decodes the Exif thumbnail if it is large enough and has the aspect ratio of the image
+HANDLE exif_thumbnail_to_dib(LPCBYTE lpJpegData, DWORD dwLenData, INT nTraceLevel, UINT uMinWidth, UINT uMinHeight, DWORD dwFlags, LPJPEG_DECODE_STATS lpStats);
+// Checks whether the image can be decoded from the DC coefficients
+BOOL can_decode_dc(j_decompress_ptr pjInfo);
+// Cuts off the data source of a progressive image behind the DC scans
+void skip_ac_scans(j_decompress_ptr pjInfo, LPCBYTE lpJpegData, DWORD dwLenData);
+// Stops the marker scanner at the first AC scan of a progressive image
+BOOL CALLBACK find_first_ac_scan(LPCJPEG_SEGMENT lpSegment, LPVOID lpParam);
+// Writes one pixel per block from the DC coefficients into the DIB
+void copy_dc_coefficients(j_decompress_ptr pjInfo, jvirt_barray_ptr* pCoefArrays, LPBYTE lpDIB, UINT uIncrement);
+// Copies the memory statistics of libjpeg into the JPEG_DECODE_STATS structure of the error manager
+void save_decode_stats(j_common_ptr pjInfo);
+// Takes a decompression object from the pool or allocates a new one
+LPJPEG_DECOMPRESS get_decompress_object();
+// Resets a decompression object and returns it to the pool
+void release_decompress_object(LPJPEG_DECOMPRESS lpJpegDecompress);
+// Performs housekeeping and deletes the output file if the compression failed
+void cleanup_dib_to_jpeg(LPJPEG_COMPRESS lpJpegCompress, LPCTSTR lpszFileName, BOOL bSuccess);
+// Transforms a JPEG image with transupp.c, bIntermediate only keeps the ICC profile
+HANDLE transform_jpeg(LPVOID lpJpegData, DWORD dwLenData, DWORD dwTransform, LPCRECT lprcCrop, BOOL bIntermediate, LPDWORD lpdwLenJpeg);
+// Sets the Exif orientation in the saved APP1 marker to 1 (top left)
+void reset_exif_orientation(j_decompress_ptr pjInfo);
+// Destroys the JPEG objects of a transformation and releases the output buffer
+void cleanup_transform_jpeg(LPJPEG_TRANSFORM lpJpegTransform);
 // Registers the callback functions for the error manager
-void set_error_manager(j_common_ptr pjInfo, j_error_mgr* pjError);
+void set_error_manager(j_common_ptr pjInfo, LPJPEG_ERROR_MGR lpError, INT nTraceLevel, LPBOOL lpbNeedDestroy);
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // Callback functions
@@ -86,32 +175,78 @@ static void my_error_exit(j_common_ptr pjInfo);
 static void my_output_message(j_common_ptr pjInfo);
 // Message handling
 static void my_emit_message(j_common_ptr pjInfo, int nMessageLevel);
+// Ends the data source with an EOI marker
+static boolean my_fill_input_eoi(j_decompress_ptr pjInfo);
+// Allocates the output buffer
+static void my_init_destination(j_compress_ptr pjInfo);
+// Writes the full output buffer to the file
+static boolean my_empty_output_buffer(j_compress_ptr pjInfo);
+// Writes the remaining data in the output buffer to the file
+static void my_term_destination(j_compress_ptr pjInfo);
+// Allocates the growing output buffer of a transformation
+static void my_init_memory_destination(j_compress_ptr pjInfo);
+// Doubles the size of the output buffer
+static boolean my_empty_memory_buffer(j_compress_ptr pjInfo);
+// Determines the length of the new JPEG file
+static void my_term_memory_destination(j_compress_ptr pjInfo);
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-HANDLE JpegToDib(LPVOID lpJpegData, DWORD dwLenData, INT nTraceLevel)
+HANDLE JpegToDib(LPVOID lpJpegData, DWORD dwLenData, INT nTraceLevel, UINT uMinWidth, UINT uMinHeight, DWORD dwFlags, LPJPEG_DECODE_STATS lpStats)
 {
-	HANDLE hDib = NULL;
+	// For a small thumbnail, the embedded Exif thumbnail is decoded instead of the main image
+	if (uMinWidth > 0 && uMinHeight > 0)
+	{
+		HANDLE hDibThumb = exif_thumbnail_to_dib((LPCBYTE)lpJpegData, dwLenData, nTraceLevel, uMinWidth, uMinHeight, dwFlags, lpStats);
+		if (hDibThumb != NULL)
+			return hDibThumb;
+	}
+
+	// Discard the statistics of a failed thumbnail decode
+	if (lpStats != NULL)
+		ZeroMemory(lpStats, sizeof(JPEG_DECODE_STATS));
 
-	// Initialize the JPEG decompression object
-	JPEG_DECOMPRESS JpegDecompress = { {0} };
-	j_decompress_ptr pjInfo = &JpegDecompress.jInfo;
-	JpegDecompress.lpProfileData = NULL;
-	JpegDecompress.nTraceLevel = nTraceLevel;
-	set_error_manager((j_common_ptr)pjInfo, &JpegDecompress.jError);
+	// Modified after setjmp and used after longjmp
+	HANDLE volatile hDib = NULL;
+
+	// Get a JPEG decompression object
+	LPJPEG_DECOMPRESS lpJpegDecompress = get_decompress_object();
+	if (lpJpegDecompress == NULL)
+	{
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+
+	j_decompress_ptr pjInfo = &lpJpegDecompress->jInfo;
+	set_error_manager((j_common_ptr)pjInfo, &lpJpegDecompress->jError, nTraceLevel, &lpJpegDecompress->bNeedDestroy);
+	lpJpegDecompress->jError.lpStats = lpStats;
 
 	// Save processor status for error handling
-	if (setjmp(JmpBuffer))
+	if (setjmp(lpJpegDecompress->jError.JmpBuffer))
 	{
-		cleanup_jpeg_to_dib(&JpegDecompress, hDib);
+		DWORD dwError = lpJpegDecompress->jError.dwError;
+		cleanup_jpeg_to_dib(lpJpegDecompress, hDib);
+		SetLastError(dwError);
 		return NULL;
 	}
 
-	jpeg_create_decompress(pjInfo);
-	JpegDecompress.bNeedDestroy = TRUE;
+	// A pooled object has already been created
+	if (!lpJpegDecompress->bNeedDestroy)
+	{
+		jpeg_create_decompress(pjInfo);
+		lpJpegDecompress->bNeedDestroy = TRUE;
+
+		// Prepare for reading an ICC profile
+		setup_read_icc_profile(pjInfo);
+	}
 
-	// Prepare for reading an ICC profile
-	setup_read_icc_profile(pjInfo);
+	// The statistics of a pooled object still contain the previous image.
+	// The peak restarts with the next allocation and includes the permanent pool.
+	pjInfo->mem->peak_space_allocated = 0;
+	pjInfo->mem->small_pools_allocated = 0;
+	pjInfo->mem->large_pools_allocated = 0;
+	pjInfo->mem->virt_space_requested = 0;
+	pjInfo->mem->backing_store_space = 0;
 
 	// Determine data source
 	jpeg_mem_src(pjInfo, (LPBYTE)lpJpegData, dwLenData);
@@ -121,7 +256,7 @@ HANDLE JpegToDib(LPVOID lpJpegData, DWORD dwLenData, INT nTraceLevel)
 
 	// Read an existing ICC profile
 	UINT uProfileLen = 0;
-	BOOL bHasProfile = read_icc_profile(pjInfo, &JpegDecompress.lpProfileData, &uProfileLen);
+	BOOL bHasProfile = read_icc_profile(pjInfo, &lpJpegDecompress->lpProfileData, &uProfileLen);
 
 	// In the case of CMYK output, we convert CMYK rudimentarily to RGB and
 	// discard the color profile. In other words: No support for CMYK and YCCK
@@ -130,10 +265,10 @@ HANDLE JpegToDib(LPVOID lpJpegData, DWORD dwLenData, INT nTraceLevel)
 		uProfileLen = 0;
 		bHasProfile = FALSE;
 
-		if (JpegDecompress.lpProfileData != NULL)
+		if (lpJpegDecompress->lpProfileData != NULL)
 		{
-			free(JpegDecompress.lpProfileData);
-			JpegDecompress.lpProfileData = NULL;
+			free(lpJpegDecompress->lpProfileData);
+			lpJpegDecompress->lpProfileData = NULL;
 		}
 
 		// Emit a trace message. The jerror.h file
@@ -142,6 +277,11 @@ HANDLE JpegToDib(LPVOID lpJpegData, DWORD dwLenData, INT nTraceLevel)
 		my_emit_message((j_common_ptr)pjInfo, 1);
 	}
 
+	// The color converter writes 32-bit pixels, there is no expansion pass
+	if ((dwFlags & JPEG_DECODE_BGRX) &&
+		(pjInfo->out_color_space == JCS_RGB || pjInfo->out_color_space == JCS_GRAYSCALE))
+		pjInfo->out_color_space = JCS_EXT_BGRX;
+
 	// Image resolution
 	LONG lXPelsPerMeter = 0;
 	LONG lYPelsPerMeter = 0;
@@ -159,25 +299,84 @@ HANDLE JpegToDib(LPVOID lpJpegData, DWORD dwLenData, INT nTraceLevel)
 		}
 	}
 
-	// Start decompression in the JPEG library
-	jpeg_start_decompress(pjInfo);
+	// Use the smallest scaling factor M/8 (with M = 1...8) that
+	// results in an image that is at least as large as requested
+	if (uMinWidth > 0 && uMinHeight > 0)
+	{
+		UINT uScale = 1;
+		while (uScale < 8 &&
+			((pjInfo->image_width * uScale + 7) / 8 < uMinWidth ||
+			(pjInfo->image_height * uScale + 7) / 8 < uMinHeight))
+			uScale++;
+
+		pjInfo->scale_num = uScale;
+		pjInfo->scale_denom = 8;
+	}
+
+	// Each DC coefficient is the average of an 8x8 block, that is one pixel at the scale 1/8.
+	// The entropy decoder of a sequential image has to decode the AC coefficients anyway, so the
+	// scaled IDCT is faster than buffering all coefficients. Progressive images need the
+	// buffer in any case, but the AC scans, which make up most of the file, can be skipped.
+	BOOL bDcOnly = (dwFlags & JPEG_DECODE_QUALITY) == JPEG_DECODE_DC && pjInfo->progressive_mode &&
+		pjInfo->scale_num == 1 && pjInfo->scale_denom == 8 && can_decode_dc(pjInfo);
+
+	// jpeg_read_header has set the defaults for the exact decoding. The fast IDCT is
+	// only used for 8x8 blocks, other block sizes use the accurate IDCT. With fancy
+	// upsampling, libjpeg decodes subsampled chroma components by a larger IDCT.
+	// Without it, they are decoded as 8x8 blocks and the pixels are replicated.
+	switch (dwFlags & JPEG_DECODE_QUALITY)
+	{
+		case JPEG_DECODE_BALANCED:
+			pjInfo->dct_method = JDCT_IFAST;
+			pjInfo->do_block_smoothing = FALSE;
+			break;
+
+		case JPEG_DECODE_PREVIEW:
+		case JPEG_DECODE_DC:
+			pjInfo->dct_method = JDCT_IFAST;
+			pjInfo->do_fancy_upsampling = FALSE;
+			pjInfo->do_block_smoothing = FALSE;
+			break;
+	}
+
+	// Start decompression in the JPEG library. The DC path only reads the coefficients,
+	// jpeg_calc_output_dimensions determines the size of the scaled image.
+	jvirt_barray_ptr* pCoefArrays = NULL;
+	if (bDcOnly)
+	{
+		skip_ac_scans(pjInfo, (LPCBYTE)lpJpegData, dwLenData);
+		jpeg_calc_output_dimensions(pjInfo);
+		pCoefArrays = jpeg_read_coefficients(pjInfo);
+	}
+	else
+		jpeg_start_decompress(pjInfo);
 
 	// Determine output image format
 	UINT uNumColors = 0;
 	WORD wBitDepth = pjInfo->output_components << 3;
 	if (wBitDepth == 8)
 		uNumColors = pjInfo->out_color_space == JCS_GRAYSCALE ? 256 : pjInfo->actual_number_of_colors;
-	UINT uIncrement = WIDTHBYTES(pjInfo->output_width * wBitDepth);
-	DWORD dwImageSize = uIncrement * pjInfo->output_height;
+	UINT64 ullIncrement = WIDTHBYTES((UINT64)pjInfo->output_width * wBitDepth);
+	UINT64 ullImageSize = ullIncrement * pjInfo->output_height;
 	DWORD dwHeaderSize = bHasProfile ? sizeof(BITMAPV5HEADER) : sizeof(BITMAPINFOHEADER);
-
-	// Allocate memory for the DIB
-	hDib = GlobalAlloc(GHND, dwHeaderSize + uNumColors * sizeof(RGBQUAD) + uProfileLen + dwImageSize);
+	UINT64 ullDibSize = dwHeaderSize + uNumColors * sizeof(RGBQUAD) + uProfileLen + ullImageSize;
+	if (lpStats != NULL)
+		lpStats->cbDib = (SIZE_T)min(ullDibSize, (UINT64)MAXSIZE_T);
+
+	// The size of the bitmap bits must fit into a DWORD and the DIB into the address space
+	BOOL bTooLarge = ullImageSize > MAXDWORD || ullDibSize > MAXSIZE_T;
+	UINT uIncrement = (UINT)ullIncrement;
+	SIZE_T cbDib = (SIZE_T)ullDibSize;
+
+	// Allocate memory for the DIB. Only the header, the color table
+	// and the row padding must be zeroed, the rest is overwritten.
+	hDib = bTooLarge ? NULL : AllocDib(cbDib, FALSE);
 	if (hDib == NULL)
 	{
 		pjInfo->err->msg_code = JWRN_GLOBAL_ALLOC;
 		my_emit_message((j_common_ptr)pjInfo, -1);
-		cleanup_jpeg_to_dib(&JpegDecompress, hDib);
+		cleanup_jpeg_to_dib(lpJpegDecompress, hDib);
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
 		return NULL;
 	}
 
@@ -187,10 +386,12 @@ HANDLE JpegToDib(LPVOID lpJpegData, DWORD dwLenData, INT nTraceLevel)
 	{
 		pjInfo->err->msg_code = JWRN_GLOBAL_LOCK;
 		my_emit_message((j_common_ptr)pjInfo, -1);
-		cleanup_jpeg_to_dib(&JpegDecompress, hDib);
+		cleanup_jpeg_to_dib(lpJpegDecompress, hDib);
 		return NULL;
 	}
 
+	ZeroMemory(lpBIV5, dwHeaderSize + uNumColors * sizeof(RGBQUAD));
+
 	lpBIV5->bV5Size = dwHeaderSize;
 	lpBIV5->bV5Width = pjInfo->output_width;
 	lpBIV5->bV5Height = pjInfo->output_height;
@@ -228,14 +429,14 @@ HANDLE JpegToDib(LPVOID lpJpegData, DWORD dwLenData, INT nTraceLevel)
 	}
 
 	// Embed an existing ICC profile into the DIB
-	if (bHasProfile && JpegDecompress.lpProfileData != NULL)
+	if (bHasProfile && lpJpegDecompress->lpProfileData != NULL)
 	{
 		lpBIV5->bV5CSType = PROFILE_EMBEDDED;
 		lpBIV5->bV5Intent = LCS_GM_IMAGES;
 		lpBIV5->bV5ProfileSize = uProfileLen;
 		lpBIV5->bV5ProfileData = dwHeaderSize + uNumColors * sizeof(RGBQUAD);
 
-		CopyMemory((LPBYTE)lpBIV5 + lpBIV5->bV5ProfileData, JpegDecompress.lpProfileData, uProfileLen);
+		CopyMemory((LPBYTE)lpBIV5 + lpBIV5->bV5ProfileData, lpJpegDecompress->lpProfileData, uProfileLen);
 	}
 
 	// Determine pointer to start of image data
@@ -246,30 +447,40 @@ HANDLE JpegToDib(LPVOID lpJpegData, DWORD dwLenData, INT nTraceLevel)
 	BYTE cKey, cRed, cGreen, cBlue;  // Color components
 	// Consider that Adobe Photoshop writes inverted CMYK data
 	BYTE cInv = pjInfo->saw_Adobe_marker ? 0x00 : 0xFF;
+	// Number of padding bytes at the end of each DIB row
+	UINT uPadding = uIncrement - pjInfo->output_width * pjInfo->output_components;
 
 	// Copy image rows (scanlines). The arrangement of the color
 	// components must be changed in jmorecfg.h from RGB to BGR.
-	while (pjInfo->output_scanline < pjInfo->output_height)
+	if (bDcOnly)
+		copy_dc_coefficients(pjInfo, pCoefArrays, lpDIB, uIncrement);
+	else
 	{
-		uScanline = pjInfo->output_height-1 - pjInfo->output_scanline;
-		lpBits = lpDIB + (UINT_PTR)uScanline * uIncrement;
-		lpScanlines[0] = lpBits;
-
-		// Decompress one line
-		jpeg_read_scanlines(pjInfo, lpScanlines, 1);
-
-		if (pjInfo->out_color_space == JCS_CMYK && pjInfo->output_components == 4)
-		{ // Convert from CMYK to RGB
-			for (UINT u = 0; u < (pjInfo->output_width * 4); u += 4)
-			{
-				cKey   = lpBits[u + 3] ^ cInv;
-				cBlue  = Mul8Bit(lpBits[u + 2] ^ cInv, cKey);
-				cGreen = Mul8Bit(lpBits[u + 1] ^ cInv, cKey);
-				cRed   = Mul8Bit(lpBits[u + 0] ^ cInv, cKey);
-				lpBits[u + 0] = cBlue;
-				lpBits[u + 1] = cGreen;
-				lpBits[u + 2] = cRed;
-				lpBits[u + 3] = 0xFF;
+		while (pjInfo->output_scanline < pjInfo->output_height)
+		{
+			uScanline = pjInfo->output_height-1 - pjInfo->output_scanline;
+			lpBits = lpDIB + (UINT_PTR)uScanline * uIncrement;
+			lpScanlines[0] = lpBits;
+
+			// Decompress one line
+			jpeg_read_scanlines(pjInfo, lpScanlines, 1);
+
+			if (uPadding > 0)
+				ZeroMemory(lpBits + (uIncrement - uPadding), uPadding);
+
+			if (pjInfo->out_color_space == JCS_CMYK && pjInfo->output_components == 4)
+			{ // Convert from CMYK to RGB
+				for (UINT u = 0; u < (pjInfo->output_width * 4); u += 4)
+				{
+					cKey   = lpBits[u + 3] ^ cInv;
+					cBlue  = Mul8Bit(lpBits[u + 2] ^ cInv, cKey);
+					cGreen = Mul8Bit(lpBits[u + 1] ^ cInv, cKey);
+					cRed   = Mul8Bit(lpBits[u + 0] ^ cInv, cKey);
+					lpBits[u + 0] = cBlue;
+					lpBits[u + 1] = cGreen;
+					lpBits[u + 2] = cRed;
+					lpBits[u + 3] = 0xFF;
+				}
 			}
 		}
 	}
@@ -279,8 +490,243 @@ HANDLE JpegToDib(LPVOID lpJpegData, DWORD dwLenData, INT nTraceLevel)
 	jpeg_finish_decompress(pjInfo);
 
 	// Free all requested memory, but keep the DIB we just created
-	cleanup_jpeg_to_dib(&JpegDecompress, NULL);
-	JpegDecompress.bNeedDestroy = FALSE;
+	cleanup_jpeg_to_dib(lpJpegDecompress, NULL);
+
+	return hDib;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL DibToJpeg(LPCTSTR lpszFileName, HANDLE hDib, INT nQuality, BOOL bOptimizeCoding)
+{
+	if (lpszFileName == NULL || hDib == NULL)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	// Initialize the JPEG compression object
+	JPEG_COMPRESS JpegCompress = { {0} };
+	j_compress_ptr pjInfo = &JpegCompress.jInfo;
+	JpegCompress.hFile = INVALID_HANDLE_VALUE;
+
+	SIZE_T cbDibSize = GlobalSize(hDib);
+	LPCSTR lpbi = (LPCSTR)GlobalLock(hDib);
+	if (lpbi == NULL)
+		return FALSE;
+	JpegCompress.hDib = hDib;
+
+	// The color profile of a CMYK DIB doesn't match the RGB data
+	LPBYTE lpProfileData = NULL;
+	UINT uProfileLen = 0;
+	if (DibHasEmbeddedProfile(lpbi) && !DibIsCMYK(lpbi))
+	{
+		LPBITMAPV5HEADER lpbiv5 = (LPBITMAPV5HEADER)lpbi;
+		if (lpbiv5->bV5ProfileData < cbDibSize && lpbiv5->bV5ProfileSize <= cbDibSize - lpbiv5->bV5ProfileData)
+		{
+			lpProfileData = (LPBYTE)lpbi + lpbiv5->bV5ProfileData;
+			uProfileLen = lpbiv5->bV5ProfileSize;
+		}
+	}
+
+	JpegCompress.lpFormat = (LPDIB_FORMAT)MyGlobalAllocPtr(GHND, sizeof(DIB_FORMAT));
+	if (JpegCompress.lpFormat == NULL)
+	{
+		cleanup_dib_to_jpeg(&JpegCompress, NULL, FALSE);
+		return FALSE;
+	}
+
+	// Compressed DIBs are decompressed to 24 bpp first
+	if (!GetDibFormat(lpbi, JpegCompress.lpFormat))
+	{
+		JpegCompress.hDibTemp = ChangeDibBitDepth(hDib, 24);
+		if (JpegCompress.hDibTemp == NULL)
+		{
+			cleanup_dib_to_jpeg(&JpegCompress, NULL, FALSE);
+			return FALSE;
+		}
+
+		cbDibSize = GlobalSize(JpegCompress.hDibTemp);
+		lpbi = (LPCSTR)GlobalLock(JpegCompress.hDibTemp);
+		if (lpbi == NULL || !GetDibFormat(lpbi, JpegCompress.lpFormat))
+		{
+			cleanup_dib_to_jpeg(&JpegCompress, NULL, FALSE);
+			return FALSE;
+		}
+	}
+
+	LPCDIB_FORMAT lpFormat = JpegCompress.lpFormat;
+	UINT uWidth = (UINT)abs(lpFormat->lWidth);
+	UINT uHeight = (UINT)abs(lpFormat->lHeight);
+	if (uWidth > JPEG_MAX_DIMENSION || uHeight > JPEG_MAX_DIMENSION)
+	{
+		SetLastError(ERROR_NOT_SUPPORTED);
+		cleanup_dib_to_jpeg(&JpegCompress, NULL, FALSE);
+		return FALSE;
+	}
+
+	// Missing scanlines of a truncated DIB are written as black lines
+	LPBYTE lpBits = FindDibBits(lpbi);
+	SIZE_T cbOffBits = (SIZE_T)(lpBits - (LPBYTE)lpbi);
+	UINT uSrcRows = cbDibSize > cbOffBits ?
+		(UINT)min((cbDibSize - cbOffBits) / lpFormat->ulIncrement, (SIZE_T)uHeight) : 0;
+
+	// DIBs with a gray color table are stored as grayscale JPEG. 24-bpp DIBs and 8-bpp DIBs
+	// with a gray ramp are passed to libjpeg without copying (BGR order, see jmorecfg.h).
+	BOOL bGrayscale = lpFormat->wBitCount <= 8;
+	BOOL bDirect = lpFormat->wBitCount == 24 || lpFormat->wBitCount == 8;
+	for (UINT u = 0; bGrayscale && u < (1U << lpFormat->wBitCount); u++)
+	{
+		DWORD dwColor = lpFormat->adwLut[u];
+		bGrayscale = (BYTE)dwColor == (BYTE)(dwColor >> 8) && (BYTE)dwColor == (BYTE)(dwColor >> 16);
+		if ((BYTE)dwColor != u)
+			bDirect = FALSE;
+	}
+	if (lpFormat->wBitCount == 8 && !bGrayscale)
+		bDirect = FALSE;
+
+	JpegCompress.lpRow = (LPBYTE)MyGlobalAllocPtr(GHND, (SIZE_T)uWidth * sizeof(DWORD));
+	if (JpegCompress.lpRow == NULL)
+	{
+		cleanup_dib_to_jpeg(&JpegCompress, NULL, FALSE);
+		return FALSE;
+	}
+
+	JpegCompress.hFile = CreateFile(lpszFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (JpegCompress.hFile == INVALID_HANDLE_VALUE)
+	{
+		cleanup_dib_to_jpeg(&JpegCompress, NULL, FALSE);
+		return FALSE;
+	}
+
+	set_error_manager((j_common_ptr)pjInfo, &JpegCompress.jError, 0, &JpegCompress.bNeedDestroy);
+
+	// Save processor status for error handling
+	if (setjmp(JpegCompress.jError.JmpBuffer))
+	{
+		cleanup_dib_to_jpeg(&JpegCompress, lpszFileName, FALSE);
+		SetLastError(JpegCompress.jError.dwError);
+		return FALSE;
+	}
+
+	jpeg_create_compress(pjInfo);
+	JpegCompress.bNeedDestroy = TRUE;
+
+	// Determine data destination
+	JpegCompress.jDest.init_destination = my_init_destination;
+	JpegCompress.jDest.empty_output_buffer = my_empty_output_buffer;
+	JpegCompress.jDest.term_destination = my_term_destination;
+	pjInfo->dest = &JpegCompress.jDest;
+
+	// Describe the input image
+	pjInfo->image_width = uWidth;
+	pjInfo->image_height = uHeight;
+	pjInfo->input_components = bGrayscale ? 1 : 3;
+	pjInfo->in_color_space = bGrayscale ? JCS_GRAYSCALE : JCS_RGB;
+	jpeg_set_defaults(pjInfo);
+	jpeg_set_quality(pjInfo, nQuality, TRUE);
+	pjInfo->optimize_coding = bOptimizeCoding ? TRUE : FALSE;
+
+	// Image resolution in pixels per inch (not present in short OS/2 2.0 headers)
+	if (*(LPDWORD)lpbi >= FIELD_OFFSET(BITMAPINFOHEADER, biClrUsed))
+	{
+		LONG lXPelsPerMeter = ((LPBITMAPINFOHEADER)lpbi)->biXPelsPerMeter;
+		LONG lYPelsPerMeter = ((LPBITMAPINFOHEADER)lpbi)->biYPelsPerMeter;
+		if (lXPelsPerMeter > 0 && lYPelsPerMeter > 0 &&
+			lXPelsPerMeter < 0x7FFFFFFF / 127 && lYPelsPerMeter < 0x7FFFFFFF / 127)
+		{
+			pjInfo->density_unit = 1;
+			pjInfo->X_density = (UINT16)min((lXPelsPerMeter * 127 + 2500) / 5000, 0xFFFF);
+			pjInfo->Y_density = (UINT16)min((lYPelsPerMeter * 127 + 2500) / 5000, 0xFFFF);
+		}
+	}
+
+	// Start compression in the JPEG library
+	jpeg_start_compress(pjInfo, TRUE);
+
+	// Embed the ICC profile of the DIB
+	if (lpProfileData != NULL)
+		write_icc_profile(pjInfo, lpProfileData, uProfileLen);
+
+	LPBYTE lpRow = JpegCompress.lpRow;
+	JSAMPROW lpScanlines[1] = { 0 }; // Pointer to a scanline
+	UINT uScanline = 0;              // Row index
+
+	// Write the image rows from top to bottom
+	while (pjInfo->next_scanline < pjInfo->image_height)
+	{
+		uScanline = lpFormat->lHeight > 0 ? uHeight - 1 - pjInfo->next_scanline : pjInfo->next_scanline;
+		LPBYTE lpSrc = lpBits + (UINT_PTR)uScanline * lpFormat->ulIncrement;
+
+		if (uScanline >= uSrcRows)
+		{
+			ZeroMemory(lpRow, (SIZE_T)uWidth * 3);
+			lpScanlines[0] = lpRow;
+		}
+		else if (bDirect)
+			lpScanlines[0] = lpSrc;
+		else
+		{ // Convert into BGRA and pack the color components in place
+			LPDWORD lpdwRow = (LPDWORD)lpRow;
+			ConvertDibRow(lpFormat, lpSrc, lpdwRow);
+
+			LPBYTE lpDest = lpRow;
+			for (UINT u = 0; u < uWidth; u++)
+			{
+				DWORD dwColor = lpdwRow[u];
+				*lpDest++ = (BYTE)dwColor;
+				if (!bGrayscale)
+				{
+					*lpDest++ = (BYTE)(dwColor >> 8);
+					*lpDest++ = (BYTE)(dwColor >> 16);
+				}
+			}
+			lpScanlines[0] = lpRow;
+		}
+
+		// Compress one line
+		jpeg_write_scanlines(pjInfo, lpScanlines, 1);
+	}
+
+	// Finish compression
+	jpeg_finish_compress(pjInfo);
+
+	cleanup_dib_to_jpeg(&JpegCompress, lpszFileName, TRUE);
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE TransformJpeg(LPVOID lpJpegData, DWORD dwLenData, DWORD dwTransform, LPCRECT lprcCrop, LPDWORD lpdwLenJpeg)
+{
+	return transform_jpeg(lpJpegData, dwLenData, dwTransform, lprcCrop, FALSE, lpdwLenJpeg);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE TransformJpegToDib(LPVOID lpJpegData, DWORD dwLenData, DWORD dwTransform, LPCRECT lprcCrop,
+	UINT uMinWidth, UINT uMinHeight, DWORD dwFlags)
+{
+	// The intermediate JPEG image still contains the original DCT coefficients
+	DWORD dwLenJpeg = 0;
+	HANDLE hJpeg = transform_jpeg(lpJpegData, dwLenData, dwTransform, lprcCrop, TRUE, &dwLenJpeg);
+	if (hJpeg == NULL)
+		return NULL;
+
+	HANDLE hDib = NULL;
+	LPVOID lpJpeg = GlobalLock(hJpeg);
+	if (lpJpeg != NULL)
+	{
+		hDib = JpegToDib(lpJpeg, dwLenJpeg, 0, uMinWidth, uMinHeight, dwFlags);
+		GlobalUnlock(hJpeg);
+	}
+
+	// Keep the error code of JpegToDib
+	DWORD dwError = GetLastError();
+	GlobalFree(hJpeg);
+	SetLastError(dwError);
 
 	return hDib;
 }
@@ -291,6 +737,10 @@ void cleanup_jpeg_to_dib(LPJPEG_DECOMPRESS lpJpegDecompress, HANDLE hDib)
 {
 	if (lpJpegDecompress != NULL)
 	{
+		// After a fatal error, my_error_exit has already saved the statistics
+		if (lpJpegDecompress->bNeedDestroy)
+			save_decode_stats((j_common_ptr)&lpJpegDecompress->jInfo);
+
 		// Release the ICC profile data
 		if (lpJpegDecompress->lpProfileData != NULL)
 		{
@@ -298,26 +748,573 @@ void cleanup_jpeg_to_dib(LPJPEG_DECOMPRESS lpJpegDecompress, HANDLE hDib)
 			lpJpegDecompress->lpProfileData = NULL;
 		}
 
-		// Destroy the JPEG decompress object
-		if (lpJpegDecompress->bNeedDestroy)
-			jpeg_destroy_decompress(&lpJpegDecompress->jInfo);
+		// Return the JPEG decompress object to the pool
+		release_decompress_object(lpJpegDecompress);
 	}
 
 	// Release the DIB
 	if (hDib != NULL)
 	{
 		GlobalUnlock(hDib);
-		GlobalFree(hDib);
+		FreeDib(hDib);
 		hDib = NULL;
 	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-void set_error_manager(j_common_ptr pjInfo, j_error_mgr* pjError)
+HANDLE exif_thumbnail_to_dib(LPCBYTE lpJpegData, DWORD dwLenData, INT nTraceLevel, UINT uMinWidth, UINT uMinHeight, DWORD dwFlags, LPJPEG_DECODE_STATS lpStats)
+{
+	EXIF_DATA exif;
+	LPCBYTE lpThumb = NULL;
+	DWORD cbThumb = 0;
+	UINT uWidth = 0, uHeight = 0;
+	UINT uThumbWidth = 0, uThumbHeight = 0;
+
+	// Only the markers in front of the frame headers are read
+	if (!FindExifData(lpJpegData, dwLenData, &exif) ||
+		!GetExifThumbnail(&exif, &lpThumb, &cbThumb) ||
+		!GetJpegDimensions(lpThumb, cbThumb, &uThumbWidth, &uThumbHeight) ||
+		!GetJpegDimensions(lpJpegData, dwLenData, &uWidth, &uHeight))
+		return NULL;
+
+	if (uThumbWidth < uMinWidth || uThumbHeight < uMinHeight)
+		return NULL;
+
+	// Cameras often store a 160 x 120 thumbnail with black bars
+	// for other aspect ratios. A deviation of 2% is tolerated.
+	ULONGLONG ullThumb = (ULONGLONG)uThumbWidth * uHeight;
+	ULONGLONG ullImage = (ULONGLONG)uWidth * uThumbHeight;
+	ULONGLONG ullDiff = ullThumb > ullImage ? ullThumb - ullImage : ullImage - ullThumb;
+	if (ullDiff * 50 > max(ullThumb, ullImage))
+		return NULL;
+
+	return JpegToDib((LPVOID)lpThumb, cbThumb, nTraceLevel, uMinWidth, uMinHeight, dwFlags, lpStats);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL can_decode_dc(j_decompress_ptr pjInfo)
+{
+	// Only 8x8 blocks with 8-bit samples
+	if (pjInfo->block_size != DCTSIZE || pjInfo->data_precision != BITS_IN_JSAMPLE)
+		return FALSE;
+
+	// CMYK, YCCK and the color transform of libjpeg 9 are left to the color converter
+	switch (pjInfo->jpeg_color_space)
+	{
+		case JCS_GRAYSCALE:
+			return pjInfo->num_components == 1 &&
+				(pjInfo->out_color_space == JCS_GRAYSCALE || pjInfo->out_color_space == JCS_EXT_BGRX);
+
+		case JCS_YCbCr:
+		case JCS_RGB:
+			return pjInfo->num_components == 3 && pjInfo->color_transform == JCT_NONE &&
+				(pjInfo->out_color_space == JCS_RGB || pjInfo->out_color_space == JCS_EXT_BGRX);
+	}
+
+	return FALSE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void skip_ac_scans(j_decompress_ptr pjInfo, LPCBYTE lpJpegData, DWORD dwLenData)
+{
+	// Only the markers and the entropy-coded data of the DC scans are examined
+	DC_SCAN_INFO dcs = { (UINT)pjInfo->num_components, 0, 0 };
+	ScanJpegMarkers(lpJpegData, dwLenData, find_first_ac_scan, &dcs);
+
+	// jpeg_read_header has stopped behind the header of the first scan
+	LPCBYTE lpAcScan = lpJpegData + dcs.dwAcScan;
+	if (dcs.dwAcScan == 0 || lpAcScan < pjInfo->src->next_input_byte ||
+		lpAcScan > pjInfo->src->next_input_byte + pjInfo->src->bytes_in_buffer)
+		return;
+
+	// The missing AC coefficients remain 0, since progressive coefficient buffers are zeroed
+	pjInfo->src->bytes_in_buffer = (size_t)(lpAcScan - pjInfo->src->next_input_byte);
+	pjInfo->src->fill_input_buffer = my_fill_input_eoi;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CALLBACK find_first_ac_scan(LPCJPEG_SEGMENT lpSegment, LPVOID lpParam)
+{
+	if (lpSegment->bMarker == JPEG_EOI)
+		return FALSE;
+	if (lpSegment->bMarker != JPEG_SOS)
+		return TRUE;
+
+	// Ns, Ns component selectors with table numbers, Ss, Se, Ah and Al
+	LPDC_SCAN_INFO lpdcs = (LPDC_SCAN_INFO)lpParam;
+	LPCBYTE lpData = lpSegment->lpData;
+	if (lpSegment->cbData < 1 || lpSegment->cbData < 4 + 2 * (DWORD)lpData[0])
+		return FALSE;
+
+	UINT uNs = lpData[0];
+	BYTE bSs = lpData[1 + 2 * uNs];
+	BYTE bSe = lpData[2 + 2 * uNs];
+	BYTE bAh = lpData[3 + 2 * uNs] >> 4;
+
+	// A first DC scan, later refinement scans only improve the precision
+	if (bSs == 0 && bSe == 0)
+	{
+		if (bAh == 0)
+			lpdcs->uDcComponents += uNs;
+		return TRUE;
+	}
+
+	// All DC coefficients must be known before the first AC scan
+	if (lpdcs->uDcComponents >= lpdcs->uComponents)
+		lpdcs->dwAcScan = lpSegment->dwOffset;
+
+	return FALSE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void copy_dc_coefficients(j_decompress_ptr pjInfo, jvirt_barray_ptr* pCoefArrays, LPBYTE lpDIB, UINT uIncrement)
+{
+	JBLOCKROW apBlocks[3] = { NULL };
+	INT anQuant[3] = { 0 };
+	INT anSample[3] = { 0 };
+
+	// Components that did not appear in a scan of a truncated image stay gray
+	int nComponents = pjInfo->num_components;
+	for (int c = 0; c < nComponents; c++)
+	{
+		JQUANT_TBL* pQuantTable = pjInfo->comp_info[c].quant_table;
+		anQuant[c] = pQuantTable != NULL ? pQuantTable->quantval[0] : 0;
+	}
+
+	BOOL bYCbCr = pjInfo->jpeg_color_space == JCS_YCbCr;
+	UINT uPixelSize = pjInfo->output_components;
+	UINT uPadding = uIncrement - pjInfo->output_width * uPixelSize;
+
+	for (JDIMENSION uRow = 0; uRow < pjInfo->output_height; uRow++)
+	{
+		// Subsampled components cover several rows and columns
+		for (int c = 0; c < nComponents; c++)
+		{
+			JDIMENSION uBlockRow = uRow * pjInfo->comp_info[c].v_samp_factor / pjInfo->max_v_samp_factor;
+			apBlocks[c] = (*pjInfo->mem->access_virt_barray)((j_common_ptr)pjInfo, pCoefArrays[c], uBlockRow, 1, FALSE)[0];
+		}
+
+		LPBYTE lpBits = lpDIB + (UINT_PTR)(pjInfo->output_height - 1 - uRow) * uIncrement;
+		for (JDIMENSION uCol = 0; uCol < pjInfo->output_width; uCol++)
+		{
+			// Dequantize and descale like the 1x1 IDCT of libjpeg
+			for (int c = 0; c < nComponents; c++)
+			{
+				JDIMENSION uBlock = uCol * pjInfo->comp_info[c].h_samp_factor / pjInfo->max_h_samp_factor;
+				INT nSample = ((apBlocks[c][uBlock][0] * anQuant[c] + 4) >> 3) + CENTERJSAMPLE;
+				anSample[c] = min(max(nSample, 0), MAXJSAMPLE);
+			}
+
+			if (nComponents == 1)
+				anSample[1] = anSample[2] = anSample[0];
+			else if (bYCbCr)
+			{ // Same fixed-point arithmetic as ycc_rgb_convert in jdcolor.c
+				INT nY = anSample[0], nCb = anSample[1] - CENTERJSAMPLE, nCr = anSample[2] - CENTERJSAMPLE;
+				anSample[0] = nY + ((91881 * nCr + 32768) >> 16);
+				anSample[1] = nY + ((-22554 * nCb - 46802 * nCr + 32768) >> 16);
+				anSample[2] = nY + ((116130 * nCb + 32768) >> 16);
+				for (int c = 0; c < 3; c++)
+					anSample[c] = min(max(anSample[c], 0), MAXJSAMPLE);
+			}
+
+			// Same pixel layout as the color converter (BGR or BGRX)
+			if (uPixelSize == 1)
+				*lpBits++ = (BYTE)anSample[0];
+			else
+			{
+				lpBits[0] = (BYTE)anSample[2];
+				lpBits[1] = (BYTE)anSample[1];
+				lpBits[2] = (BYTE)anSample[0];
+				if (uPixelSize == 4)
+					lpBits[3] = 0xFF;
+				lpBits += uPixelSize;
+			}
+		}
+
+		if (uPadding > 0)
+			ZeroMemory(lpBits, uPadding);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void save_decode_stats(j_common_ptr pjInfo)
+{
+	LPJPEG_ERROR_MGR lpError = (LPJPEG_ERROR_MGR)pjInfo->err;
+	if (lpError == NULL || lpError->lpStats == NULL || pjInfo->mem == NULL)
+		return;
+
+	LPJPEG_DECODE_STATS lpStats = lpError->lpStats;
+	lpStats->cbPeakPools = pjInfo->mem->peak_space_allocated;
+	lpStats->uSmallPools = (UINT)pjInfo->mem->small_pools_allocated;
+	lpStats->uLargePools = (UINT)pjInfo->mem->large_pools_allocated;
+	lpStats->cbVirtArrays = pjInfo->mem->virt_space_requested;
+	lpStats->cbBackingStore = pjInfo->mem->backing_store_space;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+LPJPEG_DECOMPRESS get_decompress_object()
+{
+	LPJPEG_DECOMPRESS lpJpegDecompress = NULL;
+
+	AcquireSRWLockExclusive(&g_srwJpegPool);
+
+	for (int i = 0; i < JPEGPOOL_SLOTS; i++)
+	{
+		if (g_alpJpegPool[i] != NULL)
+		{
+			lpJpegDecompress = g_alpJpegPool[i];
+			g_alpJpegPool[i] = NULL;
+			break;
+		}
+	}
+
+	ReleaseSRWLockExclusive(&g_srwJpegPool);
+
+	// A new object is created by JpegToDib (bNeedDestroy is FALSE)
+	if (lpJpegDecompress == NULL)
+		lpJpegDecompress = (LPJPEG_DECOMPRESS)MyGlobalAllocPtr(GHND, sizeof(JPEG_DECOMPRESS));
+
+	return lpJpegDecompress;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void release_decompress_object(LPJPEG_DECOMPRESS lpJpegDecompress)
+{
+	if (lpJpegDecompress == NULL)
+		return;
+
+	// Release the image memory, but keep the permanent memory. After a fatal
+	// error, my_error_exit has already destroyed the libjpeg part of the object.
+	if (lpJpegDecompress->bNeedDestroy)
+	{
+		j_decompress* pjInfo = &lpJpegDecompress->jInfo;
+		jpeg_abort_decompress(pjInfo);
+
+		// An abbreviated image without DQT or DHT markers must not be decoded
+		// with the tables of the image previously decoded with this object
+		for (int i = 0; i < NUM_QUANT_TBLS; i++)
+			pjInfo->quant_tbl_ptrs[i] = NULL;
+
+		for (int i = 0; i < NUM_HUFF_TBLS; i++)
+		{
+			pjInfo->dc_huff_tbl_ptrs[i] = NULL;
+			pjInfo->ac_huff_tbl_ptrs[i] = NULL;
+		}
+	}
+
+	if (++lpJpegDecompress->uUses < JPEGPOOL_MAX_USES)
+	{
+		AcquireSRWLockExclusive(&g_srwJpegPool);
+
+		for (int i = 0; i < JPEGPOOL_SLOTS; i++)
+		{
+			if (g_alpJpegPool[i] == NULL)
+			{
+				g_alpJpegPool[i] = lpJpegDecompress;
+				lpJpegDecompress = NULL;
+				break;
+			}
+		}
+
+		ReleaseSRWLockExclusive(&g_srwJpegPool);
+	}
+
+	// The pool is full or the object has been used too often
+	if (lpJpegDecompress != NULL)
+	{
+		if (lpJpegDecompress->bNeedDestroy)
+			jpeg_destroy_decompress(&lpJpegDecompress->jInfo);
+		MyGlobalFreePtr(lpJpegDecompress);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FlushJpegPool()
+{
+	AcquireSRWLockExclusive(&g_srwJpegPool);
+
+	for (int i = 0; i < JPEGPOOL_SLOTS; i++)
+	{
+		if (g_alpJpegPool[i] != NULL)
+		{
+			if (g_alpJpegPool[i]->bNeedDestroy)
+				jpeg_destroy_decompress(&g_alpJpegPool[i]->jInfo);
+			MyGlobalFreePtr(g_alpJpegPool[i]);
+		}
+
+		g_alpJpegPool[i] = NULL;
+	}
+
+	ReleaseSRWLockExclusive(&g_srwJpegPool);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void cleanup_dib_to_jpeg(LPJPEG_COMPRESS lpJpegCompress, LPCTSTR lpszFileName, BOOL bSuccess)
+{
+	if (lpJpegCompress == NULL)
+		return;
+
+	// Destroy the JPEG compress object
+	if (lpJpegCompress->bNeedDestroy)
+	{
+		jpeg_destroy_compress(&lpJpegCompress->jInfo);
+		lpJpegCompress->bNeedDestroy = FALSE;
+	}
+
+	// Close the output file and delete an incomplete file
+	if (lpJpegCompress->hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(lpJpegCompress->hFile);
+		lpJpegCompress->hFile = INVALID_HANDLE_VALUE;
+		if (!bSuccess && lpszFileName != NULL)
+			DeleteFile(lpszFileName);
+	}
+
+	if (lpJpegCompress->lpRow != NULL)
+	{
+		MyGlobalFreePtr(lpJpegCompress->lpRow);
+		lpJpegCompress->lpRow = NULL;
+	}
+
+	if (lpJpegCompress->lpFormat != NULL)
+	{
+		MyGlobalFreePtr(lpJpegCompress->lpFormat);
+		lpJpegCompress->lpFormat = NULL;
+	}
+
+	// Release the decompressed copy and unlock the source DIB
+	if (lpJpegCompress->hDibTemp != NULL)
+	{
+		GlobalUnlock(lpJpegCompress->hDibTemp);
+		lpJpegCompress->hDibTemp = FreeDib(lpJpegCompress->hDibTemp);
+	}
+
+	if (lpJpegCompress->hDib != NULL)
+	{
+		GlobalUnlock(lpJpegCompress->hDib);
+		lpJpegCompress->hDib = NULL;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE transform_jpeg(LPVOID lpJpegData, DWORD dwLenData, DWORD dwTransform, LPCRECT lprcCrop, BOOL bIntermediate, LPDWORD lpdwLenJpeg)
+{
+	// Transformation codes of transupp.c for JPEG_XFORM_NONE to JPEG_XFORM_WIPE
+	static const JXFORM_CODE ajxTransforms[] =
+	{
+		JXFORM_NONE, JXFORM_FLIP_H, JXFORM_FLIP_V, JXFORM_TRANSPOSE, JXFORM_TRANSVERSE,
+		JXFORM_ROT_90, JXFORM_ROT_180, JXFORM_ROT_270, JXFORM_WIPE
+	};
+
+	// Transformations that display the Exif orientations 1 to 8 upright
+	static const JXFORM_CODE ajxExifTransforms[] =
+	{
+		JXFORM_NONE, JXFORM_NONE, JXFORM_FLIP_H, JXFORM_ROT_180, JXFORM_FLIP_V,
+		JXFORM_TRANSPOSE, JXFORM_ROT_90, JXFORM_TRANSVERSE, JXFORM_ROT_270
+	};
+
+	// Wiping requires a rectangle
+	UINT uTransform = dwTransform & JPEG_XFORM_MASK;
+	if (lpJpegData == NULL || dwLenData == 0 || lpdwLenJpeg == NULL || uTransform > JPEG_XFORM_EXIF ||
+		(dwTransform & ~(JPEG_XFORM_MASK | JPEG_XFORM_TRIM | JPEG_XFORM_PERFECT | JPEG_XFORM_GRAYSCALE)) != 0 ||
+		(uTransform == JPEG_XFORM_WIPE && lprcCrop == NULL) ||
+		(lprcCrop != NULL && (lprcCrop->left < 0 || lprcCrop->top < 0 ||
+		lprcCrop->right <= lprcCrop->left || lprcCrop->bottom <= lprcCrop->top)))
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+
+	*lpdwLenJpeg = 0;
+
+	// The orientation is read from the Exif data in front of the first frame
+	UINT uOrientation = 1;
+	if (uTransform == JPEG_XFORM_EXIF)
+	{
+		EXIF_DATA exif;
+		if (!FindExifData((LPCBYTE)lpJpegData, dwLenData, &exif) ||
+			!GetExifOrientation(&exif, &uOrientation, NULL))
+			uOrientation = 1;
+	}
+
+	// Describe the transformation
+	jpeg_transform_info jxInfo;
+	ZeroMemory(&jxInfo, sizeof(jxInfo));
+	jxInfo.transform = uTransform == JPEG_XFORM_EXIF ? ajxExifTransforms[uOrientation] : ajxTransforms[uTransform];
+	jxInfo.trim = (dwTransform & JPEG_XFORM_TRIM) ? TRUE : FALSE;
+	jxInfo.perfect = (dwTransform & JPEG_XFORM_PERFECT) ? TRUE : FALSE;
+	jxInfo.force_grayscale = (dwTransform & JPEG_XFORM_GRAYSCALE) ? TRUE : FALSE;
+
+	// The rectangle refers to the transformed image. A wiped rectangle refers to the source image.
+	if (lprcCrop != NULL)
+	{
+		jxInfo.crop = TRUE;
+		jxInfo.crop_xoffset = (JDIMENSION)lprcCrop->left;
+		jxInfo.crop_xoffset_set = JCROP_POS;
+		jxInfo.crop_yoffset = (JDIMENSION)lprcCrop->top;
+		jxInfo.crop_yoffset_set = JCROP_POS;
+		jxInfo.crop_width = (JDIMENSION)(lprcCrop->right - lprcCrop->left);
+		jxInfo.crop_width_set = JCROP_POS;
+		jxInfo.crop_height = (JDIMENSION)(lprcCrop->bottom - lprcCrop->top);
+		jxInfo.crop_height_set = JCROP_POS;
+	}
+
+	// Initialize the JPEG objects
+	JPEG_TRANSFORM JpegTransform = { {0} };
+	j_compress_ptr pjDstInfo = &JpegTransform.jDstInfo;
+	j_decompress_ptr pjSrcInfo = &JpegTransform.jSrcInfo;
+
+	// my_error_exit only destroys the object that failed, the other one is destroyed by the cleanup
+	set_error_manager((j_common_ptr)pjSrcInfo, &JpegTransform.jError, 0, NULL);
+	pjDstInfo->err = pjSrcInfo->err;
+
+	// Save processor status for error handling
+	if (setjmp(JpegTransform.jError.JmpBuffer))
+	{
+		cleanup_transform_jpeg(&JpegTransform);
+		SetLastError(JpegTransform.jError.dwError);
+		return NULL;
+	}
+
+	jpeg_create_decompress(pjSrcInfo);
+	jpeg_create_compress(pjDstInfo);
+
+	// Specify data source
+	jpeg_mem_src(pjSrcInfo, (LPBYTE)lpJpegData, dwLenData);
+
+	// The decoder of the intermediate image only evaluates the ICC profile
+	if (bIntermediate)
+		setup_read_icc_profile(pjSrcInfo);
+	else
+		jcopy_markers_setup(pjSrcInfo, JCOPYOPT_ALL);
+
+	jpeg_read_header(pjSrcInfo, TRUE);
+
+	// Fails if JPEG_XFORM_PERFECT is set and the transformation is not perfect
+	if (!jtransform_request_workspace(pjSrcInfo, &jxInfo))
+	{
+		cleanup_transform_jpeg(&JpegTransform);
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return NULL;
+	}
+
+	// Read the DCT coefficients and set the parameters of the transformed image
+	jvirt_barray_ptr* pSrcCoefArrays = jpeg_read_coefficients(pjSrcInfo);
+	jpeg_copy_critical_parameters(pjSrcInfo, pjDstInfo);
+	jvirt_barray_ptr* pDstCoefArrays = jtransform_adjust_parameters(pjSrcInfo, pjDstInfo, pSrcCoefArrays, &jxInfo);
+
+	// The new file keeps the entropy coding and the progressive mode. The intermediate
+	// image is written as baseline JPEG with the standard Huffman tables to save time.
+	if (!bIntermediate)
+	{
+		if (pjSrcInfo->arith_code)
+			pjDstInfo->arith_code = TRUE;
+		pjDstInfo->optimize_coding = !pjDstInfo->arith_code;
+		if (pjSrcInfo->progressive_mode)
+			jpeg_simple_progression(pjDstInfo);
+	}
+
+	// The image is now upright
+	if (uOrientation != 1)
+		reset_exif_orientation(pjSrcInfo);
+
+	// Determine data destination
+	JpegTransform.cbOutput = min((SIZE_T)dwLenData + OUTPUT_BUF_SIZE, (SIZE_T)MAXDWORD);
+	JpegTransform.jDest.init_destination = my_init_memory_destination;
+	JpegTransform.jDest.empty_output_buffer = my_empty_memory_buffer;
+	JpegTransform.jDest.term_destination = my_term_memory_destination;
+	pjDstInfo->dest = &JpegTransform.jDest;
+
+	// Write the transformed coefficients and the saved markers
+	jpeg_write_coefficients(pjDstInfo, pDstCoefArrays);
+	jcopy_markers_execute(pjSrcInfo, pjDstInfo, JCOPYOPT_ALL);
+	jtransform_execute_transform(pjSrcInfo, pjDstInfo, pSrcCoefArrays, &jxInfo);
+
+	// Finish compression and decompression
+	jpeg_finish_compress(pjDstInfo);
+	jpeg_finish_decompress(pjSrcInfo);
+
+	// Copy the new JPEG file into a global memory object
+	HANDLE hJpeg = GlobalAlloc(GMEM_MOVEABLE, JpegTransform.cbJpeg);
+	LPVOID lpJpeg = hJpeg != NULL ? GlobalLock(hJpeg) : NULL;
+	if (lpJpeg == NULL)
+	{
+		if (hJpeg != NULL)
+			GlobalFree(hJpeg);
+		cleanup_transform_jpeg(&JpegTransform);
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+
+	CopyMemory(lpJpeg, JpegTransform.lpOutput, JpegTransform.cbJpeg);
+	GlobalUnlock(hJpeg);
+	*lpdwLenJpeg = (DWORD)JpegTransform.cbJpeg;
+
+	cleanup_transform_jpeg(&JpegTransform);
+
+	return hJpeg;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void reset_exif_orientation(j_decompress_ptr pjInfo)
+{
+	// Only the first Exif segment is evaluated, like in FindExifData
+	for (jpeg_saved_marker_ptr pMarker = pjInfo->marker_list; pMarker != NULL; pMarker = pMarker->next)
+	{
+		EXIF_DATA exif;
+		if (pMarker->marker != JPEG_APP0 + 1 || !InitExifData(pMarker->data, pMarker->data_length, &exif))
+			continue;
+
+		// The SHORT value is stored in the byte order of the TIFF structure
+		UINT uOrientation = 0;
+		LPCBYTE lpValue = NULL;
+		if (GetExifOrientation(&exif, &uOrientation, &lpValue))
+		{
+			LPBYTE lpOrientation = (LPBYTE)lpValue;
+			lpOrientation[0] = exif.bBigEndian ? 0 : 1;
+			lpOrientation[1] = exif.bBigEndian ? 1 : 0;
+		}
+
+		break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void cleanup_transform_jpeg(LPJPEG_TRANSFORM lpJpegTransform)
+{
+	if (lpJpegTransform == NULL)
+		return;
+
+	// jpeg_destroy skips an object that has not been created or has already been destroyed
+	jpeg_destroy_compress(&lpJpegTransform->jDstInfo);
+	jpeg_destroy_decompress(&lpJpegTransform->jSrcInfo);
+
+	if (lpJpegTransform->lpOutput != NULL)
+	{
+		free(lpJpegTransform->lpOutput);
+		lpJpegTransform->lpOutput = NULL;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void set_error_manager(j_common_ptr pjInfo, LPJPEG_ERROR_MGR lpError, INT nTraceLevel, LPBOOL lpbNeedDestroy)
 {
 	// Activate the default error manager
-	jpeg_std_error(pjError);
+	j_error_mgr* pjError = jpeg_std_error(&lpError->jError);
 
 	// Set callback functions
 	pjError->error_exit = my_error_exit;
@@ -330,7 +1327,14 @@ void set_error_manager(j_common_ptr pjInfo, j_error_mgr* pjError)
 	pjError->last_addon_message = JMSG_LASTADDONCODE;
 
 	// Set trace level
-	pjError->trace_level = ((LPJPEG_DECOMPRESS)pjInfo)->nTraceLevel;
+	pjError->trace_level = nTraceLevel;
+
+	// Only the GUI thread may display messages. Decoders that run on
+	// worker threads report errors exclusively via the return value.
+	lpError->lpbNeedDestroy = lpbNeedDestroy;
+	lpError->dwError = ERROR_SUCCESS;
+	lpError->lpStats = NULL;
+	lpError->bShowMessages = IsGUIThread(FALSE);
 
 	// Assign the error manager structure to the JPEG object
 	pjInfo->err = pjError;
@@ -339,18 +1343,46 @@ void set_error_manager(j_common_ptr pjInfo, j_error_mgr* pjError)
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // If an error occurs in libjpeg, my_error_exit is called. In this case, a
 // precise error message should be displayed on the screen. Then my_error_exit
-// deletes the JPEG object and returns to the JpegToDib function using throw.
+// translates the error into a system error code, deletes the JPEG object and
+// returns to the JpegToDib or DibToJpeg function using the jump buffer of the object.
 
 void my_error_exit(j_common_ptr pjInfo)
 {
+	LPJPEG_ERROR_MGR lpError = (LPJPEG_ERROR_MGR)pjInfo->err;
+
 	// Display error message on screen
 	(*pjInfo->err->output_message)(pjInfo);
 
+	// Error code for the caller of JpegToDib or DibToJpeg
+	switch (pjInfo->err->msg_code)
+	{
+		case JERR_OUT_OF_MEMORY:
+			lpError->dwError = ERROR_NOT_ENOUGH_MEMORY;
+			break;
+		case JERR_FILE_WRITE:
+		case JERR_TFILE_CREATE:
+		case JERR_TFILE_WRITE:
+			lpError->dwError = ERROR_WRITE_FAULT;
+			break;
+		case JERR_TFILE_READ:
+			lpError->dwError = ERROR_READ_FAULT;
+			break;
+		case JERR_BAD_CROP_SPEC:
+			lpError->dwError = ERROR_INVALID_PARAMETER;
+			break;
+		default:
+			lpError->dwError = ERROR_INVALID_DATA;
+	}
+
+	// Keep the memory statistics of a failed decode
+	save_decode_stats(pjInfo);
+
 	// Delete JPEG object (e.g. delete temporary files, memory, etc.)
 	jpeg_destroy(pjInfo);
-	((LPJPEG_DECOMPRESS)pjInfo)->bNeedDestroy = FALSE;
+	if (lpError->lpbNeedDestroy != NULL)
+		*lpError->lpbNeedDestroy = FALSE;
 
-	longjmp(JmpBuffer, 1);  // Return to setjmp in JpegToDib
+	longjmp(lpError->JmpBuffer, 1);  // Return to setjmp in JpegToDib or DibToJpeg
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -361,6 +1393,10 @@ void my_output_message(j_common_ptr pjInfo)
 	char szBuffer[JMSG_LENGTH_MAX];
 	TCHAR szMessage[JMSG_LENGTH_MAX];
 
+	// Worker threads must not access the dialog
+	if (!((LPJPEG_ERROR_MGR)pjInfo->err)->bShowMessages)
+		return;
+
 	// Format text
 	(*pjInfo->err->format_message)(pjInfo, szBuffer);
 
@@ -406,3 +1442,112 @@ void my_emit_message(j_common_ptr pjInfo, int nMessageLevel)
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
+// The data source of a progressive image is cut off behind the DC scans. Instead of
+// the warning of the memory source about a missing EOI marker, the marker is inserted.
+
+boolean my_fill_input_eoi(j_decompress_ptr pjInfo)
+{
+	static const JOCTET abEoi[2] = { 0xFF, JPEG_EOI };
+
+	pjInfo->src->next_input_byte = abEoi;
+	pjInfo->src->bytes_in_buffer = sizeof(abEoi);
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// The destination manager writes the compressed data into a file. The output buffer is
+// allocated from the image pool of libjpeg and is released by jpeg_destroy_compress.
+
+void my_init_destination(j_compress_ptr pjInfo)
+{
+	LPJPEG_COMPRESS lpJpegCompress = (LPJPEG_COMPRESS)pjInfo;
+
+	lpJpegCompress->lpBuffer = (JOCTET*)(*pjInfo->mem->alloc_small)
+		((j_common_ptr)pjInfo, JPOOL_IMAGE, OUTPUT_BUF_SIZE * sizeof(JOCTET));
+
+	pjInfo->dest->next_output_byte = lpJpegCompress->lpBuffer;
+	pjInfo->dest->free_in_buffer = OUTPUT_BUF_SIZE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+boolean my_empty_output_buffer(j_compress_ptr pjInfo)
+{
+	LPJPEG_COMPRESS lpJpegCompress = (LPJPEG_COMPRESS)pjInfo;
+
+	// The whole buffer must be written, regardless of free_in_buffer
+	DWORD dwWrite = 0;
+	if (!WriteFile(lpJpegCompress->hFile, lpJpegCompress->lpBuffer, OUTPUT_BUF_SIZE, &dwWrite, NULL) ||
+		dwWrite != OUTPUT_BUF_SIZE)
+		ERREXIT(pjInfo, JERR_FILE_WRITE);
+
+	pjInfo->dest->next_output_byte = lpJpegCompress->lpBuffer;
+	pjInfo->dest->free_in_buffer = OUTPUT_BUF_SIZE;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void my_term_destination(j_compress_ptr pjInfo)
+{
+	LPJPEG_COMPRESS lpJpegCompress = (LPJPEG_COMPRESS)pjInfo;
+	DWORD cbData = (DWORD)(OUTPUT_BUF_SIZE - pjInfo->dest->free_in_buffer);
+
+	DWORD dwWrite = 0;
+	if (cbData > 0 && (!WriteFile(lpJpegCompress->hFile, lpJpegCompress->lpBuffer, cbData, &dwWrite, NULL) ||
+		dwWrite != cbData))
+		ERREXIT(pjInfo, JERR_FILE_WRITE);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The destination manager of TransformJpeg writes the compressed data into a buffer in memory.
+// The buffer is allocated with malloc, so that it can grow without copying the whole file.
+
+void my_init_memory_destination(j_compress_ptr pjInfo)
+{
+	LPJPEG_TRANSFORM lpJpegTransform = (LPJPEG_TRANSFORM)pjInfo;
+
+	// The initial size is sufficient for most transformations
+	lpJpegTransform->lpOutput = (LPBYTE)malloc(lpJpegTransform->cbOutput);
+	if (lpJpegTransform->lpOutput == NULL)
+		ERREXIT1(pjInfo, JERR_OUT_OF_MEMORY, 0);
+
+	pjInfo->dest->next_output_byte = lpJpegTransform->lpOutput;
+	pjInfo->dest->free_in_buffer = lpJpegTransform->cbOutput;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+boolean my_empty_memory_buffer(j_compress_ptr pjInfo)
+{
+	LPJPEG_TRANSFORM lpJpegTransform = (LPJPEG_TRANSFORM)pjInfo;
+
+	// The whole buffer is full, regardless of free_in_buffer. The length of the file is limited to 4 GB.
+	SIZE_T cbOld = lpJpegTransform->cbOutput;
+	SIZE_T cbNew = cbOld < MAXDWORD / 2 ? cbOld * 2 : MAXDWORD;
+	LPBYTE lpNew = cbNew > cbOld ? (LPBYTE)realloc(lpJpegTransform->lpOutput, cbNew) : NULL;
+	if (lpNew == NULL)
+		ERREXIT1(pjInfo, JERR_OUT_OF_MEMORY, 1);
+
+	lpJpegTransform->lpOutput = lpNew;
+	lpJpegTransform->cbOutput = cbNew;
+
+	pjInfo->dest->next_output_byte = lpNew + cbOld;
+	pjInfo->dest->free_in_buffer = cbNew - cbOld;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void my_term_memory_destination(j_compress_ptr pjInfo)
+{
+	LPJPEG_TRANSFORM lpJpegTransform = (LPJPEG_TRANSFORM)pjInfo;
+
+	lpJpegTransform->cbJpeg = lpJpegTransform->cbOutput - pjInfo->dest->free_in_buffer;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
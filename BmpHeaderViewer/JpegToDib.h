@@ -16,7 +16,76 @@
 //
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-// Converts a JPEG image into a DIB using libjpeg
-HANDLE JpegToDib(LPVOID lpJpegData, DWORD dwLenData, INT nTraceLevel = 0);
+// Decoding quality of JpegToDib (the faster qualities mainly pay off for unscaled images)
+#define JPEG_DECODE_EXACT       0x0000  // Accurate IDCT, fancy upsampling and block smoothing
+#define JPEG_DECODE_BALANCED    0x0001  // Fast IDCT, fancy upsampling, no block smoothing
+#define JPEG_DECODE_PREVIEW     0x0002  // Fast IDCT, simple upsampling, no block smoothing
+#define JPEG_DECODE_DC          0x0003  // 1/8-scale progressive images from the DC scans only, without IDCT
+                                        // and upsampling; sequential images like JPEG_DECODE_PREVIEW
+#define JPEG_DECODE_QUALITY     0x000F  // Mask for the decoding quality
+
+// Output format of JpegToDib
+#define JPEG_DECODE_BGRX        0x0010  // 32-bpp DIB with opaque filler bytes for color and grayscale images,
+                                        // written directly by the color converter of libjpeg
+
+// Memory statistics of a JpegToDib call
+typedef struct _JPEG_DECODE_STATS
+{
+	SIZE_T cbPeakPools;     // Peak size of the memory pools of libjpeg, including the permanent pool
+	UINT   uSmallPools;     // Number of small pools allocated by libjpeg
+	UINT   uLargePools;     // Number of large objects (sample rows, coefficient blocks) allocated by libjpeg
+	SIZE_T cbVirtArrays;    // Full size of the virtual arrays (coefficients of progressive images)
+	SIZE_T cbBackingStore;  // Part of the virtual arrays that has been written to a temporary file
+	SIZE_T cbDib;           // Size of the DIB, also set if its allocation failed
+} JPEG_DECODE_STATS, *LPJPEG_DECODE_STATS;
+
+// Converts a JPEG image into a DIB using libjpeg, downscaled by the IDCT or replaced by the
+// Exif thumbnail as long as the DIB is at least uMinWidth x uMinHeight pixels. The function
+// is thread-safe. On error it returns NULL and sets the last error code, ERROR_WRITE_FAULT and
+// ERROR_READ_FAULT refer to the temporary file of large progressive images (see jmemwin.c).
+// lpStats receives the memory statistics, even if the decode fails.
+HANDLE JpegToDib(LPVOID lpJpegData, DWORD dwLenData, INT nTraceLevel = 0, UINT uMinWidth = 0, UINT uMinHeight = 0,
+	DWORD dwFlags = JPEG_DECODE_EXACT, LPJPEG_DECODE_STATS lpStats = NULL);
+
+// Compresses a DIB into a JPEG file using libjpeg. The scanlines are read directly from the
+// DIB, compressed DIBs are decompressed by ChangeDibBitDepth first. DIBs with a gray color
+// table are stored as grayscale image. An embedded ICC profile is written to APP2 markers.
+// Like JpegToDib, the function is thread-safe and sets the last error code on failure.
+BOOL DibToJpeg(LPCTSTR lpszFileName, HANDLE hDib, INT nQuality = 90, BOOL bOptimizeCoding = TRUE);
+
+// Lossless transformations of TransformJpeg
+#define JPEG_XFORM_NONE         0x0000  // No transformation, only cropping
+#define JPEG_XFORM_FLIP_H       0x0001  // Horizontal flip
+#define JPEG_XFORM_FLIP_V       0x0002  // Vertical flip
+#define JPEG_XFORM_TRANSPOSE    0x0003  // Transposition across the upper-left to lower-right axis
+#define JPEG_XFORM_TRANSVERSE   0x0004  // Transposition across the upper-right to lower-left axis
+#define JPEG_XFORM_ROT_90       0x0005  // 90-degree clockwise rotation
+#define JPEG_XFORM_ROT_180      0x0006  // 180-degree rotation
+#define JPEG_XFORM_ROT_270      0x0007  // 270-degree clockwise rotation
+#define JPEG_XFORM_WIPE         0x0008  // Fills the rectangle with gray instead of cropping
+#define JPEG_XFORM_EXIF         0x0009  // Applies the Exif orientation and resets it to 1
+#define JPEG_XFORM_MASK         0x000F  // Mask for the transformation
+
+// Options of TransformJpeg
+#define JPEG_XFORM_TRIM         0x0010  // Drops partial MCUs at the right and bottom edge
+#define JPEG_XFORM_PERFECT      0x0020  // Fails if there are partial MCUs that cannot be transformed
+#define JPEG_XFORM_GRAYSCALE    0x0040  // Keeps only the luminance component
+
+// Transforms a JPEG image losslessly by rearranging its DCT coefficients, the pixels are
+// neither decoded nor re-encoded. Without JPEG_XFORM_TRIM, partial MCUs at the right and
+// bottom edge are not transformed. If lprcCrop is not NULL, the transformed image is cropped
+// to the rectangle, whose upper left corner is moved to the MCU grid. All markers are copied.
+// The function returns a global memory handle with the new JPEG file and its length in
+// lpdwLenJpeg. On error it returns NULL and sets the last error code like JpegToDib,
+// ERROR_NOT_SUPPORTED if JPEG_XFORM_PERFECT is set and the transformation is not perfect.
+HANDLE TransformJpeg(LPVOID lpJpegData, DWORD dwLenData, DWORD dwTransform, LPCRECT lprcCrop, LPDWORD lpdwLenJpeg);
+
+// Transforms a JPEG image like TransformJpeg and decodes the result with JpegToDib. Only the
+// ICC profile is copied, so the Exif thumbnail, which is not transformed, is never used.
+HANDLE TransformJpegToDib(LPVOID lpJpegData, DWORD dwLenData, DWORD dwTransform, LPCRECT lprcCrop,
+	UINT uMinWidth = 0, UINT uMinHeight = 0, DWORD dwFlags = JPEG_DECODE_EXACT);
+
+// Releases the decompression objects that JpegToDib keeps for reuse
+void FlushJpegPool();
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -37,6 +37,68 @@ BOOL MyReadFile(HANDLE hFile, LPVOID lpBuffer, SIZE_T cbSize)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+typedef struct _PARALLELWORK
+{
+    volatile LONG lNextIndex;
+    UINT          uCount;
+    PARALLELPROC  lpfnProc;
+    LPVOID        lpParam;
+} PARALLELWORK, FAR* LPPARALLELWORK;
+
+static unsigned __stdcall ParallelWorker(LPVOID lpParam)
+{
+	LPPARALLELWORK lppw = (LPPARALLELWORK)lpParam;
+
+	// Each thread fetches the next index until all indexes are processed
+	UINT uIndex;
+	while ((uIndex = (UINT)InterlockedIncrement(&lppw->lNextIndex)) <= lppw->uCount)
+		lppw->lpfnProc(uIndex - 1, lppw->lpParam);
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ParallelFor(UINT uCount, PARALLELPROC lpfnProc, LPVOID lpParam)
+{
+	if (lpfnProc == NULL)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	PARALLELWORK pw = { 0, uCount, lpfnProc, lpParam };
+
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+
+	// The calling thread also does its share of the work
+	UINT uThreads = min(min(uCount, si.dwNumberOfProcessors), MAXIMUM_WAIT_OBJECTS + 1);
+	HANDLE ahThreads[MAXIMUM_WAIT_OBJECTS];
+	DWORD dwThreads = 0;
+
+	while (dwThreads + 1 < uThreads)
+	{
+		HANDLE hThread = (HANDLE)_beginthreadex(NULL, 0, ParallelWorker, &pw, 0, NULL);
+		if (hThread == NULL)
+			break; // Continue with the threads created so far
+		ahThreads[dwThreads++] = hThread;
+	}
+
+	ParallelWorker(&pw);
+
+	if (dwThreads > 0)
+	{
+		WaitForMultipleObjects(dwThreads, ahThreads, TRUE, INFINITE);
+		for (DWORD i = 0; i < dwThreads; i++)
+			CloseHandle(ahThreads[i]);
+	}
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 LPVOID MyGlobalAllocPtr(UINT uFlags, SIZE_T dwBytes)
 {
 	HGLOBAL handle = GlobalAlloc(uFlags, dwBytes);
@@ -126,7 +188,10 @@ void ResetThumbnail(HWND hwndThumb, LPCTSTR lpszTitle)
 {
 	// Free the memory of the current thumbnail image
 	g_hBitmapThumb = FreeBitmap(g_hBitmapThumb);
+	g_hDibDecoded = FreeDib(g_hDibDecoded);
 	g_hDibThumb = FreeDib(g_hDibThumb);
+	g_bPrepareThumb = FALSE;
+	g_bDecodeThumb = FALSE;
 
 	// Deactivate ICM by default
 	g_nIcmMode = ICM_OFF;
@@ -144,14 +209,16 @@ void ReplaceThumbnail(HWND hwndThumb, HANDLE hDib)
 {
 	// Free the memory of the current thumbnail image
 	g_hBitmapThumb = FreeBitmap(g_hBitmapThumb);
+	g_hDibDecoded = FreeDib(g_hDibDecoded);
 	g_hDibThumb = FreeDib(g_hDibThumb);
 
 	// Save the DIB for display using StretchDIBits or DrawDibDraw.
 	// If hDib is NULL, a default thumbnail is displayed.
 	g_hDibThumb = hDib;
-	// Check the DIB for transparent pixels and create an additional
-	// pre-multiplied bitmap for the AlphaBlend function if needed
-	g_hBitmapThumb = CreatePremultipliedBitmap(hDib);
+	// The pixels are not touched until the thumbnail is drawn. A header-only
+	// operation such as saving the color profile doesn't need them at all.
+	g_bPrepareThumb = (hDib != NULL);
+	g_bDecodeThumb = FALSE;
 
 	if (hDib != NULL)
 	{
@@ -164,6 +231,10 @@ void ReplaceThumbnail(HWND hwndThumb, HANDLE hDib)
 			if (DibHasColorSpaceData(lpbi))
 				g_nIcmMode = ICM_ON;
 
+			// Embedded JPEG or PNG images and video compressed DIBs
+			// with a built-in decoder are decoded when they are drawn
+			g_bDecodeThumb = DibHasBuiltinDecoder(lpbi);
+
 			GlobalUnlock(hDib);
 		}
 	}
@@ -177,6 +248,97 @@ void ReplaceThumbnail(HWND hwndThumb, HANDLE hDib)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+void PrepareThumbnail(int nWidth, int nHeight)
+{
+	if (g_hDibThumb == NULL)
+		return;
+
+	if (g_bDecodeThumb)
+	{
+		LONG lWidth = 0, lHeight = 0;
+		LONG lFullWidth = 0, lFullHeight = 0;
+		DWORD dwCaps = 0;
+
+		LPCSTR lpbi = (LPCSTR)GlobalLock(g_hDibThumb);
+		if (lpbi != NULL)
+		{
+			GetDibDimensions(lpbi, &lFullWidth, &lFullHeight, TRUE);
+			dwCaps = QueryCodecCaps(lpbi);
+			GlobalUnlock(g_hDibThumb);
+		}
+
+		if (g_hDibDecoded != NULL)
+		{
+			lpbi = (LPCSTR)GlobalLock(g_hDibDecoded);
+			if (lpbi != NULL)
+			{
+				GetDibDimensions(lpbi, &lWidth, &lHeight, TRUE);
+				GlobalUnlock(g_hDibDecoded);
+			}
+		}
+
+		// Decode the embedded image again if the requested size has grown (e.g. for
+		// printing) and a scalable decoder has decoded the image with a reduced size
+		if (g_hDibDecoded == NULL || ((lWidth < nWidth || lHeight < nHeight) &&
+			(lWidth < lFullWidth || lHeight < lFullHeight) && (dwCaps & CODEC_SCALABLE)))
+		{
+			HANDLE hDib = DecompressDib(g_hDibThumb, max(nWidth, 1), max(nHeight, 1));
+			if (hDib != NULL)
+			{
+				FreeDib(g_hDibDecoded);
+				g_hDibDecoded = hDib;
+				g_bPrepareThumb = TRUE;
+			}
+			else // Don't try again with each repaint
+				g_bDecodeThumb = FALSE;
+		}
+	}
+
+	// The pre-multiplied bitmap is not needed if ICM is enabled
+	if (!g_bPrepareThumb || g_nIcmMode == ICM_ON)
+		return;
+
+	g_bPrepareThumb = FALSE;
+
+	// Convert palettized DIBs and pixel formats that GDI can't display (or only
+	// slowly) once into a 32-bpp DIB, instead of doing this on each repaint
+	if (g_hDibDecoded == NULL && g_hDibThumb != NULL)
+	{
+		BOOL bNeedsConversion = DibNeedsConversion((LPCSTR)GlobalLock(g_hDibThumb));
+		GlobalUnlock(g_hDibThumb);
+
+		if (bNeedsConversion)
+			g_hDibDecoded = ConvertDibToBgra(g_hDibThumb);
+	}
+
+	// Check the DIB for transparent pixels and create an additional
+	// pre-multiplied bitmap for the AlphaBlend function if needed
+	g_hBitmapThumb = FreeBitmap(g_hBitmapThumb);
+	g_hBitmapThumb = CreatePremultipliedBitmap(g_hDibDecoded != NULL ? g_hDibDecoded : g_hDibThumb);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE DecodeThumbnail()
+{
+	if (g_hDibThumb == NULL)
+		return NULL;
+
+	BOOL bDecode = FALSE;
+
+	LPCSTR lpbi = (LPCSTR)GlobalLock(g_hDibThumb);
+	if (lpbi != NULL)
+	{
+		bDecode = DibHasBuiltinDecoder(lpbi);
+		GlobalUnlock(g_hDibThumb);
+	}
+
+	// g_hDibDecoded may have been decoded with a reduced size
+	return bDecode ? DecompressDib(g_hDibThumb) : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 void ClearOutputWindow(HWND hwndEdit)
 {
 	if (hwndEdit != NULL)
@@ -443,10 +605,10 @@ BOOL GetFileName(HWND hDlg, LPTSTR lpszFileName, SIZE_T cchStringLen, LPDWORD lp
 	if (bSave)
 	{
 		uID = IDS_FILTER_BMP_SAVE;
-		if (*lpdwFilterIndex == 2)
+		if (*lpdwFilterIndex == SAVE_FILTER_ICC)
 		{
 			uID = IDS_FILTER_ICC_SAVE;
-			*lpdwFilterIndex = 1;
+			*lpdwFilterIndex = SAVE_FILTER_BMP;
 		}
 	}
 	LoadString(g_hInstance, uID, szFilter, _countof(szFilter));
@@ -469,6 +631,13 @@ BOOL GetFileName(HWND hDlg, LPTSTR lpszFileName, SIZE_T cchStringLen, LPDWORD lp
 		}
 	}
 
+	// Default extension of the selected filter
+	LPCTSTR lpszDefExt = TEXT("bmp");
+	if (bSave && *lpdwFilterIndex == SAVE_FILTER_ICC)
+		lpszDefExt = TEXT("icc");
+	else if (bSave && *lpdwFilterIndex == SAVE_FILTER_JPEG)
+		lpszDefExt = TEXT("jpg");
+
 	// File name
 	TCHAR szFile[MY_OFN_MAX_PATH] = { 0 };
 	if (bSave)
@@ -484,8 +653,8 @@ BOOL GetFileName(HWND hDlg, LPTSTR lpszFileName, SIZE_T cchStringLen, LPDWORD lp
 			_tcscpy(szFile, TEXT("*"));
 		if ((psz = _tcsrchr(szFile, TEXT('.'))) != NULL)
 			szFile[psz - szFile] = TEXT('\0');
-		_tcsncat(szFile, *lpdwFilterIndex == 2 ? TEXT(".icc") : TEXT(".bmp"),
-			_countof(szFile) - _tcslen(szFile) - 1);
+		_tcsncat(szFile, TEXT("."), _countof(szFile) - _tcslen(szFile) - 1);
+		_tcsncat(szFile, lpszDefExt, _countof(szFile) - _tcslen(szFile) - 1);
 	}
 
 	OPENFILENAME of    = { 0 };
@@ -496,7 +665,7 @@ BOOL GetFileName(HWND hDlg, LPTSTR lpszFileName, SIZE_T cchStringLen, LPDWORD lp
 	of.nMaxFile        = _countof(szFile);
 	of.lpstrFilter     = szFilter;
 	of.nFilterIndex    = *lpdwFilterIndex;
-	of.lpstrDefExt     = *lpdwFilterIndex == 2 ? TEXT("icc") : TEXT("bmp");
+	of.lpstrDefExt     = lpszDefExt;
 	of.lpstrInitialDir = pszInitialDir;
 
 	BOOL bRet = FALSE;
@@ -29,6 +29,14 @@ __inline BOOL FileSeekCurrent(HANDLE hFile, LONG lDistanceToMove)
 // number of bytes has been read. hFile must be a synchronous file handle.
 BOOL MyReadFile(HANDLE hFile, LPVOID lpBuffer, SIZE_T cbSize);
 
+// Callback function for ParallelFor
+typedef void (CALLBACK* PARALLELPROC)(UINT uIndex, LPVOID lpParam);
+
+// Calls lpfnProc for each index from 0 to uCount - 1, distributed over one thread per
+// logical processor. Returns when all calls have been completed. lpfnProc must not
+// access the user interface.
+BOOL ParallelFor(UINT uCount, PARALLELPROC lpfnProc, LPVOID lpParam);
+
 // Replacement for GlobalAllocPtr from windowsx.h to avoid warning C28183
 LPVOID MyGlobalAllocPtr(UINT uFlags, SIZE_T dwBytes);
 
@@ -62,6 +70,14 @@ void ResetThumbnail(HWND hwndThumb, LPCTSTR lpszTitle = NULL);
 // Replaces the current thumbnail with the given DIB
 void ReplaceThumbnail(HWND hwndThumb, HANDLE hDib);
 
+// Creates the data needed to draw the current thumbnail when it is drawn for the first time.
+// An embedded JPEG image is decoded with at least the specified size, if possible.
+void PrepareThumbnail(int nWidth, int nHeight);
+
+// Decodes an embedded JPEG or PNG image or a video compressed thumbnail with its full size.
+// Returns NULL if the thumbnail doesn't need to be decoded. The caller frees the DIB.
+HANDLE DecodeThumbnail();
+
 // Clears the text of an edit control, resets the undo flag, and clears the modification flag
 void ClearOutputWindow(HWND hwndEdit);
 
@@ -102,6 +118,12 @@ LPCTSTR FindFileName(LPCTSTR lpszPath);
 // the short path form is retrieved. If this is not successful, only the filename is returned.
 SIZE_T ShortenPath(LPCTSTR lpszLongPath, LPTSTR lpszShortPath, SIZE_T cchBuffer);
 
+// Filter indexes of the Save As dialog box
+#define SAVE_FILTER_BMP     1   // Windows Bitmap as stored
+#define SAVE_FILTER_RLE     2   // RLE8 or RLE4 compressed Windows Bitmap
+#define SAVE_FILTER_JPEG    3   // JPEG File Interchange Format
+#define SAVE_FILTER_ICC     4   // Embedded ICC profile (only offered if lpdwFilterIndex is set to it)
+
 // Displays the File Open or Save As dialog box
 BOOL GetFileName(HWND hDlg, LPTSTR lpszFileName, SIZE_T cchStringLen, LPDWORD lpdwFilterIndex, BOOL bSave = FALSE);
 
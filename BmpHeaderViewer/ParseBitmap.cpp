@@ -18,14 +18,54 @@
 
 #include "stdafx.h"
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Bitmaps of an OS/2 bitmap array
+
+// Maximum number of bitmaps in an array
+#define MAX_ARRAY_MEMBERS   1024
+
+typedef struct _BITMAPMEMBER
+{
+    DWORD  dwOffset;                // File offset of the bitmap array header
+    DWORD  dwDibStart;              // File offset of the DIB
+    BITMAPARRAYFILEHEADER bafh;     // Bitmap array header (only bfh is valid for a single bitmap)
+    HANDLE hDib;                    // Loaded DIB or NULL
+    DWORD  dwOffBits;               // Offset to the bitmap bits passed to ParseDIBitmap
+    LONG   lGap;                    // Removed gap or overlap passed to ParseDIBitmap
+    DWORD  dwError;                 // Error code if the DIB could not be loaded
+} BITMAPMEMBER, FAR* LPBITMAPMEMBER;
+
+typedef struct _BITMAPMEMBERS
+{
+    LPCBYTE        lpFile;          // Memory-mapped file
+    DWORD          dwFileSize;      // File size
+    BOOL           bIsArray;        // The file is a bitmap array
+    UINT           uCount;          // Number of bitmaps
+    LPBITMAPMEMBER lpMembers;       // Bitmaps in the order of the array
+} BITMAPMEMBERS, FAR* LPBITMAPMEMBERS;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // Forward declarations of functions included in this code module
 
+// Collects the bitmaps of an array by following the offNext chain. Returns FALSE
+// if the chain contains a loop or an offset outside the file.
+BOOL FindBitmapMembers(LPBITMAPMEMBERS lpbm);
+// Copies a bitmap of the mapped file into a new DIB. Called by ParallelFor.
+void CALLBACK LoadBitmapMember(UINT uIndex, LPVOID lpParam);
+// Determines the size of the DIB of an array member from the bitmap header
+DWORD GetArrayMemberSize(LPCVOID lpbi, DWORD dwDibSize, DWORD dwOffBits);
+// Determines whether a bitmap of an array is better suited for the display than another
+BOOL IsBetterBitmapMember(HWND hwnd, LPBITMAPMEMBER lpMember, LPBITMAPMEMBER lpBest);
+
 // Outputs an ICC profile signature given in big-endian format
 void PrintProfileSignature(HWND hwndEdit, LPCTSTR lpszName, DWORD dwSignature, BOOL bAddCrLf = TRUE);
 // Outputs ICC profile tag data. Only simple structures that can be displayed in one line are supported.
 void PrintProfileTagData(HWND hwndEdit, LPCTSTR lpszName, LPCSTR lpData, DWORD dwSize, BOOL bAddCrLf = FALSE);
 
+// Determines the size of a gap (> 0) or an overlap (< 0) between the color table and the bitmap
+// bits that can be removed while reading the file. lpbi only has to contain the bitmap header.
+LONG GetDibGap(LPCVOID lpbi, DWORD dwDibSize, DWORD dwOffBits);
+
 // Returns the color name if the color passed is one of the 20 static system palette colors
 BOOL GetColorName(COLORREF rgbColor, LPCTSTR* lpszName);
 
@@ -51,127 +91,403 @@ BOOL ParseBitmap(HWND hDlg, HANDLE hFile, DWORD dwFileSize)
 	if (hwndThumb == NULL)
 		return FALSE;
 
-	BITMAPFILEHEADER bfh;
-	DWORD dwFileHeaderSize = sizeof(bfh);
-
-	if (dwFileSize < dwFileHeaderSize)
+	if (dwFileSize < sizeof(BITMAPFILEHEADER))
 	{
 		OutputTextFromID(hwndEdit, IDS_CORRUPTED);
 		return FALSE;
 	}
 
-	// Jump to the beginning of the file
-	if (!FileSeekBegin(hFile, 0))
+	// Map the file into memory, so that the bitmaps of an array can be loaded simultaneously
+	HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
 		return FALSE;
 
-	// Read the file header
-	ZeroMemory(&bfh, sizeof(bfh));
-	if (!MyReadFile(hFile, (LPVOID)&bfh, sizeof(bfh)))
+	LPCBYTE lpFile = (LPCBYTE)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, dwFileSize);
+	if (lpFile == NULL)
+	{
+		DWORD dwError = GetLastError();
+		CloseHandle(hMapping);
+		SetLastError(dwError);
 		return FALSE;
+	}
+
+	BITMAPMEMBERS bm;
+	ZeroMemory(&bm, sizeof(bm));
+	bm.lpFile = lpFile;
+	bm.dwFileSize = dwFileSize;
+
+	BOOL bSuccess = FALSE;
+	BOOL bChainBroken = FALSE;
+	BOOL bIconOrPointer = FALSE;
+
+	__try
+	{
+		// Collect the bitmaps of an OS/2 bitmap array or the bitmap of a single file
+		bChainBroken = !FindBitmapMembers(&bm);
+
+		// Load the DIBs on all available processors
+		if (bm.uCount > 0)
+			ParallelFor(bm.uCount, LoadBitmapMember, &bm);
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ?
+		EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		bChainBroken = TRUE;
+	}
+
+	// The output is created afterwards in the order of the array
+	UINT uBest = UINT_MAX;
+	DWORD dwError = ERROR_SUCCESS;
+	for (UINT u = 0; u < bm.uCount; u++)
+	{
+		LPBITMAPMEMBER lpMember = &bm.lpMembers[u];
+		BITMAPFILEHEADER bfh = lpMember->bafh.bfh;
 
-	if (bfh.bfType == BFT_BITMAPARRAY)
-	{ // OS/2 Bitmap Array
-		LPBITMAPARRAYFILEHEADER lpbafh = (LPBITMAPARRAYFILEHEADER)&bfh;
+		if (bm.bIsArray)
+		{ // OS/2 Bitmap Array
+			LPBITMAPARRAYFILEHEADER lpbafh = &lpMember->bafh;
 
+			OutputText(hwndEdit, g_szSepThin);
+			OutputTextFmt(hwndEdit, TEXT("Type:\t\t%hc%hc\r\n"), LOBYTE(lpbafh->usType), HIBYTE(lpbafh->usType));
+			OutputTextFmt(hwndEdit, TEXT("Size:\t\t%u bytes\r\n"), lpbafh->cbSize);
+			OutputTextFmt(hwndEdit, TEXT("OffNext:\t%u bytes\r\n"), lpbafh->offNext);
+			OutputTextFmt(hwndEdit, TEXT("CxDisplay:\t%u\r\n"), lpbafh->cxDisplay);
+			OutputTextFmt(hwndEdit, TEXT("CyDisplay:\t%u\r\n"), lpbafh->cyDisplay);
+
+			if (lpMember->dwDibStart > dwFileSize)
+			{
+				OutputTextFromID(hwndEdit, IDS_CORRUPTED);
+				continue;
+			}
+
+			if (bfh.bfType != BFT_BMAP)
+			{ // No support for icons and pointers
+				OutputTextFromID(hwndEdit, IDS_ICON_POINTER);
+				bIconOrPointer = TRUE;
+				continue;
+			}
+		}
+
+		// Output the file header (we have already checked bfType in ParseFile)
 		OutputText(hwndEdit, g_szSepThin);
-		OutputTextFmt(hwndEdit, TEXT("Type:\t\t%hc%hc\r\n"), LOBYTE(lpbafh->usType), HIBYTE(lpbafh->usType));
-		OutputTextFmt(hwndEdit, TEXT("Size:\t\t%u bytes\r\n"), lpbafh->cbSize);
-		OutputTextFmt(hwndEdit, TEXT("OffNext:\t%u bytes\r\n"), lpbafh->offNext);
-		OutputTextFmt(hwndEdit, TEXT("CxDisplay:\t%u\r\n"), lpbafh->cxDisplay);
-		OutputTextFmt(hwndEdit, TEXT("CyDisplay:\t%u\r\n"), lpbafh->cyDisplay);
-
-		// Proceed only if the array contains only one bitmap
-		if (lpbafh->offNext != 0)
+		OutputTextFmt(hwndEdit, TEXT("Type:\t\t%hc%hc\r\n"), LOBYTE(bfh.bfType), HIBYTE(bfh.bfType));
+		OutputTextFmt(hwndEdit, TEXT("Size:\t\t%u bytes\r\n"), bfh.bfSize);
+		OutputTextFmt(hwndEdit, TEXT("Reserved1:\t%u\r\n"), bfh.bfReserved1);
+		OutputTextFmt(hwndEdit, TEXT("Reserved2:\t%u\r\n"), bfh.bfReserved2);
+		OutputTextFmt(hwndEdit, TEXT("OffBits:\t%u bytes\r\n"), bfh.bfOffBits);
+
+		if (lpMember->hDib == NULL)
 		{
-			OutputTextFromID(hwndEdit, IDS_BITMAPARRAY);
-			SetThumbnailText(hwndThumb, IDS_UNSUPPORTED);
-			return FALSE;
+			if (lpMember->dwError != ERROR_SUCCESS)
+				dwError = lpMember->dwError;
+			else
+				OutputTextFromID(hwndEdit, IDS_CORRUPTED);
+			continue;
 		}
 
-		dwFileHeaderSize += dwFileHeaderSize;
-		if (dwFileSize < dwFileHeaderSize)
+		SetLastError(ERROR_SUCCESS);
+		if (!ParseDIBitmap(hDlg, lpMember->hDib, lpMember->dwOffBits, lpMember->lGap))
 		{
-			OutputTextFromID(hwndEdit, IDS_CORRUPTED);
-			return FALSE;
+			if (GetLastError() != ERROR_SUCCESS)
+				dwError = GetLastError();
+			lpMember->hDib = FreeDib(lpMember->hDib);
+			continue;
 		}
 
-		// Read the file header of the first bitmap
-		ZeroMemory(&bfh, sizeof(bfh));
-		if (!MyReadFile(hFile, (LPVOID)&bfh, sizeof(bfh)))
+		if (uBest == UINT_MAX || IsBetterBitmapMember(hDlg, lpMember, &bm.lpMembers[uBest]))
+			uBest = u;
+	}
+
+	if (bChainBroken)
+		OutputTextFromID(hwndEdit, IDS_BITMAPARRAY);
+
+	// Display the bitmap best suited for the current screen and free all others
+	if (uBest != UINT_MAX)
+	{
+		if (bm.uCount > 1)
+			SetWindowText(hwndThumb, TEXT(""));
+		ReplaceThumbnail(hwndThumb, bm.lpMembers[uBest].hDib);
+		bm.lpMembers[uBest].hDib = NULL;
+		bSuccess = TRUE;
+	}
+	else if (bIconOrPointer)
+		SetThumbnailText(hwndThumb, IDS_UNSUPPORTED);
+
+	for (UINT u = 0; u < bm.uCount; u++)
+		FreeDib(bm.lpMembers[u].hDib);
+
+	MyGlobalFreePtr(bm.lpMembers);
+	UnmapViewOfFile(lpFile);
+	CloseHandle(hMapping);
+
+	SetLastError(dwError);
+	return bSuccess;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL FindBitmapMembers(LPBITMAPMEMBERS lpbm)
+{
+	if (lpbm == NULL || lpbm->lpFile == NULL)
+		return FALSE;
+
+	LPCBYTE lpFile = lpbm->lpFile;
+	DWORD dwFileSize = lpbm->dwFileSize;
+
+	lpbm->bIsArray = (((LPBITMAPFILEHEADER)lpFile)->bfType == BFT_BITMAPARRAY);
+	if (!lpbm->bIsArray)
+	{ // Single bitmap
+		lpbm->lpMembers = (LPBITMAPMEMBER)MyGlobalAllocPtr(GHND, sizeof(BITMAPMEMBER));
+		if (lpbm->lpMembers == NULL)
 			return FALSE;
 
-		if (bfh.bfType != BFT_BMAP)
-		{ // No support for icons and pointers
-			OutputTextFromID(hwndEdit, IDS_ICON_POINTER);
-			SetThumbnailText(hwndThumb, IDS_UNSUPPORTED);
+		CopyMemory(&lpbm->lpMembers[0].bafh.bfh, lpFile, sizeof(BITMAPFILEHEADER));
+		lpbm->lpMembers[0].dwDibStart = sizeof(BITMAPFILEHEADER);
+		lpbm->uCount = 1;
+		return TRUE;
+	}
+
+	// The offsets of all headers are relative to the beginning of the file. Each
+	// offset may only be visited once, which prevents endless loops in the chain.
+	UINT uMaxCount = min(dwFileSize / (UINT)sizeof(BITMAPARRAYFILEHEADER) + 1, MAX_ARRAY_MEMBERS);
+	lpbm->lpMembers = (LPBITMAPMEMBER)MyGlobalAllocPtr(GHND, uMaxCount * sizeof(BITMAPMEMBER));
+	if (lpbm->lpMembers == NULL)
+		return FALSE;
+
+	DWORD dwOffset = 0;
+	for (;;)
+	{
+		if (lpbm->uCount >= uMaxCount)
+			return FALSE;
+
+		for (UINT u = 0; u < lpbm->uCount; u++)
+			if (lpbm->lpMembers[u].dwOffset == dwOffset)
+				return FALSE;
+
+		LPBITMAPMEMBER lpMember = &lpbm->lpMembers[lpbm->uCount++];
+		lpMember->dwOffset = dwOffset;
+
+		// An incomplete header is output as far as it is present
+		DWORD dwHeaderSize = min(dwFileSize - dwOffset, (DWORD)sizeof(BITMAPARRAYFILEHEADER));
+		CopyMemory(&lpMember->bafh, lpFile + dwOffset, dwHeaderSize);
+		lpMember->dwDibStart = dwOffset + sizeof(BITMAPARRAYFILEHEADER);
+
+		if (dwHeaderSize < sizeof(BITMAPARRAYFILEHEADER))
+			return lpMember->bafh.offNext == 0;
+
+		if (lpMember->bafh.usType != BFT_BITMAPARRAY)
+		{ // The first member has already been checked in ParseFile
+			lpbm->uCount--;
 			return FALSE;
 		}
+
+		dwOffset = lpMember->bafh.offNext;
+		if (dwOffset == 0)
+			return TRUE;
+
+		if (dwOffset > dwFileSize - sizeof(BITMAPFILEHEADER))
+			return FALSE;
 	}
+}
 
-	// Output the file header (we have already checked bfType in ParseFile)
-	OutputText(hwndEdit, g_szSepThin);
-	OutputTextFmt(hwndEdit, TEXT("Type:\t\t%hc%hc\r\n"), LOBYTE(bfh.bfType), HIBYTE(bfh.bfType));
-	OutputTextFmt(hwndEdit, TEXT("Size:\t\t%u bytes\r\n"), bfh.bfSize);
-	OutputTextFmt(hwndEdit, TEXT("Reserved1:\t%u\r\n"), bfh.bfReserved1);
-	OutputTextFmt(hwndEdit, TEXT("Reserved2:\t%u\r\n"), bfh.bfReserved2);
-	OutputTextFmt(hwndEdit, TEXT("OffBits:\t%u bytes\r\n"), bfh.bfOffBits);
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CALLBACK LoadBitmapMember(UINT uIndex, LPVOID lpParam)
+{
+	LPBITMAPMEMBERS lpbm = (LPBITMAPMEMBERS)lpParam;
+	if (lpbm == NULL || uIndex >= lpbm->uCount)
+		return;
+
+	LPBITMAPMEMBER lpMember = &lpbm->lpMembers[uIndex];
+	if (lpMember->bafh.bfh.bfType != BFT_BMAP || lpMember->dwDibStart > lpbm->dwFileSize)
+		return;
 
-	DWORD dwDibSize = dwFileSize - dwFileHeaderSize;
+	DWORD dwDibStart = lpMember->dwDibStart;
+	DWORD dwDibSize = lpbm->dwFileSize - dwDibStart;
 	if (dwDibSize < sizeof(BITMAPCOREHEADER))
+		return;
+
+	LPCBYTE lpDib = lpbm->lpFile + dwDibStart;
+	HANDLE hDib = NULL;
+
+	__try
 	{
-		OutputTextFromID(hwndEdit, IDS_CORRUPTED);
-		return FALSE;
+		// Calculate the offset from the start of the DIB to the bitmap bits
+		DWORD dwOffBits = 0;
+		if (lpMember->bafh.bfh.bfOffBits > dwDibStart)
+			dwOffBits = lpMember->bafh.bfh.bfOffBits - dwDibStart;
+
+		// Evaluate the bitmap header first. This allows us to remove a gap between the
+		// color table and the bitmap bits or to add missing color table entries while
+		// copying the DIB, instead of moving the bitmap bits around in memory afterwards.
+		BYTE abHeader[sizeof(BITMAPV5HEADER)];
+		ZeroMemory(abHeader, sizeof(abHeader));
+		CopyMemory(abHeader, lpDib, min(dwDibSize, sizeof(abHeader)));
+
+		// The bitmaps of an array usually share the rest of the file
+		if (lpbm->bIsArray)
+			dwDibSize = GetArrayMemberSize(abHeader, dwDibSize, dwOffBits);
+
+		LONG lGap = GetDibGap(abHeader, dwDibSize, dwOffBits);
+
+		// The memory block is completely overwritten by the file data
+		hDib = AllocDib(dwDibSize - lGap, FALSE);
+		if (hDib == NULL)
+		{
+			lpMember->dwError = GetLastError();
+			return;
+		}
+
+		LPSTR lpbi = (LPSTR)GlobalLock(hDib);
+		if (lpbi == NULL)
+		{
+			lpMember->dwError = GetLastError();
+			FreeDib(hDib);
+			return;
+		}
+
+		if (lGap == 0)
+		{ // Copy the DIB completely in order to analyze it
+			CopyMemory(lpbi, lpDib, dwDibSize);
+		}
+		else if (lGap > 0)
+		{ // Skip the gap between the color table and the bitmap bits
+			DWORD dwOffBitsPacked = dwOffBits - lGap;
+
+			CopyMemory(lpbi, lpDib, dwOffBitsPacked);
+			CopyMemory(lpbi + dwOffBitsPacked, lpDib + dwOffBits, dwDibSize - dwOffBits);
+
+			// Move the position of a profile that follows the bitmap bits
+			LPBITMAPV5HEADER lpbiv5 = (LPBITMAPV5HEADER)lpbi;
+			if (DibHasColorProfile(lpbi) && lpbiv5->bV5ProfileData >= dwOffBits)
+				lpbiv5->bV5ProfileData -= lGap;
+
+			dwOffBits = dwOffBitsPacked;
+		}
+		else
+		{ // Copy the bitmap bits behind the complete color table
+			DWORD dwOverlap = (DWORD)-lGap;
+			DWORD dwOffBitsPacked = dwOffBits + dwOverlap;
+
+			CopyMemory(lpbi, lpDib, dwOffBits);
+			CopyMemory(lpbi + dwOffBitsPacked, lpDib + dwOffBits, dwDibSize - dwOffBits);
+
+			// Add a grayscale palette for the missing color table entries
+			SIZE_T cbEntrySize = IS_OS2PM_DIB(lpbi) ? sizeof(RGBTRIPLE) : sizeof(RGBQUAD);
+			DWORD dwMissingEntries = dwOverlap / (DWORD)cbEntrySize;
+			LPBYTE lpEntry = (LPBYTE)lpbi + dwOffBits;
+
+			ZeroMemory(lpEntry, dwOverlap);
+			for (UINT i = 0; i < dwMissingEntries; i++, lpEntry += cbEntrySize)
+				lpEntry[0] = lpEntry[1] = lpEntry[2] = (BYTE)(i * 256 / dwMissingEntries);
+
+			dwOffBits = dwOffBitsPacked;
+		}
+
+		GlobalUnlock(hDib);
+
+		lpMember->hDib = hDib;
+		lpMember->dwOffBits = dwOffBits;
+		lpMember->lGap = lGap;
 	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ?
+		EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		// The file is only read while the DIB is locked
+		if (hDib != NULL)
+		{
+			GlobalUnlock(hDib);
+			FreeDib(hDib);
+		}
 
-	HANDLE hDib = GlobalAlloc(GHND, dwDibSize);
-	if (hDib == NULL)
-		return FALSE;
+		lpMember->dwError = ERROR_READ_FAULT;
+	}
+}
 
-	LPSTR lpbi = (LPSTR)GlobalLock(hDib);
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+DWORD GetArrayMemberSize(LPCVOID lpbi, DWORD dwDibSize, DWORD dwOffBits)
+{
 	if (lpbi == NULL)
-	{
-		DWORD dwError = GetLastError();
-		GlobalFree(hDib);
-		SetLastError(dwError);
+		return dwDibSize;
+
+	// The bitmap bits of an array are typically stored after all headers
+	UINT uImageSize = DibImageSize((LPCSTR)lpbi);
+	if (uImageSize == 0)
+		return dwDibSize;
+
+	UINT64 ullEnd = (UINT64)(dwOffBits != 0 ? dwOffBits : DibBitsOffset((LPCSTR)lpbi)) + uImageSize;
+
+	LPBITMAPV5HEADER lpbiv5 = (LPBITMAPV5HEADER)lpbi;
+	if (DibHasColorProfile((LPCSTR)lpbi))
+		ullEnd = max(ullEnd, (UINT64)lpbiv5->bV5ProfileData + lpbiv5->bV5ProfileSize);
+
+	return ullEnd < dwDibSize ? (DWORD)ullEnd : dwDibSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL IsBetterBitmapMember(HWND hwnd, LPBITMAPMEMBER lpMember, LPBITMAPMEMBER lpBest)
+{
+	if (lpMember == NULL || lpMember->hDib == NULL)
 		return FALSE;
+	if (lpBest == NULL || lpBest->hDib == NULL)
+		return TRUE;
+
+	// Resolution of the monitor that displays the thumbnail
+	int cxScreen = GetSystemMetrics(SM_CXSCREEN);
+	int cyScreen = GetSystemMetrics(SM_CYSCREEN);
+	MONITORINFO mi = { sizeof(mi) };
+	if (GetMonitorInfo(MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST), &mi))
+	{
+		cxScreen = mi.rcMonitor.right - mi.rcMonitor.left;
+		cyScreen = mi.rcMonitor.bottom - mi.rcMonitor.top;
 	}
 
-	// We read in the DIB completely in order to analyze it. The
-	// header and the color table should actually be read in first,
-	// followed by the color profile and finally the bitmap bits.
-	if (!MyReadFile(hFile, lpbi, dwDibSize))
+	// A bitmap designed for the current display beats a device-independent bitmap
+	int nRank[2] = { 0 };
+	LPBITMAPARRAYFILEHEADER lpbafh[2] = { &lpMember->bafh, &lpBest->bafh };
+	for (int i = 0; i < 2; i++)
 	{
-		DWORD dwError = GetLastError();
-		GlobalUnlock(hDib);
-		GlobalFree(hDib);
-		SetLastError(dwError);
-		return FALSE;
+		if (lpbafh[i]->cxDisplay == cxScreen && lpbafh[i]->cyDisplay == cyScreen)
+			nRank[i] = 2;
+		else if (lpbafh[i]->cxDisplay == 0 && lpbafh[i]->cyDisplay == 0)
+			nRank[i] = 1;
 	}
 
-	GlobalUnlock(hDib);
-
-	// Calculate the offset from the start of the DIB to the bitmap bits
-	DWORD dwOffBits = 0;
-	if (bfh.bfOffBits > dwFileHeaderSize)
-		dwOffBits = bfh.bfOffBits - dwFileHeaderSize;
+	if (nRank[0] != nRank[1])
+		return nRank[0] > nRank[1];
 
-	if (!ParseDIBitmap(hDlg, hDib, dwOffBits))
+	// Otherwise prefer the bitmap with the most colors and then the largest bitmap
+	BOOL bBetter = FALSE;
+	LPCSTR lpbi = (LPCSTR)GlobalLock(lpMember->hDib);
+	LPCSTR lpbiBest = (LPCSTR)GlobalLock(lpBest->hDib);
+	if (lpbi != NULL && lpbiBest != NULL)
 	{
-		DWORD dwError = GetLastError();
-		GlobalFree(hDib);
-		if (dwError != ERROR_SUCCESS)
-			SetLastError(dwError);
-		return FALSE;
+		WORD wBitCount = IS_OS2PM_DIB(lpbi) ? ((LPBITMAPCOREHEADER)lpbi)->bcBitCount : ((LPBITMAPINFOHEADER)lpbi)->biBitCount;
+		WORD wBitCountBest = IS_OS2PM_DIB(lpbiBest) ? ((LPBITMAPCOREHEADER)lpbiBest)->bcBitCount : ((LPBITMAPINFOHEADER)lpbiBest)->biBitCount;
+
+		LONG lWidth = 0, lHeight = 0, lWidthBest = 0, lHeightBest = 0;
+		GetDibDimensions(lpbi, &lWidth, &lHeight, TRUE);
+		GetDibDimensions(lpbiBest, &lWidthBest, &lHeightBest, TRUE);
+
+		if (wBitCount != wBitCountBest)
+			bBetter = wBitCount > wBitCountBest;
+		else
+			bBetter = (LONGLONG)lWidth * lHeight > (LONGLONG)lWidthBest * lHeightBest;
 	}
 
-	ReplaceThumbnail(hwndThumb, hDib);
+	if (lpbiBest != NULL)
+		GlobalUnlock(lpBest->hDib);
+	if (lpbi != NULL)
+		GlobalUnlock(lpMember->hDib);
 
-	return TRUE;
+	return bBetter;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-BOOL ParseDIBitmap(HWND hDlg, HANDLE hDib, DWORD dwOffBits)
+BOOL ParseDIBitmap(HWND hDlg, HANDLE hDib, DWORD dwOffBits, LONG lGap)
 {
 	if (hDlg == NULL || hDib == NULL)
 	{
@@ -235,9 +551,9 @@ BOOL ParseDIBitmap(HWND hDlg, HANDLE hDib, DWORD dwOffBits)
 	// Since we don't perform format conversions here, all formats that the
 	// display driver cannot directly display are marked as not displayable
 	BOOL bIsDibDisplayable = TRUE;
-	// Mark formats that cannot be displayed by a display driver but may be
-	// supported by a printer driver
-	BOOL bIsPassthroughImage = FALSE;
+	// Formats that the display driver cannot display, but a built-in decoder
+	// of the codec registry can (passthrough and video compressed DIBs)
+	BOOL bHasBuiltinDecoder = DibHasBuiltinDecoder(lpbi);
 
 	if (dwDibHeaderSize == sizeof(BITMAPCOREHEADER))
 	{ // OS/2 Version 1.1 Bitmap (DIBv2)
@@ -270,6 +586,11 @@ BOOL ParseDIBitmap(HWND hDlg, HANDLE hDib, DWORD dwOffBits)
 		if (lpbih->bV5BitCount == 64)
 			bIsDibDisplayable = TRUE;
 
+		// Other formats the display driver doesn't support, like 2-bpp DIBs (Windows CE)
+		// or unusual color masks, are converted to 32 bpp for the thumbnail
+		if (!bIsDibDisplayable && DibNeedsConversion(lpbi))
+			bIsDibDisplayable = TRUE;
+
 		// Perform some additional sanity checks
 		if (lpbih->bV5Width < 0)
 			lpbih->bV5Width = -lpbih->bV5Width;
@@ -338,11 +659,9 @@ BOOL ParseDIBitmap(HWND hDlg, HANDLE hDib, DWORD dwOffBits)
 					OutputText(hwndEdit, TEXT("BITFIELDS"));
 					break;
 				case BI_JPEG:
-					bIsPassthroughImage = TRUE;
 					OutputText(hwndEdit, TEXT("JPEG"));
 					break;
 				case BI_PNG:
-					bIsPassthroughImage = TRUE;
 					OutputText(hwndEdit, TEXT("PNG"));
 					break;
 				case BI_ALPHABITFIELDS:
@@ -671,7 +990,15 @@ BOOL ParseDIBitmap(HWND hDlg, HANDLE hDib, DWORD dwOffBits)
 		return FALSE;
 	}
 
-	if (dwOffBits > dwOffBitsPacked)
+	if (lGap != 0)
+	{ // The gap or overlap has already been removed when reading the file
+		OutputText(hwndEdit, g_szSepThin);
+		if (lGap > 0)
+			OutputTextFmt(hwndEdit, TEXT("Gap to pixels:\t%u bytes\r\n"), (DWORD)lGap);
+		else
+			OutputTextFmt(hwndEdit, TEXT("Gap to pixels:\t-%u bytes\r\n"), (DWORD)-lGap);
+	}
+	else if (dwOffBits > dwOffBitsPacked)
 	{ // Gap between color table and bitmap bits present
 		DWORD dwGap = dwOffBits - dwOffBitsPacked;
 
@@ -766,7 +1093,7 @@ BOOL ParseDIBitmap(HWND hDlg, HANDLE hDib, DWORD dwOffBits)
 	{
 		TCHAR szOutput[OUTPUT_LEN];
 
-		if ((lpbih->bV5ProfileData + lpbih->bV5ProfileSize) > dwDibSize)
+		if (lpbih->bV5ProfileData > dwDibSize || lpbih->bV5ProfileSize > dwDibSize - lpbih->bV5ProfileData)
 		{
 			GlobalUnlock(hDib);
 			OutputTextFromID(hwndEdit, IDS_CORRUPTED);
@@ -1081,7 +1408,7 @@ BOOL ParseDIBitmap(HWND hDlg, HANDLE hDib, DWORD dwOffBits)
 Exit:
 	GlobalUnlock(hDib);
 
-	if (!bIsDibDisplayable && !bIsPassthroughImage)
+	if (!bIsDibDisplayable && !bHasBuiltinDecoder)
 	{
 		SetThumbnailText(hwndThumb, IDS_UNSUPPORTED);
 		return FALSE;
@@ -1092,6 +1419,58 @@ Exit:
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+LONG GetDibGap(LPCVOID lpbi, DWORD dwDibSize, DWORD dwOffBits)
+{
+	if (lpbi == NULL || dwOffBits == 0 || dwOffBits >= dwDibSize)
+		return 0;
+
+	DWORD dwDibHeaderSize = *(LPDWORD)lpbi;
+	if (dwDibHeaderSize != sizeof(BITMAPCOREHEADER) &&
+		dwDibHeaderSize != sizeof(BITMAPINFOHEADER) &&
+		dwDibHeaderSize != sizeof(BITMAPV2INFOHEADER) &&
+		dwDibHeaderSize != sizeof(BITMAPV3INFOHEADER) &&
+		dwDibHeaderSize != sizeof(BITMAPINFOHEADER2) &&
+		dwDibHeaderSize != sizeof(BITMAPV4HEADER) &&
+		dwDibHeaderSize != sizeof(BITMAPV5HEADER))
+		return 0;
+
+	DWORD dwOffBitsPacked = DibBitsOffset((LPCSTR)lpbi);
+	if (dwOffBitsPacked > dwDibSize)
+		return 0;
+
+	if (dwOffBits > dwOffBitsPacked)
+	{
+		// Keep the gap if it contains the color profile. The end of the profile is not
+		// calculated, since bV5ProfileData + bV5ProfileSize can exceed 32 bits.
+		LPBITMAPV5HEADER lpbiv5 = (LPBITMAPV5HEADER)lpbi;
+		if (DibHasColorProfile((LPCSTR)lpbi) && lpbiv5->bV5ProfileData < dwOffBits &&
+			(lpbiv5->bV5ProfileData > dwOffBitsPacked ||
+			lpbiv5->bV5ProfileSize > dwOffBitsPacked - lpbiv5->bV5ProfileData))
+			return 0;
+
+		return (LONG)(dwOffBits - dwOffBitsPacked);
+	}
+
+	if (dwOffBits < dwOffBitsPacked && dwOffBits >= dwDibHeaderSize + ColorMasksSize((LPCSTR)lpbi))
+	{
+		DWORD dwNumEntries = DibNumColors((LPCSTR)lpbi);
+		if (dwNumEntries == 0)
+			return 0;
+
+		// Except for core DIBs, ParseDIBitmap can simply reduce the number of
+		// color table entries, as long as at least one entry remains
+		DWORD dwOverlap = dwOffBitsPacked - dwOffBits;
+		if (dwDibHeaderSize >= sizeof(BITMAPINFOHEADER) && dwNumEntries > dwOverlap / sizeof(RGBQUAD))
+			return 0;
+
+		return -(LONG)dwOverlap;
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
 void PrintProfileSignature(HWND hwndEdit, LPCTSTR lpszName, DWORD dwSignature, BOOL bAddCrLf)
 {
 	if (hwndEdit == NULL)
@@ -21,7 +21,9 @@ BOOL ParseBitmap(HWND hDlg, HANDLE hFile, DWORD dwFileSize);
 
 // Parses a DIB and displays its metadata. dwOffBits is the offset from
 // the start of the DIB to the bitmap bits (can be 0 for a packed DIB).
-BOOL ParseDIBitmap(HWND hDlg, HANDLE hDib, DWORD dwOffBits = 0);
+// lGap is the size of a gap (> 0) or an overlap (< 0) between the color
+// table and the bitmap bits that the caller has already removed.
+BOOL ParseDIBitmap(HWND hDlg, HANDLE hDib, DWORD dwOffBits = 0, LONG lGap = 0);
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // ICC profile header declarations
@@ -0,0 +1,1203 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ParseJpeg.cpp - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Metadata collected while scanning the markers
+
+// Components and quantization tables that are included in the summary
+#define JPEG_MAX_COMPONENTS 4
+#define JPEG_MAX_QUANT_TBLS 4
+
+typedef struct _JPEG_COMPONENT
+{
+    BYTE  bId;                      // Component identifier
+    BYTE  bSampling;                // Horizontal (high nibble) and vertical sampling factor
+    BYTE  bQuantTable;              // Quantization table selector
+} JPEG_COMPONENT;
+
+typedef struct _JPEG_QUANT_TABLE
+{
+    BOOL  bDefined;                 // The table has been defined by a DQT marker
+    UINT  uPrecision;               // Precision of the elements (8 or 16 bit)
+    WORD  wDC;                      // DC quantizer
+    WORD  wMinAC;                   // Smallest AC quantizer
+    WORD  wMaxAC;                   // Largest AC quantizer
+    DWORD dwSum;                    // Sum of all 64 quantizers
+} JPEG_QUANT_TABLE;
+
+typedef struct _JPEG_REPORT
+{
+    HWND  hwndEdit;                 // Output window
+    BYTE  bFrame;                   // SOFn marker of the first frame, 0 if none
+    UINT  uPrecision;               // Sample precision
+    UINT  uWidth;                   // Number of samples per line
+    UINT  uHeight;                  // Number of lines
+    UINT  uComponents;              // Number of image components
+    JPEG_COMPONENT aComponents[JPEG_MAX_COMPONENTS];
+    JPEG_QUANT_TABLE aQuantTables[JPEG_MAX_QUANT_TBLS];
+    UINT  uScans;                   // Number of SOS markers
+    BOOL  bRestartInterval;         // A DRI marker has been found
+    UINT  uRestartInterval;         // Restart interval in MCUs
+    UINT  uRestarts;                // Number of RST markers in all scans
+    UINT  uIccChunks;               // Number of ICC profile chunks
+    UINT  uIccChunkCount;           // Number of chunks according to the first chunk
+    DWORD cbIccProfile;             // Total size of the ICC profile chunks
+    BOOL  bEndOfImage;              // The EOI marker has been found
+    DWORD dwEndOfImage;             // File offset behind the EOI marker
+    BOOL  bExif;                    // Exif data has been found
+    EXIF_DATA exif;                 // Exif data of the first Exif APP1 segment
+} JPEG_REPORT, FAR* LPJPEG_REPORT;
+
+// Destination of the ICC profile chunks that are copied into a passthrough DIB
+typedef struct _JPEG_ICC_COPY
+{
+    LPBYTE lpProfile;               // Profile data behind the image data of the DIB
+    DWORD  cbProfile;               // Size of the profile according to the report
+    DWORD  cbCopied;                // Number of bytes copied so far
+    UINT   uChunks;                 // Number of chunks copied so far
+    BOOL   bFailed;                 // A chunk is out of order or doesn't fit
+} JPEG_ICC_COPY, FAR* LPJPEG_ICC_COPY;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Exif image file directories (TIFF structure)
+
+// Max. number of entries of an IFD that are evaluated
+#define EXIF_MAX_ENTRIES    256
+
+// Entry of an IFD with a validated pointer to its value
+typedef struct _EXIF_ENTRY
+{
+    WORD    wTag;                   // Tag number
+    WORD    wType;                  // Data type of the value
+    DWORD   dwCount;                // Number of values
+    LPCBYTE lpValue;                // Value inside the entry or inside the TIFF structure
+} EXIF_ENTRY, FAR* LPEXIF_ENTRY;
+
+// Tags that are evaluated
+#define EXIF_TAG_COMPRESSION        0x0103
+#define EXIF_TAG_MAKE               0x010F
+#define EXIF_TAG_MODEL              0x0110
+#define EXIF_TAG_ORIENTATION        0x0112
+#define EXIF_TAG_SOFTWARE           0x0131
+#define EXIF_TAG_DATETIME           0x0132
+#define EXIF_TAG_JPEGIF_OFFSET      0x0201
+#define EXIF_TAG_JPEGIF_LENGTH      0x0202
+#define EXIF_TAG_EXPOSURETIME       0x829A
+#define EXIF_TAG_FNUMBER            0x829D
+#define EXIF_TAG_EXIF_IFD           0x8769
+#define EXIF_TAG_ISO                0x8827
+#define EXIF_TAG_DATETIMEORIGINAL   0x9003
+#define EXIF_TAG_FOCALLENGTH        0x920A
+#define EXIF_TAG_PIXELXDIMENSION    0xA002
+#define EXIF_TAG_PIXELYDIMENSION    0xA003
+
+// Data types
+#define EXIF_TYPE_ASCII             2
+#define EXIF_TYPE_SHORT             3
+#define EXIF_TYPE_LONG              4
+#define EXIF_TYPE_RATIONAL          5
+
+// Names of the orientation values 1 to 8
+static const LPCTSTR g_aszOrientations[8] =
+{
+    TEXT("Horizontal (normal)"),
+    TEXT("Mirror horizontal"),
+    TEXT("Rotate 180"),
+    TEXT("Mirror vertical"),
+    TEXT("Mirror horizontal and rotate 270 CW"),
+    TEXT("Rotate 90 CW"),
+    TEXT("Mirror horizontal and rotate 90 CW"),
+    TEXT("Rotate 270 CW")
+};
+
+// Frame types of the SOFn markers
+static const LPCTSTR g_aszFrameTypes[16] =
+{
+    TEXT("Baseline DCT"),
+    TEXT("Extended sequential DCT"),
+    TEXT("Progressive DCT"),
+    TEXT("Lossless"),
+    NULL,
+    TEXT("Differential sequential DCT"),
+    TEXT("Differential progressive DCT"),
+    TEXT("Differential lossless"),
+    NULL,
+    TEXT("Extended sequential DCT, arithmetic"),
+    TEXT("Progressive DCT, arithmetic"),
+    TEXT("Lossless, arithmetic"),
+    NULL,
+    TEXT("Differential sequential DCT, arithmetic"),
+    TEXT("Differential progressive DCT, arithmetic"),
+    TEXT("Differential lossless, arithmetic")
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Forward declarations of functions included in this code module
+
+// Outputs one line of the marker table. Called by ScanJpegMarkers.
+BOOL CALLBACK PrintJpegSegment(LPCJPEG_SEGMENT lpSegment, LPVOID lpParam);
+// Outputs the frame type, the components, the quantization tables and the ICC profile layout
+void PrintJpegSummary(LPJPEG_REPORT lpReport, DWORD dwFileSize);
+// Creates a passthrough DIB (BI_JPEG) with a copy of the file and its ICC profile
+HANDLE CreateJpegDib(LPJPEG_REPORT lpReport, LPCBYTE lpFile, DWORD dwFileSize);
+// Copies the ICC profile chunks behind the image data. Called by ScanJpegMarkers.
+BOOL CALLBACK CopyIccChunk(LPCJPEG_SEGMENT lpSegment, LPVOID lpParam);
+
+// Outputs the identifier of an APPn segment and the details of JFIF, ICC and Adobe segments
+void PrintAppSegment(LPJPEG_REPORT lpReport, LPCJPEG_SEGMENT lpSegment);
+// Outputs the quantization tables of a DQT segment and collects their statistics
+void PrintQuantTables(LPJPEG_REPORT lpReport, LPCJPEG_SEGMENT lpSegment);
+// Outputs the Huffman tables of a DHT segment
+void PrintHuffmanTables(LPJPEG_REPORT lpReport, LPCJPEG_SEGMENT lpSegment);
+// Outputs a frame header and stores the first one in the report
+void PrintFrameHeader(LPJPEG_REPORT lpReport, LPCJPEG_SEGMENT lpSegment);
+// Outputs a scan header including the spectral selection and successive approximation
+void PrintScanHeader(LPJPEG_REPORT lpReport, LPCJPEG_SEGMENT lpSegment);
+
+// Outputs the camera, capture and thumbnail metadata of the Exif data
+void PrintExifData(HWND hwndEdit, LPCEXIF_DATA lpExif);
+// Outputs an IFD entry if it is one of the evaluated tags
+void PrintExifEntry(HWND hwndEdit, LPCEXIF_DATA lpExif, const EXIF_ENTRY* lpEntry);
+
+// Reads the entries of an IFD. Entries with values outside the TIFF structure are skipped.
+UINT ReadExifIfd(LPCEXIF_DATA lpExif, DWORD dwOffset, LPEXIF_ENTRY lpEntries, UINT uMaxEntries, LPDWORD lpdwNextIfd);
+// Gets the first value of a SHORT or LONG entry
+BOOL GetExifUInt(LPCEXIF_DATA lpExif, const EXIF_ENTRY* lpEntry, LPDWORD lpdwValue);
+// Stops ScanJpegMarkers at the Exif segment. Called by ScanJpegMarkers.
+BOOL CALLBACK FindExifSegment(LPCJPEG_SEGMENT lpSegment, LPVOID lpParam);
+// Stops ScanJpegMarkers at the first frame header. Called by ScanJpegMarkers.
+BOOL CALLBACK FindFrameHeader(LPCJPEG_SEGMENT lpSegment, LPVOID lpParam);
+
+// Gets the mnemonic of a marker code
+void GetJpegMarkerName(BYTE bMarker, LPTSTR lpszName, SIZE_T cchName);
+
+// Reads a big-endian word
+__inline WORD GetWordBE(LPCBYTE lpData) { return (WORD)((lpData[0] << 8) | lpData[1]); }
+
+// Reads a word or a double word of the Exif data in its byte order
+__inline WORD GetExifWord(LPCEXIF_DATA lpExif, LPCBYTE lpData)
+{ return lpExif->bBigEndian ? GetWordBE(lpData) : (WORD)((lpData[1] << 8) | lpData[0]); }
+
+__inline DWORD GetExifDword(LPCEXIF_DATA lpExif, LPCBYTE lpData)
+{ return lpExif->bBigEndian ? ((DWORD)GetExifWord(lpExif, lpData) << 16) | GetExifWord(lpExif, lpData + 2) :
+	((DWORD)GetExifWord(lpExif, lpData + 2) << 16) | GetExifWord(lpExif, lpData); }
+
+// Checks whether a marker starts a frame
+__inline BOOL IsFrameMarker(BYTE bMarker)
+{ return bMarker >= JPEG_SOF0 && bMarker <= JPEG_SOF15 && bMarker != JPEG_DHT && bMarker != JPEG_JPG && bMarker != JPEG_DAC; }
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ParseJpeg(HWND hDlg, HANDLE hFile, DWORD dwFileSize)
+{
+	if (hDlg == NULL || hFile == NULL || dwFileSize == 0)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	HWND hwndEdit = GetDlgItem(hDlg, IDC_OUTPUT);
+	if (hwndEdit == NULL)
+		return FALSE;
+
+	HWND hwndThumb = GetDlgItem(hDlg, IDC_THUMB);
+	if (hwndThumb == NULL)
+		return FALSE;
+
+	// Map the file into memory. The markers are read directly from the view
+	// and the file is copied from it into the passthrough DIB of the thumbnail.
+	HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+		return FALSE;
+
+	LPCBYTE lpFile = (LPCBYTE)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, dwFileSize);
+	if (lpFile == NULL)
+	{
+		DWORD dwError = GetLastError();
+		CloseHandle(hMapping);
+		SetLastError(dwError);
+		return FALSE;
+	}
+
+	JPEG_REPORT report;
+	ZeroMemory(&report, sizeof(report));
+	report.hwndEdit = hwndEdit;
+
+	BOOL bComplete = FALSE;
+
+	OutputText(hwndEdit, g_szSepThin);
+	OutputText(hwndEdit, TEXT("Marker |     Offset |     Length | Content\r\n"));
+
+	__try
+	{
+		// List the markers without entropy decoding
+		bComplete = ScanJpegMarkers(lpFile, dwFileSize, PrintJpegSegment, &report);
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ?
+		EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		bComplete = FALSE;
+	}
+
+	PrintJpegSummary(&report, dwFileSize);
+	if (!bComplete)
+		OutputTextFromID(hwndEdit, IDS_CORRUPTED);
+
+	// The image is not decoded here. The thumbnail gets a copy of the file as passthrough DIB,
+	// which is decoded when it's drawn, with the size of the thumbnail control. This allows
+	// an Exif thumbnail to be used instead of the main image.
+	HANDLE hDib = CreateJpegDib(&report, lpFile, dwFileSize);
+
+	UnmapViewOfFile(lpFile);
+	CloseHandle(hMapping);
+
+	if (hDib == NULL)
+	{
+		SetThumbnailText(hwndThumb, IDS_UNSUPPORTED);
+		return FALSE;
+	}
+
+	// Parse the passthrough DIB
+	if (!ParseDIBitmap(hDlg, hDib))
+	{
+		DWORD dwError = GetLastError();
+		FreeDib(hDib);
+		if (dwError != ERROR_SUCCESS)
+			SetLastError(dwError);
+		return FALSE;
+	}
+
+	ReplaceThumbnail(hwndThumb, hDib);
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE CreateJpegDib(LPJPEG_REPORT lpReport, LPCBYTE lpFile, DWORD dwFileSize)
+{
+	if (lpReport == NULL || lpFile == NULL || dwFileSize == 0 || lpReport->bFrame == 0)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+
+	// The profile is only embedded if all chunks are present. JpegToDib converts CMYK
+	// and YCCK images to RGB and discards their profile, so it's not embedded either.
+	DWORD cbProfile = 0;
+	if (lpReport->uIccChunks > 0 && lpReport->uIccChunks == lpReport->uIccChunkCount &&
+		lpReport->uComponents != 4)
+		cbProfile = lpReport->cbIccProfile;
+
+	DWORD dwHeaderSize = cbProfile > 0 ? sizeof(BITMAPV5HEADER) : sizeof(BITMAPINFOHEADER);
+	if (dwFileSize > MAXDWORD - dwHeaderSize - cbProfile)
+	{
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+
+	HANDLE hDib = AllocDib(dwHeaderSize + dwFileSize + cbProfile);
+	if (hDib == NULL)
+		return NULL;
+
+	LPBYTE lpbi = (LPBYTE)GlobalLock(hDib);
+	if (lpbi == NULL)
+	{
+		FreeDib(hDib);
+		return NULL;
+	}
+
+	// The file is read from the view, the pages may not be available
+	__try
+	{
+		CopyMemory(lpbi + dwHeaderSize, lpFile, dwFileSize);
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ?
+		EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		GlobalUnlock(hDib);
+		FreeDib(hDib);
+		SetLastError(ERROR_READ_FAULT);
+		return NULL;
+	}
+
+	LPBITMAPV5HEADER lpbih = (LPBITMAPV5HEADER)lpbi;
+	lpbih->bV5Size        = dwHeaderSize;
+	lpbih->bV5Width       = lpReport->uWidth;
+	lpbih->bV5Height      = lpReport->uHeight;
+	lpbih->bV5Planes      = 1;
+	lpbih->bV5BitCount    = 0;
+	lpbih->bV5Compression = BI_JPEG;
+	lpbih->bV5SizeImage   = dwFileSize;
+
+	if (cbProfile > 0)
+	{
+		// Assemble the profile from the copy, which can no longer fail with an in-page error
+		JPEG_ICC_COPY copy;
+		ZeroMemory(&copy, sizeof(copy));
+		copy.lpProfile = lpbi + dwHeaderSize + dwFileSize;
+		copy.cbProfile = cbProfile;
+
+		ScanJpegMarkers(lpbi + dwHeaderSize, dwFileSize, CopyIccChunk, &copy);
+
+		if (!copy.bFailed && copy.cbCopied == cbProfile && copy.uChunks == lpReport->uIccChunkCount)
+		{
+			lpbih->bV5CSType      = PROFILE_EMBEDDED;
+			lpbih->bV5Intent      = LCS_GM_IMAGES;
+			lpbih->bV5ProfileData = dwHeaderSize + dwFileSize;
+			lpbih->bV5ProfileSize = cbProfile;
+		}
+		else
+			lpbih->bV5CSType = LCS_sRGB;
+	}
+
+	GlobalUnlock(hDib);
+
+	return hDib;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CALLBACK CopyIccChunk(LPCJPEG_SEGMENT lpSegment, LPVOID lpParam)
+{
+	LPJPEG_ICC_COPY lpCopy = (LPJPEG_ICC_COPY)lpParam;
+	if (lpSegment == NULL || lpCopy == NULL)
+		return FALSE;
+
+	LPCBYTE lpData = lpSegment->lpData;
+	DWORD cbData = lpSegment->cbData;
+
+	// libjpeg only reads the markers in front of the first scan
+	if (lpSegment->bMarker == JPEG_SOS)
+		return FALSE;
+
+	if (lpSegment->bMarker != JPEG_APP0 + 2 || cbData < 14 || memcmp(lpData, "ICC_PROFILE", 12) != 0)
+		return TRUE;
+
+	// Only chunks that are stored in ascending order are assembled
+	if (lpData[12] != lpCopy->uChunks + 1 || cbData - 14 > lpCopy->cbProfile - lpCopy->cbCopied)
+	{
+		lpCopy->bFailed = TRUE;
+		return FALSE;
+	}
+
+	CopyMemory(lpCopy->lpProfile + lpCopy->cbCopied, lpData + 14, cbData - 14);
+	lpCopy->cbCopied += cbData - 14;
+	lpCopy->uChunks++;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ScanJpegMarkers(LPCBYTE lpData, DWORD dwSize, JPEGSEGMENTPROC lpfnSegment, LPVOID lpParam)
+{
+	if (lpData == NULL || lpfnSegment == NULL || dwSize < 2 ||
+		lpData[0] != 0xFF || lpData[1] != JPEG_SOI)
+	{
+		SetLastError(ERROR_INVALID_DATA);
+		return FALSE;
+	}
+
+	JPEG_SEGMENT seg;
+	DWORD dwPos = 0;
+
+	for (;;)
+	{
+		// Skip extraneous bytes and fill bytes in front of the marker
+		while (dwPos < dwSize && lpData[dwPos] != 0xFF)
+			dwPos++;
+		while (dwPos < dwSize && lpData[dwPos] == 0xFF)
+			dwPos++;
+		if (dwPos >= dwSize)
+			break;
+
+		ZeroMemory(&seg, sizeof(seg));
+		seg.bMarker = lpData[dwPos++];
+		seg.dwOffset = dwPos - 2;
+		seg.dwLength = 2;
+
+		// Markers without a length field
+		if (seg.bMarker == JPEG_SOI || seg.bMarker == JPEG_EOI || seg.bMarker == JPEG_TEM ||
+			(seg.bMarker >= JPEG_RST0 && seg.bMarker <= JPEG_RST7))
+		{
+			if (!lpfnSegment(&seg, lpParam) || seg.bMarker == JPEG_EOI)
+				return TRUE;
+			continue;
+		}
+
+		// The length field includes itself, but not the marker
+		if (dwSize - dwPos < 2)
+			break;
+		DWORD cbLength = GetWordBE(lpData + dwPos);
+		if (cbLength < 2 || cbLength > dwSize - dwPos)
+			break;
+
+		seg.dwLength = cbLength + 2;
+		seg.lpData = lpData + dwPos + 2;
+		seg.cbData = cbLength - 2;
+		dwPos += cbLength;
+
+		if (!lpfnSegment(&seg, lpParam))
+			return TRUE;
+
+		if (seg.bMarker != JPEG_SOS)
+			continue;
+
+		// The entropy-coded data ends at the first marker that is neither a stuffed
+		// zero byte nor a restart marker. Only the 0xFF bytes have to be examined.
+		ZeroMemory(&seg, sizeof(seg));
+		seg.bMarker = JPEG_ECS;
+		seg.dwOffset = dwPos;
+		seg.lpData = lpData + dwPos;
+
+		for (;;)
+		{
+			LPCBYTE lpNext = (LPCBYTE)memchr(lpData + dwPos, 0xFF, dwSize - dwPos);
+			if (lpNext == NULL || lpNext + 1 >= lpData + dwSize)
+			{
+				dwPos = dwSize;
+				break;
+			}
+
+			dwPos = (DWORD)(lpNext - lpData);
+			BYTE bNext = lpNext[1];
+			if (bNext == 0x00)
+				dwPos += 2;
+			else if (bNext >= JPEG_RST0 && bNext <= JPEG_RST7)
+			{
+				seg.uRestarts++;
+				dwPos += 2;
+			}
+			else if (bNext == 0xFF)
+				dwPos++;
+			else
+				break;
+		}
+
+		seg.cbData = dwPos - seg.dwOffset;
+		seg.dwLength = seg.cbData;
+		if (!lpfnSegment(&seg, lpParam))
+			return TRUE;
+	}
+
+	// Truncated segment or missing EOI marker
+	SetLastError(ERROR_INVALID_DATA);
+	return FALSE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CALLBACK PrintJpegSegment(LPCJPEG_SEGMENT lpSegment, LPVOID lpParam)
+{
+	LPJPEG_REPORT lpReport = (LPJPEG_REPORT)lpParam;
+	if (lpSegment == NULL || lpReport == NULL)
+		return FALSE;
+
+	HWND hwndEdit = lpReport->hwndEdit;
+	BYTE bMarker = lpSegment->bMarker;
+	LPCBYTE lpData = lpSegment->lpData;
+
+	TCHAR szName[16];
+	GetJpegMarkerName(bMarker, szName, _countof(szName));
+	OutputTextFmt(hwndEdit, TEXT("%-6s | %10u | %10u |"), szName, lpSegment->dwOffset, lpSegment->dwLength);
+
+	if (bMarker >= JPEG_APP0 && bMarker <= JPEG_APP15)
+		PrintAppSegment(lpReport, lpSegment);
+	else if (bMarker == JPEG_DQT)
+		PrintQuantTables(lpReport, lpSegment);
+	else if (bMarker == JPEG_DHT)
+		PrintHuffmanTables(lpReport, lpSegment);
+	else if (IsFrameMarker(bMarker))
+		PrintFrameHeader(lpReport, lpSegment);
+	else if (bMarker == JPEG_SOS)
+		PrintScanHeader(lpReport, lpSegment);
+	else if (bMarker == JPEG_DRI && lpSegment->cbData >= 2)
+	{
+		lpReport->bRestartInterval = TRUE;
+		lpReport->uRestartInterval = GetWordBE(lpData);
+		OutputTextFmt(hwndEdit, TEXT(" %u MCUs"), lpReport->uRestartInterval);
+	}
+	else if (bMarker == JPEG_DNL && lpSegment->cbData >= 2)
+		OutputTextFmt(hwndEdit, TEXT(" %u lines"), GetWordBE(lpData));
+	else if (bMarker == JPEG_COM)
+	{
+		CHAR szComment[48];
+		UINT uLen = min(lpSegment->cbData, _countof(szComment) - 1);
+		for (UINT u = 0; u < uLen; u++)
+			szComment[u] = isprint(lpData[u]) ? lpData[u] : '.';
+		szComment[uLen] = '\0';
+		OutputTextFmt(hwndEdit, TEXT(" \"%hs\"%s"), szComment, lpSegment->cbData > uLen ? TEXT("...") : TEXT(""));
+	}
+	else if (bMarker == JPEG_ECS)
+	{
+		lpReport->uRestarts += lpSegment->uRestarts;
+		if (lpSegment->uRestarts > 0)
+			OutputTextFmt(hwndEdit, TEXT(" %u restart markers"), lpSegment->uRestarts);
+	}
+	else if (bMarker == JPEG_EOI)
+	{
+		lpReport->bEndOfImage = TRUE;
+		lpReport->dwEndOfImage = lpSegment->dwOffset + 2;
+	}
+
+	OutputText(hwndEdit, TEXT("\r\n"));
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PrintJpegSummary(LPJPEG_REPORT lpReport, DWORD dwFileSize)
+{
+	if (lpReport == NULL)
+		return;
+
+	HWND hwndEdit = lpReport->hwndEdit;
+
+	OutputText(hwndEdit, g_szSepThin);
+
+	if (lpReport->bFrame != 0)
+	{
+		LPCTSTR lpszFrameType = g_aszFrameTypes[lpReport->bFrame - JPEG_SOF0];
+		OutputTextFmt(hwndEdit, TEXT("Frame:\t\t%s\r\n"), lpszFrameType != NULL ? lpszFrameType : TEXT("Unknown"));
+		OutputTextFmt(hwndEdit, TEXT("Precision:\t%u bit\r\n"), lpReport->uPrecision);
+		OutputTextFmt(hwndEdit, TEXT("Width:\t\t%u\r\n"), lpReport->uWidth);
+		OutputTextFmt(hwndEdit, TEXT("Height:\t\t%u\r\n"), lpReport->uHeight);
+		OutputTextFmt(hwndEdit, TEXT("Components:\t%u\r\n"), lpReport->uComponents);
+
+		UINT uComponents = min(lpReport->uComponents, JPEG_MAX_COMPONENTS);
+		for (UINT u = 0; u < uComponents; u++)
+		{
+			JPEG_COMPONENT* lpComp = &lpReport->aComponents[u];
+			OutputTextFmt(hwndEdit, TEXT("Component %u:\tID %u, sampling %ux%u, quant. table %u\r\n"),
+				u + 1, lpComp->bId, lpComp->bSampling >> 4, lpComp->bSampling & 0x0F, lpComp->bQuantTable);
+		}
+
+		// Chroma subsampling relative to the luminance component
+		if (lpReport->uComponents == 3 &&
+			lpReport->aComponents[1].bSampling == lpReport->aComponents[2].bSampling)
+		{
+			UINT uH0 = lpReport->aComponents[0].bSampling >> 4;
+			UINT uV0 = lpReport->aComponents[0].bSampling & 0x0F;
+			UINT uH1 = lpReport->aComponents[1].bSampling >> 4;
+			UINT uV1 = lpReport->aComponents[1].bSampling & 0x0F;
+
+			LPCTSTR lpszSubsampling = NULL;
+			if (uH1 != 0 && uV1 != 0 && uH0 % uH1 == 0 && uV0 % uV1 == 0)
+			{
+				UINT uH = uH0 / uH1;
+				UINT uV = uV0 / uV1;
+				if (uH == 1 && uV == 1)
+					lpszSubsampling = TEXT("4:4:4");
+				else if (uH == 2 && uV == 1)
+					lpszSubsampling = TEXT("4:2:2");
+				else if (uH == 2 && uV == 2)
+					lpszSubsampling = TEXT("4:2:0");
+				else if (uH == 1 && uV == 2)
+					lpszSubsampling = TEXT("4:4:0");
+				else if (uH == 4 && uV == 1)
+					lpszSubsampling = TEXT("4:1:1");
+				else if (uH == 4 && uV == 2)
+					lpszSubsampling = TEXT("4:1:0");
+			}
+
+			if (lpszSubsampling != NULL)
+				OutputTextFmt(hwndEdit, TEXT("Subsampling:\t%s\r\n"), lpszSubsampling);
+		}
+	}
+
+	for (UINT u = 0; u < JPEG_MAX_QUANT_TBLS; u++)
+	{
+		JPEG_QUANT_TABLE* lpTable = &lpReport->aQuantTables[u];
+		if (lpTable->bDefined)
+			OutputTextFmt(hwndEdit, TEXT("QuantTable %u:\t%u bit, DC %u, AC %u - %u, average %.1f\r\n"),
+				u, lpTable->uPrecision, lpTable->wDC, lpTable->wMinAC, lpTable->wMaxAC, lpTable->dwSum / 64.0);
+	}
+
+	OutputTextFmt(hwndEdit, TEXT("Scans:\t\t%u\r\n"), lpReport->uScans);
+
+	if (lpReport->bRestartInterval)
+		OutputTextFmt(hwndEdit, TEXT("RestartIntv:\t%u MCUs, %u restart markers\r\n"),
+			lpReport->uRestartInterval, lpReport->uRestarts);
+
+	if (lpReport->uIccChunks > 0)
+		OutputTextFmt(hwndEdit, TEXT("ICC profile:\t%u bytes in %u of %u chunks\r\n"),
+			lpReport->cbIccProfile, lpReport->uIccChunks, lpReport->uIccChunkCount);
+
+	if (lpReport->bEndOfImage && lpReport->dwEndOfImage < dwFileSize)
+		OutputTextFmt(hwndEdit, TEXT("Trailing data:\t%u bytes\r\n"), dwFileSize - lpReport->dwEndOfImage);
+
+	if (lpReport->bExif)
+	{
+		OutputText(hwndEdit, g_szSepThin);
+		PrintExifData(hwndEdit, &lpReport->exif);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PrintAppSegment(LPJPEG_REPORT lpReport, LPCJPEG_SEGMENT lpSegment)
+{
+	HWND hwndEdit = lpReport->hwndEdit;
+	LPCBYTE lpData = lpSegment->lpData;
+	DWORD cbData = lpSegment->cbData;
+
+	// Most application segments start with a null-terminated identifier
+	CHAR szIdentifier[32];
+	UINT uLen = 0;
+	while (uLen < cbData && uLen < _countof(szIdentifier) - 1 && lpData[uLen] >= 0x20 && lpData[uLen] < 0x7F)
+	{
+		szIdentifier[uLen] = lpData[uLen];
+		uLen++;
+	}
+	szIdentifier[uLen] = '\0';
+
+	if (uLen > 0)
+		OutputTextFmt(hwndEdit, TEXT(" %hs"), szIdentifier);
+
+	if (lpSegment->bMarker == JPEG_APP0 + 1 && !lpReport->bExif)
+		lpReport->bExif = InitExifData(lpData, cbData, &lpReport->exif);
+	else if (lpSegment->bMarker == JPEG_APP0 && cbData >= 14 && memcmp(lpData, "JFIF", 5) == 0)
+	{
+		static const LPCTSTR aszUnits[] = { TEXT("aspect ratio"), TEXT("dpi"), TEXT("dpcm") };
+		OutputTextFmt(hwndEdit, TEXT(" %u.%02u, density %u x %u %s"), lpData[5], lpData[6],
+			GetWordBE(lpData + 8), GetWordBE(lpData + 10), lpData[7] < _countof(aszUnits) ? aszUnits[lpData[7]] : TEXT(""));
+		if (lpData[12] != 0 && lpData[13] != 0)
+			OutputTextFmt(hwndEdit, TEXT(", thumbnail %u x %u"), lpData[12], lpData[13]);
+	}
+	else if (lpSegment->bMarker == JPEG_APP0 + 2 && cbData >= 14 && memcmp(lpData, "ICC_PROFILE", 12) == 0)
+	{
+		OutputTextFmt(hwndEdit, TEXT(" chunk %u of %u, %u bytes"), lpData[12], lpData[13], cbData - 14);
+
+		if (lpReport->uIccChunks == 0)
+			lpReport->uIccChunkCount = lpData[13];
+		lpReport->uIccChunks++;
+		lpReport->cbIccProfile += cbData - 14;
+	}
+	else if (lpSegment->bMarker == JPEG_APP0 + 14 && cbData >= 12 && memcmp(lpData, "Adobe", 5) == 0)
+		OutputTextFmt(hwndEdit, TEXT(" version %u, transform %u"), GetWordBE(lpData + 5), lpData[11]);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PrintQuantTables(LPJPEG_REPORT lpReport, LPCJPEG_SEGMENT lpSegment)
+{
+	LPCBYTE lpData = lpSegment->lpData;
+	DWORD cbData = lpSegment->cbData;
+	DWORD dwPos = 0;
+
+	while (dwPos < cbData)
+	{
+		UINT uPrecision = lpData[dwPos] >> 4;
+		UINT uTable = lpData[dwPos] & 0x0F;
+		UINT cbElement = uPrecision ? 2 : 1;
+		if (cbData - dwPos - 1 < 64 * cbElement)
+		{
+			OutputText(lpReport->hwndEdit, TEXT(" truncated"));
+			return;
+		}
+
+		OutputTextFmt(lpReport->hwndEdit, TEXT("%s table %u (%u bit)"),
+			dwPos > 0 ? TEXT(",") : TEXT(""), uTable, cbElement * 8);
+
+		// The elements are stored in zigzag order, so the DC quantizer comes first
+		LPCBYTE lpElements = lpData + dwPos + 1;
+		if (uTable < JPEG_MAX_QUANT_TBLS)
+		{
+			JPEG_QUANT_TABLE* lpTable = &lpReport->aQuantTables[uTable];
+			lpTable->bDefined = TRUE;
+			lpTable->uPrecision = cbElement * 8;
+			lpTable->wMinAC = 0xFFFF;
+			lpTable->wMaxAC = 0;
+			lpTable->dwSum = 0;
+
+			for (UINT u = 0; u < 64; u++)
+			{
+				WORD wValue = cbElement == 2 ? GetWordBE(lpElements + 2 * u) : lpElements[u];
+				lpTable->dwSum += wValue;
+				if (u == 0)
+					lpTable->wDC = wValue;
+				else
+				{
+					lpTable->wMinAC = min(lpTable->wMinAC, wValue);
+					lpTable->wMaxAC = max(lpTable->wMaxAC, wValue);
+				}
+			}
+		}
+
+		dwPos += 1 + 64 * cbElement;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PrintHuffmanTables(LPJPEG_REPORT lpReport, LPCJPEG_SEGMENT lpSegment)
+{
+	LPCBYTE lpData = lpSegment->lpData;
+	DWORD cbData = lpSegment->cbData;
+	DWORD dwPos = 0;
+
+	while (dwPos < cbData)
+	{
+		if (cbData - dwPos < 17)
+		{
+			OutputText(lpReport->hwndEdit, TEXT(" truncated"));
+			return;
+		}
+
+		// The table class and destination are followed by the number of codes of each length
+		UINT uCodes = 0;
+		for (UINT u = 1; u <= 16; u++)
+			uCodes += lpData[dwPos + u];
+
+		OutputTextFmt(lpReport->hwndEdit, TEXT("%s %s %u (%u codes)"), dwPos > 0 ? TEXT(",") : TEXT(""),
+			(lpData[dwPos] >> 4) ? TEXT("AC") : TEXT("DC"), lpData[dwPos] & 0x0F, uCodes);
+
+		dwPos += 17 + uCodes;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PrintFrameHeader(LPJPEG_REPORT lpReport, LPCJPEG_SEGMENT lpSegment)
+{
+	LPCBYTE lpData = lpSegment->lpData;
+	DWORD cbData = lpSegment->cbData;
+
+	if (cbData < 6 || cbData < 6 + 3 * (DWORD)lpData[5])
+	{
+		OutputText(lpReport->hwndEdit, TEXT(" truncated"));
+		return;
+	}
+
+	UINT uComponents = lpData[5];
+	OutputTextFmt(lpReport->hwndEdit, TEXT(" %u bit, %u x %u, %u component%s"),
+		lpData[0], GetWordBE(lpData + 3), GetWordBE(lpData + 1), uComponents, uComponents == 1 ? TEXT("") : TEXT("s"));
+
+	// Hierarchical files contain more than one frame
+	if (lpReport->bFrame != 0)
+		return;
+
+	lpReport->bFrame = lpSegment->bMarker;
+	lpReport->uPrecision = lpData[0];
+	lpReport->uHeight = GetWordBE(lpData + 1);
+	lpReport->uWidth = GetWordBE(lpData + 3);
+	lpReport->uComponents = uComponents;
+
+	for (UINT u = 0; u < uComponents && u < JPEG_MAX_COMPONENTS; u++)
+	{
+		lpReport->aComponents[u].bId = lpData[6 + 3 * u];
+		lpReport->aComponents[u].bSampling = lpData[7 + 3 * u];
+		lpReport->aComponents[u].bQuantTable = lpData[8 + 3 * u];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PrintScanHeader(LPJPEG_REPORT lpReport, LPCJPEG_SEGMENT lpSegment)
+{
+	HWND hwndEdit = lpReport->hwndEdit;
+	LPCBYTE lpData = lpSegment->lpData;
+	DWORD cbData = lpSegment->cbData;
+
+	lpReport->uScans++;
+
+	if (cbData < 1 || cbData < 4 + 2 * (DWORD)lpData[0])
+	{
+		OutputText(hwndEdit, TEXT(" truncated"));
+		return;
+	}
+
+	// Component selectors, followed by the spectral selection and the successive approximation
+	UINT uComponents = lpData[0];
+	OutputText(hwndEdit, uComponents == 1 ? TEXT(" component") : TEXT(" components"));
+	for (UINT u = 0; u < uComponents; u++)
+		OutputTextFmt(hwndEdit, TEXT("%s %u"), u > 0 ? TEXT(",") : TEXT(""), lpData[1 + 2 * u]);
+
+	LPCBYTE lpParams = lpData + 1 + 2 * uComponents;
+	OutputTextFmt(hwndEdit, TEXT("; Ss %u, Se %u, Ah %u, Al %u"),
+		lpParams[0], lpParams[1], lpParams[2] >> 4, lpParams[2] & 0x0F);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL FindExifData(LPCBYTE lpData, DWORD dwSize, LPEXIF_DATA lpExif)
+{
+	if (lpData == NULL || lpExif == NULL)
+		return FALSE;
+
+	ZeroMemory(lpExif, sizeof(EXIF_DATA));
+	ScanJpegMarkers(lpData, dwSize, FindExifSegment, lpExif);
+
+	return lpExif->lpTiff != NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL GetExifThumbnail(LPCEXIF_DATA lpExif, LPCBYTE* lplpThumb, LPDWORD lpcbThumb)
+{
+	if (lpExif == NULL || lpExif->lpTiff == NULL || lplpThumb == NULL || lpcbThumb == NULL)
+		return FALSE;
+
+	// IFD1 follows IFD0 and describes the thumbnail
+	EXIF_ENTRY aEntries[EXIF_MAX_ENTRIES];
+	DWORD dwIfd1 = 0;
+	ReadExifIfd(lpExif, GetExifDword(lpExif, lpExif->lpTiff + 4), aEntries, EXIF_MAX_ENTRIES, &dwIfd1);
+	if (dwIfd1 == 0)
+		return FALSE;
+
+	UINT uEntries = ReadExifIfd(lpExif, dwIfd1, aEntries, EXIF_MAX_ENTRIES, NULL);
+
+	DWORD dwCompression = 6;
+	DWORD dwOffset = 0;
+	DWORD dwLength = 0;
+	for (UINT u = 0; u < uEntries; u++)
+	{
+		if (aEntries[u].wTag == EXIF_TAG_COMPRESSION)
+			GetExifUInt(lpExif, &aEntries[u], &dwCompression);
+		else if (aEntries[u].wTag == EXIF_TAG_JPEGIF_OFFSET)
+			GetExifUInt(lpExif, &aEntries[u], &dwOffset);
+		else if (aEntries[u].wTag == EXIF_TAG_JPEGIF_LENGTH)
+			GetExifUInt(lpExif, &aEntries[u], &dwLength);
+	}
+
+	// Only JPEG compressed thumbnails are supported
+	if (dwCompression != 6 || dwOffset == 0 || dwLength < 4 ||
+		dwOffset > lpExif->cbTiff || dwLength > lpExif->cbTiff - dwOffset)
+		return FALSE;
+
+	LPCBYTE lpThumb = lpExif->lpTiff + dwOffset;
+	if (lpThumb[0] != 0xFF || lpThumb[1] != JPEG_SOI)
+		return FALSE;
+
+	*lplpThumb = lpThumb;
+	*lpcbThumb = dwLength;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL GetExifOrientation(LPCEXIF_DATA lpExif, LPUINT lpuOrientation, LPCBYTE* lplpValue)
+{
+	if (lpExif == NULL || lpExif->lpTiff == NULL || lpuOrientation == NULL)
+		return FALSE;
+
+	EXIF_ENTRY aEntries[EXIF_MAX_ENTRIES];
+	UINT uEntries = ReadExifIfd(lpExif, GetExifDword(lpExif, lpExif->lpTiff + 4), aEntries, EXIF_MAX_ENTRIES, NULL);
+
+	for (UINT u = 0; u < uEntries; u++)
+	{
+		DWORD dwOrientation = 0;
+		if (aEntries[u].wTag == EXIF_TAG_ORIENTATION && aEntries[u].wType == EXIF_TYPE_SHORT &&
+			GetExifUInt(lpExif, &aEntries[u], &dwOrientation) && dwOrientation >= 1 && dwOrientation <= 8)
+		{
+			*lpuOrientation = dwOrientation;
+			if (lplpValue != NULL)
+				*lplpValue = aEntries[u].lpValue;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL GetJpegDimensions(LPCBYTE lpData, DWORD dwSize, LPUINT lpuWidth, LPUINT lpuHeight)
+{
+	if (lpData == NULL || lpuWidth == NULL || lpuHeight == NULL)
+		return FALSE;
+
+	// The callback function stores the number of lines and samples per line
+	UINT auSize[2] = { 0, 0 };
+	ScanJpegMarkers(lpData, dwSize, FindFrameHeader, auSize);
+
+	*lpuWidth = auSize[0];
+	*lpuHeight = auSize[1];
+
+	return auSize[0] != 0 && auSize[1] != 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PrintExifData(HWND hwndEdit, LPCEXIF_DATA lpExif)
+{
+	EXIF_ENTRY aEntries[EXIF_MAX_ENTRIES];
+	DWORD dwIfd1 = 0;
+	DWORD dwExifIfd = 0;
+
+	OutputTextFmt(hwndEdit, TEXT("Exif:\t\t%u bytes, %s byte order\r\n"),
+		lpExif->cbTiff, lpExif->bBigEndian ? TEXT("Motorola") : TEXT("Intel"));
+
+	// IFD0 contains the camera data and the pointer to the Exif IFD
+	UINT uEntries = ReadExifIfd(lpExif, GetExifDword(lpExif, lpExif->lpTiff + 4), aEntries, EXIF_MAX_ENTRIES, &dwIfd1);
+	for (UINT u = 0; u < uEntries; u++)
+	{
+		if (aEntries[u].wTag == EXIF_TAG_EXIF_IFD)
+			GetExifUInt(lpExif, &aEntries[u], &dwExifIfd);
+		else
+			PrintExifEntry(hwndEdit, lpExif, &aEntries[u]);
+	}
+
+	// Capture settings
+	if (dwExifIfd != 0)
+	{
+		uEntries = ReadExifIfd(lpExif, dwExifIfd, aEntries, EXIF_MAX_ENTRIES, NULL);
+		for (UINT u = 0; u < uEntries; u++)
+			PrintExifEntry(hwndEdit, lpExif, &aEntries[u]);
+	}
+
+	LPCBYTE lpThumb = NULL;
+	DWORD cbThumb = 0;
+	UINT uWidth = 0;
+	UINT uHeight = 0;
+	if (GetExifThumbnail(lpExif, &lpThumb, &cbThumb))
+	{
+		OutputTextFmt(hwndEdit, TEXT("Thumbnail:\tJPEG, %u bytes"), cbThumb);
+		if (GetJpegDimensions(lpThumb, cbThumb, &uWidth, &uHeight))
+			OutputTextFmt(hwndEdit, TEXT(", %u x %u"), uWidth, uHeight);
+		OutputText(hwndEdit, TEXT("\r\n"));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PrintExifEntry(HWND hwndEdit, LPCEXIF_DATA lpExif, const EXIF_ENTRY* lpEntry)
+{
+	LPCTSTR lpszName = NULL;
+	DWORD dwValue = 0;
+
+	switch (lpEntry->wTag)
+	{
+		case EXIF_TAG_MAKE:             lpszName = TEXT("Make:\t\t"); break;
+		case EXIF_TAG_MODEL:            lpszName = TEXT("Model:\t\t"); break;
+		case EXIF_TAG_SOFTWARE:         lpszName = TEXT("Software:\t"); break;
+		case EXIF_TAG_DATETIME:         lpszName = TEXT("DateTime:\t"); break;
+		case EXIF_TAG_DATETIMEORIGINAL: lpszName = TEXT("DateTimeOrig.:\t"); break;
+		case EXIF_TAG_ORIENTATION:      lpszName = TEXT("Orientation:\t"); break;
+		case EXIF_TAG_EXPOSURETIME:     lpszName = TEXT("ExposureTime:\t"); break;
+		case EXIF_TAG_FNUMBER:          lpszName = TEXT("FNumber:\t"); break;
+		case EXIF_TAG_ISO:              lpszName = TEXT("ISO:\t\t"); break;
+		case EXIF_TAG_FOCALLENGTH:      lpszName = TEXT("FocalLength:\t"); break;
+		case EXIF_TAG_PIXELXDIMENSION:  lpszName = TEXT("PixelXDim.:\t"); break;
+		case EXIF_TAG_PIXELYDIMENSION:  lpszName = TEXT("PixelYDim.:\t"); break;
+		default:
+			return;
+	}
+
+	if (lpEntry->wType == EXIF_TYPE_ASCII)
+	{ // Null-terminated string
+		CHAR szText[64];
+		UINT uLen = 0;
+		while (uLen < lpEntry->dwCount && uLen < _countof(szText) - 1 && lpEntry->lpValue[uLen] != '\0')
+		{
+			szText[uLen] = isprint(lpEntry->lpValue[uLen]) ? lpEntry->lpValue[uLen] : '.';
+			uLen++;
+		}
+		szText[uLen] = '\0';
+		OutputTextFmt(hwndEdit, TEXT("%s%hs\r\n"), lpszName, szText);
+	}
+	else if (lpEntry->wType == EXIF_TYPE_RATIONAL)
+	{ // Numerator and denominator
+		DWORD dwNumerator = GetExifDword(lpExif, lpEntry->lpValue);
+		DWORD dwDenominator = GetExifDword(lpExif, lpEntry->lpValue + 4);
+		if (dwDenominator == 0)
+			return;
+
+		double dValue = (double)dwNumerator / dwDenominator;
+		if (lpEntry->wTag == EXIF_TAG_EXPOSURETIME && dValue > 0.0 && dValue < 1.0)
+			OutputTextFmt(hwndEdit, TEXT("%s1/%.0f s\r\n"), lpszName, 1.0 / dValue);
+		else if (lpEntry->wTag == EXIF_TAG_EXPOSURETIME)
+			OutputTextFmt(hwndEdit, TEXT("%s%g s\r\n"), lpszName, dValue);
+		else if (lpEntry->wTag == EXIF_TAG_FNUMBER)
+			OutputTextFmt(hwndEdit, TEXT("%sf/%.1f\r\n"), lpszName, dValue);
+		else if (lpEntry->wTag == EXIF_TAG_FOCALLENGTH)
+			OutputTextFmt(hwndEdit, TEXT("%s%.1f mm\r\n"), lpszName, dValue);
+	}
+	else if (GetExifUInt(lpExif, lpEntry, &dwValue))
+	{
+		OutputTextFmt(hwndEdit, TEXT("%s%u"), lpszName, dwValue);
+		if (lpEntry->wTag == EXIF_TAG_ORIENTATION && dwValue >= 1 && dwValue <= _countof(g_aszOrientations))
+			OutputTextFmt(hwndEdit, TEXT(" (%s)"), g_aszOrientations[dwValue - 1]);
+		OutputText(hwndEdit, TEXT("\r\n"));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL InitExifData(LPCBYTE lpData, DWORD cbData, LPEXIF_DATA lpExif)
+{
+	// The identifier is followed by a TIFF header
+	if (lpData == NULL || lpExif == NULL || cbData < 6 + 8 || memcmp(lpData, "Exif\0", 6) != 0)
+		return FALSE;
+
+	LPCBYTE lpTiff = lpData + 6;
+	if (lpTiff[0] == 'M' && lpTiff[1] == 'M' && lpTiff[2] == 0x00 && lpTiff[3] == 0x2A)
+		lpExif->bBigEndian = TRUE;
+	else if (lpTiff[0] == 'I' && lpTiff[1] == 'I' && lpTiff[2] == 0x2A && lpTiff[3] == 0x00)
+		lpExif->bBigEndian = FALSE;
+	else
+		return FALSE;
+
+	lpExif->lpTiff = lpTiff;
+	lpExif->cbTiff = cbData - 6;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+UINT ReadExifIfd(LPCEXIF_DATA lpExif, DWORD dwOffset, LPEXIF_ENTRY lpEntries, UINT uMaxEntries, LPDWORD lpdwNextIfd)
+{
+	// Sizes of the data types 1 to 12
+	static const BYTE abTypeSize[13] = { 0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8 };
+
+	if (lpdwNextIfd != NULL)
+		*lpdwNextIfd = 0;
+
+	DWORD cbTiff = lpExif->cbTiff;
+	if (dwOffset < 8 || dwOffset > cbTiff - 2)
+		return 0;
+
+	LPCBYTE lpIfd = lpExif->lpTiff + dwOffset;
+	UINT uCount = GetExifWord(lpExif, lpIfd);
+	if (uCount > (cbTiff - dwOffset - 2) / 12)
+		return 0;
+
+	UINT uEntries = 0;
+	for (UINT u = 0; u < uCount && uEntries < uMaxEntries; u++)
+	{
+		LPCBYTE lpEntry = lpIfd + 2 + 12 * u;
+		LPEXIF_ENTRY lpResult = &lpEntries[uEntries];
+		lpResult->wTag = GetExifWord(lpExif, lpEntry);
+		lpResult->wType = GetExifWord(lpExif, lpEntry + 2);
+		lpResult->dwCount = GetExifDword(lpExif, lpEntry + 4);
+
+		if (lpResult->wType == 0 || lpResult->wType >= _countof(abTypeSize) || lpResult->dwCount == 0)
+			continue;
+
+		// Values of up to four bytes are stored in the entry itself
+		ULONGLONG ullSize = (ULONGLONG)lpResult->dwCount * abTypeSize[lpResult->wType];
+		if (ullSize <= 4)
+			lpResult->lpValue = lpEntry + 8;
+		else
+		{
+			DWORD dwValueOffset = GetExifDword(lpExif, lpEntry + 8);
+			if (dwValueOffset > cbTiff || ullSize > cbTiff - dwValueOffset)
+				continue;
+			lpResult->lpValue = lpExif->lpTiff + dwValueOffset;
+		}
+
+		uEntries++;
+	}
+
+	// The offset of the next IFD follows the last entry
+	if (lpdwNextIfd != NULL && 2 + 12 * uCount + 4 <= cbTiff - dwOffset)
+		*lpdwNextIfd = GetExifDword(lpExif, lpIfd + 2 + 12 * uCount);
+
+	return uEntries;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL GetExifUInt(LPCEXIF_DATA lpExif, const EXIF_ENTRY* lpEntry, LPDWORD lpdwValue)
+{
+	if (lpEntry->wType == EXIF_TYPE_SHORT)
+		*lpdwValue = GetExifWord(lpExif, lpEntry->lpValue);
+	else if (lpEntry->wType == EXIF_TYPE_LONG)
+		*lpdwValue = GetExifDword(lpExif, lpEntry->lpValue);
+	else
+		return FALSE;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CALLBACK FindExifSegment(LPCJPEG_SEGMENT lpSegment, LPVOID lpParam)
+{
+	if (IsFrameMarker(lpSegment->bMarker) || lpSegment->bMarker == JPEG_SOS)
+		return FALSE;
+
+	if (lpSegment->bMarker == JPEG_APP0 + 1 && InitExifData(lpSegment->lpData, lpSegment->cbData, (LPEXIF_DATA)lpParam))
+		return FALSE;
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL CALLBACK FindFrameHeader(LPCJPEG_SEGMENT lpSegment, LPVOID lpParam)
+{
+	if (IsFrameMarker(lpSegment->bMarker))
+	{
+		if (lpSegment->cbData >= 5)
+		{
+			LPUINT lpuSize = (LPUINT)lpParam;
+			lpuSize[0] = GetWordBE(lpSegment->lpData + 3);
+			lpuSize[1] = GetWordBE(lpSegment->lpData + 1);
+		}
+		return FALSE;
+	}
+
+	return lpSegment->bMarker != JPEG_SOS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void GetJpegMarkerName(BYTE bMarker, LPTSTR lpszName, SIZE_T cchName)
+{
+	LPCTSTR lpszMnemonic = NULL;
+
+	switch (bMarker)
+	{
+		case JPEG_ECS: lpszMnemonic = TEXT("Data"); break;
+		case JPEG_TEM: lpszMnemonic = TEXT("TEM"); break;
+		case JPEG_DHT: lpszMnemonic = TEXT("DHT"); break;
+		case JPEG_JPG: lpszMnemonic = TEXT("JPG"); break;
+		case JPEG_DAC: lpszMnemonic = TEXT("DAC"); break;
+		case JPEG_SOI: lpszMnemonic = TEXT("SOI"); break;
+		case JPEG_EOI: lpszMnemonic = TEXT("EOI"); break;
+		case JPEG_SOS: lpszMnemonic = TEXT("SOS"); break;
+		case JPEG_DQT: lpszMnemonic = TEXT("DQT"); break;
+		case JPEG_DNL: lpszMnemonic = TEXT("DNL"); break;
+		case JPEG_DRI: lpszMnemonic = TEXT("DRI"); break;
+		case JPEG_DHP: lpszMnemonic = TEXT("DHP"); break;
+		case JPEG_EXP: lpszMnemonic = TEXT("EXP"); break;
+		case JPEG_COM: lpszMnemonic = TEXT("COM"); break;
+	}
+
+	if (lpszMnemonic != NULL)
+		MyStrNCpy(lpszName, lpszMnemonic, (int)cchName);
+	else if (bMarker >= JPEG_SOF0 && bMarker <= JPEG_SOF15)
+		_sntprintf(lpszName, cchName, TEXT("SOF%u"), bMarker - JPEG_SOF0);
+	else if (bMarker >= JPEG_RST0 && bMarker <= JPEG_RST7)
+		_sntprintf(lpszName, cchName, TEXT("RST%u"), bMarker - JPEG_RST0);
+	else if (bMarker >= JPEG_APP0 && bMarker <= JPEG_APP15)
+		_sntprintf(lpszName, cchName, TEXT("APP%u"), bMarker - JPEG_APP0);
+	else if (bMarker >= 0xF0 && bMarker <= 0xFD)
+		_sntprintf(lpszName, cchName, TEXT("JPG%u"), bMarker - 0xF0);
+	else
+		_sntprintf(lpszName, cchName, TEXT("%02X"), bMarker);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ParseJpeg.h - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// JPEG marker codes (second byte of a marker)
+#define JPEG_SOF0           0xC0    // Start of frame, baseline DCT
+#define JPEG_SOF15          0xCF    // Start of frame, differential lossless, arithmetic coding
+#define JPEG_DHT            0xC4    // Define Huffman tables
+#define JPEG_JPG            0xC8    // Reserved for JPEG extensions
+#define JPEG_DAC            0xCC    // Define arithmetic coding conditioning
+#define JPEG_RST0           0xD0    // Restart with modulo 8 count 0
+#define JPEG_RST7           0xD7    // Restart with modulo 8 count 7
+#define JPEG_SOI            0xD8    // Start of image
+#define JPEG_EOI            0xD9    // End of image
+#define JPEG_SOS            0xDA    // Start of scan
+#define JPEG_DQT            0xDB    // Define quantization tables
+#define JPEG_DNL            0xDC    // Define number of lines
+#define JPEG_DRI            0xDD    // Define restart interval
+#define JPEG_DHP            0xDE    // Define hierarchical progression
+#define JPEG_EXP            0xDF    // Expand reference components
+#define JPEG_APP0           0xE0    // Application segment 0
+#define JPEG_APP15          0xEF    // Application segment 15
+#define JPEG_COM            0xFE    // Comment
+#define JPEG_TEM            0x01    // For temporary private use in arithmetic coding
+#define JPEG_ECS            0x00    // Pseudo marker for the entropy-coded data of a scan
+
+// Marker segment or entropy-coded data passed to the callback function of ScanJpegMarkers
+typedef struct _JPEG_SEGMENT
+{
+    BYTE    bMarker;        // Marker code or JPEG_ECS
+    DWORD   dwOffset;       // File offset of the marker or of the entropy-coded data
+    DWORD   dwLength;       // Length including the marker, the length field and all data
+    LPCBYTE lpData;         // Segment data behind the length field or entropy-coded data
+    DWORD   cbData;         // Length of the data pointed to by lpData
+    UINT    uRestarts;      // Number of restart markers in the entropy-coded data
+} JPEG_SEGMENT, FAR* LPJPEG_SEGMENT;
+
+typedef const JPEG_SEGMENT FAR* LPCJPEG_SEGMENT;
+
+// Called by ScanJpegMarkers for each segment. Returning FALSE stops the scanner.
+typedef BOOL (CALLBACK* JPEGSEGMENTPROC)(LPCJPEG_SEGMENT lpSegment, LPVOID lpParam);
+
+// Walks through the markers of a JPEG image in memory without decoding the entropy-coded
+// data. Fill bytes and extraneous bytes between segments are skipped. The function returns
+// TRUE when the EOI marker has been reached or the callback function stopped the scanner.
+// If the data is truncated or not a JPEG image, it returns FALSE and sets ERROR_INVALID_DATA.
+BOOL ScanJpegMarkers(LPCBYTE lpData, DWORD dwSize, JPEGSEGMENTPROC lpfnSegment, LPVOID lpParam);
+
+// Exif metadata of an APP1 segment
+typedef struct _EXIF_DATA
+{
+    LPCBYTE lpTiff;         // TIFF header in front of the image file directories
+    DWORD   cbTiff;         // Size of the TIFF structure
+    BOOL    bBigEndian;     // Motorola byte order
+} EXIF_DATA, FAR* LPEXIF_DATA;
+
+typedef const EXIF_DATA FAR* LPCEXIF_DATA;
+
+// Finds the Exif APP1 segment in front of the first frame of a JPEG image
+BOOL FindExifData(LPCBYTE lpData, DWORD dwSize, LPEXIF_DATA lpExif);
+
+// Checks the identifier and the TIFF header of an APP1 segment (the data behind the length field)
+BOOL InitExifData(LPCBYTE lpData, DWORD cbData, LPEXIF_DATA lpExif);
+
+// Gets the JPEG thumbnail that is stored in the second image file directory (IFD1)
+BOOL GetExifThumbnail(LPCEXIF_DATA lpExif, LPCBYTE* lplpThumb, LPDWORD lpcbThumb);
+
+// Gets the orientation (1 to 8) from the first image file directory (IFD0). If lplpValue is
+// not NULL, it receives the position of the SHORT value inside the TIFF structure.
+BOOL GetExifOrientation(LPCEXIF_DATA lpExif, LPUINT lpuOrientation, LPCBYTE* lplpValue);
+
+// Gets the image size from the first frame header of a JPEG image
+BOOL GetJpegDimensions(LPCBYTE lpData, DWORD dwSize, LPUINT lpuWidth, LPUINT lpuHeight);
+
+// Parses a JPEG file and displays its marker structure and metadata
+BOOL ParseJpeg(HWND hDlg, HANDLE hFile, DWORD dwFileSize);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
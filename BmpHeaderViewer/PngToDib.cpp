@@ -0,0 +1,963 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// PngToDib.cpp - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Data Types
+
+#define HUFFMAN_FAST_BITS   9           // Number of code bits resolved by a single table lookup
+#define HUFFMAN_MAX_BITS    15          // Maximum length of a deflate Huffman code
+#define HUFFMAN_MAX_SYMBOLS 288         // Number of literal/length symbols
+
+#define PNG_MAX_PROFILE     0x01000000  // Upper limit for the size of an embedded ICC profile
+
+// Huffman decoding table
+typedef struct _HUFFMAN_TABLE
+{
+	WORD awFast[1 << HUFFMAN_FAST_BITS];    // Symbol | (code length << 9) of short codes, or 0
+	WORD awCount[HUFFMAN_MAX_BITS + 1];     // Number of codes of each length
+	WORD awSymbol[HUFFMAN_MAX_SYMBOLS];     // Symbols in canonical order
+} HUFFMAN_TABLE, *LPHUFFMAN_TABLE;
+
+// Deflate stream
+typedef struct _INFLATE_STREAM
+{
+	LPCBYTE lpIn;           // Compressed data
+	SIZE_T  cbIn;           // Size of the compressed data
+	SIZE_T  cbInPos;        // Read position
+	UINT64  ullBits;        // Bit buffer
+	UINT    uBitCount;      // Number of bits in the bit buffer
+	SIZE_T  cbOverrun;      // Number of zero bytes added beyond the end of the input
+	LPBYTE  lpOut;          // Output buffer
+	SIZE_T  cbOut;          // Size of the output buffer
+	SIZE_T  cbOutPos;       // Write position
+} INFLATE_STREAM, *LPINFLATE_STREAM;
+
+// PNG image information
+typedef struct _PNG_INFO
+{
+	UINT    uWidth;         // Image width
+	UINT    uHeight;        // Image height
+	BYTE    bBitDepth;      // Bits per sample
+	BYTE    bColorType;     // 0 = Gray, 2 = RGB, 3 = Palette, 4 = Gray + Alpha, 6 = RGBA
+	BYTE    bInterlace;     // 0 = None, 1 = Adam7
+	UINT    uChannels;      // Number of samples per pixel
+	UINT    uNumColors;     // Number of PLTE entries
+	RGBQUAD argbColors[256];// Palette including tRNS alpha values
+	BOOL    bHasTrans;      // tRNS chunk for gray or RGB images present
+	WORD    awTrans[3];     // Transparent gray or RGB sample values
+} PNG_INFO, *LPPNG_INFO;
+typedef const PNG_INFO* LPCPNG_INFO;
+
+// Signature at the beginning of each PNG file
+static const BYTE g_abPngSignature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+
+// Base values and extra bits of the length and distance codes
+static const WORD g_awLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const BYTE g_abLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const WORD g_awDistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const BYTE g_abDistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// Order of the code length code lengths in a dynamic block header
+static const BYTE g_abCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Adam7 pass origins and increments
+static const BYTE g_abAdam7[7][4] = { // x0, y0, dx, dy
+	{ 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+	{ 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 } };
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Helper functions
+
+// Decompresses a zlib stream into a buffer of fixed size
+static BOOL InflateZlib(LPCBYTE lpIn, SIZE_T cbIn, LPBYTE lpOut, SIZE_T cbOut, SIZE_T* pcbWritten);
+// Decompresses all blocks of a raw deflate stream
+static BOOL InflateBlocks(LPINFLATE_STREAM lpStream);
+// Decompresses a block with fixed or dynamic Huffman codes
+static BOOL InflateHuffmanBlock(LPINFLATE_STREAM lpStream, const HUFFMAN_TABLE* lpLitTable, const HUFFMAN_TABLE* lpDistTable);
+// Builds the decoding tables for a dynamic Huffman block
+static BOOL ReadDynamicTables(LPINFLATE_STREAM lpStream, LPHUFFMAN_TABLE lpLitTable, LPHUFFMAN_TABLE lpDistTable);
+// Builds a canonical Huffman decoding table from a list of code lengths
+static BOOL BuildHuffmanTable(LPHUFFMAN_TABLE lpTable, LPCBYTE lpLengths, UINT uNumSymbols);
+// Decodes a single Huffman coded symbol
+static int DecodeSymbol(LPINFLATE_STREAM lpStream, const HUFFMAN_TABLE* lpTable);
+// Reverses the PNG filter of an image row
+static BOOL UnfilterRow(BYTE bFilter, LPBYTE lpRow, LPCBYTE lpPrev, UINT uRowBytes, UINT uPixelBytes);
+// Converts an unfiltered image row to BGRA
+static void ConvertRow(LPCPNG_INFO lpPng, LPCBYTE lpRow, LPBYTE lpDest, UINT uPixels, UINT uStep);
+// Reads an embedded ICC profile from an iCCP chunk
+static LPBYTE ReadProfileChunk(LPCBYTE lpChunk, DWORD dwChunkLen, LPDWORD lpdwProfileLen);
+
+__inline DWORD ReadBigEndian32(LPCBYTE lp)
+{ return ((DWORD)lp[0] << 24) | ((DWORD)lp[1] << 16) | ((DWORD)lp[2] << 8) | lp[3]; }
+
+__inline WORD ReadBigEndian16(LPCBYTE lp)
+{ return (WORD)((lp[0] << 8) | lp[1]); }
+
+// Fills the bit buffer. Zero bytes are appended to the end of the input.
+__inline void RefillBits(LPINFLATE_STREAM lpStream)
+{
+	while (lpStream->uBitCount <= 56)
+	{
+		BYTE b = 0;
+		if (lpStream->cbInPos < lpStream->cbIn)
+			b = lpStream->lpIn[lpStream->cbInPos++];
+		else
+			lpStream->cbOverrun++;
+		lpStream->ullBits |= (UINT64)b << lpStream->uBitCount;
+		lpStream->uBitCount += 8;
+	}
+}
+
+// Checks whether any of the appended zero bytes have been consumed
+__inline BOOL IsTruncated(LPINFLATE_STREAM lpStream)
+{ return lpStream->cbOverrun * 8 > lpStream->uBitCount; }
+
+// Removes n bits (n <= 32) from the bit buffer
+__inline UINT GetBits(LPINFLATE_STREAM lpStream, UINT n)
+{
+	RefillBits(lpStream);
+	UINT uValue = (UINT)(lpStream->ullBits & ((1ULL << n) - 1));
+	lpStream->ullBits >>= n;
+	lpStream->uBitCount -= n;
+	return uValue;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE PngToDib(LPVOID lpPngData, DWORD dwLenData)
+{
+	LPCBYTE lpData = (LPCBYTE)lpPngData;
+	if (lpData == NULL || dwLenData < sizeof(g_abPngSignature) + 25 ||
+		memcmp(lpData, g_abPngSignature, sizeof(g_abPngSignature)) != 0)
+	{
+		SetLastError(ERROR_INVALID_DATA);
+		return NULL;
+	}
+
+	PNG_INFO Png;
+	ZeroMemory(&Png, sizeof(Png));
+
+	LPCBYTE lpIdat = NULL;          // Compressed image data
+	SIZE_T cbIdat = 0;              // Size of the compressed image data
+	UINT uNumIdat = 0;              // Number of IDAT chunks
+	LPCBYTE lpProfileChunk = NULL;  // iCCP chunk data
+	DWORD dwProfileChunkLen = 0;    // iCCP chunk size
+	LONG lXPelsPerMeter = 0;
+	LONG lYPelsPerMeter = 0;
+	BOOL bHeader = FALSE;
+
+	// Walk through the chunks. The first pass only determines the size
+	// of the image data, because the IDAT chunks may not be contiguous.
+	DWORD dwPos = sizeof(g_abPngSignature);
+	while (dwLenData - dwPos >= 12)
+	{
+		DWORD dwChunkLen = ReadBigEndian32(lpData + dwPos);
+		DWORD dwChunkType = ReadBigEndian32(lpData + dwPos + 4);
+		LPCBYTE lpChunk = lpData + dwPos + 8;
+
+		// Use the available part of a truncated chunk
+		DWORD dwAvail = dwLenData - dwPos - 8;
+		if (dwChunkLen > dwAvail)
+			dwChunkLen = dwAvail;
+
+		if (!bHeader && dwChunkType != 'IHDR')
+			break;
+
+		if (dwChunkType == 'IHDR' && !bHeader && dwChunkLen >= 13)
+		{
+			Png.uWidth = ReadBigEndian32(lpChunk);
+			Png.uHeight = ReadBigEndian32(lpChunk + 4);
+			Png.bBitDepth = lpChunk[8];
+			Png.bColorType = lpChunk[9];
+			Png.bInterlace = lpChunk[12];
+			if (lpChunk[10] != 0 || lpChunk[11] != 0 || Png.bInterlace > 1)
+				break;
+			bHeader = TRUE;
+		}
+		else if (dwChunkType == 'PLTE' && uNumIdat == 0)
+		{
+			Png.uNumColors = min(dwChunkLen / 3, 256);
+			for (UINT u = 0; u < Png.uNumColors; u++)
+			{
+				Png.argbColors[u].rgbRed      = lpChunk[u * 3];
+				Png.argbColors[u].rgbGreen    = lpChunk[u * 3 + 1];
+				Png.argbColors[u].rgbBlue     = lpChunk[u * 3 + 2];
+				Png.argbColors[u].rgbReserved = 0xFF;
+			}
+		}
+		else if (dwChunkType == 'tRNS' && uNumIdat == 0)
+		{
+			if (Png.bColorType == 3)
+			{
+				for (UINT u = 0; u < dwChunkLen && u < Png.uNumColors; u++)
+					Png.argbColors[u].rgbReserved = lpChunk[u];
+			}
+			else if (Png.bColorType == 0 && dwChunkLen >= 2)
+			{
+				Png.awTrans[0] = ReadBigEndian16(lpChunk);
+				Png.bHasTrans = TRUE;
+			}
+			else if (Png.bColorType == 2 && dwChunkLen >= 6)
+			{
+				Png.awTrans[0] = ReadBigEndian16(lpChunk);
+				Png.awTrans[1] = ReadBigEndian16(lpChunk + 2);
+				Png.awTrans[2] = ReadBigEndian16(lpChunk + 4);
+				Png.bHasTrans = TRUE;
+			}
+		}
+		else if (dwChunkType == 'pHYs' && dwChunkLen >= 9)
+		{
+			if (lpChunk[8] == 1)
+			{ // Pixel per meter
+				lXPelsPerMeter = (LONG)ReadBigEndian32(lpChunk);
+				lYPelsPerMeter = (LONG)ReadBigEndian32(lpChunk + 4);
+			}
+		}
+		else if (dwChunkType == 'iCCP' && uNumIdat == 0)
+		{
+			lpProfileChunk = lpChunk;
+			dwProfileChunkLen = dwChunkLen;
+		}
+		else if (dwChunkType == 'IDAT')
+		{
+			if (uNumIdat++ == 0)
+				lpIdat = lpChunk;
+			cbIdat += dwChunkLen;
+		}
+		else if (dwChunkType == 'IEND')
+			break;
+
+		if (dwAvail - dwChunkLen < 4)
+			break;
+		dwPos += 12 + dwChunkLen;
+	}
+
+	// Validate the image header
+	switch (Png.bColorType)
+	{
+		case 0: Png.uChannels = 1; break;
+		case 2: Png.uChannels = 3; break;
+		case 3: Png.uChannels = 1; break;
+		case 4: Png.uChannels = 2; break;
+		case 6: Png.uChannels = 4; break;
+	}
+
+	BYTE b = Png.bBitDepth;
+	if (!bHeader || uNumIdat == 0 || Png.uChannels == 0 ||
+		Png.uWidth == 0 || Png.uWidth > 0x7FFFFFFF || Png.uHeight == 0 || Png.uHeight > 0x7FFFFFFF ||
+		(b != 1 && b != 2 && b != 4 && b != 8 && b != 16) ||
+		(Png.bColorType == 3 && b == 16) || (Png.bColorType != 0 && Png.bColorType != 3 && b < 8) ||
+		(Png.bColorType == 3 && Png.uNumColors == 0) ||
+		(UINT64)Png.uWidth * Png.uHeight * 4 > 0x80000000)
+	{
+		SetLastError(ERROR_INVALID_DATA);
+		return NULL;
+	}
+
+	// Determine the size of the decompressed image data (filter bytes included)
+	UINT uBitsPerPixel = Png.uChannels * Png.bBitDepth;
+	UINT uPixelBytes = max(uBitsPerPixel / 8, 1);
+	UINT uPasses = Png.bInterlace ? 7 : 1;
+	UINT64 ullRawSize = 0;
+	for (UINT uPass = 0; uPass < uPasses; uPass++)
+	{
+		UINT64 ullPassWidth = Png.uWidth, ullPassHeight = Png.uHeight;
+		if (Png.bInterlace)
+		{
+			ullPassWidth = (Png.uWidth + g_abAdam7[uPass][2] - g_abAdam7[uPass][0] - 1) / g_abAdam7[uPass][2];
+			ullPassHeight = (Png.uHeight + g_abAdam7[uPass][3] - g_abAdam7[uPass][1] - 1) / g_abAdam7[uPass][3];
+		}
+		if (ullPassWidth != 0)
+			ullRawSize += ullPassHeight * (1 + (ullPassWidth * uBitsPerPixel + 7) / 8);
+	}
+	if (ullRawSize > 0xFFFFFFFF)
+	{
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+
+	// Gather the IDAT chunks into one buffer if they are not contiguous
+	LPBYTE lpIdatCopy = NULL;
+	if (uNumIdat > 1)
+	{
+		lpIdatCopy = (LPBYTE)MyGlobalAllocPtr(GMEM_MOVEABLE, cbIdat);
+		if (lpIdatCopy == NULL)
+			return NULL;
+
+		SIZE_T cbCopied = 0;
+		dwPos = sizeof(g_abPngSignature);
+		while (dwLenData - dwPos >= 12 && cbCopied < cbIdat)
+		{
+			DWORD dwChunkLen = ReadBigEndian32(lpData + dwPos);
+			DWORD dwChunkType = ReadBigEndian32(lpData + dwPos + 4);
+			DWORD dwAvail = dwLenData - dwPos - 8;
+			if (dwChunkLen > dwAvail)
+				dwChunkLen = dwAvail;
+			if (dwChunkType == 'IDAT')
+			{
+				dwChunkLen = (DWORD)min(dwChunkLen, cbIdat - cbCopied);
+				CopyMemory(lpIdatCopy + cbCopied, lpData + dwPos + 8, dwChunkLen);
+				cbCopied += dwChunkLen;
+			}
+			if (dwAvail - dwChunkLen < 4)
+				break;
+			dwPos += 12 + dwChunkLen;
+		}
+		lpIdat = lpIdatCopy;
+	}
+
+	// Decompress the image data. Rows that are missing
+	// in a truncated or damaged stream remain zero.
+	LPBYTE lpRaw = (LPBYTE)MyGlobalAllocPtr(GHND, (SIZE_T)ullRawSize + 1);
+	if (lpRaw == NULL)
+	{
+		if (lpIdatCopy != NULL)
+			MyGlobalFreePtr(lpIdatCopy);
+		return NULL;
+	}
+
+	SIZE_T cbRaw = 0;
+	BOOL bSuccess = InflateZlib(lpIdat, cbIdat, lpRaw, (SIZE_T)ullRawSize, &cbRaw);
+
+	if (lpIdatCopy != NULL)
+		MyGlobalFreePtr(lpIdatCopy);
+
+	if (!bSuccess && cbRaw == 0)
+	{
+		MyGlobalFreePtr(lpRaw);
+		SetLastError(ERROR_INVALID_DATA);
+		return NULL;
+	}
+
+	// Read an existing ICC profile
+	DWORD dwProfileLen = 0;
+	LPBYTE lpProfileData = NULL;
+	if (lpProfileChunk != NULL)
+		lpProfileData = ReadProfileChunk(lpProfileChunk, dwProfileChunkLen, &dwProfileLen);
+
+	// Allocate memory for the DIB. Only the header must be zeroed,
+	// the pixels are overwritten completely by the passes below.
+	DWORD dwHeaderSize = lpProfileData != NULL ? sizeof(BITMAPV5HEADER) : sizeof(BITMAPINFOHEADER);
+	DWORD dwImageSize = Png.uWidth * Png.uHeight * 4;
+	HANDLE hDib = AllocDib(dwHeaderSize + dwProfileLen + dwImageSize, FALSE);
+	LPBITMAPV5HEADER lpBIV5 = hDib != NULL ? (LPBITMAPV5HEADER)GlobalLock(hDib) : NULL;
+	if (lpBIV5 == NULL)
+	{
+		if (hDib != NULL)
+			FreeDib(hDib);
+		if (lpProfileData != NULL)
+			MyGlobalFreePtr(lpProfileData);
+		MyGlobalFreePtr(lpRaw);
+		return NULL;
+	}
+
+	ZeroMemory(lpBIV5, dwHeaderSize);
+
+	lpBIV5->bV5Size = dwHeaderSize;
+	lpBIV5->bV5Width = Png.uWidth;
+	lpBIV5->bV5Height = Png.uHeight;
+	lpBIV5->bV5Planes = 1;
+	lpBIV5->bV5BitCount = 32;
+	lpBIV5->bV5Compression = BI_RGB;
+	lpBIV5->bV5SizeImage = dwImageSize;
+	lpBIV5->bV5XPelsPerMeter = lXPelsPerMeter;
+	lpBIV5->bV5YPelsPerMeter = lYPelsPerMeter;
+
+	// Embed an existing ICC profile into the DIB
+	if (lpProfileData != NULL)
+	{
+		lpBIV5->bV5CSType = PROFILE_EMBEDDED;
+		lpBIV5->bV5Intent = LCS_GM_IMAGES;
+		lpBIV5->bV5ProfileSize = dwProfileLen;
+		lpBIV5->bV5ProfileData = dwHeaderSize;
+
+		CopyMemory((LPBYTE)lpBIV5 + dwHeaderSize, lpProfileData, dwProfileLen);
+		MyGlobalFreePtr(lpProfileData);
+	}
+
+	// The previous row of the first row of each pass consists of zeros
+	UINT uMaxRowBytes = (UINT)(((UINT64)Png.uWidth * uBitsPerPixel + 7) / 8);
+	LPBYTE lpZeroRow = (LPBYTE)MyGlobalAllocPtr(GHND, uMaxRowBytes);
+	if (lpZeroRow == NULL)
+	{
+		GlobalUnlock(hDib);
+		FreeDib(hDib);
+		MyGlobalFreePtr(lpRaw);
+		return NULL;
+	}
+
+	// Unfilter the rows of each pass and copy the pixels into the bottom-up DIB
+	LPBYTE lpBits = (LPBYTE)lpBIV5 + dwHeaderSize + dwProfileLen;
+	UINT uIncrement = Png.uWidth * 4;
+	LPBYTE lpRow = lpRaw;
+	for (UINT uPass = 0; uPass < uPasses; uPass++)
+	{
+		UINT x0 = 0, y0 = 0, dx = 1, dy = 1;
+		if (Png.bInterlace)
+		{
+			x0 = g_abAdam7[uPass][0];
+			y0 = g_abAdam7[uPass][1];
+			dx = g_abAdam7[uPass][2];
+			dy = g_abAdam7[uPass][3];
+		}
+		if (x0 >= Png.uWidth || y0 >= Png.uHeight)
+			continue;
+
+		UINT uPassWidth = (Png.uWidth - x0 + dx - 1) / dx;
+		UINT uRowBytes = (UINT)(((UINT64)uPassWidth * uBitsPerPixel + 7) / 8);
+		LPCBYTE lpPrev = lpZeroRow;
+
+		for (UINT y = y0; y < Png.uHeight; y += dy)
+		{
+			if (!UnfilterRow(lpRow[0], lpRow + 1, lpPrev, uRowBytes, uPixelBytes))
+				ZeroMemory(lpRow + 1, uRowBytes);
+
+			ConvertRow(&Png, lpRow + 1, lpBits + (UINT_PTR)(Png.uHeight - 1 - y) * uIncrement + x0 * 4,
+				uPassWidth, dx * 4);
+
+			lpPrev = lpRow + 1;
+			lpRow += 1 + uRowBytes;
+		}
+	}
+
+	MyGlobalFreePtr(lpZeroRow);
+	MyGlobalFreePtr(lpRaw);
+	GlobalUnlock(hDib);
+
+	return hDib;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// The PNG filters predict each byte from the byte to the left (a), the byte above (b) and
+// the byte above left (c). The loops are kept simple so that the compiler can vectorize
+// the Sub, Up and Average filters. The Paeth predictor depends on the previous result.
+
+BOOL UnfilterRow(BYTE bFilter, LPBYTE lpRow, LPCBYTE lpPrev, UINT uRowBytes, UINT uPixelBytes)
+{
+	UINT u;
+
+	switch (bFilter)
+	{
+		case 0: // None
+			break;
+
+		case 1: // Sub
+			for (u = uPixelBytes; u < uRowBytes; u++)
+				lpRow[u] += lpRow[u - uPixelBytes];
+			break;
+
+		case 2: // Up
+			for (u = 0; u < uRowBytes; u++)
+				lpRow[u] += lpPrev[u];
+			break;
+
+		case 3: // Average
+			for (u = 0; u < uPixelBytes && u < uRowBytes; u++)
+				lpRow[u] += lpPrev[u] >> 1;
+			for (; u < uRowBytes; u++)
+				lpRow[u] += (BYTE)((lpRow[u - uPixelBytes] + lpPrev[u]) >> 1);
+			break;
+
+		case 4: // Paeth
+			for (u = 0; u < uPixelBytes && u < uRowBytes; u++)
+				lpRow[u] += lpPrev[u];
+			for (; u < uRowBytes; u++)
+			{
+				int a = lpRow[u - uPixelBytes];
+				int b = lpPrev[u];
+				int c = lpPrev[u - uPixelBytes];
+				int pa = abs(b - c);
+				int pb = abs(a - c);
+				int pc = abs(a + b - c - c);
+				lpRow[u] += (BYTE)((pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c));
+			}
+			break;
+
+		default:
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ConvertRow(LPCPNG_INFO lpPng, LPCBYTE lpRow, LPBYTE lpDest, UINT uPixels, UINT uStep)
+{
+	UINT uDepth = lpPng->bBitDepth;
+
+	switch (lpPng->bColorType)
+	{
+		case 0: // Grayscale
+			if (uDepth == 16)
+			{
+				for (UINT u = 0; u < uPixels; u++, lpDest += uStep)
+				{
+					WORD w = ReadBigEndian16(lpRow + u * 2);
+					lpDest[0] = lpDest[1] = lpDest[2] = (BYTE)(w >> 8);
+					lpDest[3] = (lpPng->bHasTrans && w == lpPng->awTrans[0]) ? 0 : 0xFF;
+				}
+			}
+			else
+			{
+				UINT uMax = (1 << uDepth) - 1;
+				for (UINT u = 0; u < uPixels; u++, lpDest += uStep)
+				{
+					UINT uBit = u * uDepth;
+					UINT v = (lpRow[uBit >> 3] >> (8 - uDepth - (uBit & 7))) & uMax;
+					lpDest[0] = lpDest[1] = lpDest[2] = (BYTE)(v * 255 / uMax);
+					lpDest[3] = (lpPng->bHasTrans && v == lpPng->awTrans[0]) ? 0 : 0xFF;
+				}
+			}
+			break;
+
+		case 2: // RGB
+			if (uDepth == 16)
+			{
+				for (UINT u = 0; u < uPixels; u++, lpDest += uStep, lpRow += 6)
+				{
+					WORD r = ReadBigEndian16(lpRow), g = ReadBigEndian16(lpRow + 2), b = ReadBigEndian16(lpRow + 4);
+					lpDest[0] = (BYTE)(b >> 8);
+					lpDest[1] = (BYTE)(g >> 8);
+					lpDest[2] = (BYTE)(r >> 8);
+					lpDest[3] = (lpPng->bHasTrans && r == lpPng->awTrans[0] &&
+						g == lpPng->awTrans[1] && b == lpPng->awTrans[2]) ? 0 : 0xFF;
+				}
+			}
+			else
+			{
+				for (UINT u = 0; u < uPixels; u++, lpDest += uStep, lpRow += 3)
+				{
+					lpDest[0] = lpRow[2];
+					lpDest[1] = lpRow[1];
+					lpDest[2] = lpRow[0];
+					lpDest[3] = (lpPng->bHasTrans && lpRow[0] == lpPng->awTrans[0] &&
+						lpRow[1] == lpPng->awTrans[1] && lpRow[2] == lpPng->awTrans[2]) ? 0 : 0xFF;
+				}
+			}
+			break;
+
+		case 3: // Palette
+			{
+				UINT uMask = (1 << uDepth) - 1;
+				for (UINT u = 0; u < uPixels; u++, lpDest += uStep)
+				{
+					UINT uBit = u * uDepth;
+					UINT uIndex = (lpRow[uBit >> 3] >> (8 - uDepth - (uBit & 7))) & uMask;
+					if (uIndex < lpPng->uNumColors)
+					{
+						lpDest[0] = lpPng->argbColors[uIndex].rgbBlue;
+						lpDest[1] = lpPng->argbColors[uIndex].rgbGreen;
+						lpDest[2] = lpPng->argbColors[uIndex].rgbRed;
+						lpDest[3] = lpPng->argbColors[uIndex].rgbReserved;
+					}
+					else
+					{ // Out of range indices are displayed black
+						lpDest[0] = lpDest[1] = lpDest[2] = 0;
+						lpDest[3] = 0xFF;
+					}
+				}
+			}
+			break;
+
+		case 4: // Grayscale + Alpha
+			{
+				UINT uBytes = uDepth / 4;
+				for (UINT u = 0; u < uPixels; u++, lpDest += uStep, lpRow += uBytes)
+				{
+					lpDest[0] = lpDest[1] = lpDest[2] = lpRow[0];
+					lpDest[3] = lpRow[uBytes / 2];
+				}
+			}
+			break;
+
+		case 6: // RGBA
+			{
+				UINT uBytes = uDepth / 2;
+				UINT uSample = uDepth / 8;
+				for (UINT u = 0; u < uPixels; u++, lpDest += uStep, lpRow += uBytes)
+				{
+					lpDest[0] = lpRow[uSample * 2];
+					lpDest[1] = lpRow[uSample];
+					lpDest[2] = lpRow[0];
+					lpDest[3] = lpRow[uSample * 3];
+				}
+			}
+			break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// The iCCP chunk contains the profile name, a null separator, the
+// compression method and the zlib stream. The size of the profile
+// is taken from the profile header after decompressing its beginning.
+
+LPBYTE ReadProfileChunk(LPCBYTE lpChunk, DWORD dwChunkLen, LPDWORD lpdwProfileLen)
+{
+	DWORD dwNameLen = 0;
+	while (dwNameLen < dwChunkLen && dwNameLen < 80 && lpChunk[dwNameLen] != 0)
+		dwNameLen++;
+
+	if (dwNameLen == 0 || dwNameLen >= 80 || dwNameLen + 2 >= dwChunkLen || lpChunk[dwNameLen + 1] != 0)
+		return NULL;
+
+	LPCBYTE lpStream = lpChunk + dwNameLen + 2;
+	DWORD dwStreamLen = dwChunkLen - dwNameLen - 2;
+
+	BYTE abHeader[128];
+	SIZE_T cbWritten = 0;
+	InflateZlib(lpStream, dwStreamLen, abHeader, sizeof(abHeader), &cbWritten);
+	if (cbWritten < sizeof(abHeader))
+		return NULL;
+
+	DWORD dwProfileLen = ReadBigEndian32(abHeader);
+	if (dwProfileLen < sizeof(abHeader) || dwProfileLen > PNG_MAX_PROFILE)
+		return NULL;
+
+	LPBYTE lpProfileData = (LPBYTE)MyGlobalAllocPtr(GMEM_MOVEABLE, dwProfileLen);
+	if (lpProfileData == NULL)
+		return NULL;
+
+	if (!InflateZlib(lpStream, dwStreamLen, lpProfileData, dwProfileLen, &cbWritten) || cbWritten != dwProfileLen)
+	{
+		MyGlobalFreePtr(lpProfileData);
+		return NULL;
+	}
+
+	*lpdwProfileLen = dwProfileLen;
+
+	return lpProfileData;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// A zlib stream consists of a two-byte header, the deflate data and an Adler-32 checksum.
+// The checksum is not verified. The function fails if the decompressed data does not fit
+// into the output buffer, but the output buffer contains the data decompressed so far.
+
+BOOL InflateZlib(LPCBYTE lpIn, SIZE_T cbIn, LPBYTE lpOut, SIZE_T cbOut, SIZE_T* pcbWritten)
+{
+	*pcbWritten = 0;
+
+	if (lpIn == NULL || cbIn < 2 || (lpIn[0] & 0x0F) != 8 || (lpIn[0] >> 4) > 7 ||
+		((lpIn[0] << 8) | lpIn[1]) % 31 != 0 || (lpIn[1] & 0x20) != 0)
+		return FALSE;
+
+	INFLATE_STREAM Stream = { 0 };
+	Stream.lpIn = lpIn + 2;
+	Stream.cbIn = cbIn - 2;
+	Stream.lpOut = lpOut;
+	Stream.cbOut = cbOut;
+
+	BOOL bSuccess = InflateBlocks(&Stream);
+	*pcbWritten = Stream.cbOutPos;
+
+	return bSuccess;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL InflateBlocks(LPINFLATE_STREAM lpStream)
+{
+	HUFFMAN_TABLE LitTable, DistTable;
+	UINT uFinal = 0;
+
+	do
+	{
+		uFinal = GetBits(lpStream, 1);
+		UINT uType = GetBits(lpStream, 2);
+
+		if (uType == 0)
+		{ // Stored block: skip to the next byte boundary
+			GetBits(lpStream, lpStream->uBitCount & 7);
+			UINT uLen = GetBits(lpStream, 16);
+			UINT uNLen = GetBits(lpStream, 16);
+			if (uLen != (~uNLen & 0xFFFF) || IsTruncated(lpStream))
+				return FALSE;
+
+			while (uLen > 0)
+			{
+				if (lpStream->cbOutPos >= lpStream->cbOut)
+					return FALSE;
+				if (lpStream->uBitCount >= 8)
+				{ // Drain the bit buffer first
+					lpStream->lpOut[lpStream->cbOutPos++] = (BYTE)lpStream->ullBits;
+					lpStream->ullBits >>= 8;
+					lpStream->uBitCount -= 8;
+					uLen--;
+				}
+				else
+				{ // Then copy directly from the input
+					SIZE_T cbCopy = min(min((SIZE_T)uLen, lpStream->cbIn - lpStream->cbInPos),
+						lpStream->cbOut - lpStream->cbOutPos);
+					if (cbCopy == 0)
+						return FALSE;
+					CopyMemory(lpStream->lpOut + lpStream->cbOutPos, lpStream->lpIn + lpStream->cbInPos, cbCopy);
+					lpStream->cbOutPos += cbCopy;
+					lpStream->cbInPos += cbCopy;
+					uLen -= (UINT)cbCopy;
+				}
+			}
+			if (IsTruncated(lpStream))
+				return FALSE;
+		}
+		else if (uType == 1)
+		{ // Fixed Huffman codes
+			BYTE abLengths[HUFFMAN_MAX_SYMBOLS];
+			UINT u = 0;
+			for (; u < 144; u++) abLengths[u] = 8;
+			for (; u < 256; u++) abLengths[u] = 9;
+			for (; u < 280; u++) abLengths[u] = 7;
+			for (; u < 288; u++) abLengths[u] = 8;
+			BuildHuffmanTable(&LitTable, abLengths, 288);
+			for (u = 0; u < 30; u++) abLengths[u] = 5;
+			BuildHuffmanTable(&DistTable, abLengths, 30);
+
+			if (!InflateHuffmanBlock(lpStream, &LitTable, &DistTable))
+				return FALSE;
+		}
+		else if (uType == 2)
+		{ // Dynamic Huffman codes
+			if (!ReadDynamicTables(lpStream, &LitTable, &DistTable) ||
+				!InflateHuffmanBlock(lpStream, &LitTable, &DistTable))
+				return FALSE;
+		}
+		else
+			return FALSE;
+	}
+	while (!uFinal);
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL InflateHuffmanBlock(LPINFLATE_STREAM lpStream, const HUFFMAN_TABLE* lpLitTable, const HUFFMAN_TABLE* lpDistTable)
+{
+	LPBYTE lpOut = lpStream->lpOut;
+	SIZE_T cbOut = lpStream->cbOut;
+	SIZE_T cbOutPos = lpStream->cbOutPos;
+	BOOL bSuccess = FALSE;
+
+	for (;;)
+	{
+		int nSymbol = DecodeSymbol(lpStream, lpLitTable);
+		if (nSymbol < 0 || IsTruncated(lpStream))
+			break;
+
+		if (nSymbol < 256)
+		{ // Literal
+			if (cbOutPos >= cbOut)
+				break;
+			lpOut[cbOutPos++] = (BYTE)nSymbol;
+		}
+		else if (nSymbol == 256)
+		{ // End of block
+			bSuccess = TRUE;
+			break;
+		}
+		else
+		{ // Length/distance pair
+			nSymbol -= 257;
+			if (nSymbol >= 29)
+				break;
+			SIZE_T cbLen = g_awLengthBase[nSymbol] + GetBits(lpStream, g_abLengthExtra[nSymbol]);
+
+			nSymbol = DecodeSymbol(lpStream, lpDistTable);
+			if (nSymbol < 0 || nSymbol >= 30)
+				break;
+			SIZE_T cbDist = g_awDistBase[nSymbol] + GetBits(lpStream, g_abDistExtra[nSymbol]);
+			if (cbDist > cbOutPos || IsTruncated(lpStream))
+				break;
+
+			// Copy as much as fits, byte by byte because the source may overlap the destination
+			SIZE_T cbCopy = min(cbLen, cbOut - cbOutPos);
+			LPBYTE lpSrc = lpOut + cbOutPos - cbDist;
+			LPBYTE lpDest = lpOut + cbOutPos;
+			for (SIZE_T cb = 0; cb < cbCopy; cb++)
+				lpDest[cb] = lpSrc[cb];
+			cbOutPos += cbCopy;
+
+			if (cbCopy < cbLen)
+				break;
+		}
+	}
+
+	lpStream->cbOutPos = cbOutPos;
+
+	return bSuccess;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ReadDynamicTables(LPINFLATE_STREAM lpStream, LPHUFFMAN_TABLE lpLitTable, LPHUFFMAN_TABLE lpDistTable)
+{
+	UINT uNumLit = GetBits(lpStream, 5) + 257;
+	UINT uNumDist = GetBits(lpStream, 5) + 1;
+	UINT uNumCodeLen = GetBits(lpStream, 4) + 4;
+	if (uNumLit > 286 || uNumDist > 30)
+		return FALSE;
+
+	// Code lengths of the code length alphabet
+	BYTE abLengths[HUFFMAN_MAX_SYMBOLS + 32] = { 0 };
+	for (UINT u = 0; u < uNumCodeLen; u++)
+		abLengths[g_abCodeLengthOrder[u]] = (BYTE)GetBits(lpStream, 3);
+
+	HUFFMAN_TABLE CodeLenTable;
+	if (!BuildHuffmanTable(&CodeLenTable, abLengths, 19))
+		return FALSE;
+
+	// Code lengths of the literal/length and distance alphabets
+	UINT uIndex = 0;
+	while (uIndex < uNumLit + uNumDist)
+	{
+		int nSymbol = DecodeSymbol(lpStream, &CodeLenTable);
+		if (nSymbol < 0 || IsTruncated(lpStream))
+			return FALSE;
+
+		if (nSymbol < 16)
+		{
+			abLengths[uIndex++] = (BYTE)nSymbol;
+			continue;
+		}
+
+		BYTE bLen = 0;
+		UINT uRepeat = 0;
+		if (nSymbol == 16)
+		{
+			if (uIndex == 0)
+				return FALSE;
+			bLen = abLengths[uIndex - 1];
+			uRepeat = 3 + GetBits(lpStream, 2);
+		}
+		else if (nSymbol == 17)
+			uRepeat = 3 + GetBits(lpStream, 3);
+		else
+			uRepeat = 11 + GetBits(lpStream, 7);
+
+		if (uIndex + uRepeat > uNumLit + uNumDist)
+			return FALSE;
+		while (uRepeat--)
+			abLengths[uIndex++] = bLen;
+	}
+
+	// The end-of-block code is required
+	if (abLengths[256] == 0)
+		return FALSE;
+
+	return BuildHuffmanTable(lpLitTable, abLengths, uNumLit) &&
+		BuildHuffmanTable(lpDistTable, abLengths + uNumLit, uNumDist);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Codes up to HUFFMAN_FAST_BITS long are stored in a lookup table indexed by the next
+// bits of the stream (in reversed order, since deflate packs Huffman codes MSB first).
+// Longer codes are decoded bit by bit using the number of codes per length.
+
+BOOL BuildHuffmanTable(LPHUFFMAN_TABLE lpTable, LPCBYTE lpLengths, UINT uNumSymbols)
+{
+	WORD awOffset[HUFFMAN_MAX_BITS + 2];
+	UINT uLen, u;
+
+	ZeroMemory(lpTable->awCount, sizeof(lpTable->awCount));
+	for (u = 0; u < uNumSymbols; u++)
+		lpTable->awCount[lpLengths[u]]++;
+	lpTable->awCount[0] = 0;
+
+	// Reject over-subscribed code sets. Incomplete sets are permitted.
+	int nLeft = 1;
+	for (uLen = 1; uLen <= HUFFMAN_MAX_BITS; uLen++)
+	{
+		nLeft <<= 1;
+		nLeft -= lpTable->awCount[uLen];
+		if (nLeft < 0)
+			return FALSE;
+	}
+
+	// Sort the symbols by code length
+	awOffset[1] = 0;
+	for (uLen = 1; uLen <= HUFFMAN_MAX_BITS; uLen++)
+		awOffset[uLen + 1] = awOffset[uLen] + lpTable->awCount[uLen];
+	for (u = 0; u < uNumSymbols; u++)
+		if (lpLengths[u] != 0)
+			lpTable->awSymbol[awOffset[lpLengths[u]]++] = (WORD)u;
+
+	// Fill the lookup table with the short codes
+	ZeroMemory(lpTable->awFast, sizeof(lpTable->awFast));
+	UINT uCode = 0, uIndex = 0;
+	for (uLen = 1; uLen <= HUFFMAN_FAST_BITS; uLen++)
+	{
+		for (u = 0; u < lpTable->awCount[uLen]; u++, uIndex++, uCode++)
+		{
+			UINT uReversed = 0;
+			for (UINT uBit = 0; uBit < uLen; uBit++)
+				uReversed |= ((uCode >> uBit) & 1) << (uLen - 1 - uBit);
+
+			WORD wEntry = (WORD)((uLen << 9) | lpTable->awSymbol[uIndex]);
+			for (UINT v = uReversed; v < (1 << HUFFMAN_FAST_BITS); v += (1 << uLen))
+				lpTable->awFast[v] = wEntry;
+		}
+		uCode <<= 1;
+	}
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int DecodeSymbol(LPINFLATE_STREAM lpStream, const HUFFMAN_TABLE* lpTable)
+{
+	RefillBits(lpStream);
+
+	WORD wEntry = lpTable->awFast[lpStream->ullBits & ((1 << HUFFMAN_FAST_BITS) - 1)];
+	if (wEntry != 0)
+	{
+		UINT uLen = wEntry >> 9;
+		lpStream->ullBits >>= uLen;
+		lpStream->uBitCount -= uLen;
+		return wEntry & 0x1FF;
+	}
+
+	UINT64 ullBits = lpStream->ullBits;
+	int nCode = 0, nFirst = 0, nIndex = 0;
+	for (UINT uLen = 1; uLen <= HUFFMAN_MAX_BITS; uLen++)
+	{
+		nCode |= (int)(ullBits & 1);
+		ullBits >>= 1;
+		int nCount = lpTable->awCount[uLen];
+		if (nCode - nCount < nFirst)
+		{
+			lpStream->ullBits >>= uLen;
+			lpStream->uBitCount -= uLen;
+			return lpTable->awSymbol[nIndex + (nCode - nFirst)];
+		}
+		nIndex += nCount;
+		nFirst += nCount;
+		nFirst <<= 1;
+		nCode <<= 1;
+	}
+
+	return -1; // Invalid code
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,663 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Quantize.cpp - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+#include "stdafx.h"
+
+// Depth of the octree, one level per bit of the histogram
+#define OCTREE_DEPTH        HISTOGRAM_BITS
+// Number of cells of the color histogram
+#define HISTOGRAM_SIZE      (1 << (3 * HISTOGRAM_BITS))
+// Maximum number of partial histograms that are built in parallel
+#define MAX_HISTOGRAMS      64
+// Number of k-means iterations that refine the palette of the octree
+#define KMEANS_ITERATIONS   2
+
+// Resolution of the inverse color map in bits per color channel (red, green, blue)
+#define CMAP_C0_BITS        5
+#define CMAP_C1_BITS        6
+#define CMAP_C2_BITS        5
+// Size of the boxes that are filled at once (log2 of the number of cells per dimension)
+#define BOX_C0_LOG          2
+#define BOX_C1_LOG          3
+#define BOX_C2_LOG          2
+// Number of boxes per dimension
+#define BOXES_C0            (1 << (CMAP_C0_BITS - BOX_C0_LOG))
+#define BOXES_C1            (1 << (CMAP_C1_BITS - BOX_C1_LOG))
+#define BOXES_C2            (1 << (CMAP_C2_BITS - BOX_C2_LOG))
+
+// States of a box of the inverse color map
+#define BOX_EMPTY           0
+#define BOX_FILLING         1
+#define BOX_FILLED          2
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Node of the octree used for color quantization
+typedef struct _OCTREE_NODE
+{
+    ULONGLONG     ullRed;                     // Sum of the red values (leaves only)
+    ULONGLONG     ullGreen;                   // Sum of the green values (leaves only)
+    ULONGLONG     ullBlue;                    // Sum of the blue values (leaves only)
+    ULONGLONG     ullPixels;                  // Number of pixels in this subtree
+    BOOL          bIsLeaf;                    // The node represents a palette color
+    struct _OCTREE_NODE FAR* lpNext;          // Next reducible node of the same level or next free node
+    struct _OCTREE_NODE FAR* alpChildren[8];  // Child nodes, indexed by one bit of each color
+} OCTREE_NODE, FAR* LPOCTREE_NODE;
+
+// Octree that is reduced to the maximum number of colors while the colors are added
+typedef struct _OCTREE
+{
+    LPOCTREE_NODE lpPool;                     // Memory block of all nodes
+    LPOCTREE_NODE lpFree;                     // List of unused nodes
+    LPOCTREE_NODE lpRoot;                     // Root node
+    LPOCTREE_NODE alpReducible[OCTREE_DEPTH]; // Lists of the inner nodes of each level
+    UINT          uLeaves;                    // Current number of colors
+    UINT          uMaxColors;                 // Maximum number of colors
+} OCTREE, FAR* LPOCTREE;
+
+// Parameters of the parallel histogram creation
+typedef struct _HISTOGRAM_JOB
+{
+    LPCDIB_FORMAT  lpFormat;                     // Format of the DIB
+    LPCBYTE        lpBits;                       // Bitmap bits of the DIB
+    LONG           lRows;                        // Number of scan lines
+    UINT           uParts;                       // Number of partial histograms
+    LPDWORD        alpHistograms[MAX_HISTOGRAMS]; // Partial histograms
+} HISTOGRAM_JOB, FAR* LPHISTOGRAM_JOB;
+
+// Inverse color map with the nearest color table index for each 5-6-5 color
+struct _INVERSE_CMAP
+{
+    RGBQUAD        aColors[256];                 // Color table
+    UINT           uColors;                      // Number of colors
+    volatile LONG  alBoxState[BOXES_C0 * BOXES_C1 * BOXES_C2]; // BOX_EMPTY, BOX_FILLING or BOX_FILLED
+    BYTE           abCells[1 << (CMAP_C0_BITS + CMAP_C1_BITS + CMAP_C2_BITS)]; // Color indexes
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Forward declarations of functions included in this code module
+
+// Builds the histogram of a part of the scan lines
+static void CALLBACK BuildPartialHistogram(UINT uIndex, LPVOID lpParam);
+// Moves the palette colors to the centroids of the histogram cells mapped to them
+static void RefinePalette(LPCDWORD lpHistogram, LPRGBQUAD lpColors, UINT uColors);
+// Returns the color value at the center of a histogram cell
+static int HistogramCellValue(UINT uCell);
+// Finds the nearest color table entry by comparing all colors
+static UINT FindNearestColor(const RGBQUAD FAR* lpColors, UINT uColors, int nRed, int nGreen, int nBlue);
+// Fills a box of the inverse color map, considering only the colors that can be nearest
+static void FillInverseBox(LPINVERSE_CMAP lpMap, UINT uBox);
+
+// Allocates the node pool of an octree and creates the root node
+static BOOL OctreeCreate(LPOCTREE lpTree, UINT uMaxColors);
+// Adds a color to an octree and reduces the tree if it has too many colors
+static void OctreeAddColor(LPOCTREE lpTree, DWORD dwColor, ULONGLONG ullCount);
+// Takes a node from the free list and links it into the tree structure
+static LPOCTREE_NODE OctreeNewNode(LPOCTREE lpTree, UINT uLevel);
+// Merges the children of the least used inner node of the deepest level
+static void OctreeReduce(LPOCTREE lpTree);
+// Stores the colors of all leaves in a color table
+static void OctreeGetColors(LPOCTREE_NODE lpNode, LPRGBQUAD lpColors, LPUINT lpuColors);
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+UINT CreateOptimizedPalette(LPCDIB_FORMAT lpFormat, LPCBYTE lpBits, LONG lRows, LPRGBQUAD lpColors, UINT uMaxColors)
+{
+	if (lpFormat == NULL || lpBits == NULL || lpColors == NULL)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+
+	uMaxColors = min(max(uMaxColors, 2U), 256U);
+
+	// Build one partial histogram per processor and merge them at the end
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+
+	HISTOGRAM_JOB hj = { 0 };
+	hj.lpFormat = lpFormat;
+	hj.lpBits = lpBits;
+	hj.lRows = max(lRows, 0);
+	hj.uParts = min(min(si.dwNumberOfProcessors, (DWORD)MAX_HISTOGRAMS), (DWORD)max(hj.lRows, 1));
+
+	ParallelFor(hj.uParts, BuildPartialHistogram, &hj);
+
+	UINT uColors = 0;
+	LPDWORD lpHistogram = hj.alpHistograms[0];
+	BOOL bSuccess = (lpHistogram != NULL);
+
+	for (UINT u = 1; u < hj.uParts; u++)
+	{
+		LPDWORD lpPart = hj.alpHistograms[u];
+		if (lpPart == NULL)
+		{
+			bSuccess = FALSE;
+			continue;
+		}
+
+		if (bSuccess)
+		{
+			for (UINT uCell = 0; uCell < HISTOGRAM_SIZE; uCell++)
+				lpHistogram[uCell] += lpPart[uCell];
+		}
+
+		MyGlobalFreePtr(lpPart);
+	}
+
+	OCTREE tree;
+	if (bSuccess && OctreeCreate(&tree, uMaxColors))
+	{
+		for (UINT uCell = 0; uCell < HISTOGRAM_SIZE; uCell++)
+		{
+			if (lpHistogram[uCell] != 0)
+			{
+				DWORD dwColor = ((DWORD)HistogramCellValue(uCell) << 16) |
+					((DWORD)HistogramCellValue(uCell >> HISTOGRAM_BITS) << 8) |
+					(DWORD)HistogramCellValue(uCell >> (2 * HISTOGRAM_BITS));
+				OctreeAddColor(&tree, dwColor, lpHistogram[uCell]);
+			}
+		}
+
+		OctreeGetColors(tree.lpRoot, lpColors, &uColors);
+		MyGlobalFreePtr(tree.lpPool);
+
+		RefinePalette(lpHistogram, lpColors, uColors);
+
+		// An empty image gets a black color table entry
+		if (uColors == 0)
+		{
+			ZeroMemory(&lpColors[0], sizeof(RGBQUAD));
+			uColors = 1;
+		}
+	}
+
+	if (lpHistogram != NULL)
+		MyGlobalFreePtr(lpHistogram);
+
+	return uColors;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+LPINVERSE_CMAP CreateInverseColorMap(const RGBQUAD FAR* lpColors, UINT uColors)
+{
+	if (lpColors == NULL || uColors == 0 || uColors > 256)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+
+	LPINVERSE_CMAP lpMap = (LPINVERSE_CMAP)MyGlobalAllocPtr(GHND, sizeof(INVERSE_CMAP));
+	if (lpMap == NULL)
+		return NULL;
+
+	CopyMemory(lpMap->aColors, lpColors, uColors * sizeof(RGBQUAD));
+	lpMap->uColors = uColors;
+
+	return lpMap;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeInverseColorMap(LPINVERSE_CMAP lpMap)
+{
+	MyGlobalFreePtr(lpMap);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BYTE MapToColorIndex(LPINVERSE_CMAP lpMap, int nRed, int nGreen, int nBlue)
+{
+	UINT c0 = (UINT)nRed >> (8 - CMAP_C0_BITS);
+	UINT c1 = (UINT)nGreen >> (8 - CMAP_C1_BITS);
+	UINT c2 = (UINT)nBlue >> (8 - CMAP_C2_BITS);
+	UINT uBox = (((c0 >> BOX_C0_LOG) * BOXES_C1) + (c1 >> BOX_C1_LOG)) * BOXES_C2 + (c2 >> BOX_C2_LOG);
+
+	if (ReadAcquire(&lpMap->alBoxState[uBox]) != BOX_FILLED)
+	{
+		// The first thread that needs the box fills it, the others wait for it
+		LONG lState = InterlockedCompareExchange(&lpMap->alBoxState[uBox], BOX_FILLING, BOX_EMPTY);
+		if (lState == BOX_EMPTY)
+		{
+			FillInverseBox(lpMap, uBox);
+			InterlockedExchange(&lpMap->alBoxState[uBox], BOX_FILLED);
+		}
+		else
+		{
+			while (ReadAcquire(&lpMap->alBoxState[uBox]) != BOX_FILLED)
+				YieldProcessor();
+		}
+	}
+
+	return lpMap->abCells[(((c0 << CMAP_C1_BITS) | c1) << CMAP_C2_BITS) | c2];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void CALLBACK BuildPartialHistogram(UINT uIndex, LPVOID lpParam)
+{
+	LPHISTOGRAM_JOB lpJob = (LPHISTOGRAM_JOB)lpParam;
+	LPCDIB_FORMAT lpFormat = lpJob->lpFormat;
+
+	LONG lWidth = abs(lpFormat->lWidth);
+	LONG lFirst = (LONG)((LONGLONG)lpJob->lRows * uIndex / lpJob->uParts);
+	LONG lLast = (LONG)((LONGLONG)lpJob->lRows * (uIndex + 1) / lpJob->uParts);
+
+	LPDWORD lpHistogram = (LPDWORD)MyGlobalAllocPtr(GHND, HISTOGRAM_SIZE * sizeof(DWORD));
+	if (lpHistogram == NULL)
+		return;
+
+	LPDWORD lpRow = (LPDWORD)MyGlobalAllocPtr(GMEM_MOVEABLE, (SIZE_T)lWidth * sizeof(DWORD));
+	if (lpRow == NULL)
+	{
+		MyGlobalFreePtr(lpHistogram);
+		return;
+	}
+
+	__try
+	{
+		for (LONG h = lFirst; h < lLast; h++)
+		{
+			ConvertDibRow(lpFormat, lpJob->lpBits + (ULONG_PTR)h * lpFormat->ulIncrement, lpRow);
+
+			for (LONG w = 0; w < lWidth; w++)
+			{
+				DWORD dwColor = lpRow[w];
+				UINT uCell = ((dwColor >> (24 - HISTOGRAM_BITS)) & ((1 << HISTOGRAM_BITS) - 1)) |
+					((dwColor >> (16 - 2 * HISTOGRAM_BITS)) & (((1 << HISTOGRAM_BITS) - 1) << HISTOGRAM_BITS)) |
+					((dwColor << (3 * HISTOGRAM_BITS - 8)) & (((1 << HISTOGRAM_BITS) - 1) << (2 * HISTOGRAM_BITS)));
+				lpHistogram[uCell]++;
+			}
+		}
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER) { ; }
+
+	MyGlobalFreePtr(lpRow);
+
+	lpJob->alpHistograms[uIndex] = lpHistogram;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void RefinePalette(LPCDWORD lpHistogram, LPRGBQUAD lpColors, UINT uColors)
+{
+	if (uColors == 0)
+		return;
+
+	ULONGLONG aullRed[256], aullGreen[256], aullBlue[256], aullCount[256];
+
+	for (UINT uIteration = 0; uIteration < KMEANS_ITERATIONS; uIteration++)
+	{
+		ZeroMemory(aullRed, sizeof(aullRed));
+		ZeroMemory(aullGreen, sizeof(aullGreen));
+		ZeroMemory(aullBlue, sizeof(aullBlue));
+		ZeroMemory(aullCount, sizeof(aullCount));
+
+		for (UINT uCell = 0; uCell < HISTOGRAM_SIZE; uCell++)
+		{
+			DWORD dwCount = lpHistogram[uCell];
+			if (dwCount == 0)
+				continue;
+
+			int nRed   = HistogramCellValue(uCell);
+			int nGreen = HistogramCellValue(uCell >> HISTOGRAM_BITS);
+			int nBlue  = HistogramCellValue(uCell >> (2 * HISTOGRAM_BITS));
+
+			UINT u = FindNearestColor(lpColors, uColors, nRed, nGreen, nBlue);
+			aullRed[u]   += (ULONGLONG)nRed * dwCount;
+			aullGreen[u] += (ULONGLONG)nGreen * dwCount;
+			aullBlue[u]  += (ULONGLONG)nBlue * dwCount;
+			aullCount[u] += dwCount;
+		}
+
+		// Colors without any pixels keep their value
+		for (UINT u = 0; u < uColors; u++)
+		{
+			ULONGLONG ullCount = aullCount[u];
+			if (ullCount == 0)
+				continue;
+
+			lpColors[u].rgbRed   = (BYTE)((aullRed[u] + ullCount / 2) / ullCount);
+			lpColors[u].rgbGreen = (BYTE)((aullGreen[u] + ullCount / 2) / ullCount);
+			lpColors[u].rgbBlue  = (BYTE)((aullBlue[u] + ullCount / 2) / ullCount);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int HistogramCellValue(UINT uCell)
+{
+	// Scale the cell index so that 0 and 255 can be reached
+	const int nMax = (1 << HISTOGRAM_BITS) - 1;
+	return ((int)(uCell & nMax) * 255 + nMax / 2) / nMax;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static UINT FindNearestColor(const RGBQUAD FAR* lpColors, UINT uColors, int nRed, int nGreen, int nBlue)
+{
+	UINT uBest = 0;
+	int nBestDist = 3 * 256 * 256;
+
+	for (UINT u = 0; u < uColors; u++)
+	{
+		int dr = nRed - lpColors[u].rgbRed;
+		int dg = nGreen - lpColors[u].rgbGreen;
+		int db = nBlue - lpColors[u].rgbBlue;
+		int nDist = dr * dr + dg * dg + db * db;
+		if (nDist < nBestDist)
+		{
+			nBestDist = nDist;
+			uBest = u;
+		}
+	}
+
+	return uBest;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void FillInverseBox(LPINVERSE_CMAP lpMap, UINT uBox)
+{
+	// First cell of the box in each dimension
+	UINT c0 = (uBox / (BOXES_C1 * BOXES_C2)) << BOX_C0_LOG;
+	UINT c1 = ((uBox / BOXES_C2) % BOXES_C1) << BOX_C1_LOG;
+	UINT c2 = (uBox % BOXES_C2) << BOX_C2_LOG;
+
+	// Color range covered by the box
+	int anMin[3] = { (int)(c0 << (8 - CMAP_C0_BITS)), (int)(c1 << (8 - CMAP_C1_BITS)), (int)(c2 << (8 - CMAP_C2_BITS)) };
+	int anMax[3] = {
+		anMin[0] + (1 << (8 - CMAP_C0_BITS + BOX_C0_LOG)) - 1,
+		anMin[1] + (1 << (8 - CMAP_C1_BITS + BOX_C1_LOG)) - 1,
+		anMin[2] + (1 << (8 - CMAP_C2_BITS + BOX_C2_LOG)) - 1 };
+
+	// Like find_nearby_colors in jquant2.c: a color can only be the nearest for a cell
+	// of the box if its minimum distance to the box is not greater than the smallest
+	// maximum distance of all colors to the box
+	int anMinDist[256];
+	int nMinMaxDist = 3 * 256 * 256;
+	for (UINT u = 0; u < lpMap->uColors; u++)
+	{
+		int anColor[3] = { lpMap->aColors[u].rgbRed, lpMap->aColors[u].rgbGreen, lpMap->aColors[u].rgbBlue };
+		int nMinDist = 0, nMaxDist = 0;
+
+		for (int i = 0; i < 3; i++)
+		{
+			int nDist;
+			if (anColor[i] < anMin[i])
+				nDist = anMin[i] - anColor[i];
+			else if (anColor[i] > anMax[i])
+				nDist = anColor[i] - anMax[i];
+			else
+				nDist = 0;
+			nMinDist += nDist * nDist;
+
+			nDist = max(anColor[i] - anMin[i], anMax[i] - anColor[i]);
+			nMaxDist += nDist * nDist;
+		}
+
+		anMinDist[u] = nMinDist;
+		nMinMaxDist = min(nMinMaxDist, nMaxDist);
+	}
+
+	BYTE abCandidates[256];
+	UINT uCandidates = 0;
+	for (UINT u = 0; u < lpMap->uColors; u++)
+	{
+		if (anMinDist[u] <= nMinMaxDist)
+			abCandidates[uCandidates++] = (BYTE)u;
+	}
+
+	// Find the nearest candidate for the center of each cell
+	for (UINT i0 = 0; i0 < (1 << BOX_C0_LOG); i0++)
+	{
+		int nRed = ((int)(c0 + i0) << (8 - CMAP_C0_BITS)) + (1 << (7 - CMAP_C0_BITS));
+
+		for (UINT i1 = 0; i1 < (1 << BOX_C1_LOG); i1++)
+		{
+			int nGreen = ((int)(c1 + i1) << (8 - CMAP_C1_BITS)) + (1 << (7 - CMAP_C1_BITS));
+			LPBYTE lpCell = &lpMap->abCells[((((c0 + i0) << CMAP_C1_BITS) | (c1 + i1)) << CMAP_C2_BITS) | c2];
+
+			for (UINT i2 = 0; i2 < (1 << BOX_C2_LOG); i2++)
+			{
+				int nBlue = ((int)(c2 + i2) << (8 - CMAP_C2_BITS)) + (1 << (7 - CMAP_C2_BITS));
+				BYTE cBest = abCandidates[0];
+				int nBestDist = 3 * 256 * 256;
+
+				for (UINT u = 0; u < uCandidates; u++)
+				{
+					const RGBQUAD* lpColor = &lpMap->aColors[abCandidates[u]];
+					int dr = nRed - lpColor->rgbRed;
+					int dg = nGreen - lpColor->rgbGreen;
+					int db = nBlue - lpColor->rgbBlue;
+					int nDist = dr * dr + dg * dg + db * db;
+					if (nDist < nBestDist)
+					{
+						nBestDist = nDist;
+						cBest = abCandidates[u];
+					}
+				}
+
+				*lpCell++ = cBest;
+			}
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL OctreeCreate(LPOCTREE lpTree, UINT uMaxColors)
+{
+	ZeroMemory(lpTree, sizeof(OCTREE));
+
+	// Each leaf has at most OCTREE_DEPTH ancestors, and there is at most
+	// one leaf more than allowed before the tree is reduced again
+	UINT uNodes = (uMaxColors + 2) * (OCTREE_DEPTH + 1);
+	lpTree->lpPool = (LPOCTREE_NODE)MyGlobalAllocPtr(GMEM_MOVEABLE, uNodes * sizeof(OCTREE_NODE));
+	if (lpTree->lpPool == NULL)
+		return FALSE;
+
+	for (UINT u = 0; u < uNodes; u++)
+	{
+		lpTree->lpPool[u].lpNext = lpTree->lpFree;
+		lpTree->lpFree = &lpTree->lpPool[u];
+	}
+
+	lpTree->uMaxColors = max(uMaxColors, 2);
+	lpTree->lpRoot = OctreeNewNode(lpTree, 0);
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void OctreeAddColor(LPOCTREE lpTree, DWORD dwColor, ULONGLONG ullCount)
+{
+	BYTE cRed   = (BYTE)(dwColor >> 16);
+	BYTE cGreen = (BYTE)(dwColor >> 8);
+	BYTE cBlue  = (BYTE)dwColor;
+
+	LPOCTREE_NODE lpNode = lpTree->lpRoot;
+	for (UINT uLevel = 0; ; uLevel++)
+	{
+		lpNode->ullPixels += ullCount;
+		if (lpNode->bIsLeaf)
+			break;
+
+		UINT uShift = 7 - uLevel;
+		UINT uChild = (((cRed >> uShift) & 1) << 2) | (((cGreen >> uShift) & 1) << 1) | ((cBlue >> uShift) & 1);
+		if (lpNode->alpChildren[uChild] == NULL)
+			lpNode->alpChildren[uChild] = OctreeNewNode(lpTree, uLevel + 1);
+
+		lpNode = lpNode->alpChildren[uChild];
+	}
+
+	lpNode->ullRed   += cRed * ullCount;
+	lpNode->ullGreen += cGreen * ullCount;
+	lpNode->ullBlue  += cBlue * ullCount;
+
+	while (lpTree->uLeaves > lpTree->uMaxColors)
+		OctreeReduce(lpTree);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static LPOCTREE_NODE OctreeNewNode(LPOCTREE lpTree, UINT uLevel)
+{
+	LPOCTREE_NODE lpNode = lpTree->lpFree;
+	lpTree->lpFree = lpNode->lpNext;
+	ZeroMemory(lpNode, sizeof(OCTREE_NODE));
+
+	if (uLevel >= OCTREE_DEPTH)
+	{
+		lpNode->bIsLeaf = TRUE;
+		lpTree->uLeaves++;
+	}
+	else
+	{
+		lpNode->lpNext = lpTree->alpReducible[uLevel];
+		lpTree->alpReducible[uLevel] = lpNode;
+	}
+
+	return lpNode;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void OctreeReduce(LPOCTREE lpTree)
+{
+	int nLevel = OCTREE_DEPTH - 1;
+	while (nLevel > 0 && lpTree->alpReducible[nLevel] == NULL)
+		nLevel--;
+
+	// Reducing the root would leave a single color. Instead, the least
+	// used child of the root is merged into the child with the nearest color.
+	if (nLevel == 0)
+	{
+		LPOCTREE_NODE* alpChildren = lpTree->lpRoot->alpChildren;
+		int nMin = -1;
+		for (int i = 0; i < 8; i++)
+		{
+			if (alpChildren[i] != NULL && (nMin < 0 || alpChildren[i]->ullPixels < alpChildren[nMin]->ullPixels))
+				nMin = i;
+		}
+		if (nMin < 0)
+			return;
+
+		LPOCTREE_NODE lpMin = alpChildren[nMin];
+		ULONGLONG ullPixels = max(lpMin->ullPixels, 1);
+		double fBest = 0.0;
+		int nNearest = -1;
+		for (int i = 0; i < 8; i++)
+		{
+			LPOCTREE_NODE lpChild = alpChildren[i];
+			if (i == nMin || lpChild == NULL)
+				continue;
+
+			ULONGLONG ullChildPixels = max(lpChild->ullPixels, 1);
+			double fRed   = (double)lpChild->ullRed / ullChildPixels - (double)lpMin->ullRed / ullPixels;
+			double fGreen = (double)lpChild->ullGreen / ullChildPixels - (double)lpMin->ullGreen / ullPixels;
+			double fBlue  = (double)lpChild->ullBlue / ullChildPixels - (double)lpMin->ullBlue / ullPixels;
+			double fDist = fRed * fRed + fGreen * fGreen + fBlue * fBlue;
+			if (nNearest < 0 || fDist < fBest)
+			{
+				fBest = fDist;
+				nNearest = i;
+			}
+		}
+		if (nNearest < 0)
+			return;
+
+		LPOCTREE_NODE lpNearest = alpChildren[nNearest];
+		lpNearest->ullRed    += lpMin->ullRed;
+		lpNearest->ullGreen  += lpMin->ullGreen;
+		lpNearest->ullBlue   += lpMin->ullBlue;
+		lpNearest->ullPixels += lpMin->ullPixels;
+
+		lpMin->lpNext = lpTree->lpFree;
+		lpTree->lpFree = lpMin;
+		alpChildren[nMin] = NULL;
+		lpTree->uLeaves--;
+		return;
+	}
+
+	// Merging the least used node keeps the frequent colors accurate
+	LPOCTREE_NODE* lplpLink = &lpTree->alpReducible[nLevel];
+	for (LPOCTREE_NODE* lplp = lplpLink; *lplp != NULL; lplp = &(*lplp)->lpNext)
+	{
+		if ((*lplp)->ullPixels < (*lplpLink)->ullPixels)
+			lplpLink = lplp;
+	}
+
+	LPOCTREE_NODE lpNode = *lplpLink;
+	if (lpNode == NULL)
+		return;
+	*lplpLink = lpNode->lpNext;
+
+	// The nodes of deeper levels are already reduced, so all children are leaves
+	UINT uChildren = 0;
+	for (UINT u = 0; u < 8; u++)
+	{
+		LPOCTREE_NODE lpChild = lpNode->alpChildren[u];
+		if (lpChild == NULL)
+			continue;
+
+		lpNode->ullRed   += lpChild->ullRed;
+		lpNode->ullGreen += lpChild->ullGreen;
+		lpNode->ullBlue  += lpChild->ullBlue;
+
+		lpChild->lpNext = lpTree->lpFree;
+		lpTree->lpFree = lpChild;
+		lpNode->alpChildren[u] = NULL;
+		uChildren++;
+	}
+
+	lpNode->bIsLeaf = TRUE;
+	lpTree->uLeaves -= uChildren;
+	lpTree->uLeaves++;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void OctreeGetColors(LPOCTREE_NODE lpNode, LPRGBQUAD lpColors, LPUINT lpuColors)
+{
+	if (lpNode == NULL)
+		return;
+
+	if (lpNode->bIsLeaf)
+	{
+		ULONGLONG ullPixels = lpNode->ullPixels;
+		if (ullPixels == 0)
+			return;
+
+		LPRGBQUAD lpColor = &lpColors[(*lpuColors)++];
+		lpColor->rgbRed      = (BYTE)((lpNode->ullRed + ullPixels / 2) / ullPixels);
+		lpColor->rgbGreen    = (BYTE)((lpNode->ullGreen + ullPixels / 2) / ullPixels);
+		lpColor->rgbBlue     = (BYTE)((lpNode->ullBlue + ullPixels / 2) / ullPixels);
+		lpColor->rgbReserved = 0;
+		return;
+	}
+
+	for (UINT u = 0; u < 8; u++)
+		OctreeGetColors(lpNode->alpChildren[u], lpColors, lpuColors);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
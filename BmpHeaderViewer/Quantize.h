@@ -0,0 +1,38 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Quantize.h - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+// Number of bits per color channel of the color histogram
+#define HISTOGRAM_BITS      6
+
+typedef struct _INVERSE_CMAP INVERSE_CMAP, FAR* LPINVERSE_CMAP;
+
+// Creates a color table with up to uMaxColors (2 to 256) colors that represents the pixels
+// of lRows scan lines. The histogram is built in parallel, the palette is created using an
+// octree and refined with k-means iterations. Returns the number of colors, or 0 on error.
+UINT CreateOptimizedPalette(LPCDIB_FORMAT lpFormat, LPCBYTE lpBits, LONG lRows, LPRGBQUAD lpColors, UINT uMaxColors);
+
+// Creates an inverse color map for a color table with up to 256 colors. As with the
+// fill_inverse_cmap function of jquant2.c, the map is filled in boxes on first use.
+LPINVERSE_CMAP CreateInverseColorMap(const RGBQUAD FAR* lpColors, UINT uColors);
+
+// Frees an inverse color map
+void FreeInverseColorMap(LPINVERSE_CMAP lpMap);
+
+// Returns the index of the nearest color table entry. Can be called by several threads.
+BYTE MapToColorIndex(LPINVERSE_CMAP lpMap, int nRed, int nGreen, int nBlue);
@@ -0,0 +1,473 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// VideoToDib.cpp - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Data Types
+
+// Cinepak codebooks. Each entry holds a 2x2 pixel block
+// as BGRA values (top left, top right, bottom left, bottom right).
+typedef struct _CINEPAK_CODEBOOKS
+{
+	DWORD adwV1[256][4];    // Entries scaled up to 4x4 pixels
+	DWORD adwV4[256][4];    // Entries used for a quarter of a 4x4 pixel block
+} CINEPAK_CODEBOOKS, *LPCINEPAK_CODEBOOKS;
+
+// Output DIB
+typedef struct _VIDEO_DIB
+{
+	LPDWORD lpdwBits;       // Pixels of the 32-bpp bottom-up DIB
+	UINT    uWidth;         // Image width
+	UINT    uHeight;        // Image height
+} VIDEO_DIB, *LPVIDEO_DIB;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Helper functions
+
+// Allocates a zeroed 32-bpp DIB with the dimensions and resolution of the compressed DIB
+static HANDLE CreateVideoDib(LPCSTR lpbi, LPVIDEO_DIB lpDib);
+// Reads a Cinepak V1 or V4 codebook chunk
+static void DecodeCinepakCodebook(DWORD (*lpCodebook)[4], BYTE bChunkId, LPCBYTE lpData, LPCBYTE lpEnd);
+// Decodes the 4x4 pixel blocks of a Cinepak strip
+static BOOL DecodeCinepakVectors(LPCINEPAK_CODEBOOKS lpCodebooks, BYTE bChunkId, LPCBYTE lpData, LPCBYTE lpEnd,
+	LPVIDEO_DIB lpDib, UINT uTop, UINT uBottom);
+// Copies a 4x4 pixel block into the DIB, clipped to the image size. y is counted from the top.
+static void PutBlock(LPVIDEO_DIB lpDib, UINT x, UINT y, const DWORD* lpdwBlock);
+
+__inline DWORD ReadBigEndian24(LPCBYTE lp)
+{ return ((DWORD)lp[0] << 16) | ((DWORD)lp[1] << 8) | lp[2]; }
+
+__inline DWORD ReadBigEndian32(LPCBYTE lp)
+{ return ((DWORD)lp[0] << 24) | ((DWORD)lp[1] << 16) | ((DWORD)lp[2] << 8) | lp[3]; }
+
+__inline WORD ReadBigEndian16(LPCBYTE lp)
+{ return (WORD)((lp[0] << 8) | lp[1]); }
+
+__inline BYTE ClampByte(int n)
+{ return (BYTE)(n < 0 ? 0 : (n > 255 ? 255 : n)); }
+
+// Converts a RGB555 value to opaque BGRA
+__inline DWORD Rgb555ToBgra(WORD w)
+{
+	DWORD r = (w >> 10) & 0x1F, g = (w >> 5) & 0x1F, b = w & 0x1F;
+	return 0xFF000000 | (((r << 3) | (r >> 2)) << 16) | (((g << 3) | (g >> 2)) << 8) | ((b << 3) | (b >> 2));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// A Cinepak frame consists of horizontal strips. Each strip can update the codebooks and
+// then codes its 4x4 pixel blocks either as one V1 entry scaled up to 4x4 pixels or as four
+// V4 entries of 2x2 pixels. Only intra coded data can be displayed without a previous frame.
+// Blocks skipped by inter coded strips remain black.
+
+HANDLE CinepakToDib(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData)
+{
+	LPCBYTE lpSrc = (LPCBYTE)lpData;
+	if (lpbi == NULL || lpSrc == NULL || dwLenData < 10)
+	{
+		SetLastError(ERROR_INVALID_DATA);
+		return NULL;
+	}
+
+	VIDEO_DIB Dib;
+	HANDLE hDib = CreateVideoDib(lpbi, &Dib);
+	if (hDib == NULL)
+		return NULL;
+
+	// The codebooks are zeroed and passed on from strip to strip
+	LPCINEPAK_CODEBOOKS lpCodebooks = (LPCINEPAK_CODEBOOKS)MyGlobalAllocPtr(GHND, sizeof(CINEPAK_CODEBOOKS));
+	if (lpCodebooks == NULL)
+	{
+		GlobalUnlock(hDib);
+		FreeDib(hDib);
+		return NULL;
+	}
+
+	// Frame header: flags (1), frame size (3), width (2), height (2), number of strips (2)
+	DWORD dwFrameSize = ReadBigEndian24(lpSrc + 1);
+	LPCBYTE lpEnd = lpSrc + (dwFrameSize >= 10 && dwFrameSize < dwLenData ? dwFrameSize : dwLenData);
+	UINT uNumStrips = ReadBigEndian16(lpSrc + 8);
+	lpSrc += 10;
+
+	UINT uTop = 0;
+	for (UINT uStrip = 0; uStrip < uNumStrips && lpEnd - lpSrc >= 12 && uTop < Dib.uHeight; uStrip++)
+	{
+		// Strip header: id (1), strip size (3), top (2), left (2), bottom (2), right (2).
+		// Some encoders store the strip height instead of absolute coordinates.
+		DWORD dwStripSize = ReadBigEndian24(lpSrc + 1);
+		UINT uStripTop = ReadBigEndian16(lpSrc + 4);
+		UINT uStripBottom = ReadBigEndian16(lpSrc + 8);
+		UINT uStripHeight = uStripTop == 0 ? uStripBottom : (uStripBottom > uStripTop ? uStripBottom - uStripTop : 0);
+		if (dwStripSize < 12)
+			break;
+
+		LPCBYTE lpStripEnd = lpSrc + min((SIZE_T)dwStripSize, (SIZE_T)(lpEnd - lpSrc));
+		lpSrc += 12;
+
+		// Chunks: id (1), chunk size (3), data
+		while (lpStripEnd - lpSrc >= 4)
+		{
+			BYTE bChunkId = lpSrc[0];
+			DWORD dwChunkSize = ReadBigEndian24(lpSrc + 1);
+			if (dwChunkSize < 4)
+				break;
+
+			LPCBYTE lpChunkEnd = lpSrc + min((SIZE_T)dwChunkSize, (SIZE_T)(lpStripEnd - lpSrc));
+
+			switch (bChunkId)
+			{
+				case 0x20: case 0x21: case 0x24: case 0x25:
+					DecodeCinepakCodebook(lpCodebooks->adwV4, bChunkId, lpSrc + 4, lpChunkEnd);
+					break;
+
+				case 0x22: case 0x23: case 0x26: case 0x27:
+					DecodeCinepakCodebook(lpCodebooks->adwV1, bChunkId, lpSrc + 4, lpChunkEnd);
+					break;
+
+				case 0x30: case 0x31: case 0x32:
+					DecodeCinepakVectors(lpCodebooks, bChunkId, lpSrc + 4, lpChunkEnd,
+						&Dib, uTop, min(uTop + uStripHeight, Dib.uHeight));
+					break;
+			}
+
+			lpSrc = lpChunkEnd;
+		}
+
+		lpSrc = lpStripEnd;
+		uTop += uStripHeight;
+	}
+
+	MyGlobalFreePtr(lpCodebooks);
+	GlobalUnlock(hDib);
+
+	return hDib;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Microsoft Video 1 codes the image in 4x4 pixel blocks, starting with the bottom left block.
+// A block is either skipped, filled with one color, or uses a 16-bit mask to select one of
+// two colors for the whole block or for each of its 2x2 quadrants (8-color block). The 8-bpp
+// variant stores palette indices, the 16-bpp variant RGB555 values.
+
+HANDLE Video1ToDib(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData)
+{
+	LPCBYTE lpSrc = (LPCBYTE)lpData;
+	if (lpbi == NULL || lpSrc == NULL || !IS_WIN30_DIB(lpbi))
+	{
+		SetLastError(ERROR_INVALID_DATA);
+		return NULL;
+	}
+
+	WORD wBitCount = ((LPBITMAPINFOHEADER)lpbi)->biBitCount;
+	if (wBitCount != 8 && wBitCount != 16)
+	{
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return NULL;
+	}
+
+	// Opaque BGRA values of the color table
+	DWORD adwPalette[256] = { 0 };
+	if (wBitCount == 8)
+	{
+		LPRGBQUAD lprgbqColors = (LPRGBQUAD)FindDibPalette(lpbi);
+		UINT uNumColors = min(DibNumColors(lpbi), 256);
+		for (UINT u = 0; lprgbqColors != NULL && u < uNumColors; u++)
+			adwPalette[u] = 0xFF000000 | (lprgbqColors[u].rgbRed << 16) |
+				(lprgbqColors[u].rgbGreen << 8) | lprgbqColors[u].rgbBlue;
+	}
+
+	VIDEO_DIB Dib;
+	HANDLE hDib = CreateVideoDib(lpbi, &Dib);
+	if (hDib == NULL)
+		return NULL;
+
+	LPCBYTE lpEnd = lpSrc + dwLenData;
+	UINT uBlocksWide = Dib.uWidth / 4;
+	UINT uBlocksHigh = Dib.uHeight / 4;
+	UINT uSkip = 0;
+
+	for (UINT uBlockY = 0; uBlockY < uBlocksHigh; uBlockY++)
+	{
+		for (UINT uBlockX = 0; uBlockX < uBlocksWide; uBlockX++)
+		{
+			if (uSkip > 0)
+			{
+				uSkip--;
+				continue;
+			}
+
+			if (lpEnd - lpSrc < 2)
+				goto Done;
+
+			BYTE a = lpSrc[0];
+			BYTE b = lpSrc[1];
+			lpSrc += 2;
+
+			DWORD adwColors[8];
+			WORD wFlags = 0;
+			BOOL bEightColors = FALSE;
+
+			if ((b & 0xFC) == 0x84)
+			{ // Skip blocks (including the current one)
+				uSkip = ((b - 0x84) << 8) + a;
+				if (uSkip > 0)
+					uSkip--;
+				continue;
+			}
+			else if (b < 0x80 || (wBitCount == 8 && b >= 0x90))
+			{ // 2-color or 8-color block
+				wFlags = (WORD)((b << 8) | a);
+
+				if (wBitCount == 16)
+				{
+					if (lpEnd - lpSrc < 4)
+						goto Done;
+					WORD wColor0 = (WORD)(lpSrc[0] | (lpSrc[1] << 8));
+					bEightColors = (wColor0 & 0x8000) != 0;
+					UINT uNumColors = bEightColors ? 8 : 2;
+					if (lpEnd - lpSrc < (INT_PTR)uNumColors * 2)
+						goto Done;
+					for (UINT u = 0; u < uNumColors; u++, lpSrc += 2)
+						adwColors[u] = Rgb555ToBgra((WORD)(lpSrc[0] | (lpSrc[1] << 8)));
+				}
+				else
+				{
+					bEightColors = b >= 0x90;
+					UINT uNumColors = bEightColors ? 8 : 2;
+					if (lpEnd - lpSrc < (INT_PTR)uNumColors)
+						goto Done;
+					for (UINT u = 0; u < uNumColors; u++)
+						adwColors[u] = adwPalette[*lpSrc++];
+				}
+			}
+			else
+			{ // 1-color block
+				adwColors[0] = adwColors[1] = wBitCount == 16 ? Rgb555ToBgra((WORD)((b << 8) | a)) : adwPalette[a];
+				wFlags = 0xFFFF;
+			}
+
+			// A set bit selects the first color of the pair. The 8-color
+			// block uses a separate pair for each 2x2 quadrant.
+			LPDWORD lpdwRow = Dib.lpdwBits + (UINT_PTR)uBlockY * 4 * Dib.uWidth + uBlockX * 4;
+			for (UINT y = 0; y < 4; y++, lpdwRow += Dib.uWidth)
+			{
+				for (UINT x = 0; x < 4; x++, wFlags >>= 1)
+				{
+					UINT uPair = bEightColors ? ((y & 2) << 1) + (x & 2) : 0;
+					lpdwRow[x] = adwColors[uPair + ((wFlags & 1) ^ 1)];
+				}
+			}
+		}
+	}
+
+Done:
+	GlobalUnlock(hDib);
+
+	return hDib;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Codebook entries consist of four luminance values and, for color codebooks, the two
+// chrominance values u and v. The chunk ids with bit 0 set contain partial updates,
+// where a bit field precedes each group of 32 entries. Bit 2 marks grayscale entries.
+
+void DecodeCinepakCodebook(DWORD (*lpCodebook)[4], BYTE bChunkId, LPCBYTE lpData, LPCBYTE lpEnd)
+{
+	INT_PTR nEntrySize = (bChunkId & 0x04) ? 4 : 6;
+	DWORD dwFlags = 0, dwMask = 0;
+
+	for (UINT uEntry = 0; uEntry < 256; uEntry++)
+	{
+		if (bChunkId & 0x01)
+		{
+			if ((dwMask >>= 1) == 0)
+			{
+				if (lpEnd - lpData < 4)
+					break;
+				dwFlags = ReadBigEndian32(lpData);
+				lpData += 4;
+				dwMask = 0x80000000;
+			}
+
+			if (!(dwFlags & dwMask))
+				continue;
+		}
+
+		if (lpEnd - lpData < nEntrySize)
+			break;
+
+		int u = 0, v = 0;
+		if (nEntrySize == 6)
+		{
+			u = (signed char)lpData[4];
+			v = (signed char)lpData[5];
+		}
+
+		for (UINT uPixel = 0; uPixel < 4; uPixel++)
+		{
+			int y = lpData[uPixel];
+			lpCodebook[uEntry][uPixel] = 0xFF000000 | (ClampByte(y + v * 2) << 16) |
+				(ClampByte(y - u / 2 - v) << 8) | ClampByte(y + u * 2);
+		}
+
+		lpData += nEntrySize;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Chunk id 0x30 codes every block, 0x31 adds a flag to skip unchanged blocks and 0x32 uses
+// V1 entries only. The flag bits for skipping and for selecting V4 share one bit stream.
+
+BOOL DecodeCinepakVectors(LPCINEPAK_CODEBOOKS lpCodebooks, BYTE bChunkId, LPCBYTE lpData, LPCBYTE lpEnd,
+	LPVIDEO_DIB lpDib, UINT uTop, UINT uBottom)
+{
+	DWORD dwFlags = 0, dwMask = 0;
+	DWORD adwBlock[16];
+
+	for (UINT y = uTop; y < uBottom; y += 4)
+	{
+		for (UINT x = 0; x < lpDib->uWidth; x += 4)
+		{
+			if (bChunkId & 0x01)
+			{
+				if ((dwMask >>= 1) == 0)
+				{
+					if (lpEnd - lpData < 4)
+						return FALSE;
+					dwFlags = ReadBigEndian32(lpData);
+					lpData += 4;
+					dwMask = 0x80000000;
+				}
+
+				if (!(dwFlags & dwMask))
+					continue;
+			}
+
+			BOOL bV4 = FALSE;
+			if (!(bChunkId & 0x02))
+			{
+				if ((dwMask >>= 1) == 0)
+				{
+					if (lpEnd - lpData < 4)
+						return FALSE;
+					dwFlags = ReadBigEndian32(lpData);
+					lpData += 4;
+					dwMask = 0x80000000;
+				}
+
+				bV4 = (dwFlags & dwMask) != 0;
+			}
+
+			if (!bV4)
+			{ // Scale up a single 2x2 entry
+				if (lpData >= lpEnd)
+					return FALSE;
+				const DWORD* p = lpCodebooks->adwV1[*lpData++];
+				adwBlock[0]  = adwBlock[1]  = adwBlock[4]  = adwBlock[5]  = p[0];
+				adwBlock[2]  = adwBlock[3]  = adwBlock[6]  = adwBlock[7]  = p[1];
+				adwBlock[8]  = adwBlock[9]  = adwBlock[12] = adwBlock[13] = p[2];
+				adwBlock[10] = adwBlock[11] = adwBlock[14] = adwBlock[15] = p[3];
+			}
+			else
+			{ // One entry for each quadrant
+				if (lpEnd - lpData < 4)
+					return FALSE;
+				for (UINT uQuadrant = 0; uQuadrant < 4; uQuadrant++)
+				{
+					const DWORD* p = lpCodebooks->adwV4[*lpData++];
+					UINT i = (uQuadrant >> 1) * 8 + (uQuadrant & 1) * 2;
+					adwBlock[i]     = p[0];
+					adwBlock[i + 1] = p[1];
+					adwBlock[i + 4] = p[2];
+					adwBlock[i + 5] = p[3];
+				}
+			}
+
+			PutBlock(lpDib, x, y, adwBlock);
+		}
+	}
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PutBlock(LPVIDEO_DIB lpDib, UINT x, UINT y, const DWORD* lpdwBlock)
+{
+	UINT uCols = min(lpDib->uWidth - x, 4);
+	UINT uRows = min(lpDib->uHeight - y, 4);
+
+	for (UINT uRow = 0; uRow < uRows; uRow++)
+	{
+		LPDWORD lpdwDest = lpDib->lpdwBits + (UINT_PTR)(lpDib->uHeight - 1 - y - uRow) * lpDib->uWidth + x;
+		for (UINT uCol = 0; uCol < uCols; uCol++)
+			lpdwDest[uCol] = lpdwBlock[uRow * 4 + uCol];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE CreateVideoDib(LPCSTR lpbi, LPVIDEO_DIB lpDib)
+{
+	LONG lWidth = 0, lHeight = 0;
+	if (!IS_WIN30_DIB(lpbi) || !GetDibDimensions(lpbi, &lWidth, &lHeight, TRUE) ||
+		lWidth <= 0 || lHeight <= 0 || (UINT64)lWidth * lHeight * 4 > 0x80000000)
+	{
+		SetLastError(ERROR_INVALID_DATA);
+		return NULL;
+	}
+
+	DWORD dwImageSize = (DWORD)lWidth * lHeight * 4;
+
+	// The pixels are set to opaque black below
+	HANDLE hDib = AllocDib(sizeof(BITMAPINFOHEADER) + dwImageSize, FALSE);
+	if (hDib == NULL)
+		return NULL;
+
+	LPBITMAPINFOHEADER lpbih = (LPBITMAPINFOHEADER)GlobalLock(hDib);
+	if (lpbih == NULL)
+	{
+		FreeDib(hDib);
+		return NULL;
+	}
+
+	ZeroMemory(lpbih, sizeof(BITMAPINFOHEADER));
+	lpbih->biSize = sizeof(BITMAPINFOHEADER);
+	lpbih->biWidth = lWidth;
+	lpbih->biHeight = lHeight;
+	lpbih->biPlanes = 1;
+	lpbih->biBitCount = 32;
+	lpbih->biCompression = BI_RGB;
+	lpbih->biSizeImage = dwImageSize;
+	lpbih->biXPelsPerMeter = ((LPBITMAPINFOHEADER)lpbi)->biXPelsPerMeter;
+	lpbih->biYPelsPerMeter = ((LPBITMAPINFOHEADER)lpbi)->biYPelsPerMeter;
+
+	lpDib->lpdwBits = (LPDWORD)(lpbih + 1);
+	lpDib->uWidth = (UINT)lWidth;
+	lpDib->uHeight = (UINT)lHeight;
+
+	// Skipped blocks and pixels outside of complete blocks are not written. They must be
+	// opaque black, otherwise the thumbnail shows them as transparent pixels.
+	LPDWORD lpdwBits = lpDib->lpdwBits;
+	for (DWORD dw = dwImageSize / 4; dw > 0; dw--)
+		*lpdwBits++ = 0xFF000000;
+
+	return hDib;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,31 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// VideoToDib.h - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// FourCC codes of the video compressed DIBs decoded by this module
+#define FOURCC_CVID         mmioFOURCC('c','v','i','d') // Cinepak by Radius
+#define FOURCC_CRAM         mmioFOURCC('C','R','A','M') // Microsoft Video 1
+#define FOURCC_MSVC         mmioFOURCC('M','S','V','C') // Microsoft Video 1
+#define FOURCC_WHAM         mmioFOURCC('W','H','A','M') // Microsoft Video 1
+
+// Decodes a Cinepak key frame into a 32-bpp DIB. lpbi points to the header of the
+// compressed DIB, lpData to the compressed bitmap bits.
+HANDLE CinepakToDib(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData);
+
+// Decodes a Microsoft Video 1 key frame (8 or 16 bpp) into a 32-bpp DIB. lpbi points
+// to the header of the compressed DIB, lpData to the compressed bitmap bits.
+HANDLE Video1ToDib(LPCSTR lpbi, LPVOID lpData, DWORD dwLenData);
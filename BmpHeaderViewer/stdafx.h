@@ -50,12 +50,21 @@
 
 // C RunTime Header Files
 #include <tchar.h>
+#include <process.h>
 #include <setjmp.h>
 #include <math.h>
 
 // TODO: reference additional headers your program requires here
 #include "BmpHeaderViewer.h"
 #include "ParseBitmap.h"
+#include "ParseJpeg.h"
 #include "JpegToDib.h"
+#include "PngToDib.h"
+#include "VideoToDib.h"
 #include "DibApi.h"
+#include "DibConvert.h"
+#include "DibToRle.h"
+#include "Quantize.h"
+#include "BmpWriter.h"
+#include "Codecs.h"
 #include "Misc.h"
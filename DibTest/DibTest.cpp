@@ -0,0 +1,879 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// DibTest.cpp - Copyright (c) 2024 by W. Rolke.
+//
+// Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+// the European Commission - subsequent versions of the EUPL (the "Licence");
+// You may not use this work except in compliance with the Licence.
+// You may obtain a copy of the Licence at:
+//
+// https://joinup.ec.europa.eu/software/page/eupl
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the Licence is distributed on an "AS IS" basis,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the Licence for the specific language governing permissions and
+// limitations under the Licence.
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Console test driver for the image modules of BMP Header Viewer. It is built from the
+// source files of the application, except for the user interface in BmpHeaderViewer.cpp.
+// The Debug configurations are compiled with AddressSanitizer.
+
+#include "stdafx.h"
+
+// Globals of BmpHeaderViewer.cpp that are referenced by the shared modules
+const TCHAR g_szTitle[] = TEXT("DibTest");
+HINSTANCE g_hInstance = NULL;
+HBITMAP g_hBitmapThumb = NULL;
+HANDLE g_hDibThumb = NULL;
+HANDLE g_hDibDecoded = NULL;
+BOOL g_bPrepareThumb = FALSE;
+BOOL g_bDecodeThumb = FALSE;
+int g_nIcmMode = ICM_OFF;
+
+// Maximum number of worker threads of the stress test
+#define STRESS_MAX_THREADS  MAXIMUM_WAIT_OBJECTS
+
+// Number of decoding variants of the stress test
+#define STRESS_VARIANTS     5
+
+// Decoding qualities compared by the benchmark
+#define BENCH_QUALITIES     (JPEG_DECODE_DC + 1)
+
+// JPEG file loaded into memory
+typedef struct _TEST_FILE
+{
+    LPCTSTR        lpszFileName;              // Name of the file
+    LPBYTE         lpData;                    // File content
+    DWORD          dwSize;                    // Size of the file
+    LONG           lWidth;                    // Width of the full-size image
+    LONG           lHeight;                   // Height of the full-size image
+    DWORD          adwChecksum[STRESS_VARIANTS]; // Results of the single-threaded decodes, 0 if failed
+} TEST_FILE, FAR* LPTEST_FILE;
+
+// Shared state of the stress test
+typedef struct _STRESS_TEST
+{
+    LPTEST_FILE    lpFiles;                   // Files to decode
+    UINT           uFiles;                    // Number of files
+    LONG           lDecodes;                  // Total number of decodes
+    volatile LONG  lNextDecode;               // Number of decodes started so far
+    volatile LONG  lErrors;                   // Number of results that differ from the reference
+} STRESS_TEST, FAR* LPSTRESS_TEST;
+
+// Source of the scan lines of the write test
+typedef struct _ROW_SOURCE
+{
+    LPBYTE         lpBits;                    // Bitmap bits of the decoded DIB
+    UINT           uCancelRow;                // Scan line at which the callback fails, MAXUINT for none
+} ROW_SOURCE, FAR* LPROW_SOURCE;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Forward declarations of functions included in this code module
+
+// Decodes JPEG files from many threads at the same time and compares the results
+int StressTest(int argc, LPTSTR argv[]);
+// Thread function of the stress test
+static unsigned __stdcall StressWorker(LPVOID lpParam);
+
+// Measures the decoding time of each quality at full, 1/2 and 1/8 size
+int BenchTest(int argc, LPTSTR argv[]);
+// Decodes a JPEG file repeatedly for at least dwMinTime milliseconds and returns the last DIB
+HANDLE TimeDecode(LPTEST_FILE lpFile, UINT uMinWidth, UINT uMinHeight, DWORD dwFlags, DWORD dwMinTime,
+	double* lpdMilliseconds);
+// Computes the peak signal-to-noise ratio of two DIBs of the same format, -1 if they differ in format
+double DibPsnr(HANDLE hDib1, HANDLE hDib2);
+
+// Writes a decoded JPEG file with SaveBitmap and row by row with WriteBitmap and compares the files
+int WriteTest(int argc, LPTSTR argv[]);
+// Row callback of the write test
+static BOOL CALLBACK CopyRowProc(UINT uRow, LPBYTE lpRow, UINT cbRow, LPVOID lpParam);
+// Compares the contents of two files
+BOOL FilesEqual(LPCTSTR lpszFileName1, LPCTSTR lpszFileName2);
+
+// Encodes decoded JPEG files with DibToRle and compares the result with the indexed source DIB
+int RleTest(int argc, LPTSTR argv[]);
+// Checks the layout and the pixels of an RLE DIB, returns NULL if it matches the source DIB
+LPCTSTR CompareRleDib(HANDLE hDib, HANDLE hDibRle);
+// Expands RLE8 or RLE4 bits into bottom-up scan lines of the same bit depth
+BOOL ExpandRle(LPCBYTE lpRle, DWORD cbRle, UINT uBitCount, UINT uWidth, UINT uHeight, LPBYTE lpBits);
+
+// Decodes a JPEG file with one of the variants of the stress test
+HANDLE DecodeVariant(LPTEST_FILE lpFile, UINT uVariant);
+// Computes a FNV-1a hash of the header, color table, profile and bits of a DIB, 0 for NULL
+DWORD DibChecksum(HANDLE hDib);
+
+// Reads the files named on the command line into memory
+LPTEST_FILE LoadTestFiles(int argc, LPTSTR argv[], LPUINT lpuFiles);
+// Frees the files read by LoadTestFiles
+void FreeTestFiles(LPTEST_FILE lpFiles, UINT uFiles);
+
+// Outputs the command line syntax
+int Usage();
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Entry-point function of the test driver
+//
+int _tmain(int argc, TCHAR* argv[])
+{
+	if (argc >= 3 && _tcsicmp(argv[1], TEXT("stress")) == 0)
+		return StressTest(argc - 2, argv + 2);
+	if (argc >= 3 && _tcsicmp(argv[1], TEXT("bench")) == 0)
+		return BenchTest(argc - 2, argv + 2);
+	if (argc == 4 && _tcsicmp(argv[1], TEXT("write")) == 0)
+		return WriteTest(argc - 2, argv + 2);
+	if (argc >= 3 && _tcsicmp(argv[1], TEXT("rle")) == 0)
+		return RleTest(argc - 2, argv + 2);
+
+	return Usage();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int Usage()
+{
+	_tprintf(TEXT("Usage:\n")
+		TEXT("  DibTest stress [/t threads] [/n decodes] file.jpg ...\n")
+		TEXT("    Decodes the files concurrently in several ways and checks that each result\n")
+		TEXT("    matches the single-threaded decode of the same file.\n")
+		TEXT("  DibTest bench [/s milliseconds] file.jpg ...\n")
+		TEXT("    Measures the time per decode of each decoding quality at full, 1/2 and 1/8\n")
+		TEXT("    size and compares the results with the exact decode of the same size.\n")
+		TEXT("  DibTest write file.jpg file.bmp\n")
+		TEXT("    Saves the decoded file as a bitmap, writes it again row by row through a\n")
+		TEXT("    callback, checks that both files are identical and that a failing callback\n")
+		TEXT("    cancels the write.\n")
+		TEXT("  DibTest rle file.jpg ...\n")
+		TEXT("    Compresses the decoded files with RLE8 or RLE4, checks the placement of the\n")
+		TEXT("    bits and the color profile and compares the expanded pixels with the source.\n"));
+
+	return 2;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// ThreadSanitizer is not available for Windows, so the stress test detects races by their
+// effect: each variant of each file is first decoded on one thread, then all variants are
+// decoded again by up to 64 threads at once, and every result must be identical. The pool of
+// decompression objects is flushed now and then while the other threads use it. Running the
+// Debug build also checks all decodes with AddressSanitizer.
+//
+int StressTest(int argc, LPTSTR argv[])
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+
+	UINT uThreads = min(4 * si.dwNumberOfProcessors, STRESS_MAX_THREADS);
+	UINT uDecodes = 1000;
+
+	int nArg = 0;
+	for (; nArg + 1 < argc && argv[nArg][0] == '/'; nArg += 2)
+	{
+		if (_tcsicmp(argv[nArg], TEXT("/t")) == 0)
+			uThreads = min(max(_tcstoul(argv[nArg + 1], NULL, 10), 1), STRESS_MAX_THREADS);
+		else if (_tcsicmp(argv[nArg], TEXT("/n")) == 0)
+			uDecodes = _tcstoul(argv[nArg + 1], NULL, 10);
+		else
+			return Usage();
+	}
+
+	UINT uFiles = 0;
+	LPTEST_FILE lpFiles = LoadTestFiles(argc - nArg, argv + nArg, &uFiles);
+	if (lpFiles == NULL)
+		return 1;
+
+	// Single-threaded reference decodes
+	for (UINT u = 0; u < uFiles; u++)
+	{
+		for (UINT uVariant = 0; uVariant < STRESS_VARIANTS; uVariant++)
+		{
+			HANDLE hDib = DecodeVariant(&lpFiles[u], uVariant);
+			lpFiles[u].adwChecksum[uVariant] = DibChecksum(hDib);
+
+			if (uVariant == 0 && hDib != NULL)
+			{
+				LPCSTR lpbi = (LPCSTR)GlobalLock(hDib);
+				if (lpbi != NULL)
+				{
+					GetDibDimensions(lpbi, &lpFiles[u].lWidth, &lpFiles[u].lHeight, TRUE);
+					GlobalUnlock(hDib);
+				}
+			}
+
+			FreeDib(hDib);
+		}
+
+		if (lpFiles[u].adwChecksum[0] == 0)
+			_tprintf(TEXT("%s: cannot be decoded, only the failure is checked\n"), lpFiles[u].lpszFileName);
+	}
+
+	FlushJpegPool();
+
+	STRESS_TEST st = { lpFiles, uFiles, (LONG)min(uDecodes, (UINT)MAXLONG), 0, 0 };
+
+	_tprintf(TEXT("%u decodes of %u files on %u threads\n"), st.lDecodes, uFiles, uThreads);
+
+	ULONGLONG ullStart = GetTickCount64();
+
+	HANDLE ahThreads[STRESS_MAX_THREADS];
+	DWORD dwThreads = 0;
+	while (dwThreads < uThreads)
+	{
+		HANDLE hThread = (HANDLE)_beginthreadex(NULL, 0, StressWorker, &st, 0, NULL);
+		if (hThread == NULL)
+			break;
+		ahThreads[dwThreads++] = hThread;
+	}
+
+	if (dwThreads == 0)
+		StressWorker(&st);
+	else
+	{
+		WaitForMultipleObjects(dwThreads, ahThreads, TRUE, INFINITE);
+		for (DWORD i = 0; i < dwThreads; i++)
+			CloseHandle(ahThreads[i]);
+	}
+
+	FlushJpegPool();
+
+	_tprintf(TEXT("%lu errors, %I64u ms\n"), (ULONG)st.lErrors, GetTickCount64() - ullStart);
+
+	FreeTestFiles(lpFiles, uFiles);
+
+	return st.lErrors != 0 ? 1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static unsigned __stdcall StressWorker(LPVOID lpParam)
+{
+	LPSTRESS_TEST lpst = (LPSTRESS_TEST)lpParam;
+
+	LONG lDecode;
+	while ((lDecode = InterlockedIncrement(&lpst->lNextDecode)) <= lpst->lDecodes)
+	{
+		// Neighboring decodes use different files and variants
+		UINT uFile = (UINT)(lDecode - 1) % lpst->uFiles;
+		UINT uVariant = ((UINT)(lDecode - 1) / lpst->uFiles) % STRESS_VARIANTS;
+		LPTEST_FILE lpFile = &lpst->lpFiles[uFile];
+
+		HANDLE hDib = DecodeVariant(lpFile, uVariant);
+		if (DibChecksum(hDib) != lpFile->adwChecksum[uVariant])
+		{
+			InterlockedIncrement(&lpst->lErrors);
+			_tprintf(TEXT("%s: variant %u differs (error %lu)\n"), lpFile->lpszFileName, uVariant,
+				hDib == NULL ? GetLastError() : ERROR_SUCCESS);
+		}
+
+		FreeDib(hDib);
+
+		if (lDecode % 97 == 0)
+			FlushJpegPool();
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Each measurement repeats the decode for half a second by default and reports the average. The
+// speedup and the PSNR refer to JPEG_DECODE_EXACT with the same minimum size. JPEG_DECODE_DC
+// only differs from JPEG_DECODE_PREVIEW for progressive images decoded at 1/8 size.
+//
+int BenchTest(int argc, LPTSTR argv[])
+{
+	static const LPCTSTR s_aszQualities[BENCH_QUALITIES] = {
+		TEXT("exact"), TEXT("balanced"), TEXT("preview"), TEXT("dc") };
+	static const UINT s_auScales[] = { 1, 2, 8 };
+
+	DWORD dwMinTime = 500;
+
+	int nArg = 0;
+	for (; nArg + 1 < argc && argv[nArg][0] == '/'; nArg += 2)
+	{
+		if (_tcsicmp(argv[nArg], TEXT("/s")) == 0)
+			dwMinTime = _tcstoul(argv[nArg + 1], NULL, 10);
+		else
+			return Usage();
+	}
+
+	UINT uFiles = 0;
+	LPTEST_FILE lpFiles = LoadTestFiles(argc - nArg, argv + nArg, &uFiles);
+	if (lpFiles == NULL)
+		return 1;
+
+	int nResult = 0;
+
+	for (UINT u = 0; u < uFiles; u++)
+	{
+		UINT uWidth = 0, uHeight = 0;
+		if (!GetJpegDimensions(lpFiles[u].lpData, lpFiles[u].dwSize, &uWidth, &uHeight))
+		{
+			_tprintf(TEXT("%s: no JPEG file\n"), lpFiles[u].lpszFileName);
+			nResult = 1;
+			continue;
+		}
+
+		_tprintf(TEXT("%s (%u x %u)\n"), lpFiles[u].lpszFileName, uWidth, uHeight);
+
+		for (UINT i = 0; i < _countof(s_auScales); i++)
+		{
+			UINT uMinWidth = s_auScales[i] > 1 ? uWidth / s_auScales[i] : 0;
+			UINT uMinHeight = s_auScales[i] > 1 ? uHeight / s_auScales[i] : 0;
+
+			HANDLE hDibExact = NULL;
+			double dExact = 0.0;
+
+			for (DWORD dwQuality = 0; dwQuality < BENCH_QUALITIES; dwQuality++)
+			{
+				double dTime = 0.0;
+				HANDLE hDib = TimeDecode(&lpFiles[u], uMinWidth, uMinHeight, dwQuality, dwMinTime, &dTime);
+				if (hDib == NULL)
+				{
+					_tprintf(TEXT("  1/%u %-8s cannot be decoded (error %lu)\n"), s_auScales[i],
+						s_aszQualities[dwQuality], GetLastError());
+					nResult = 1;
+					continue;
+				}
+
+				LONG lWidth = 0, lHeight = 0;
+				LPCSTR lpbi = (LPCSTR)GlobalLock(hDib);
+				if (lpbi != NULL)
+				{
+					GetDibDimensions(lpbi, &lWidth, &lHeight, TRUE);
+					GlobalUnlock(hDib);
+				}
+
+				TCHAR szPsnr[32] = TEXT("-");
+				if (dwQuality == JPEG_DECODE_EXACT)
+				{
+					hDibExact = hDib;
+					dExact = dTime;
+				}
+				else
+				{
+					double dPsnr = DibPsnr(hDibExact, hDib);
+					if (dPsnr == HUGE_VAL)
+						_sntprintf(szPsnr, _countof(szPsnr), TEXT("identical"));
+					else if (dPsnr >= 0.0)
+						_sntprintf(szPsnr, _countof(szPsnr), TEXT("%.1f dB"), dPsnr);
+					FreeDib(hDib);
+				}
+
+				_tprintf(TEXT("  1/%u %-8s %5ld x %-5ld %10.3f ms %6.2fx  %s\n"), s_auScales[i],
+					s_aszQualities[dwQuality], lWidth, lHeight, dTime, dExact > 0.0 ? dExact / dTime : 0.0, szPsnr);
+			}
+
+			FreeDib(hDibExact);
+		}
+	}
+
+	FreeTestFiles(lpFiles, uFiles);
+
+	return nResult;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE TimeDecode(LPTEST_FILE lpFile, UINT uMinWidth, UINT uMinHeight, DWORD dwFlags, DWORD dwMinTime,
+	double* lpdMilliseconds)
+{
+	LARGE_INTEGER liFrequency, liStart, liNow;
+	QueryPerformanceFrequency(&liFrequency);
+	QueryPerformanceCounter(&liStart);
+
+	HANDLE hDib = NULL;
+	UINT uDecodes = 0;
+	double dElapsed = 0.0;
+
+	do
+	{
+		FreeDib(hDib);
+		hDib = JpegToDib(lpFile->lpData, lpFile->dwSize, 0, uMinWidth, uMinHeight, dwFlags);
+		uDecodes++;
+
+		QueryPerformanceCounter(&liNow);
+		dElapsed = (double)(liNow.QuadPart - liStart.QuadPart) * 1000.0 / (double)liFrequency.QuadPart;
+	}
+	while (hDib != NULL && dElapsed < dwMinTime);
+
+	*lpdMilliseconds = dElapsed / uDecodes;
+
+	return hDib;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+double DibPsnr(HANDLE hDib1, HANDLE hDib2)
+{
+	if (hDib1 == NULL || hDib2 == NULL)
+		return -1.0;
+
+	LPBITMAPINFOHEADER lpbi1 = (LPBITMAPINFOHEADER)GlobalLock(hDib1);
+	LPBITMAPINFOHEADER lpbi2 = (LPBITMAPINFOHEADER)GlobalLock(hDib2);
+
+	double dPsnr = -1.0;
+
+	if (lpbi1 != NULL && lpbi2 != NULL && lpbi1->biWidth == lpbi2->biWidth &&
+		lpbi1->biHeight == lpbi2->biHeight && lpbi1->biBitCount == lpbi2->biBitCount &&
+		DibImageSize((LPCSTR)lpbi1) == DibImageSize((LPCSTR)lpbi2))
+	{
+		// The padding bytes are 0 in both DIBs and don't change the sum
+		LPBYTE lpBits1 = FindDibBits((LPCSTR)lpbi1);
+		LPBYTE lpBits2 = FindDibBits((LPCSTR)lpbi2);
+		UINT cbImage = DibImageSize((LPCSTR)lpbi1);
+
+		double dSquares = 0.0;
+		for (UINT i = 0; i < cbImage; i++)
+		{
+			double dDiff = (double)lpBits1[i] - (double)lpBits2[i];
+			dSquares += dDiff * dDiff;
+		}
+
+		dPsnr = dSquares > 0.0 ? 10.0 * log10(255.0 * 255.0 * cbImage / dSquares) : HUGE_VAL;
+	}
+
+	if (lpbi1 != NULL)
+		GlobalUnlock(hDib1);
+	if (lpbi2 != NULL)
+		GlobalUnlock(hDib2);
+
+	return dPsnr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// WriteBitmap is used in two ways: SaveBitmap passes the complete bitmap bits, while a
+// BMPROWPROC callback supplies one scan line after the other. The test writes the same DIB
+// both ways, the second file gets the extension ".rows.bmp" and is deleted if it matches.
+//
+int WriteTest(int argc, LPTSTR argv[])
+{
+	UINT uFiles = 0;
+	LPTEST_FILE lpFile = LoadTestFiles(1, argv, &uFiles);
+	if (lpFile == NULL)
+		return 1;
+
+	HANDLE hDib = JpegToDib(lpFile->lpData, lpFile->dwSize);
+	FreeTestFiles(lpFile, uFiles);
+	if (hDib == NULL)
+	{
+		_tprintf(TEXT("%s: cannot be decoded (error %lu)\n"), argv[0], GetLastError());
+		return 1;
+	}
+
+	TCHAR szRowsFile[MAX_PATH];
+	if (_tcslen(argv[1]) + 10 > _countof(szRowsFile))
+	{
+		FreeDib(hDib);
+		return Usage();
+	}
+	_sntprintf(szRowsFile, _countof(szRowsFile), TEXT("%s.rows.bmp"), argv[1]);
+
+	int nResult = 1;
+
+	if (!SaveBitmap(argv[1], hDib))
+		_tprintf(TEXT("SaveBitmap failed (error %lu)\n"), GetLastError());
+	else
+	{
+		LPCSTR lpbi = (LPCSTR)GlobalLock(hDib);
+		if (lpbi != NULL)
+		{
+			LONG lWidth = 0, lHeight = 0;
+			GetDibDimensions(lpbi, &lWidth, &lHeight, TRUE);
+
+			ROW_SOURCE rs = { FindDibBits(lpbi), MAXUINT };
+			if (!WriteBitmap(szRowsFile, lpbi, NULL, NULL, CopyRowProc, &rs))
+				_tprintf(TEXT("WriteBitmap with row callback failed (error %lu)\n"), GetLastError());
+			else if (!FilesEqual(argv[1], szRowsFile))
+				_tprintf(TEXT("%s differs from %s\n"), szRowsFile, argv[1]);
+			else
+			{
+				DeleteFile(szRowsFile);
+
+				// A failing callback must fail WriteBitmap and remove the incomplete file
+				rs.uCancelRow = (UINT)lHeight / 2;
+				if (WriteBitmap(szRowsFile, lpbi, NULL, NULL, CopyRowProc, &rs))
+					_tprintf(TEXT("WriteBitmap ignored the failing row callback\n"));
+				else if (GetLastError() != ERROR_CANCELLED)
+					_tprintf(TEXT("WriteBitmap returned error %lu for a cancelled write\n"), GetLastError());
+				else if (GetFileAttributes(szRowsFile) != INVALID_FILE_ATTRIBUTES)
+					_tprintf(TEXT("%s was not deleted after the cancelled write\n"), szRowsFile);
+				else
+				{
+					_tprintf(TEXT("%s: %ld x %ld pixels written both ways\n"), argv[1], lWidth, lHeight);
+					nResult = 0;
+				}
+			}
+
+			GlobalUnlock(hDib);
+		}
+	}
+
+	FreeDib(hDib);
+
+	return nResult;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static BOOL CALLBACK CopyRowProc(UINT uRow, LPBYTE lpRow, UINT cbRow, LPVOID lpParam)
+{
+	LPROW_SOURCE lprs = (LPROW_SOURCE)lpParam;
+	if (uRow == lprs->uCancelRow)
+		return FALSE;
+
+	// The scan lines are stored in the DIB in the same order as in the file
+	CopyMemory(lpRow, lprs->lpBits + (SIZE_T)uRow * cbRow, cbRow);
+
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL FilesEqual(LPCTSTR lpszFileName1, LPCTSTR lpszFileName2)
+{
+	LPCTSTR alpszFileNames[2] = { lpszFileName1, lpszFileName2 };
+	HANDLE ahFiles[2] = { INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE };
+	for (int i = 0; i < 2; i++)
+		ahFiles[i] = CreateFile(alpszFileNames[i], GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+	BOOL bEqual = ahFiles[0] != INVALID_HANDLE_VALUE && ahFiles[1] != INVALID_HANDLE_VALUE;
+
+	BYTE abBuffer1[4096], abBuffer2[4096];
+	while (bEqual)
+	{
+		DWORD dwRead1 = 0, dwRead2 = 0;
+		if (!ReadFile(ahFiles[0], abBuffer1, sizeof(abBuffer1), &dwRead1, NULL) ||
+			!ReadFile(ahFiles[1], abBuffer2, sizeof(abBuffer2), &dwRead2, NULL) ||
+			dwRead1 != dwRead2 || memcmp(abBuffer1, abBuffer2, dwRead1) != 0)
+			bEqual = FALSE;
+		else if (dwRead1 == 0)
+			break;
+	}
+
+	for (int i = 0; i < 2; i++)
+		if (ahFiles[i] != INVALID_HANDLE_VALUE)
+			CloseHandle(ahFiles[i]);
+
+	return bEqual;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Grayscale JPEG files are decoded to 8-bpp DIBs, which DibToRle encodes directly. Together
+// with an embedded ICC profile, this checks that the profile of the source DIB, which JpegToDib
+// places in front of the bits, is moved behind the encoded bits. Color JPEG files are reduced
+// to 256 colors by ConvertDibBitDepth first, in the same way as by DibToRle.
+//
+int RleTest(int argc, LPTSTR argv[])
+{
+	UINT uFiles = 0;
+	LPTEST_FILE lpFiles = LoadTestFiles(argc, argv, &uFiles);
+	if (lpFiles == NULL)
+		return 1;
+
+	UINT uErrors = 0;
+	for (UINT u = 0; u < uFiles; u++)
+	{
+		LPCTSTR lpszFileName = lpFiles[u].lpszFileName;
+		HANDLE hDib = JpegToDib(lpFiles[u].lpData, lpFiles[u].dwSize);
+		if (hDib == NULL)
+		{
+			_tprintf(TEXT("%s: cannot be decoded (error %lu)\n"), lpszFileName, GetLastError());
+			uErrors++;
+			continue;
+		}
+
+		WORD wBitCount = 0;
+		LPCSTR lpbi = (LPCSTR)GlobalLock(hDib);
+		if (lpbi != NULL)
+		{
+			wBitCount = ((LPBITMAPINFOHEADER)lpbi)->biBitCount;
+			GlobalUnlock(hDib);
+		}
+
+		HANDLE hDibIndexed = wBitCount > 8 ? ConvertDibBitDepth(hDib, 8) : hDib;
+		HANDLE hDibRle = DibToRle(hDib);
+
+		LPCTSTR lpszError = TEXT("DibToRle failed");
+		if (hDibIndexed == NULL)
+			lpszError = TEXT("ConvertDibBitDepth failed");
+		else if (hDibRle != NULL)
+			lpszError = CompareRleDib(hDibIndexed, hDibRle);
+
+		if (lpszError != NULL)
+		{
+			_tprintf(TEXT("%s: %s\n"), lpszFileName, lpszError);
+			uErrors++;
+		}
+		else if ((lpbi = (LPCSTR)GlobalLock(hDibRle)) != NULL)
+		{
+			LPBITMAPINFOHEADER lpbih = (LPBITMAPINFOHEADER)lpbi;
+			_tprintf(TEXT("%s: %ld x %ld pixels encoded with %lu bytes of %s%s\n"), lpszFileName,
+				lpbih->biWidth, lpbih->biHeight, lpbih->biSizeImage,
+				lpbih->biCompression == BI_RLE8 ? TEXT("RLE8") : TEXT("RLE4"),
+				DibHasEmbeddedProfile(lpbi) ? TEXT(" and a color profile") : TEXT(""));
+			GlobalUnlock(hDibRle);
+		}
+
+		FreeDib(hDibRle);
+		if (hDibIndexed != hDib)
+			FreeDib(hDibIndexed);
+		FreeDib(hDib);
+	}
+
+	FreeTestFiles(lpFiles, uFiles);
+
+	return uErrors == 0 ? 0 : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+LPCTSTR CompareRleDib(HANDLE hDib, HANDLE hDibRle)
+{
+	LPCSTR lpbi = (LPCSTR)GlobalLock(hDib);
+	LPCSTR lpbiRle = (LPCSTR)GlobalLock(hDibRle);
+	if (lpbi == NULL || lpbiRle == NULL)
+	{
+		if (lpbi != NULL)
+			GlobalUnlock(hDib);
+		if (lpbiRle != NULL)
+			GlobalUnlock(hDibRle);
+		return TEXT("GlobalLock failed");
+	}
+
+	LPBITMAPINFOHEADER lpbih = (LPBITMAPINFOHEADER)lpbi;
+	LPBITMAPINFOHEADER lpbihRle = (LPBITMAPINFOHEADER)lpbiRle;
+	SIZE_T cbRleSize = GlobalSize(hDibRle);
+	UINT uBitCount = lpbih->biBitCount;
+	UINT uWidth = (UINT)lpbih->biWidth;
+	UINT uHeight = (UINT)abs(lpbih->biHeight);
+	UINT uPalette = PaletteSize(lpbi);
+
+	// The header and the color table must be followed by the bits, an embedded profile by the bits
+	DWORD dwOffBits = DibBitsOffset(lpbiRle);
+	LPCTSTR lpszError = NULL;
+	if (lpbihRle->biSize != lpbih->biSize || lpbihRle->biBitCount != uBitCount ||
+		lpbihRle->biCompression != (uBitCount == 8 ? BI_RLE8 : BI_RLE4) ||
+		lpbihRle->biWidth != lpbih->biWidth || lpbihRle->biHeight != (LONG)uHeight)
+		lpszError = TEXT("the header does not match");
+	else if (PaletteSize(lpbiRle) != uPalette || memcmp(FindDibPalette(lpbiRle), FindDibPalette(lpbi), uPalette) != 0)
+		lpszError = TEXT("the color table does not match");
+	else if (dwOffBits != lpbihRle->biSize + ColorMasksSize(lpbiRle) + uPalette ||
+		dwOffBits > cbRleSize || lpbihRle->biSizeImage > cbRleSize - dwOffBits)
+		lpszError = TEXT("the bits do not follow the color table");
+	else if (DibHasEmbeddedProfile(lpbi) != DibHasEmbeddedProfile(lpbiRle))
+		lpszError = TEXT("the color profile is missing");
+	else if (DibHasEmbeddedProfile(lpbi))
+	{
+		LPBITMAPV5HEADER lpbiv5 = (LPBITMAPV5HEADER)lpbi;
+		LPBITMAPV5HEADER lpbiv5Rle = (LPBITMAPV5HEADER)lpbiRle;
+		if (lpbiv5Rle->bV5ProfileData != dwOffBits + lpbihRle->biSizeImage ||
+			lpbiv5Rle->bV5ProfileSize != lpbiv5->bV5ProfileSize ||
+			lpbiv5Rle->bV5ProfileSize > cbRleSize - lpbiv5Rle->bV5ProfileData ||
+			memcmp(lpbiRle + lpbiv5Rle->bV5ProfileData, lpbi + lpbiv5->bV5ProfileData, lpbiv5->bV5ProfileSize) != 0)
+			lpszError = TEXT("the color profile does not follow the bits");
+	}
+
+	ULONG ulIncrement = WIDTHBYTES((ULONG)uWidth * uBitCount);
+	LPBYTE lpBits = lpszError == NULL ? (LPBYTE)MyGlobalAllocPtr(GHND, (SIZE_T)ulIncrement * uHeight) : NULL;
+	if (lpszError == NULL && lpBits == NULL)
+		lpszError = TEXT("not enough memory");
+	else if (lpszError == NULL && !ExpandRle((LPCBYTE)lpbiRle + dwOffBits, lpbihRle->biSizeImage,
+		uBitCount, uWidth, uHeight, lpBits))
+		lpszError = TEXT("the RLE data is invalid");
+	else if (lpszError == NULL)
+	{
+		// Compare the color indexes without the padding of the scan lines
+		LPCBYTE lpSrcBits = FindDibBits(lpbi);
+		for (UINT y = 0; y < uHeight && lpszError == NULL; y++)
+		{
+			LPCBYTE lpSrc = lpSrcBits + (SIZE_T)(lpbih->biHeight < 0 ? uHeight - 1 - y : y) * ulIncrement;
+			LPCBYTE lpDest = lpBits + (SIZE_T)y * ulIncrement;
+			UINT cbFull = uWidth * uBitCount / 8;
+			if (memcmp(lpSrc, lpDest, cbFull) != 0)
+				lpszError = TEXT("the pixels differ");
+			else if (cbFull * 8 < uWidth * uBitCount && ((lpSrc[cbFull] ^ lpDest[cbFull]) & 0xF0) != 0)
+				lpszError = TEXT("the pixels differ");
+		}
+	}
+
+	if (lpBits != NULL)
+		MyGlobalFreePtr(lpBits);
+
+	GlobalUnlock(hDibRle);
+	GlobalUnlock(hDib);
+
+	return lpszError;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+BOOL ExpandRle(LPCBYTE lpRle, DWORD cbRle, UINT uBitCount, UINT uWidth, UINT uHeight, LPBYTE lpBits)
+{
+	ULONG ulIncrement = WIDTHBYTES((ULONG)uWidth * uBitCount);
+	UINT x = 0, y = 0;
+	DWORD i = 0;
+
+	while (i + 1 < cbRle)
+	{
+		UINT uCount = lpRle[i++];
+		BYTE bValue = lpRle[i++];
+		LPBYTE lpRow = lpBits + (SIZE_T)y * ulIncrement;
+
+		if (uCount > 0)
+		{ // Encoded run, RLE4 alternates between the two nibbles
+			if (y >= uHeight || x > uWidth || uCount > uWidth - x)
+				return FALSE;
+			for (UINT n = 0; n < uCount; n++, x++)
+			{
+				if (uBitCount == 8)
+					lpRow[x] = bValue;
+				else
+					lpRow[x / 2] |= (n & 1 ? bValue & 0x0F : bValue >> 4) << (x & 1 ? 0 : 4);
+			}
+		}
+		else if (bValue == 0)
+		{ // End of line
+			x = 0;
+			y++;
+		}
+		else if (bValue == 1)
+			return TRUE; // End of bitmap
+		else if (bValue == 2)
+		{ // Delta, the skipped pixels keep index 0
+			if (i + 1 >= cbRle)
+				return FALSE;
+			x += lpRle[i++];
+			y += lpRle[i++];
+		}
+		else
+		{ // Absolute run, padded to a 16-bit boundary
+			DWORD cbRun = uBitCount == 8 ? bValue : (bValue + 1) / 2;
+			if (y >= uHeight || x > uWidth || bValue > uWidth - x || cbRun > cbRle - i)
+				return FALSE;
+			for (UINT n = 0; n < bValue; n++, x++)
+			{
+				if (uBitCount == 8)
+					lpRow[x] = lpRle[i + n];
+				else
+					lpRow[x / 2] |= (n & 1 ? lpRle[i + n / 2] & 0x0F : lpRle[i + n / 2] >> 4) << (x & 1 ? 0 : 4);
+			}
+			i += (cbRun + 1) & ~1;
+		}
+	}
+
+	// The end-of-bitmap marker is missing
+	return FALSE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+HANDLE DecodeVariant(LPTEST_FILE lpFile, UINT uVariant)
+{
+	JPEG_DECODE_STATS stats;
+
+	switch (uVariant)
+	{
+		case 0:
+			return JpegToDib(lpFile->lpData, lpFile->dwSize);
+		case 1: // Downscaling by the IDCT
+			return JpegToDib(lpFile->lpData, lpFile->dwSize, 0, lpFile->lWidth / 2, lpFile->lHeight / 2,
+				JPEG_DECODE_PREVIEW);
+		case 2: // Fast IDCT, direct 32-bpp output and memory statistics
+			return JpegToDib(lpFile->lpData, lpFile->dwSize, 0, 0, 0, JPEG_DECODE_BALANCED | JPEG_DECODE_BGRX, &stats);
+		case 3: // Lossless transformation with transupp
+			return TransformJpegToDib(lpFile->lpData, lpFile->dwSize, JPEG_XFORM_ROT_90, NULL);
+		case 4: // DC scans of progressive images, or the Exif thumbnail
+			return JpegToDib(lpFile->lpData, lpFile->dwSize, 0, lpFile->lWidth / 8, lpFile->lHeight / 8,
+				JPEG_DECODE_DC);
+	}
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+DWORD DibChecksum(HANDLE hDib)
+{
+	if (hDib == NULL)
+		return 0;
+
+	LPCSTR lpbi = (LPCSTR)GlobalLock(hDib);
+	if (lpbi == NULL)
+		return 0;
+
+	// The allocation may be larger than the DIB
+	SIZE_T cbDib = (SIZE_T)(FindDibBits(lpbi) - (LPBYTE)lpbi) + DibImageSize(lpbi);
+	cbDib = min(cbDib, GlobalSize(hDib));
+
+	DWORD dwHash = 2166136261;
+	for (SIZE_T i = 0; i < cbDib; i++)
+		dwHash = (dwHash ^ (BYTE)lpbi[i]) * 16777619;
+
+	GlobalUnlock(hDib);
+
+	return dwHash != 0 ? dwHash : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+LPTEST_FILE LoadTestFiles(int argc, LPTSTR argv[], LPUINT lpuFiles)
+{
+	*lpuFiles = 0;
+	if (argc <= 0)
+	{
+		Usage();
+		return NULL;
+	}
+
+	LPTEST_FILE lpFiles = (LPTEST_FILE)MyGlobalAllocPtr(GHND, argc * sizeof(TEST_FILE));
+	if (lpFiles == NULL)
+		return NULL;
+
+	for (int i = 0; i < argc; i++)
+	{
+		lpFiles[i].lpszFileName = argv[i];
+
+		HANDLE hFile = CreateFile(argv[i], GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hFile != INVALID_HANDLE_VALUE)
+		{
+			DWORD dwSize = GetFileSize(hFile, NULL);
+			if (dwSize != INVALID_FILE_SIZE && dwSize > 0)
+				lpFiles[i].lpData = (LPBYTE)MyGlobalAllocPtr(GMEM_MOVEABLE, dwSize);
+			if (lpFiles[i].lpData != NULL && MyReadFile(hFile, lpFiles[i].lpData, dwSize))
+				lpFiles[i].dwSize = dwSize;
+			CloseHandle(hFile);
+		}
+
+		if (lpFiles[i].dwSize == 0)
+		{
+			_tprintf(TEXT("%s: cannot be read\n"), argv[i]);
+			FreeTestFiles(lpFiles, i + 1);
+			return NULL;
+		}
+	}
+
+	*lpuFiles = argc;
+
+	return lpFiles;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FreeTestFiles(LPTEST_FILE lpFiles, UINT uFiles)
+{
+	if (lpFiles == NULL)
+		return;
+
+	for (UINT u = 0; u < uFiles; u++)
+		MyGlobalFreePtr(lpFiles[u].lpData);
+
+	MyGlobalFreePtr(lpFiles);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
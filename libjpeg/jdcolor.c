@@ -238,6 +238,51 @@ ycc_rgb_convert (j_decompress_ptr cinfo,
 }
 
 
+/*
+ * Same as ycc_rgb_convert, but for 32-bit BGRX output.
+ */
+
+METHODDEF(void)
+ycc_bgrx_convert (j_decompress_ptr cinfo,
+		  JSAMPIMAGE input_buf, JDIMENSION input_row,
+		  JSAMPARRAY output_buf, int num_rows)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
+  register int y, cb, cr;
+  register JSAMPROW outptr;
+  register JSAMPROW inptr0, inptr1, inptr2;
+  register JDIMENSION col;
+  JDIMENSION num_cols = cinfo->output_width;
+  /* copy these pointers into registers if possible */
+  register JSAMPLE * range_limit = cinfo->sample_range_limit;
+  register int * Crrtab = cconvert->Cr_r_tab;
+  register int * Cbbtab = cconvert->Cb_b_tab;
+  register INT32 * Crgtab = cconvert->Cr_g_tab;
+  register INT32 * Cbgtab = cconvert->Cb_g_tab;
+  SHIFT_TEMPS
+
+  while (--num_rows >= 0) {
+    inptr0 = input_buf[0][input_row];
+    inptr1 = input_buf[1][input_row];
+    inptr2 = input_buf[2][input_row];
+    input_row++;
+    outptr = *output_buf++;
+    for (col = 0; col < num_cols; col++) {
+      y  = GETJSAMPLE(inptr0[col]);
+      cb = GETJSAMPLE(inptr1[col]);
+      cr = GETJSAMPLE(inptr2[col]);
+      outptr[BGRX_RED]    = range_limit[y + Crrtab[cr]];
+      outptr[BGRX_GREEN]  = range_limit[y +
+			      ((int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr],
+						 SCALEBITS))];
+      outptr[BGRX_BLUE]   = range_limit[y + Cbbtab[cb]];
+      outptr[BGRX_FILLER] = MAXJSAMPLE;
+      outptr += BGRX_PIXELSIZE;
+    }
+  }
+}
+
+
 /**************** Cases other than YCC -> RGB ****************/
 
 
@@ -342,6 +387,41 @@ rgb1_rgb_convert (j_decompress_ptr cinfo,
 }
 
 
+/*
+ * Same as rgb1_rgb_convert, but for 32-bit BGRX output.
+ */
+
+METHODDEF(void)
+rgb1_bgrx_convert (j_decompress_ptr cinfo,
+		   JSAMPIMAGE input_buf, JDIMENSION input_row,
+		   JSAMPARRAY output_buf, int num_rows)
+{
+  register int r, g, b;
+  register JSAMPROW outptr;
+  register JSAMPROW inptr0, inptr1, inptr2;
+  register JDIMENSION col;
+  JDIMENSION num_cols = cinfo->output_width;
+
+  while (--num_rows >= 0) {
+    inptr0 = input_buf[0][input_row];
+    inptr1 = input_buf[1][input_row];
+    inptr2 = input_buf[2][input_row];
+    input_row++;
+    outptr = *output_buf++;
+    for (col = 0; col < num_cols; col++) {
+      r = GETJSAMPLE(inptr0[col]);
+      g = GETJSAMPLE(inptr1[col]);
+      b = GETJSAMPLE(inptr2[col]);
+      outptr[BGRX_RED]    = (JSAMPLE) ((r + g - CENTERJSAMPLE) & MAXJSAMPLE);
+      outptr[BGRX_GREEN]  = (JSAMPLE) g;
+      outptr[BGRX_BLUE]   = (JSAMPLE) ((b + g - CENTERJSAMPLE) & MAXJSAMPLE);
+      outptr[BGRX_FILLER] = MAXJSAMPLE;
+      outptr += BGRX_PIXELSIZE;
+    }
+  }
+}
+
+
 /*
  * [R-G,G,B-G] to grayscale conversion with modulo calculation
  * (inverse color transform).
@@ -417,6 +497,38 @@ rgb_convert (j_decompress_ptr cinfo,
 }
 
 
+/*
+ * Same as rgb_convert, but for 32-bit BGRX output.
+ */
+
+METHODDEF(void)
+rgb_bgrx_convert (j_decompress_ptr cinfo,
+		  JSAMPIMAGE input_buf, JDIMENSION input_row,
+		  JSAMPARRAY output_buf, int num_rows)
+{
+  register JSAMPROW outptr;
+  register JSAMPROW inptr0, inptr1, inptr2;
+  register JDIMENSION col;
+  JDIMENSION num_cols = cinfo->output_width;
+
+  while (--num_rows >= 0) {
+    inptr0 = input_buf[0][input_row];
+    inptr1 = input_buf[1][input_row];
+    inptr2 = input_buf[2][input_row];
+    input_row++;
+    outptr = *output_buf++;
+    for (col = 0; col < num_cols; col++) {
+      /* We can dispense with GETJSAMPLE() here */
+      outptr[BGRX_RED]    = inptr0[col];
+      outptr[BGRX_GREEN]  = inptr1[col];
+      outptr[BGRX_BLUE]   = inptr2[col];
+      outptr[BGRX_FILLER] = MAXJSAMPLE;
+      outptr += BGRX_PIXELSIZE;
+    }
+  }
+}
+
+
 /*
  * Color conversion for no colorspace change: just copy the data,
  * converting from separate-planes to interleaved representation.
@@ -500,6 +612,33 @@ gray_rgb_convert (j_decompress_ptr cinfo,
 }
 
 
+/*
+ * Same as gray_rgb_convert, but for 32-bit BGRX output.
+ */
+
+METHODDEF(void)
+gray_bgrx_convert (j_decompress_ptr cinfo,
+		   JSAMPIMAGE input_buf, JDIMENSION input_row,
+		   JSAMPARRAY output_buf, int num_rows)
+{
+  register JSAMPROW outptr;
+  register JSAMPROW inptr;
+  register JDIMENSION col;
+  JDIMENSION num_cols = cinfo->output_width;
+
+  while (--num_rows >= 0) {
+    inptr = input_buf[0][input_row++];
+    outptr = *output_buf++;
+    for (col = 0; col < num_cols; col++) {
+      /* We can dispense with GETJSAMPLE() here */
+      outptr[BGRX_RED] = outptr[BGRX_GREEN] = outptr[BGRX_BLUE] = inptr[col];
+      outptr[BGRX_FILLER] = MAXJSAMPLE;
+      outptr += BGRX_PIXELSIZE;
+    }
+  }
+}
+
+
 /*
  * Convert some rows of samples to the output colorspace.
  * This version handles Adobe-style YCCK->CMYK conversion,
@@ -719,6 +858,37 @@ jinit_color_deconverter (j_decompress_ptr cinfo)
     }
     break;
 
+  case JCS_EXT_BGRX:
+    cinfo->out_color_components = BGRX_PIXELSIZE;
+    switch (cinfo->jpeg_color_space) {
+    case JCS_GRAYSCALE:
+      cconvert->pub.color_convert = gray_bgrx_convert;
+      break;
+    case JCS_YCbCr:
+      cconvert->pub.color_convert = ycc_bgrx_convert;
+      build_ycc_rgb_table(cinfo);
+      break;
+    case JCS_BG_YCC:
+      cconvert->pub.color_convert = ycc_bgrx_convert;
+      build_bg_ycc_rgb_table(cinfo);
+      break;
+    case JCS_RGB:
+      switch (cinfo->color_transform) {
+      case JCT_NONE:
+	cconvert->pub.color_convert = rgb_bgrx_convert;
+	break;
+      case JCT_SUBTRACT_GREEN:
+	cconvert->pub.color_convert = rgb1_bgrx_convert;
+	break;
+      default:
+	ERREXIT(cinfo, JERR_CONVERSION_NOTIMPL);
+      }
+      break;
+    default:
+      ERREXIT(cinfo, JERR_CONVERSION_NOTIMPL);
+    }
+    break;
+
   case JCS_BG_RGB:
     if (cinfo->jpeg_color_space != JCS_BG_RGB)
       ERREXIT(cinfo, JERR_CONVERSION_NOTIMPL);
@@ -62,8 +62,9 @@ use_merged_upsample (j_decompress_ptr cinfo)
   if ((cinfo->jpeg_color_space != JCS_YCbCr &&
        cinfo->jpeg_color_space != JCS_BG_YCC) ||
       cinfo->num_components != 3 ||
-      cinfo->out_color_space != JCS_RGB ||
-      cinfo->out_color_components != RGB_PIXELSIZE ||
+      ((cinfo->out_color_space != JCS_RGB ||
+	cinfo->out_color_components != RGB_PIXELSIZE) &&
+       cinfo->out_color_space != JCS_EXT_BGRX) ||
       cinfo->color_transform)
     return FALSE;
   /* and it only handles 2h1v or 2h2v sampling ratios */
@@ -173,6 +174,9 @@ jpeg_calc_output_dimensions (j_decompress_ptr cinfo)
   case JCS_BG_RGB:
     cinfo->out_color_components = RGB_PIXELSIZE;
     break;
+  case JCS_EXT_BGRX:
+    cinfo->out_color_components = BGRX_PIXELSIZE;
+    break;
   default:	/* YCCK <=> CMYK conversion or same colorspace as in file */
     i = 0;
     for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
@@ -394,6 +394,155 @@ h2v2_merged_upsample (j_decompress_ptr cinfo,
 }
 
 
+/*
+ * Same as h2v1_merged_upsample, but for 32-bit BGRX output.
+ */
+
+METHODDEF(void)
+h2v1_merged_bgrx (j_decompress_ptr cinfo,
+		  JSAMPIMAGE input_buf, JDIMENSION in_row_group_ctr,
+		  JSAMPARRAY output_buf)
+{
+  my_upsample_ptr upsample = (my_upsample_ptr) cinfo->upsample;
+  register int y, cred, cgreen, cblue;
+  int cb, cr;
+  register JSAMPROW outptr;
+  JSAMPROW inptr0, inptr1, inptr2;
+  JDIMENSION col;
+  /* copy these pointers into registers if possible */
+  register JSAMPLE * range_limit = cinfo->sample_range_limit;
+  int * Crrtab = upsample->Cr_r_tab;
+  int * Cbbtab = upsample->Cb_b_tab;
+  INT32 * Crgtab = upsample->Cr_g_tab;
+  INT32 * Cbgtab = upsample->Cb_g_tab;
+  SHIFT_TEMPS
+
+  inptr0 = input_buf[0][in_row_group_ctr];
+  inptr1 = input_buf[1][in_row_group_ctr];
+  inptr2 = input_buf[2][in_row_group_ctr];
+  outptr = output_buf[0];
+  /* Loop for each pair of output pixels */
+  for (col = cinfo->output_width >> 1; col > 0; col--) {
+    /* Do the chroma part of the calculation */
+    cb = GETJSAMPLE(*inptr1++);
+    cr = GETJSAMPLE(*inptr2++);
+    cred   = Crrtab[cr];
+    cgreen = (int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS);
+    cblue  = Cbbtab[cb];
+    /* Fetch 2 Y values and emit 2 pixels */
+    y  = GETJSAMPLE(*inptr0++);
+    outptr[BGRX_RED]    = range_limit[y + cred];
+    outptr[BGRX_GREEN]  = range_limit[y + cgreen];
+    outptr[BGRX_BLUE]   = range_limit[y + cblue];
+    outptr[BGRX_FILLER] = MAXJSAMPLE;
+    outptr += BGRX_PIXELSIZE;
+    y  = GETJSAMPLE(*inptr0++);
+    outptr[BGRX_RED]    = range_limit[y + cred];
+    outptr[BGRX_GREEN]  = range_limit[y + cgreen];
+    outptr[BGRX_BLUE]   = range_limit[y + cblue];
+    outptr[BGRX_FILLER] = MAXJSAMPLE;
+    outptr += BGRX_PIXELSIZE;
+  }
+  /* If image width is odd, do the last output column separately */
+  if (cinfo->output_width & 1) {
+    cb = GETJSAMPLE(*inptr1);
+    cr = GETJSAMPLE(*inptr2);
+    cred   = Crrtab[cr];
+    cgreen = (int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS);
+    cblue  = Cbbtab[cb];
+    y  = GETJSAMPLE(*inptr0);
+    outptr[BGRX_RED]    = range_limit[y + cred];
+    outptr[BGRX_GREEN]  = range_limit[y + cgreen];
+    outptr[BGRX_BLUE]   = range_limit[y + cblue];
+    outptr[BGRX_FILLER] = MAXJSAMPLE;
+  }
+}
+
+
+/*
+ * Same as h2v2_merged_upsample, but for 32-bit BGRX output.
+ */
+
+METHODDEF(void)
+h2v2_merged_bgrx (j_decompress_ptr cinfo,
+		  JSAMPIMAGE input_buf, JDIMENSION in_row_group_ctr,
+		  JSAMPARRAY output_buf)
+{
+  my_upsample_ptr upsample = (my_upsample_ptr) cinfo->upsample;
+  register int y, cred, cgreen, cblue;
+  int cb, cr;
+  register JSAMPROW outptr0, outptr1;
+  JSAMPROW inptr00, inptr01, inptr1, inptr2;
+  JDIMENSION col;
+  /* copy these pointers into registers if possible */
+  register JSAMPLE * range_limit = cinfo->sample_range_limit;
+  int * Crrtab = upsample->Cr_r_tab;
+  int * Cbbtab = upsample->Cb_b_tab;
+  INT32 * Crgtab = upsample->Cr_g_tab;
+  INT32 * Cbgtab = upsample->Cb_g_tab;
+  SHIFT_TEMPS
+
+  inptr00 = input_buf[0][in_row_group_ctr*2];
+  inptr01 = input_buf[0][in_row_group_ctr*2 + 1];
+  inptr1 = input_buf[1][in_row_group_ctr];
+  inptr2 = input_buf[2][in_row_group_ctr];
+  outptr0 = output_buf[0];
+  outptr1 = output_buf[1];
+  /* Loop for each group of output pixels */
+  for (col = cinfo->output_width >> 1; col > 0; col--) {
+    /* Do the chroma part of the calculation */
+    cb = GETJSAMPLE(*inptr1++);
+    cr = GETJSAMPLE(*inptr2++);
+    cred   = Crrtab[cr];
+    cgreen = (int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS);
+    cblue  = Cbbtab[cb];
+    /* Fetch 4 Y values and emit 4 pixels */
+    y  = GETJSAMPLE(*inptr00++);
+    outptr0[BGRX_RED]    = range_limit[y + cred];
+    outptr0[BGRX_GREEN]  = range_limit[y + cgreen];
+    outptr0[BGRX_BLUE]   = range_limit[y + cblue];
+    outptr0[BGRX_FILLER] = MAXJSAMPLE;
+    outptr0 += BGRX_PIXELSIZE;
+    y  = GETJSAMPLE(*inptr00++);
+    outptr0[BGRX_RED]    = range_limit[y + cred];
+    outptr0[BGRX_GREEN]  = range_limit[y + cgreen];
+    outptr0[BGRX_BLUE]   = range_limit[y + cblue];
+    outptr0[BGRX_FILLER] = MAXJSAMPLE;
+    outptr0 += BGRX_PIXELSIZE;
+    y  = GETJSAMPLE(*inptr01++);
+    outptr1[BGRX_RED]    = range_limit[y + cred];
+    outptr1[BGRX_GREEN]  = range_limit[y + cgreen];
+    outptr1[BGRX_BLUE]   = range_limit[y + cblue];
+    outptr1[BGRX_FILLER] = MAXJSAMPLE;
+    outptr1 += BGRX_PIXELSIZE;
+    y  = GETJSAMPLE(*inptr01++);
+    outptr1[BGRX_RED]    = range_limit[y + cred];
+    outptr1[BGRX_GREEN]  = range_limit[y + cgreen];
+    outptr1[BGRX_BLUE]   = range_limit[y + cblue];
+    outptr1[BGRX_FILLER] = MAXJSAMPLE;
+    outptr1 += BGRX_PIXELSIZE;
+  }
+  /* If image width is odd, do the last output column separately */
+  if (cinfo->output_width & 1) {
+    cb = GETJSAMPLE(*inptr1);
+    cr = GETJSAMPLE(*inptr2);
+    cred   = Crrtab[cr];
+    cgreen = (int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS);
+    cblue  = Cbbtab[cb];
+    y  = GETJSAMPLE(*inptr00);
+    outptr0[BGRX_RED]    = range_limit[y + cred];
+    outptr0[BGRX_GREEN]  = range_limit[y + cgreen];
+    outptr0[BGRX_BLUE]   = range_limit[y + cblue];
+    outptr0[BGRX_FILLER] = MAXJSAMPLE;
+    y  = GETJSAMPLE(*inptr01);
+    outptr1[BGRX_RED]    = range_limit[y + cred];
+    outptr1[BGRX_GREEN]  = range_limit[y + cgreen];
+    outptr1[BGRX_BLUE]   = range_limit[y + cblue];
+    outptr1[BGRX_FILLER] = MAXJSAMPLE;
+  }
+}
+
+
 /*
  * Module initialization routine for merged upsampling/color conversion.
  *
@@ -417,14 +566,20 @@ jinit_merged_upsampler (j_decompress_ptr cinfo)
 
   if (cinfo->max_v_samp_factor == 2) {
     upsample->pub.upsample = merged_2v_upsample;
-    upsample->upmethod = h2v2_merged_upsample;
+    if (cinfo->out_color_space == JCS_EXT_BGRX)
+      upsample->upmethod = h2v2_merged_bgrx;
+    else
+      upsample->upmethod = h2v2_merged_upsample;
     /* Allocate a spare row buffer */
     upsample->spare_row = (JSAMPROW) (*cinfo->mem->alloc_large)
       ((j_common_ptr) cinfo, JPOOL_IMAGE,
        (size_t) upsample->out_row_width * SIZEOF(JSAMPLE));
   } else {
     upsample->pub.upsample = merged_1v_upsample;
-    upsample->upmethod = h2v1_merged_upsample;
+    if (cinfo->out_color_space == JCS_EXT_BGRX)
+      upsample->upmethod = h2v1_merged_bgrx;
+    else
+      upsample->upmethod = h2v1_merged_upsample;
     /* No spare row needed */
     upsample->spare_row = NULL;
   }
@@ -160,6 +160,7 @@ struct jvirt_sarray_control {
   boolean pre_zero;		/* pre-zero mode requested? */
   boolean dirty;		/* do current buffer contents need written? */
   boolean b_s_open;		/* is backing-store data valid? */
+  long b_s_written;		/* end of the data written to backing store */
   jvirt_sarray_ptr next;	/* link to next virtual sarray control block */
   backing_store_info b_s_info;	/* System-dependent control info */
 };
@@ -176,6 +177,7 @@ struct jvirt_barray_control {
   boolean pre_zero;		/* pre-zero mode requested? */
   boolean dirty;		/* do current buffer contents need written? */
   boolean b_s_open;		/* is backing-store data valid? */
+  long b_s_written;		/* end of the data written to backing store */
   jvirt_barray_ptr next;	/* link to next virtual barray control block */
   backing_store_info b_s_info;	/* System-dependent control info */
 };
@@ -226,6 +228,15 @@ out_of_memory (j_common_ptr cinfo, int which)
 }
 
 
+LOCAL(void)
+update_peak_space (my_mem_ptr mem)
+/* Keep track of the peak space for the application's statistics */
+{
+  if (mem->total_space_allocated > mem->pub.peak_space_allocated)
+    mem->pub.peak_space_allocated = mem->total_space_allocated;
+}
+
+
 /*
  * Allocation of "small" objects.
  *
@@ -305,6 +316,8 @@ alloc_small (j_common_ptr cinfo, int pool_id, size_t sizeofobject)
 	out_of_memory(cinfo, 2); /* jpeg_get_small failed */
     }
     mem->total_space_allocated += min_request + slop;
+    mem->pub.small_pools_allocated++;
+    update_peak_space(mem);
     /* Success, initialize the new pool header and add to end of list */
     hdr_ptr->hdr.next = NULL;
     hdr_ptr->hdr.bytes_used = 0;
@@ -365,6 +378,8 @@ alloc_large (j_common_ptr cinfo, int pool_id, size_t sizeofobject)
   if (hdr_ptr == NULL)
     out_of_memory(cinfo, 4);	/* jpeg_get_large failed */
   mem->total_space_allocated += sizeofobject + SIZEOF(large_pool_hdr);
+  mem->pub.large_pools_allocated++;
+  update_peak_space(mem);
 
   /* Success, initialize the new pool header and add to list */
   hdr_ptr->hdr.next = mem->large_list[pool_id];
@@ -578,6 +593,35 @@ request_virt_barray (j_common_ptr cinfo, int pool_id, boolean pre_zero,
 }
 
 
+/*
+ * Space totals and backing-store offsets are longs, which have only 32 bits
+ * on Windows.  The maximum space needed by several large arrays therefore
+ * saturates instead of overflowing, and a single array that doesn't fit in
+ * memory must not exceed MAX_BACKING_STORE bytes.
+ */
+
+#define MAX_BACKING_STORE  0x7FFFFFFFL
+
+LOCAL(long)
+add_space (long total, JDIMENSION rows, long bytesperrow)
+{
+  double space = (double) total + (double) rows * (double) bytesperrow;
+
+  return space < (double) MAX_BACKING_STORE ? (long) space : MAX_BACKING_STORE;
+}
+
+
+/* The statistics use size_t, but saturate as well */
+
+LOCAL(size_t)
+add_stat_space (size_t total, JDIMENSION rows, long bytesperrow)
+{
+  double space = (double) total + (double) rows * (double) bytesperrow;
+
+  return space < (double) ((size_t) -1) ? (size_t) space : (size_t) -1;
+}
+
+
 METHODDEF(void)
 realize_virt_arrays (j_common_ptr cinfo)
 /* Allocate the in-memory buffers for any unrealized virtual arrays */
@@ -598,14 +642,22 @@ realize_virt_arrays (j_common_ptr cinfo)
     if (sptr->mem_buffer == NULL) { /* if not realized yet */
       bytesperrow = (long) sptr->samplesperrow * SIZEOF(JSAMPLE);
       space_per_minheight += (long) sptr->maxaccess * bytesperrow;
-      maximum_space += (long) sptr->rows_in_array * bytesperrow;
+      maximum_space = add_space(maximum_space, sptr->rows_in_array,
+				bytesperrow);
+      mem->pub.virt_space_requested =
+	add_stat_space(mem->pub.virt_space_requested, sptr->rows_in_array,
+		       bytesperrow);
     }
   }
   for (bptr = mem->virt_barray_list; bptr != NULL; bptr = bptr->next) {
     if (bptr->mem_buffer == NULL) { /* if not realized yet */
       bytesperrow = (long) bptr->blocksperrow * SIZEOF(JBLOCK);
       space_per_minheight += (long) bptr->maxaccess * bytesperrow;
-      maximum_space += (long) bptr->rows_in_array * bytesperrow;
+      maximum_space = add_space(maximum_space, bptr->rows_in_array,
+				bytesperrow);
+      mem->pub.virt_space_requested =
+	add_stat_space(mem->pub.virt_space_requested, bptr->rows_in_array,
+		       bytesperrow);
     }
   }
 
@@ -641,12 +693,16 @@ realize_virt_arrays (j_common_ptr cinfo)
 	sptr->rows_in_mem = sptr->rows_in_array;
       } else {
 	/* It doesn't fit in memory, create backing store. */
+	if (add_space(0L, sptr->rows_in_array, (long) sptr->samplesperrow *
+		      SIZEOF(JSAMPLE)) >= MAX_BACKING_STORE)
+	  out_of_memory(cinfo, 5);	/* array exceeds backing store offsets */
 	sptr->rows_in_mem = (JDIMENSION) (max_minheights * sptr->maxaccess);
 	jpeg_open_backing_store(cinfo, & sptr->b_s_info,
 				(long) sptr->rows_in_array *
 				(long) sptr->samplesperrow *
 				(long) SIZEOF(JSAMPLE));
 	sptr->b_s_open = TRUE;
+	sptr->b_s_written = 0L;
       }
       sptr->mem_buffer = alloc_sarray(cinfo, JPOOL_IMAGE,
 				      sptr->samplesperrow, sptr->rows_in_mem);
@@ -665,12 +721,16 @@ realize_virt_arrays (j_common_ptr cinfo)
 	bptr->rows_in_mem = bptr->rows_in_array;
       } else {
 	/* It doesn't fit in memory, create backing store. */
+	if (add_space(0L, bptr->rows_in_array, (long) bptr->blocksperrow *
+		      SIZEOF(JBLOCK)) >= MAX_BACKING_STORE)
+	  out_of_memory(cinfo, 5);	/* array exceeds backing store offsets */
 	bptr->rows_in_mem = (JDIMENSION) (max_minheights * bptr->maxaccess);
 	jpeg_open_backing_store(cinfo, & bptr->b_s_info,
 				(long) bptr->rows_in_array *
 				(long) bptr->blocksperrow *
 				(long) SIZEOF(JBLOCK));
 	bptr->b_s_open = TRUE;
+	bptr->b_s_written = 0L;
       }
       bptr->mem_buffer = alloc_barray(cinfo, JPOOL_IMAGE,
 				      bptr->blocksperrow, bptr->rows_in_mem);
@@ -687,6 +747,7 @@ LOCAL(void)
 do_sarray_io (j_common_ptr cinfo, jvirt_sarray_ptr ptr, boolean writing)
 /* Do backing store read or write of a virtual sample array */
 {
+  my_mem_ptr mem = (my_mem_ptr) cinfo->mem;
   long bytesperrow, file_offset, byte_count, rows, thisrow, i;
 
   bytesperrow = (long) ptr->samplesperrow * SIZEOF(JSAMPLE);
@@ -713,6 +774,13 @@ do_sarray_io (j_common_ptr cinfo, jvirt_sarray_ptr ptr, boolean writing)
 					   file_offset, byte_count);
     file_offset += byte_count;
   }
+  /* Count only the bytes that really went to backing store */
+  if (writing && file_offset > ptr->b_s_written) {
+    mem->pub.backing_store_space =
+      add_stat_space(mem->pub.backing_store_space, 1,
+		     file_offset - ptr->b_s_written);
+    ptr->b_s_written = file_offset;
+  }
 }
 
 
@@ -720,6 +788,7 @@ LOCAL(void)
 do_barray_io (j_common_ptr cinfo, jvirt_barray_ptr ptr, boolean writing)
 /* Do backing store read or write of a virtual coefficient-block array */
 {
+  my_mem_ptr mem = (my_mem_ptr) cinfo->mem;
   long bytesperrow, file_offset, byte_count, rows, thisrow, i;
 
   bytesperrow = (long) ptr->blocksperrow * SIZEOF(JBLOCK);
@@ -746,6 +815,13 @@ do_barray_io (j_common_ptr cinfo, jvirt_barray_ptr ptr, boolean writing)
 					   file_offset, byte_count);
     file_offset += byte_count;
   }
+  /* Count only the bytes that really went to backing store */
+  if (writing && file_offset > ptr->b_s_written) {
+    mem->pub.backing_store_space =
+      add_stat_space(mem->pub.backing_store_space, 1,
+		     file_offset - ptr->b_s_written);
+    ptr->b_s_written = file_offset;
+  }
 }
 
 
@@ -1088,6 +1164,12 @@ jinit_memory_mgr (j_common_ptr cinfo)
 
   mem->total_space_allocated = SIZEOF(my_memory_mgr);
 
+  mem->pub.peak_space_allocated = mem->total_space_allocated;
+  mem->pub.small_pools_allocated = 0;
+  mem->pub.large_pools_allocated = 0;
+  mem->pub.virt_space_requested = 0;
+  mem->pub.backing_store_space = 0;
+
   /* Declare ourselves open for business */
   cinfo->mem = &mem->pub;
 
@@ -160,12 +160,18 @@ typedef struct backing_store_struct {
   short temp_file;		/* file reference number to temp file */
   FSSpec tempSpec;		/* the FSSpec for the temp file */
   char temp_name[TEMP_NAME_LENGTH]; /* name if it's a file */
+#else
+#ifdef USE_WIN32_MEMMGR
+  /* For the Win32 manager (jmemwin.c), we need: */
+  void * temp_file;		/* Win32 file handle of temp file */
+  char temp_name[TEMP_NAME_LENGTH]; /* name of temp file */
 #else
   /* For a typical implementation with temp files, we need: */
   FILE * temp_file;		/* stdio reference to temp file */
   char temp_name[TEMP_NAME_LENGTH]; /* name of temp file */
 #endif
 #endif
+#endif
 } backing_store_info;
 
 
@@ -0,0 +1,217 @@
+/*
+ * jmemwin.c
+ *
+ * Copyright (C) 1992-1996, Thomas G. Lane.
+ * This file is part of the Independent JPEG Group's software.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file provides a Win32 implementation of the system-dependent
+ * portion of the JPEG memory manager.  It is based on jmemansi.c.
+ * Unlike jmemnobs.c, it supports backing store: if the virtual arrays
+ * of a progressive or multi-scan image need more memory than
+ * max_memory_to_use allows, the arrays are swapped out to a temporary
+ * file.  The file is created with FILE_ATTRIBUTE_TEMPORARY, so Windows
+ * keeps it in the file cache as long as there is enough memory, and it
+ * is deleted automatically when it is closed.
+ *
+ * If max_memory_to_use is 0 (the default unless the JPEGMEM environment
+ * variable or the application sets it), the limit is half of the
+ * available physical memory or address space, whichever is smaller.
+ *
+ * Note that jmemmgr.c passes file offsets as long, so a single virtual
+ * array is limited to 2 GB.  Each component has its own array of DCT
+ * coefficients, which take 2 bytes per pixel of the full-size luminance
+ * component.  This allows progressive images of about 32768 x 32768 pixels.
+ */
+
+#include <windows.h>
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jmemsys.h"		/* import the system-dependent declarations */
+
+#ifndef HAVE_STDLIB_H		/* <stdlib.h> should declare malloc(),free() */
+extern void * malloc JPP((size_t size));
+extern void free JPP((void *ptr));
+#endif
+
+#define MAX_MEM_AVAILABLE  0x7FFFFFFFL	/* largest value of a long */
+
+
+/*
+ * Memory allocation and freeing are controlled by the regular library
+ * routines malloc() and free().
+ */
+
+GLOBAL(void *)
+jpeg_get_small (j_common_ptr cinfo, size_t sizeofobject)
+{
+  return (void *) malloc(sizeofobject);
+}
+
+GLOBAL(void)
+jpeg_free_small (j_common_ptr cinfo, void * object, size_t sizeofobject)
+{
+  free(object);
+}
+
+
+/*
+ * "Large" objects are treated the same as "small" ones.
+ */
+
+GLOBAL(void FAR *)
+jpeg_get_large (j_common_ptr cinfo, size_t sizeofobject)
+{
+  return (void FAR *) malloc(sizeofobject);
+}
+
+GLOBAL(void)
+jpeg_free_large (j_common_ptr cinfo, void FAR * object, size_t sizeofobject)
+{
+  free(object);
+}
+
+
+/*
+ * This routine computes the total memory space available for allocation.
+ */
+
+GLOBAL(long)
+jpeg_mem_available (j_common_ptr cinfo, long min_bytes_needed,
+		    long max_bytes_needed, long already_allocated)
+{
+  MEMORYSTATUSEX status;
+  ULONGLONG avail;
+
+  if (cinfo->mem->max_memory_to_use)
+    return cinfo->mem->max_memory_to_use - already_allocated;
+
+  /* Leave room for the output image and other threads */
+  status.dwLength = sizeof(status);
+  if (! GlobalMemoryStatusEx(&status))
+    return max_bytes_needed;
+
+  avail = MIN(status.ullAvailPhys, status.ullAvailVirtual) / 2;
+  if (avail > (ULONGLONG) MAX_MEM_AVAILABLE)
+    avail = MAX_MEM_AVAILABLE;
+
+  return (long) avail - already_allocated;
+}
+
+
+/*
+ * Backing store (temporary file) management.
+ * Backing store objects are only used when the value returned by
+ * jpeg_mem_available is less than the total space needed.
+ * The file is accessed with explicit offsets, so no seek is needed.
+ */
+
+
+METHODDEF(void)
+read_backing_store (j_common_ptr cinfo, backing_store_ptr info,
+		    void FAR * buffer_address,
+		    long file_offset, long byte_count)
+{
+  OVERLAPPED overlapped;
+  DWORD bytes_read = 0;
+
+  MEMZERO(&overlapped, SIZEOF(overlapped));
+  overlapped.Offset = (DWORD) file_offset;
+
+  if (! ReadFile((HANDLE) info->temp_file, buffer_address,
+		 (DWORD) byte_count, &bytes_read, &overlapped) ||
+      bytes_read != (DWORD) byte_count)
+    ERREXIT(cinfo, JERR_TFILE_READ);
+}
+
+
+METHODDEF(void)
+write_backing_store (j_common_ptr cinfo, backing_store_ptr info,
+		     void FAR * buffer_address,
+		     long file_offset, long byte_count)
+{
+  OVERLAPPED overlapped;
+  DWORD bytes_written = 0;
+
+  MEMZERO(&overlapped, SIZEOF(overlapped));
+  overlapped.Offset = (DWORD) file_offset;
+
+  if (! WriteFile((HANDLE) info->temp_file, buffer_address,
+		  (DWORD) byte_count, &bytes_written, &overlapped) ||
+      bytes_written != (DWORD) byte_count)
+    ERREXIT(cinfo, JERR_TFILE_WRITE);
+}
+
+
+METHODDEF(void)
+close_backing_store (j_common_ptr cinfo, backing_store_ptr info)
+{
+  /* FILE_FLAG_DELETE_ON_CLOSE deletes the file */
+  CloseHandle((HANDLE) info->temp_file);
+  TRACEMSS(cinfo, 1, JTRC_TFILE_CLOSE, info->temp_name);
+}
+
+
+/*
+ * Initial opening of a backing-store object.
+ *
+ * The file is created in the temp directory with a unique name.
+ * Only the name without the path is kept in info->temp_name[],
+ * it is used for trace messages.
+ */
+
+GLOBAL(void)
+jpeg_open_backing_store (j_common_ptr cinfo, backing_store_ptr info,
+			 long total_bytes_needed)
+{
+  char temp_path[MAX_PATH];
+  char temp_file[MAX_PATH];
+  char * file_name;
+  HANDLE hFile;
+
+  temp_file[0] = '\0';
+  if (GetTempPathA(MAX_PATH, temp_path) == 0 ||
+      GetTempFileNameA(temp_path, "JPG", 0, temp_file) == 0)
+    ERREXITS(cinfo, JERR_TFILE_CREATE, temp_file);
+
+  /* GetTempFileName has already created the file */
+  hFile = CreateFileA(temp_file, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+		      CREATE_ALWAYS,
+		      FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+		      NULL);
+  if (hFile == INVALID_HANDLE_VALUE) {
+    DeleteFileA(temp_file);
+    ERREXITS(cinfo, JERR_TFILE_CREATE, temp_file);
+  }
+
+  file_name = strrchr(temp_file, '\\');
+  file_name = file_name != NULL ? file_name + 1 : temp_file;
+  strncpy(info->temp_name, file_name, TEMP_NAME_LENGTH - 1);
+  info->temp_name[TEMP_NAME_LENGTH - 1] = '\0';
+
+  info->temp_file = (void *) hFile;
+  info->read_backing_store = read_backing_store;
+  info->write_backing_store = write_backing_store;
+  info->close_backing_store = close_backing_store;
+  TRACEMSS(cinfo, 1, JTRC_TFILE_OPEN, info->temp_name);
+}
+
+
+/*
+ * These routines take care of any system-dependent initialization and
+ * cleanup required.
+ */
+
+GLOBAL(long)
+jpeg_mem_init (j_common_ptr cinfo)
+{
+  return 0;			/* limit determined by jpeg_mem_available */
+}
+
+GLOBAL(void)
+jpeg_mem_term (j_common_ptr cinfo)
+{
+  /* no work */
+}
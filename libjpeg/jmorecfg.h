@@ -399,6 +399,19 @@ typedef enum { FALSE = 0, TRUE = 1 } boolean;
 #define RGB_BLUE	0	/* Offset of Blue */
 #define RGB_PIXELSIZE	3	/* JSAMPLEs per RGB scanline element */
 
+/*
+ * Ordering of the JCS_EXT_BGRX output colorspace.  Unlike the RGB macros
+ * above, this is a fixed 32-bit layout that can be selected at run time.
+ * The filler byte is set to MAXJSAMPLE, so the pixels are opaque if the
+ * filler is interpreted as alpha.  Decompression only.
+ */
+
+#define BGRX_RED	2	/* Offset of Red in a BGRX scanline element */
+#define BGRX_GREEN	1	/* Offset of Green */
+#define BGRX_BLUE	0	/* Offset of Blue */
+#define BGRX_FILLER	3	/* Offset of the filler byte */
+#define BGRX_PIXELSIZE	4	/* JSAMPLEs per BGRX scanline element */
+
 
 /* Definitions for speed-related optimizations. */
 
@@ -225,7 +225,8 @@ typedef enum {
 	JCS_CMYK,		/* C/M/Y/K */
 	JCS_YCCK,		/* Y/Cb/Cr/K */
 	JCS_BG_RGB,		/* big gamut red/green/blue, bg-sRGB */
-	JCS_BG_YCC		/* big gamut Y/Cb/Cr, bg-sYCC */
+	JCS_BG_YCC,		/* big gamut Y/Cb/Cr, bg-sYCC */
+	JCS_EXT_BGRX		/* blue/green/red/filler, output only */
 } J_COLOR_SPACE;
 
 /* Supported color transforms. */
@@ -859,6 +860,18 @@ struct jpeg_memory_mgr {
 
   /* Maximum allocation request accepted by alloc_large. */
   long max_alloc_chunk;
+
+  /* Memory statistics, maintained by the memory manager.  The outer
+   * application may reset them to zero between images; the peak then
+   * starts again with the next allocation.  The peak includes the
+   * permanent pool, the pool counts only include pools obtained since
+   * the reset.
+   */
+  size_t peak_space_allocated;	/* max. space obtained from jpeg_get_xxx */
+  long small_pools_allocated;	/* # of small pools obtained */
+  long large_pools_allocated;	/* # of large objects obtained */
+  size_t virt_space_requested;	/* full size of realized virtual arrays */
+  size_t backing_store_space;	/* bytes written to backing store */
 };
 
 